@@ -0,0 +1,137 @@
+/**
+* @file bench.c
+*
+* @brief Timing and allocation counting for the micro benchmarks.
+*
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocs = 0;
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+unsigned long bench_alloc_count(void) {
+    return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// BENCH_JSON=path appends a JSON object per result to path, one per line
+static FILE *json_file(void) {
+    static FILE *file = NULL;
+    static bool opened = false;
+    if (!opened) {
+        const char *path = getenv("BENCH_JSON");
+        opened = true;
+        if (path && *path) {
+            file = fopen(path, "ae");
+            if (!file) {
+                perror(path);
+            }
+        }
+    }
+    return file;
+}
+
+static void json_string(FILE *file, const char *s) {
+    fputc('"', file);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', file);
+        }
+        if ((unsigned char) *s >= 0x20) {
+            fputc(*s, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void json_begin(FILE *file, const char *name) {
+    fputs("{\"suite\":", file);
+    json_string(file, program_invocation_short_name);
+    fputs(",\"name\":", file);
+    json_string(file, name);
+    fprintf(file, ",\"time\":%ld", (long) time(NULL));
+}
+
+void bench_metric(const char *name, double value, const char *unit) {
+    FILE *file = json_file();
+    if (file) {
+        json_begin(file, name);
+        fprintf(file, ",\"value\":%.6g,\"unit\":", value);
+        json_string(file, unit);
+        fputs("}\n", file);
+        fflush(file);
+    }
+}
+
+double bench_run(const char *name, uint64_t iterations, bench_fn_t fn, void *ctx) {
+    // warm up caches and lazily allocated state before measuring
+    for (uint64_t i = 0; i < iterations / 10 + 1; i++) {
+        fn(ctx, i);
+    }
+    // the spread of the rounds tells a real change from noise
+    double round_ns[BENCH_ROUNDS];
+    int rounds = iterations < BENCH_ROUNDS ? (int) iterations : BENCH_ROUNDS;
+    unsigned long allocs_start = bench_alloc_count();
+    uint64_t start = bench_now_ns();
+    uint64_t i = 0;
+    for (int r = 0; r < rounds; r++) {
+        uint64_t end = iterations * (uint64_t) (r + 1) / (uint64_t) rounds;
+        uint64_t round_start = bench_now_ns();
+        uint64_t n = end - i;
+        for (; i < end; i++) {
+            fn(ctx, i);
+        }
+        round_ns[r] = (double) (bench_now_ns() - round_start) / (double) n;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    double allocs_per_op = iterations ? (double) (bench_alloc_count() - allocs_start) / (double) iterations : 0.0;
+    double mean = iterations ? (double) elapsed / (double) iterations : 0.0;
+    double variance = 0.0;
+    for (int r = 0; r < rounds; r++) {
+        variance += (round_ns[r] - mean) * (round_ns[r] - mean);
+    }
+    double stddev = rounds > 1 ? sqrt(variance / (rounds - 1)) : 0.0;
+    printf("%-40s %12.1f ns/op %6.1f%% sd %8.2f allocs/op\n", name, mean, mean > 0 ? stddev * 100.0 / mean : 0.0,
+           allocs_per_op);
+
+    FILE *file = json_file();
+    if (file) {
+        json_begin(file, name);
+        fprintf(file, ",\"iterations\":%llu,\"ns_per_op\":%.3f,\"stddev_ns\":%.3f,\"allocs_per_op\":%.4f}\n",
+                (unsigned long long) iterations, mean, stddev, allocs_per_op);
+        fflush(file);
+    }
+    return allocs_per_op;
+}
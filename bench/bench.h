@@ -0,0 +1,36 @@
+/**
+* @file bench.h
+*
+* @brief Helpers shared by the micro benchmarks in this directory.
+*
+* Every benchmark binary links bench.c, which counts malloc/calloc/realloc
+* calls of the whole process (libc internals included) so a benchmark can
+* report allocations per operation next to the time.
+*
+* With BENCH_JSON=path in the environment every result is also appended to
+* path as a JSON object per line, tagged with the benchmark binary and the
+* time of the run, so runs can be compared over time.
+*/
+#ifndef SUPER_CLOCK_BENCH_H
+#define SUPER_CLOCK_BENCH_H
+
+#include <stdint.h>
+
+typedef void (*bench_fn_t)(void *ctx, uint64_t i);
+
+uint64_t bench_now_ns(void);
+
+unsigned long bench_alloc_count(void);
+
+// bench_run() times the iterations in this many rounds for the standard deviation
+#define BENCH_ROUNDS 5
+
+/** Run fn iterations times and print ns/op, its standard deviation over the rounds and allocations/op
+ * @return allocations per operation
+ */
+double bench_run(const char *name, uint64_t iterations, bench_fn_t fn, void *ctx);
+
+/** Add a result measured outside bench_run() to the JSON output */
+void bench_metric(const char *name, double value, const char *unit);
+
+#endif //SUPER_CLOCK_BENCH_H
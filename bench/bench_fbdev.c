@@ -0,0 +1,222 @@
+/**
+* @file bench_fbdev.c
+*
+* @brief Frame cost of the fbdev backend against the SDL renderer path.
+*
+* A 640x480 screen with the static layers and five widgets of the sizes the
+* clock uses, the time widget changes every frame. The fbdev backend draws
+* into a regular file standing in for /dev/fb0 (argument 1, an existing file
+* or device, a temporary file sized here by default), the SDL path uses the
+* software renderer SDL falls back to without GL. Both must produce the same
+* pixels.
+*
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <SDL2/SDL.h>
+
+#include "bench.h"
+#include "fbdev.h"
+#include "dfork.h"
+
+#define SCREEN_W 640
+#define SCREEN_H 480
+#define WIDGETS 5
+
+static const SDL_Rect widget_rects[WIDGETS] = {
+        {190, 195, 260, 90},   // time
+        {120, 145, 400, 40},   // battery
+        {170, 340, 300, 40},   // power
+        {60, 290, 120, 40},    // indoor temp
+        {460, 290, 120, 40},   // outdoor temp
+};
+
+typedef struct {
+    Uint32 format;
+    SDL_Surface *background;
+    SDL_Surface *widgets[WIDGETS];
+    fbdev_t fb;
+    SDL_Surface *screen;
+    SDL_Renderer *renderer;
+    SDL_Texture *background_texture;
+    SDL_Texture *textures[WIDGETS];
+} frame_ctx_t;
+
+static void fill_noise(SDL_Surface *surface, unsigned int seed) {
+    srandom(seed);
+    for (int y = 0; y < surface->h; y++) {
+        Uint8 *row = (Uint8 *) surface->pixels + y * surface->pitch;
+        for (int x = 0; x < surface->w * surface->format->BytesPerPixel; x++) {
+            row[x] = (Uint8) random();
+        }
+    }
+}
+
+// the clock changes, a different pattern every frame
+static void tick_widget(frame_ctx_t *c, uint64_t i) {
+    SDL_Surface *w = c->widgets[0];
+    SDL_FillRect(w, NULL, SDL_MapRGB(w->format, (Uint8) i, (Uint8) (i >> 8), 0x80));
+    SDL_Rect digit = {(int) (i % 4) * 60, 10, 50, 70};
+    SDL_FillRect(w, &digit, SDL_MapRGB(w->format, 0xff, 0xff, 0xff));
+}
+
+// what fb_compose() in superclock-sdl.c does
+static void compose(void *ctx, const fbdev_rect_t *rect, uint8_t *dst, int pitch) {
+    frame_ctx_t *c = ctx;
+    SDL_Surface *target = SDL_CreateRGBSurfaceWithFormatFrom(dst, rect->w, rect->h, SDL_BITSPERPIXEL(c->format),
+                                                             pitch, c->format);
+    SDL_Rect area = {rect->x, rect->y, rect->w, rect->h};
+    SDL_Rect src = area;
+    SDL_BlitSurface(c->background, &src, target, NULL);
+    for (int n = 0; n < WIDGETS; n++) {
+        SDL_Rect part;
+        if (SDL_IntersectRect(&area, &widget_rects[n], &part)) {
+            SDL_Rect from = {part.x - widget_rects[n].x, part.y - widget_rects[n].y, part.w, part.h};
+            SDL_Rect to = {part.x - area.x, part.y - area.y, part.w, part.h};
+            SDL_BlitSurface(c->widgets[n], &from, target, &to);
+        }
+    }
+    SDL_FreeSurface(target);
+}
+
+static void bench_fbdev_damaged(void *ctx, uint64_t i) {
+    frame_ctx_t *c = ctx;
+    tick_widget(c, i);
+    fbdev_rect_t damage = {widget_rects[0].x, widget_rects[0].y, widget_rects[0].w, widget_rects[0].h};
+    fbdev_present(&c->fb, &damage, 1, compose, c);
+}
+
+static void bench_fbdev_full(void *ctx, uint64_t i) {
+    frame_ctx_t *c = ctx;
+    tick_widget(c, i);
+    fbdev_rect_t damage = {0, 0, SCREEN_W, SCREEN_H};
+    fbdev_present(&c->fb, &damage, 1, compose, c);
+}
+
+// the render loop of superclock-sdl.c: upload the changed widget, copy the layers and every widget
+static void bench_sdl_renderer(void *ctx, uint64_t i) {
+    frame_ctx_t *c = ctx;
+    tick_widget(c, i);
+    SDL_UpdateTexture(c->textures[0], NULL, c->widgets[0]->pixels, c->widgets[0]->pitch);
+    SDL_RenderCopy(c->renderer, c->background_texture, NULL, NULL);
+    for (int n = 0; n < WIDGETS; n++) {
+        SDL_RenderCopy(c->renderer, c->textures[n], NULL, &widget_rects[n]);
+    }
+    SDL_RenderPresent(c->renderer);
+}
+
+static int frame_setup(frame_ctx_t *c, Uint32 format, const char *path) {
+    memset(c, 0, sizeof(frame_ctx_t));
+    c->format = format;
+    int bpp = SDL_BITSPERPIXEL(format);
+    c->background = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_W, SCREEN_H, bpp, format);
+    SDL_FillRect(c->background, NULL, SDL_MapRGB(c->background->format, 24, 90, 147));
+    SDL_Rect inner = {4, 4, SCREEN_W - 8, SCREEN_H - 8};
+    SDL_FillRect(c->background, &inner, SDL_MapRGB(c->background->format, 28, 81, 128));
+    SDL_SetSurfaceBlendMode(c->background, SDL_BLENDMODE_NONE);
+    for (int n = 0; n < WIDGETS; n++) {
+        c->widgets[n] = SDL_CreateRGBSurfaceWithFormat(0, widget_rects[n].w, widget_rects[n].h, bpp, format);
+        fill_noise(c->widgets[n], (unsigned int) n + 1);
+        SDL_SetSurfaceBlendMode(c->widgets[n], SDL_BLENDMODE_NONE);
+    }
+
+    if (fbdev_open(&c->fb, path, SCREEN_W, SCREEN_H, bpp > 16 ? 32 : 16)) {
+        perror(path);
+        return -1;
+    }
+
+    c->screen = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_W, SCREEN_H, bpp, format);
+    c->renderer = SDL_CreateSoftwareRenderer(c->screen);
+    if (!c->renderer) {
+        fprintf(stderr, "SDL_CreateSoftwareRenderer: %s\n", SDL_GetError());
+        return -1;
+    }
+    c->background_texture = SDL_CreateTextureFromSurface(c->renderer, c->background);
+    SDL_SetTextureBlendMode(c->background_texture, SDL_BLENDMODE_NONE);
+    for (int n = 0; n < WIDGETS; n++) {
+        c->textures[n] = SDL_CreateTexture(c->renderer, format, SDL_TEXTUREACCESS_STREAMING, widget_rects[n].w,
+                                           widget_rects[n].h);
+        SDL_SetTextureBlendMode(c->textures[n], SDL_BLENDMODE_NONE);
+        SDL_UpdateTexture(c->textures[n], NULL, c->widgets[n]->pixels, c->widgets[n]->pitch);
+    }
+    return 0;
+}
+
+static void frame_cleanup(frame_ctx_t *c) {
+    for (int n = 0; n < WIDGETS; n++) {
+        SDL_DestroyTexture(c->textures[n]);
+        SDL_FreeSurface(c->widgets[n]);
+    }
+    SDL_DestroyTexture(c->background_texture);
+    SDL_DestroyRenderer(c->renderer);
+    SDL_FreeSurface(c->screen);
+    SDL_FreeSurface(c->background);
+    fbdev_close(&c->fb);
+}
+
+// the same frame from both paths, pixel for pixel
+static int frame_compare(frame_ctx_t *c) {
+    bench_fbdev_full(c, 7);
+    bench_sdl_renderer(c, 7);
+    const uint8_t *fb = fbdev_front_buffer(&c->fb);
+    size_t row = (size_t) SCREEN_W * c->screen->format->BytesPerPixel;
+    for (int y = 0; y < SCREEN_H; y++) {
+        if (memcmp(fb + y * c->fb.pitch, (const Uint8 *) c->screen->pixels + y * c->screen->pitch, row) != 0) {
+            fprintf(stderr, "%s: fbdev and SDL frames differ in row %d\n", SDL_GetPixelFormatName(c->format), y);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static frame_ctx_t frame;
+    static const Uint32 formats[] = {SDL_PIXELFORMAT_RGB565, SDL_PIXELFORMAT_RGB888};
+    char path[] = "/tmp/bench_fbdev.XXXXXX";
+    char name[64];
+    int res = 0;
+
+    if (argc < 2) {
+        // room for the 32 bpp frame, fbdev_open() creates nothing
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            perror(path);
+            return 1;
+        }
+        if (ftruncate(fd, (off_t) SCREEN_W * SCREEN_H * 4) < 0) {
+            perror(path);
+            close(fd);
+            unlink(path);
+            return 1;
+        }
+        close(fd);
+    }
+    if (SDL_Init(0) != 0) {
+        return 1;
+    }
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        const char *format = SDL_GetPixelFormatName(formats[f]);
+        if (frame_setup(&frame, formats[f], argc > 1 ? argv[1] : path)) {
+            res = 1;
+            break;
+        }
+        res |= frame_compare(&frame);
+        snprintf(name, sizeof(name), "fbdev time widget damaged %s", format);
+        bench_run(name, 20000, bench_fbdev_damaged, &frame);
+        snprintf(name, sizeof(name), "fbdev full frame %s", format);
+        bench_run(name, 2000, bench_fbdev_full, &frame);
+        snprintf(name, sizeof(name), "SDL software renderer %s", format);
+        bench_run(name, 2000, bench_sdl_renderer, &frame);
+        frame_cleanup(&frame);
+    }
+    if (argc < 2) {
+        unlink(path);
+    }
+    SDL_Quit();
+    return res;
+}
@@ -0,0 +1,80 @@
+/**
+* @file bench_fmt.c
+*
+* @brief Widget text formatting: the old vasprintf + strcmp path against
+* the inline buffer of dfmt.c.
+*
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "dfmt.h"
+#include "dmem.h"
+#include "dfork.h"
+
+static const double powers[] = {540.2, 540.4, 1250.0, 3.0};
+
+typedef struct {
+    char *text;
+} asprintf_ctx_t;
+
+// what printf_SDL_Texture did before the inline buffers
+static void bench_vasprintf_same(void *ctx, uint64_t UNUSED(i)) {
+    asprintf_ctx_t *c = ctx;
+    char *buf = NULL;
+    if (asprintf(&buf, "%.0fW %.0fV", 540.2, 235.0) < 0) {
+        return;
+    }
+    if (c->text && strcmp(c->text, buf) == 0) {
+        FREE(buf);
+    } else {
+        FREE(c->text);
+        c->text = buf;
+    }
+}
+
+static void bench_text_same(void *ctx, uint64_t UNUSED(i)) {
+    fmt_text_set(ctx, "%.0fW %.0fV", 540.2, 235.0);
+}
+
+static void bench_text_changed(void *ctx, uint64_t i) {
+    fmt_text_set(ctx, "%.0fW %.0fV", powers[i & 3], 235.0);
+}
+
+static void bench_text_temperature(void *ctx, uint64_t i) {
+    fmt_text_set(ctx, "%.1fC", 20.0 + (double) (i & 7) * 0.1);
+}
+
+static void bench_text_battery(void *ctx, uint64_t i) {
+    fmt_text_set(ctx, "%.0f%% %.0fW %.0fC %.0fh", 55.0 + (double) (i & 1), -0.51 * 53.2, 31.0, 140.0 / 0.51);
+}
+
+static void bench_text_clock(void *ctx, uint64_t i) {
+    fmt_text_set(ctx, "%02d:%02d", (int) (i / 60) % 24, (int) i % 60);
+}
+
+int main(void) {
+    const uint64_t n = 2000000;
+    asprintf_ctx_t asprintf_ctx = {NULL};
+    fmt_text_t text = {0};
+    int res = 0;
+
+    bench_run("vasprintf+strcmp unchanged", n, bench_vasprintf_same, &asprintf_ctx);
+    FREE(asprintf_ctx.text);
+
+    // the steady state of every text widget must not touch the heap
+    if (bench_run("fmt_text_set unchanged", n, bench_text_same, &text) != 0.0) res = 1;
+    if (bench_run("fmt_text_set changed %.0fW %.0fV", n, bench_text_changed, &text) != 0.0) res = 1;
+    if (bench_run("fmt_text_set %.1fC", n, bench_text_temperature, &text) != 0.0) res = 1;
+    if (bench_run("fmt_text_set battery", n, bench_text_battery, &text) != 0.0) res = 1;
+    if (bench_run("fmt_text_set %02d:%02d", n, bench_text_clock, &text) != 0.0) res = 1;
+
+    if (res) {
+        fprintf(stderr, "fmt_text_set allocated memory\n");
+    }
+    return res;
+}
@@ -0,0 +1,209 @@
+/**
+* @file bench_history.c
+*
+* @brief Ingest rate, size on disk and range scans of the sensor history and
+* its rollups.
+*
+* A week of every recorded series sampled each 10 s with the precision the
+* MQTT sensors report, written into a temporary directory (argument 1 to keep
+* the files elsewhere). The rollups are fed the same samples, reopened to
+* exercise the rebuild and checked against the sample count.
+*
+*/
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "history.h"
+#include "rollup.h"
+#include "dfork.h"
+
+#define DAYS 7
+#define INTERVAL 10
+#define START 1700000000
+
+static const sensor_key_t keys[] = {
+        SENSOR_MAIN_POWER, SENSOR_MAIN_VOLTAGE, SENSOR_BATTERY_SOC, SENSOR_BATTERY_CURRENT, SENSOR_BATTERY_VOLTAGE,
+        SENSOR_BATTERY_TEMP, SENSOR_BATTERY_CAPACITY, SENSOR_INDOOR_TEMP, SENSOR_OUTDOOR_TEMP,
+};
+
+#define KEYS (sizeof(keys) / sizeof(keys[0]))
+#define SAMPLES ((uint64_t) DAYS * 86400 / INTERVAL * KEYS)
+
+typedef struct {
+    uint64_t n;
+    unsigned int seed;
+    double power;
+    double sum;
+    uint64_t count;
+} ingest_ctx_t;
+
+static double noise(ingest_ctx_t *c, int range) {
+    c->seed = c->seed * 1103515245u + 12345u;
+    return (double) ((int) ((c->seed >> 16) % (unsigned int) (2 * range + 1)) - range);
+}
+
+// a value as the sensor reports it, rounded to its precision
+static double sample(ingest_ctx_t *c, sensor_key_t key, uint64_t tick) {
+    switch (key) {
+        case SENSOR_MAIN_POWER:
+            c->power += noise(c, 3);
+            if (tick % 360 == 0) {
+                c->power = 300.0 + noise(c, 200) + 200.0;
+            }
+            return c->power;
+        case SENSOR_MAIN_VOLTAGE:
+            return 232.0 + noise(c, 2);
+        case SENSOR_BATTERY_SOC:
+            return (double) (60 + (tick / 720) % 40);
+        case SENSOR_BATTERY_CURRENT:
+            return (double) (int) (noise(c, 50) - 300.0) / 100.0;
+        case SENSOR_BATTERY_VOLTAGE:
+            return (double) (int) (5320.0 + noise(c, 5)) / 100.0;
+        case SENSOR_BATTERY_TEMP:
+            return (double) (30 + (tick / 1000) % 3);
+        case SENSOR_BATTERY_CAPACITY:
+            return 140.0;
+        case SENSOR_INDOOR_TEMP:
+            return (double) (int) (2300.0 + noise(c, 3)) / 100.0;
+        default:
+            return (double) (int) (93.0 + (double) (tick % 8640) / 200.0) / 10.0;
+    }
+}
+
+static void bench_ingest(void *ctx, uint64_t UNUSED(i)) {
+    ingest_ctx_t *c = ctx;
+    uint64_t tick = c->n / KEYS;
+    sensor_key_t key = keys[c->n % KEYS];
+    history_append(key, (time_t) (START + tick * INTERVAL), sample(c, key, tick));
+    c->n++;
+}
+
+static void bench_rollup_add(void *ctx, uint64_t UNUSED(i)) {
+    ingest_ctx_t *c = ctx;
+    uint64_t tick = c->n / KEYS;
+    sensor_key_t key = keys[c->n % KEYS];
+    rollup_add(key, (time_t) (START + tick * INTERVAL), sample(c, key, tick));
+    c->n++;
+}
+
+static void sum_sample(void *ctx, time_t UNUSED(t), double value) {
+    ((ingest_ctx_t *) ctx)->sum += value;
+}
+
+static void bench_scan_hour(void *ctx, uint64_t i) {
+    time_t from = START + (time_t) (i % (DAYS * 24 - 1)) * 3600;
+    history_scan(SENSOR_MAIN_POWER, from, from + 3600, sum_sample, ctx);
+}
+
+static void bench_scan_day(void *ctx, uint64_t i) {
+    time_t from = START + (time_t) (i % (DAYS - 1)) * 86400;
+    history_scan(SENSOR_MAIN_POWER, from, from + 86400, sum_sample, ctx);
+}
+
+static void sum_record(void *ctx, const rollup_record_t *record) {
+    ingest_ctx_t *c = ctx;
+    c->sum += record->mean;
+    c->count += record->count;
+}
+
+static void bench_rollup_week_hours(void *ctx, uint64_t UNUSED(i)) {
+    rollup_scan(SENSOR_MAIN_POWER, ROLLUP_HOUR, START, START + DAYS * 86400, sum_record, ctx);
+}
+
+static void bench_scan_week(void *ctx, uint64_t UNUSED(i)) {
+    history_scan(SENSOR_MAIN_POWER, START, START + DAYS * 86400, sum_sample, ctx);
+}
+
+static long dir_bytes(const char *path, bool remove) {
+    DIR *dir = opendir(path);
+    struct dirent *de;
+    char name[4096];
+    struct stat st;
+    long bytes = 0;
+    if (!dir) {
+        return -1;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+        if (stat(name, &st) == 0) {
+            bytes += (long) st.st_size;
+        }
+        if (remove) {
+            unlink(name);
+        }
+    }
+    closedir(dir);
+    return bytes;
+}
+
+int main(int argc, char *argv[]) {
+    char tmp[] = "/tmp/bench_history.XXXXXX";
+    const char *dir = argc > 1 ? argv[1] : mkdtemp(tmp);
+    ingest_ctx_t ingest = {.seed = 1, .power = 500.0};
+    history_stats_t stats;
+
+    if (!dir || history_open(dir) < 0 || rollup_open(dir, START) < 0) {
+        perror("history_open");
+        return 1;
+    }
+    // the warm up runs a tenth more
+    bench_run("history append", SAMPLES * 10 / 11, bench_ingest, &ingest);
+    ingest_ctx_t rollup = {.seed = 1, .power = 500.0};
+    bench_run("rollup add", SAMPLES * 10 / 11, bench_rollup_add, &rollup);
+    history_get_stats(&stats);
+    uint64_t open_samples = (START + ingest.n / KEYS * INTERVAL) % 86400 / INTERVAL * KEYS;
+    printf("%-40s %12.2f bytes/sample compressed, %lu dropped\n", "history open day",
+           (double) stats.bits / 8.0 / (double) open_samples, stats.dropped);
+    rollup_close();
+    history_close();
+    long bytes = dir_bytes(dir, false);
+    printf("%-40s %12.2f bytes/sample on disk, %ld bytes for %lu samples\n", "history and rollup files",
+           (double) bytes / (double) ingest.n, bytes, (unsigned long) ingest.n);
+
+    // the last sample is still in the open bucket, reopening rebuilds it from the history
+    if (history_open(dir) < 0 || rollup_open(dir, START + (time_t) (ingest.n / KEYS * INTERVAL)) < 0) {
+        perror("history_open");
+        return 1;
+    }
+    unsigned long expected = (unsigned long) (ingest.n / KEYS);
+    size_t n = history_scan(SENSOR_MAIN_POWER, START, START + DAYS * 86400, sum_sample, &ingest);
+    int res = n != expected;
+    if (res) {
+        fprintf(stderr, "scan returned %zu samples of %lu\n", n, expected);
+    }
+    for (int level = 0; level < ROLLUP_LEVELS; level++) {
+        ingest_ctx_t records = {0};
+        n = rollup_scan(SENSOR_MAIN_POWER, (rollup_level_t) level, START - 86400, START + DAYS * 86400, sum_record,
+                        &records);
+        printf("%-40s %12zu records of %lu samples\n", level == ROLLUP_MINUTE ? "rollup minutes" :
+                                                      level == ROLLUP_HOUR ? "rollup hours" : "rollup days", n,
+               (unsigned long) records.count);
+        if (records.count != expected) {
+            fprintf(stderr, "rollup level %d counts %lu samples of %lu\n", level, (unsigned long) records.count,
+                    expected);
+            res = 1;
+        }
+    }
+    bench_run("history scan 1 hour of power", 20000, bench_scan_hour, &ingest);
+    bench_run("history scan 1 day of power", 200, bench_scan_day, &ingest);
+    bench_run("history scan 1 week of power", 20, bench_scan_week, &ingest);
+    bench_run("rollup 1 week of power hours", 2000, bench_rollup_week_hours, &ingest);
+    rollup_close();
+    history_close();
+
+    if (argc < 2) {
+        dir_bytes(dir, true);
+        rmdir(dir);
+    }
+    return res;
+}
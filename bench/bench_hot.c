@@ -0,0 +1,384 @@
+/**
+* @file bench_hot.c
+*
+* @brief The hot functions of superclock one by one: icon colouring, widget
+* text rendering, MQTT dispatch, the JSON callbacks on the sample payloads of
+* their source comments, daemon_log per sink and extract_zip.
+*
+* Run from the source tree for images/ and the font superclock uses, argument
+* 1 names another TrueType font. The text benches are skipped when the font
+* can't be opened. The syslog sink measures whatever /dev/log does on this
+* machine.
+*/
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <SDL2/SDL_ttf.h>
+#include <zip.h>
+
+#include "bench.h"
+#include "colorize.h"
+#include "dfmt.h"
+#include "dlog.h"
+#include "dblog.h"
+#include "dflight.h"
+#include "dzip.h"
+#include "mq.h"
+#include "mqcb.h"
+#include "raster.h"
+#include "dfork.h"
+
+#define MAX_IMAGES 64
+#define FONT_FILE "freesansbold.ttf"
+
+typedef struct {
+    SDL_Surface *icon;
+    Uint32 format;
+} icon_ctx_t;
+
+typedef struct {
+    const char *font;
+    int size;
+    const char *format;
+    fmt_text_t text;
+} text_ctx_t;
+
+typedef struct {
+    struct mosquitto_message msgs[100];
+    int count;
+} dispatch_ctx_t;
+
+typedef struct {
+    mosq_cb_t cb;
+    struct mosquitto_message msg;
+} callback_ctx_t;
+
+typedef struct {
+    FILE *null;
+} log_ctx_t;
+
+typedef struct {
+    char archive[64];
+    char out[64];
+} zip_ctx_t;
+
+static unsigned long dispatched = 0;
+
+static void bench_colorize(void *ctx, uint64_t UNUSED(i)) {
+    icon_ctx_t *c = ctx;
+    SDL_FreeSurface(colorize_surface(c->icon, (SDL_Color) {0, 255, 0, 255}, c->format));
+}
+
+// what printf_SDL_Surface() and raster_flush() do for a changed widget
+static void bench_text(void *ctx, uint64_t i) {
+    text_ctx_t *c = ctx;
+    fmt_text_set(&c->text, c->format, (int) (i / 60 % 24), (int) (i % 60));
+    raster_job_t job = {c->font, c->size, c->text.buf, {255, 255, 255, 255}, NULL};
+    raster_job_t *jobs[] = {&job};
+    raster_pool_run(jobs, 1);
+    SDL_FreeSurface(job.surface);
+}
+
+static void count_cb(const struct mosquitto_message *UNUSED(msg)) {
+    dispatched++;
+}
+
+static void bench_dispatch(void *ctx, uint64_t i) {
+    dispatch_ctx_t *c = ctx;
+    mosq_dispatch(&c->msgs[i % (uint64_t) c->count]);
+}
+
+static void bench_callback(void *ctx, uint64_t UNUSED(i)) {
+    callback_ctx_t *c = ctx;
+    c->cb(&c->msg);
+}
+
+static void bench_log(void *UNUSED(ctx), uint64_t i) {
+    daemon_log(LOG_INFO, "outdoor temperature: %.1fC", (double) (i % 300) / 10.0);
+}
+
+static void bench_log_debug(void *UNUSED(ctx), uint64_t i) {
+    daemon_log(LOG_DEBUG, "outdoor temperature: %.1fC", (double) (i % 300) / 10.0);
+}
+
+// the console sinks write to /dev/null, the bench results still go to stdout
+static void bench_log_stdout(void *ctx, uint64_t i) {
+    FILE *saved = stdout;
+    stdout = ((log_ctx_t *) ctx)->null;
+    bench_log(ctx, i);
+    stdout = saved;
+}
+
+static void bench_log_stderr(void *ctx, uint64_t i) {
+    FILE *saved = stderr;
+    stderr = ((log_ctx_t *) ctx)->null;
+    bench_log(ctx, i);
+    stderr = saved;
+}
+
+static void bench_extract_zip(void *ctx, uint64_t UNUSED(i)) {
+    zip_ctx_t *c = ctx;
+    extract_zip(c->archive, c->out);
+}
+
+static void message(struct mosquitto_message *msg, const char *topic, const char *payload) {
+    memset(msg, 0, sizeof(*msg));
+    msg->topic = (char *) topic;
+    msg->payload = (void *) payload;
+    msg->payloadlen = (int) strlen(payload);
+}
+
+static void bench_icons(void) {
+    glob_t images;
+    if (glob("images/*.png", 0, NULL, &images) != 0) {
+        fprintf(stderr, "no icons in images/, run from the source tree\n");
+        return;
+    }
+    for (size_t n = 0; n < images.gl_pathc && n < MAX_IMAGES; n++) {
+        SDL_Surface *loaded = IMG_Load(images.gl_pathv[n]);
+        if (!loaded) {
+            continue;
+        }
+        // as img_create() prepares them
+        icon_ctx_t c = {SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0), SDL_PIXELFORMAT_ARGB8888};
+        SDL_FreeSurface(loaded);
+        if (!c.icon) {
+            continue;
+        }
+        char name[128];
+        const char *base = strrchr(images.gl_pathv[n], '/') + 1;
+        snprintf(name, sizeof(name), "colorize %.*s", (int) (strcspn(base, ".")), base);
+        bench_run(name, 20000, bench_colorize, &c);
+        c.format = SDL_PIXELFORMAT_RGB565;
+        snprintf(name, sizeof(name), "colorize %.*s rgb565", (int) (strcspn(base, ".")), base);
+        bench_run(name, 20000, bench_colorize, &c);
+        SDL_FreeSurface(c.icon);
+    }
+    globfree(&images);
+}
+
+static void bench_texts(const char *font) {
+    TTF_Font *probe = TTF_OpenFont(font, 25);
+    if (!probe) {
+        fprintf(stderr, "%s: %s, text benches skipped\n", font, TTF_GetError());
+        return;
+    }
+    TTF_CloseFont(probe);
+    text_ctx_t clock = {font, 55, "%02d:%02d", {0}};
+    text_ctx_t power = {font, 25, "%dW %dV", {0}};
+    bench_run("text clock 55px", 5000, bench_text, &clock);
+    bench_run("text power 25px", 5000, bench_text, &power);
+    raster_pool_done();
+}
+
+static void bench_dispatches(void) {
+    static const char *topics[] = {
+            "tele/main_battery/SENSOR", "tele/main-power/SENSOR", "tele/main-power/LWT", "tele/main_battery/LWT",
+            "tele/hass/SENSOR", "tele/hass/LWT", "zigbee2mqtt/thps_sf_hall", "zigbee2mqtt/thps_sf_hall/availability",
+            "zigbee2mqtt/dos-entranse/availability", "zigbee2mqtt/dos-entranse",
+    };
+    static char names[90][32];
+    dispatch_ctx_t c = {.count = 10};
+    for (int i = 0; i < 10; i++) {
+        mosq_register_on_message_cb(topics[i], count_cb);
+        message(&c.msgs[i], topics[i], "Online");
+    }
+    bench_run("on_message dispatch 10 topics", 1000000, bench_dispatch, &c);
+    for (int i = 0; i < 90; i++) {
+        snprintf(names[i], sizeof(names[i]), "zigbee2mqtt/sensor_%02d", i);
+        mosq_register_on_message_cb(names[i], count_cb);
+        message(&c.msgs[10 + i], names[i], "Online");
+    }
+    c.count = 100;
+    bench_run("on_message dispatch 100 topics", 1000000, bench_dispatch, &c);
+}
+
+static void bench_callbacks(void) {
+    static const struct {
+        const char *name;
+        mosq_cb_t cb;
+        const char *payload;
+    } samples[] = {
+            {"battery_cb", battery_cb,
+                    "{\"Time\":\"2023-11-06T13:36:55\",\"soc\":78,\"current\":-3.12,\"voltage\":53.21,"
+                    "\"temp_tube\":31,\"capacity\":140}"},
+            {"main_power_cb", main_power_cb,
+                    "{\"Time\":\"2023-11-06T13:36:55\",\"SHT3X\":{\"Temperature\":36.7,\"Humidity\":27.3},"
+                    "\"PZEM004T\":{\"Total\":8211.639,\"Power\":540,\"Voltage\":235,\"Current\":3.070},"
+                    "\"TempUnit\":\"C\"}"},
+            {"main_power_lwt_cb", main_power_lwt_cb, "Online"},
+            {"main_battery_lwt_cb", main_battery_lwt_cb, "Online"},
+            {"outdoor_cb", outdoor_cb,
+                    "{\"Time\":\"2023-11-08T14:55:49\",\"IN\":{\"time\": \"2023-11-08 14:55:32\",\"brand\": "
+                    "\"ODROID\",\"model\": \"WB2\",\"id\": 0,\"channel\": 1,\"battery\": \"OK\",\"temperature_C\": "
+                    "25.47,\"humidity\": 53.48,\"pressure\": 984.9,\"altitude\": 329.2581,\"uv_index\": 0.01,"
+                    "\"visible\": 206,\"ir\": 30},\"EX\":{\"time\": \"2023-11-08 14:55:36\",\"brand\": \"OS\","
+                    "\"model\": \"Oregon-THGR122N\",\"id\": 249,\"channel\": 1,\"battery_ok\": 1,"
+                    "\"temperature_C\": 9.3,\"humidity\": 87}}"},
+            {"outdoor_lwt_cb", outdoor_lwt_cb, "Online"},
+            {"thps_sf_hall_cb", thps_sf_hall_cb,
+                    "{\"battery\":100,\"humidity\":51.52,\"last_seen\":\"2023-11-08T12:53:56.724Z\","
+                    "\"linkquality\":76,\"pressure\":984.7,\"temperature\":23.39,\"voltage\":3005}"},
+            {"thps_sf_hall_lwt_cb", thps_sf_hall_lwt_cb, "online"},
+            {"dos_entranse_lwt_cb", dos_entranse_lwt_cb, "online"},
+            {"dos_entranse_cb", dos_entranse_cb,
+                    "{\"battery\":91,\"battery_low\":false,\"contact\":true,\"linkquality\":102,"
+                    "\"tamper\":false,\"voltage\":2900}"},
+    };
+    // the callbacks log every value, the sinks are measured on their own
+    unsigned int prio = daemon_log_upto(LOG_WARNING);
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+        callback_ctx_t c = {samples[i].cb, {0}};
+        char name[64];
+        message(&c.msg, "", samples[i].payload);
+        snprintf(name, sizeof(name), "callback %s", samples[i].name);
+        bench_run(name, 200000, bench_callback, &c);
+    }
+    daemon_log_upto(prio);
+}
+
+static void bench_logs(void) {
+    log_ctx_t c = {fopen("/dev/null", "we")};
+    enum daemon_log_flags use = daemon_log_use;
+    unsigned int prio = daemon_log_upto(LOG_INFO);
+    if (!c.null) {
+        perror("/dev/null");
+        return;
+    }
+    daemon_log_use = DAEMON_LOG_STDERR;
+    bench_run("daemon_log stderr", 200000, bench_log_stderr, &c);
+    daemon_log_use = DAEMON_LOG_STDOUT;
+    bench_run("daemon_log stdout", 200000, bench_log_stdout, &c);
+    daemon_log_use = DAEMON_LOG_SYSLOG;
+    bench_run("daemon_log syslog", 50000, bench_log, &c);
+    // the writer thread writes to fd 2 itself
+    daemon_log_use = DAEMON_LOG_STDERR;
+    int saved_stderr = dup(STDERR_FILENO);
+    dup2(fileno(c.null), STDERR_FILENO);
+    if (daemon_log_async_start() == 0) {
+        daemon_log_async_stats_t stats;
+        bench_run("daemon_log async", 200000, bench_log, &c);
+        daemon_log_async_stop();
+        daemon_log_async_stats(&stats);
+        bench_metric("daemon_log async dropped", (double) stats.dropped, "records");
+        printf("%-40s %12lu records %10lu dropped %10lu writes\n", "  async writer", stats.records, stats.dropped,
+               stats.writes);
+    }
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    char blog_path[] = "/tmp/bench_hot.blogXXXXXX";
+    int blog_fd = mkstemp(blog_path);
+    if (blog_fd >= 0) {
+        close(blog_fd);
+        if (daemon_blog_open(blog_path, DAEMON_BLOG_DEFAULT_SIZE) == 0) {
+            daemon_log_use = DAEMON_LOG_BINARY;
+            bench_run("daemon_log binary", 1000000, bench_log, &c);
+            daemon_blog_close();
+        }
+        unlink(blog_path);
+    }
+    daemon_log_upto(LOG_WARNING);
+    bench_run("daemon_log filtered out", 1000000, bench_log, &c);
+    // info is still recorded, debug is below what the recorder keeps
+    char flight_path[] = "/tmp/bench_hot.flightXXXXXX";
+    int flight_fd = mkstemp(flight_path);
+    if (flight_fd >= 0) {
+        close(flight_fd);
+        if (daemon_flight_open(flight_path) == 0) {
+            bench_run("daemon_log filtered out, recorded", 1000000, bench_log, &c);
+            bench_run("daemon_log debug filtered out, recorder", 1000000, bench_log_debug, &c);
+            daemon_flight_close();
+        }
+        unlink(flight_path);
+    }
+    daemon_log_use = use;
+    daemon_log_upto(prio);
+    fclose(c.null);
+}
+
+// an archive like the updates extract_zip() unpacks: a few icons and a text file
+static bool zip_create(const char *path) {
+    static const char readme[] = "superclock icons\n";
+    int err;
+    zip_t *zip = zip_open(path, ZIP_CREATE | ZIP_TRUNCATE, &err);
+    if (!zip) {
+        return false;
+    }
+    glob_t images;
+    if (glob("images/outline_power*.png", 0, NULL, &images) == 0) {
+        for (size_t n = 0; n < images.gl_pathc; n++) {
+            zip_source_t *src = zip_source_file(zip, images.gl_pathv[n], 0, -1);
+            if (src && zip_file_add(zip, strrchr(images.gl_pathv[n], '/') + 1, src, ZIP_FL_OVERWRITE) < 0) {
+                zip_source_free(src);
+            }
+        }
+        globfree(&images);
+    }
+    zip_source_t *src = zip_source_buffer(zip, readme, sizeof(readme) - 1, 0);
+    if (src && zip_file_add(zip, "README", src, ZIP_FL_OVERWRITE) < 0) {
+        zip_source_free(src);
+    }
+    return zip_close(zip) == 0;
+}
+
+static void dir_remove(const char *path) {
+    DIR *dir = opendir(path);
+    struct dirent *de;
+    char name[4096];
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') {
+            snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+            unlink(name);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+static void bench_zip(void) {
+    char dir[] = "/tmp/bench_hot.XXXXXX";
+    zip_ctx_t c;
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        return;
+    }
+    snprintf(c.archive, sizeof(c.archive), "%s/update.zip", dir);
+    snprintf(c.out, sizeof(c.out), "%s/out", dir);
+    if (zip_create(c.archive)) {
+        unsigned int prio = daemon_log_upto(LOG_WARNING);
+        bench_run("extract_zip", 500, bench_extract_zip, &c);
+        daemon_log_upto(prio);
+    } else {
+        fprintf(stderr, "%s: can't create the sample archive\n", c.archive);
+    }
+    dir_remove(c.out);
+    dir_remove(dir);
+}
+
+int main(int argc, char *argv[]) {
+    const char *font = argc > 1 ? argv[1] : FONT_FILE;
+
+    if (SDL_Init(0) < 0 || TTF_Init() < 0) {
+        fprintf(stderr, "SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+    bench_icons();
+    bench_texts(font);
+    bench_dispatches();
+    bench_callbacks();
+    bench_logs();
+    bench_zip();
+    TTF_Quit();
+    SDL_Quit();
+    return dispatched ? 0 : 1;
+}
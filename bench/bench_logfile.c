@@ -0,0 +1,186 @@
+/**
+* @file bench_logfile.c
+*
+* @brief Caller cost and write amplification of the rotating log file sink.
+*
+* The sensor callbacks' log lines go to a file rotated each 256 KiB with a
+* 1 MiB disk budget, first formatted and written on the calling thread, then
+* through the asynchronous writer. Write amplification is reported against
+* the bytes of the log lines, prefixes included:
+*
+* - syscall: bytes passed to write() by the process (wchar of /proc/self/io),
+*   the sink plus libzip writing the archives
+* - storage: bytes the process caused to be written to the block device
+*   (write_bytes), 0 on tmpfs: pass a directory on the SD card as argument 1
+* - footprint: bytes left on disk, the archives within the budget and the
+*   current file
+*
+* The files go to a temporary directory unless argument 1 names one.
+*/
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "dlog.h"
+#include "dlogfile.h"
+#include "dfork.h"
+
+#define MAX_SIZE (256 * 1024)
+#define BUDGET (1024 * 1024)
+#define LINES 200000
+
+typedef struct {
+    unsigned long long wchar;
+    unsigned long long write_bytes;
+} proc_io_t;
+
+static proc_io_t proc_io(void) {
+    proc_io_t io = {0};
+    char line[128];
+    FILE *f = fopen("/proc/self/io", "re");
+    while (f && fgets(line, sizeof(line), f)) {
+        sscanf(line, "wchar: %llu", &io.wchar);
+        sscanf(line, "write_bytes: %llu", &io.write_bytes);
+    }
+    if (f) {
+        fclose(f);
+    }
+    return io;
+}
+
+// the line battery_cb logs for every message
+static void bench_log(void *UNUSED(ctx), uint64_t i) {
+    double current = (double) (i % 400) / 10.0 - 20.0;
+    daemon_log(LOG_INFO, "soc: %.0f%%, current: %.2fA, voltage: %.2fV, power:%.2fW temp: %.0fC capacity: %.0f",
+               (double) (i % 100), current, 52.1, current * 52.1, 24.0, 280.0);
+}
+
+// the log file and its archives
+static long dir_bytes(const char *path, bool remove) {
+    DIR *dir = opendir(path);
+    struct dirent *de;
+    char name[4096];
+    struct stat st;
+    long bytes = 0;
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "superclock.log", 14) != 0) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+        if (stat(name, &st) == 0) {
+            bytes += (long) st.st_size;
+        }
+        if (remove) {
+            unlink(name);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return bytes;
+}
+
+// a rotated file not yet deflated, or the file itself not yet rotated
+static bool rotating(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    struct stat st;
+    bool busy = false;
+    while (d && !busy && (de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (strcmp(de->d_name, "superclock.log") == 0) {
+            busy = fstatat(dirfd(d), de->d_name, &st, 0) == 0 && st.st_size > 0;
+        } else if (strncmp(de->d_name, "superclock.log.", 15) == 0) {
+            busy = len < 4 || strcmp(de->d_name + len - 4, ".zip") != 0;
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    return busy;
+}
+
+// the rotation thread compresses in the background, the last lines are rotated and waited for
+static void rotate_and_wait(const char *dir) {
+    for (int i = 0; i < 1000 && rotating(dir); i++) {
+        daemon_log_file_rotate();
+        usleep(10000);
+    }
+}
+
+static void report(const char *name, const proc_io_t *before, const char *dir) {
+    daemon_log_file_stats_t stats;
+    proc_io_t after = proc_io();
+    daemon_log_file_stats(&stats);
+    double bytes = (double) stats.bytes;
+    double syscall = (double) (after.wchar - before->wchar) / bytes;
+    double storage = (double) (after.write_bytes - before->write_bytes) / bytes;
+    double footprint = (double) dir_bytes(dir, false) / bytes;
+    char metric[80];
+
+    printf("%-40s %12lu bytes %6lu writes %4lu rotations %4lu removed\n", name, (unsigned long) stats.bytes,
+           (unsigned long) stats.writes, (unsigned long) stats.rotations, (unsigned long) stats.removed);
+    printf("%-40s %12.2f syscall %6.2f storage %6.2f footprint %6.2f deflate\n", "  write amplification", syscall,
+           storage, footprint,
+           stats.rotated_bytes ? (double) stats.compressed_bytes / (double) stats.rotated_bytes : 0.0);
+    snprintf(metric, sizeof(metric), "%s syscall amplification", name);
+    bench_metric(metric, syscall, "ratio");
+    snprintf(metric, sizeof(metric), "%s storage amplification", name);
+    bench_metric(metric, storage, "ratio");
+    snprintf(metric, sizeof(metric), "%s footprint", name);
+    bench_metric(metric, footprint, "ratio");
+}
+
+int main(int argc, char *argv[]) {
+    char tmp[] = "/tmp/bench_logfile.XXXXXX";
+    const char *dir = argc > 1 ? argv[1] : mkdtemp(tmp);
+    char path[4096];
+    enum daemon_log_flags use = daemon_log_use;
+
+    if (!dir) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/superclock.log", dir);
+    daemon_log_use = DAEMON_LOG_FILE;
+
+    proc_io_t before = proc_io();
+    if (daemon_log_file_open(path, MAX_SIZE, 0, BUDGET) < 0) {
+        perror(path);
+        return 1;
+    }
+    bench_run("daemon_log file", LINES, bench_log, NULL);
+    rotate_and_wait(dir);
+    report("daemon_log file", &before, dir);
+    daemon_log_file_close();
+    dir_bytes(dir, true);
+
+    before = proc_io();
+    if (daemon_log_file_open(path, MAX_SIZE, 0, BUDGET) < 0 || daemon_log_async_start() < 0) {
+        perror(path);
+        return 1;
+    }
+    bench_run("daemon_log file async", LINES, bench_log, NULL);
+    daemon_log_async_stop();
+    daemon_log_async_stats_t async_stats;
+    daemon_log_async_stats(&async_stats);
+    // the ring of the thread is full when the writer is behind, the line is dropped
+    printf("%-40s %12lu records %6lu dropped\n", "daemon_log file async", async_stats.records, async_stats.dropped);
+    rotate_and_wait(dir);
+    report("daemon_log file async", &before, dir);
+    daemon_log_file_close();
+
+    daemon_log_use = use;
+    dir_bytes(dir, true);
+    if (argc < 2) {
+        rmdir(dir);
+    }
+    return 0;
+}
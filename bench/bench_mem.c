@@ -0,0 +1,147 @@
+/**
+* @file bench_mem.c
+*
+* @brief Cost of the dmem wrappers with and without allocation tracking.
+*
+* The sizes are those of the app: a topic string, a history block and a
+* buffer above the mmap threshold of glibc, where calloc gets zeroed pages
+* from the kernel and bzero used to touch every one of them. The tracked
+* pass ends with the report the app logs on SIGHUP and at exit.
+*
+* The transient blocks of a message, a path, a payload copy and a few
+* buffers, then come from malloc and from an arena reset per message, alone
+* and with a second thread doing the same as the render and mosquitto
+* threads do.
+*/
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bench.h"
+#include "dmem.h"
+#include "dlog.h"
+#include "dfork.h"
+
+typedef struct {
+    size_t size;
+} mem_ctx_t;
+
+static void bench_alloc(void *ctx, uint64_t UNUSED(i)) {
+    mem_ctx_t *c = ctx;
+    char *p = xmalloc(c->size);
+    // the block is used, the compiler can't drop the pair
+    __asm__ volatile("" : : "r"(p) : "memory");
+    FREE(p);
+}
+
+static void bench_strdup(void *UNUSED(ctx), uint64_t UNUSED(i)) {
+    char *topic = xstrdup("stat/tasmota_8F1A6C/RESULT");
+    __asm__ volatile("" : : "r"(topic) : "memory");
+    FREE(topic);
+}
+
+// a block that stays allocated while others come and go, like the history series
+static void bench_realloc(void *ctx, uint64_t i) {
+    char **blocks = ctx;
+    blocks[i % 64] = xrealloc(blocks[i % 64], 64 + (i % 8) * 32);
+}
+
+// the blocks a message used to take from malloc
+static void bench_message_malloc(void *UNUSED(ctx), uint64_t i) {
+    char *path = NULL;
+    if (asprintf(&path, "/sys/class/thermal/thermal_zone%d/temp", (int) (i % 4)) < 0) {
+        return;
+    }
+    char *payload = xmalloc(160);
+    double *means = xmalloc(64 * sizeof(double));
+    int *count = xmalloc(64 * sizeof(int));
+    __asm__ volatile("" : : "r"(path), "r"(payload), "r"(means), "r"(count) : "memory");
+    FREE(count);
+    FREE(means);
+    FREE(payload);
+    FREE(path);
+}
+
+static void bench_message_arena(void *ctx, uint64_t i) {
+    dmem_arena_t *arena = ctx;
+    char *path = dmem_arena_printf(arena, "/sys/class/thermal/thermal_zone%d/temp", (int) (i % 4));
+    char *payload = dmem_arena_alloc(arena, 160);
+    double *means = dmem_arena_alloc(arena, 64 * sizeof(double));
+    int *count = dmem_arena_alloc(arena, 64 * sizeof(int));
+    __asm__ volatile("" : : "r"(path), "r"(payload), "r"(means), "r"(count) : "memory");
+    dmem_arena_reset(arena);
+}
+
+typedef struct {
+    bench_fn_t fn;
+    bool stop;
+} busy_ctx_t;
+
+// the other thread of the pair, until stopped
+static void *busy_thread(void *arg) {
+    busy_ctx_t *c = arg;
+    dmem_arena_t arena = DMEM_ARENA_INIT;
+    for (uint64_t i = 0; !__atomic_load_n(&c->stop, __ATOMIC_RELAXED); i++) {
+        c->fn(&arena, i);
+    }
+    dmem_arena_free(&arena);
+    return NULL;
+}
+
+static void bench_messages(void) {
+    dmem_arena_t arena = DMEM_ARENA_INIT;
+    bench_run("message blocks malloc", 1000000, bench_message_malloc, NULL);
+    bench_run("message blocks arena", 1000000, bench_message_arena, &arena);
+
+    busy_ctx_t busy = {bench_message_malloc, false};
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, busy_thread, &busy) == 0) {
+        bench_run("message blocks malloc, 2 threads", 1000000, bench_message_malloc, NULL);
+        __atomic_store_n(&busy.stop, true, __ATOMIC_RELAXED);
+        pthread_join(thread, NULL);
+    }
+    busy = (busy_ctx_t) {bench_message_arena, false};
+    if (pthread_create(&thread, NULL, busy_thread, &busy) == 0) {
+        bench_run("message blocks arena, 2 threads", 1000000, bench_message_arena, &arena);
+        __atomic_store_n(&busy.stop, true, __ATOMIC_RELAXED);
+        pthread_join(thread, NULL);
+    }
+    printf("%-40s %12zu high water %4lu chunks added\n", "  message arena", arena.high, (unsigned long) arena.grows);
+    dmem_arena_free(&arena);
+}
+
+static void bench_pass(const char *mode) {
+    static const size_t sizes[] = {32, 1024, 256 * 1024};
+    char name[64];
+    char *blocks[64] = {NULL};
+
+    for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+        mem_ctx_t c = {sizes[n]};
+        snprintf(name, sizeof(name), "xmalloc+FREE %zu%s", sizes[n], mode);
+        bench_run(name, sizes[n] > 4096 ? 20000 : 1000000, bench_alloc, &c);
+    }
+    snprintf(name, sizeof(name), "xstrdup+FREE%s", mode);
+    bench_run(name, 1000000, bench_strdup, NULL);
+    snprintf(name, sizeof(name), "xrealloc%s", mode);
+    bench_run(name, 1000000, bench_realloc, blocks);
+    for (int i = 0; i < 64; i++) {
+        FREE(blocks[i]);
+    }
+}
+
+int main(void) {
+    bench_pass("");
+    bench_messages();
+    dmem_track_start();
+    bench_pass(" tracked");
+
+    // a leak for the report
+    char *leak = xmalloc(4096);
+    __asm__ volatile("" : : "r"(leak) : "memory");
+    dmem_report(5);
+    return 0;
+}
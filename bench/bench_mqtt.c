@@ -0,0 +1,433 @@
+/**
+* @file bench_mqtt.c
+*
+* @brief Throughput and latency of the MQTT path with a broker in the loop.
+*
+* Starts a mosquitto broker on a free loopback port and points the mq.c client
+* at it with the callbacks of mqcb.c registered, the client subscribes to the
+* ten topics superclock registers. A second client publishes the payloads the
+* house sensors send (Tasmota PZEM, battery, hass weather, zigbee2mqtt THPS
+* and door contact, LWT and availability) round robin over the topics at each
+* rate given on the command line.
+*
+* Every payload carries a sequence number after its terminating NUL, the
+* callbacks see the usual string and the probe behind them matches the
+* message to its send time. The probe runs after the superclock callback of
+* the topic.
+*
+* Reported per rate: messages/s dispatched, callback latency percentiles, CPU
+* of the client thread and of the broker per message, dropped messages and
+* messages later than the limit. The exit status is 1 when a message was
+* dropped or late, 2 when the broker did not come up.
+*
+* bench_mqtt [-b mosquitto] [-d seconds] [-l late ms] [rate ...]
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <mosquitto.h>
+
+#include "bench.h"
+#include "mq.h"
+#include "mqcb.h"
+#include "dlog.h"
+#include "dmem.h"
+
+#define DEFAULT_SECONDS 5
+#define DEFAULT_LATE_MS 250
+// no progress for this long ends the wait for the tail of a round
+#define DRAIN_NS 2000000000ULL
+
+static const char *topics[] = {
+        "tele/main_battery/SENSOR",
+        "tele/main-power/SENSOR",
+        "tele/main-power/LWT",
+        "tele/main_battery/LWT",
+        "tele/hass/SENSOR",
+        "tele/hass/LWT",
+        "zigbee2mqtt/thps_sf_hall",
+        "zigbee2mqtt/thps_sf_hall/availability",
+        "zigbee2mqtt/dos-entranse/availability",
+        "zigbee2mqtt/dos-entranse",
+};
+
+#define TOPICS (sizeof(topics) / sizeof(topics[0]))
+
+typedef struct {
+    // sequence numbers [base, base + count) belong to the round
+    uint64_t base;
+    uint64_t count;
+    uint64_t *sent_ns;
+    uint64_t *latency_ns;
+    uint8_t *seen;
+    // written by the client thread only
+    uint64_t received;
+    uint64_t duplicates;
+    uint64_t cpu_first;
+    uint64_t cpu_last;
+} round_t;
+
+static round_t *current = NULL;
+static unsigned long untagged = 0;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// registered after the superclock callbacks, dispatch runs it once they returned
+static void probe_cb(const struct mosquitto_message *msg) {
+    uint64_t now = bench_now_ns();
+    const char *payload = msg->payload;
+    size_t len = strlen(payload);
+
+    round_t *r = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (!r || (int) len + 1 >= msg->payloadlen) {
+        __atomic_add_fetch(&untagged, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint64_t seq = strtoull(payload + len + 1, NULL, 10);
+    if (seq < r->base || seq >= r->base + r->count) {
+        return;
+    }
+    seq -= r->base;
+    if (r->seen[seq]) {
+        r->duplicates++;
+        return;
+    }
+    uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    if (!r->received) {
+        r->cpu_first = cpu;
+    }
+    r->cpu_last = cpu;
+    r->seen[seq] = 1;
+    r->latency_ns[seq] = now - __atomic_load_n(&r->sent_ns[seq], __ATOMIC_ACQUIRE);
+    __atomic_store_n(&r->received, r->received + 1, __ATOMIC_RELEASE);
+}
+
+// the payload the sensor behind the topic sends, values drifting with seq
+static int payload(char *buf, size_t size, size_t topic, uint64_t seq, const char *time) {
+    int v = (int) (seq % 97);
+    switch (topic) {
+        case 0:
+            return snprintf(buf, size,
+                            "{\"Time\":\"%s\",\"soc\":%d,\"current\":%.2f,\"voltage\":%.2f,\"temp_tube\":%d,"
+                            "\"capacity\":140}", time, 60 + v % 40, -3.0 + v / 50.0, 53.2 + v / 100.0,
+                            30 + v % 3);
+        case 1:
+            return snprintf(buf, size,
+                            "{\"Time\":\"%s\",\"PZEM004T\":{\"Total\":1834.512,\"Yesterday\":12.204,"
+                            "\"Today\":4.317,\"Power\":%d,\"ApparentPower\":%d,\"ReactivePower\":48,"
+                            "\"Factor\":0.98,\"Frequency\":50,\"Voltage\":%d,\"Current\":%.3f}}",
+                            time, 400 + v * 3, 410 + v * 3, 228 + v % 6, (400 + v * 3) / 230.0);
+        case 4:
+            return snprintf(buf, size,
+                            "{\"Time\":\"%s\",\"IN\":{\"time\":\"%s\",\"brand\":\"ODROID\",\"model\":\"WB2\","
+                            "\"id\":0,\"channel\":1,\"battery\":\"OK\",\"temperature_C\":%.2f,"
+                            "\"humidity\":53.48,\"pressure\":984.9},\"EX\":{\"time\":\"%s\",\"brand\":\"OS\","
+                            "\"model\":\"Oregon-THGR122N\",\"id\":249,\"channel\":1,\"battery_ok\":1,"
+                            "\"temperature_C\":%.1f,\"humidity\":87}}", time, time, 25.0 + v / 100.0, time,
+                            5.0 + v / 10.0);
+        case 6:
+            return snprintf(buf, size,
+                            "{\"battery\":100,\"humidity\":%.2f,\"last_seen\":\"%s.724Z\",\"linkquality\":76,"
+                            "\"pressure\":984.7,\"temperature\":%.2f,\"voltage\":3005}", 50.0 + v / 10.0, time,
+                            23.0 + v / 100.0);
+        case 9:
+            return snprintf(buf, size,
+                            "{\"battery\":91,\"battery_low\":false,\"contact\":%s,\"linkquality\":102,"
+                            "\"tamper\":false,\"voltage\":2900}", v & 1 ? "true" : "false");
+        case 7:
+        case 8:
+            return snprintf(buf, size, "%s", v == 13 ? "offline" : "online");
+        default:
+            return snprintf(buf, size, "%s", v == 13 ? "Offline" : "Online");
+    }
+}
+
+static int publish(struct mosquitto *gen, size_t topic, uint64_t seq, bool tagged) {
+    static char time_buf[24] = {0};
+    static time_t time_last = 0;
+    char buf[1024];
+    time_t now = time(NULL);
+    if (now != time_last) {
+        strftime(time_buf, sizeof(time_buf), "%Y-%m-%dT%H:%M:%S", gmtime(&now));
+        time_last = now;
+    }
+    int len = payload(buf, sizeof(buf), topic, seq, time_buf);
+    if (tagged) {
+        len += snprintf(buf + len + 1, sizeof(buf) - (size_t) len - 1, "%llu", (unsigned long long) seq) + 1;
+    }
+    return mosquitto_publish(gen, NULL, topics[topic], len, buf, 0, false);
+}
+
+static int free_port(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int port = -1;
+    if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (struct sockaddr *) &addr, &len) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return port;
+}
+
+static bool port_open(int port) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((uint16_t) port),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool open = fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return open;
+}
+
+static pid_t broker_start(const char *binary, const char *conf, int port) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp(binary, binary, "-c", conf, (char *) NULL);
+        if (!strchr(binary, '/')) {
+            // packaged brokers live in sbin, often not on a user's PATH
+            execl("/usr/sbin/mosquitto", "mosquitto", "-c", conf, (char *) NULL);
+        }
+        fprintf(stderr, "exec %s: %s\n", binary, strerror(errno));
+        _exit(127);
+    }
+    for (int i = 0; pid > 0 && i < 500; i++) {
+        if (port_open(port)) {
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return -1;
+        }
+        usleep(10000);
+    }
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    return -1;
+}
+
+// utime + stime of a process in ns
+static uint64_t process_cpu_ns(pid_t pid) {
+    char path[64];
+    unsigned long utime = 0, stime = 0;
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return 0;
+    }
+    // the command name in field 2 has no spaces, mosquitto
+    if (fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        utime = stime = 0;
+    }
+    fclose(f);
+    return (uint64_t) (utime + stime) * (1000000000ULL / (uint64_t) sysconf(_SC_CLK_TCK));
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int run_round(struct mosquitto *gen, pid_t broker, uint64_t *seq, double rate, int seconds,
+                     uint64_t late_ns) {
+    round_t *r = xmalloc(sizeof(round_t));
+    memset(r, 0, sizeof(round_t));
+    r->base = *seq;
+    r->count = (uint64_t) (rate * seconds);
+    r->sent_ns = xmalloc(r->count * sizeof(uint64_t));
+    r->latency_ns = xmalloc(r->count * sizeof(uint64_t));
+    r->seen = xmalloc(r->count);
+    memset(r->seen, 0, r->count);
+    __atomic_store_n(&current, r, __ATOMIC_RELEASE);
+
+    uint64_t broker_cpu = process_cpu_ns(broker);
+    uint64_t start = bench_now_ns();
+    uint64_t failed = 0;
+    for (uint64_t i = 0; i < r->count; i++) {
+        uint64_t due = start + (uint64_t) ((double) i * 1e9 / rate);
+        uint64_t now = bench_now_ns();
+        // sleeping costs tens of µs, short gaps are caught up in a burst
+        if (due > now + 200000) {
+            struct timespec ts = {(time_t) ((due - now) / 1000000000ULL), (long) ((due - now) % 1000000000ULL)};
+            nanosleep(&ts, NULL);
+        }
+        __atomic_store_n(&r->sent_ns[i], bench_now_ns(), __ATOMIC_RELEASE);
+        failed += publish(gen, i % TOPICS, r->base + i, true) != MOSQ_ERR_SUCCESS;
+    }
+    uint64_t sent = bench_now_ns() - start;
+
+    uint64_t received = 0, progress = bench_now_ns();
+    while (received < r->count && bench_now_ns() - progress < DRAIN_NS) {
+        usleep(1000);
+        uint64_t n = __atomic_load_n(&r->received, __ATOMIC_ACQUIRE);
+        if (n != received) {
+            received = n;
+            progress = bench_now_ns();
+        }
+    }
+    uint64_t elapsed = progress - start;
+    broker_cpu = process_cpu_ns(broker) - broker_cpu;
+    __atomic_store_n(&current, NULL, __ATOMIC_RELEASE);
+    // let a callback still holding the round finish
+    usleep(10000);
+
+    uint64_t late = 0, n = 0;
+    for (uint64_t i = 0; i < r->count; i++) {
+        if (r->seen[i]) {
+            late += r->latency_ns[i] > late_ns;
+            r->latency_ns[n++] = r->latency_ns[i];
+        }
+    }
+    qsort(r->latency_ns, n, sizeof(uint64_t), cmp_u64);
+    uint64_t dropped = r->count - n;
+    char name[64];
+    snprintf(name, sizeof(name), "mqtt %.0f msg/s", rate);
+    printf("%-40s %12.0f msg/s dispatched, %.0f msg/s sent, %lu publish errors\n", name,
+           (double) n * 1e9 / (double) elapsed, (double) r->count * 1e9 / (double) sent, (unsigned long) failed);
+    if (n) {
+        printf("%-40s %12.1f us p50 %10.1f us p99 %10.1f us p99.9 %10.1f us max\n", "  callback latency",
+               (double) r->latency_ns[n / 2] / 1e3, (double) r->latency_ns[n * 99 / 100] / 1e3,
+               (double) r->latency_ns[n * 999 / 1000] / 1e3, (double) r->latency_ns[n - 1] / 1e3);
+        printf("%-40s %12.2f us/msg client %7.2f us/msg broker\n", "  cpu",
+               n > 1 ? (double) (r->cpu_last - r->cpu_first) / 1e3 / (double) (n - 1) : 0.0,
+               (double) broker_cpu / 1e3 / (double) n);
+    }
+    printf("%-40s %12lu dropped %10lu late %10lu duplicated\n", "  lost", (unsigned long) dropped,
+           (unsigned long) late, (unsigned long) r->duplicates);
+    bench_metric(name, (double) n * 1e9 / (double) elapsed, "msg/s");
+    snprintf(name, sizeof(name), "mqtt %.0f msg/s p99 latency", rate);
+    bench_metric(name, n ? (double) r->latency_ns[n * 99 / 100] / 1e3 : 0.0, "us");
+    snprintf(name, sizeof(name), "mqtt %.0f msg/s dropped", rate);
+    bench_metric(name, (double) dropped, "messages");
+    snprintf(name, sizeof(name), "mqtt %.0f msg/s late", rate);
+    bench_metric(name, (double) late, "messages");
+
+    *seq += r->count;
+    FREE(r->sent_ns);
+    FREE(r->latency_ns);
+    FREE(r->seen);
+    FREE(r);
+    return dropped || late ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *binary = "mosquitto";
+    int seconds = DEFAULT_SECONDS;
+    uint64_t late_ns = DEFAULT_LATE_MS * 1000000ULL;
+    static const double default_rates[] = {1000, 10000, 30000};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:d:l:")) != -1) {
+        switch (opt) {
+            case 'b':
+                binary = optarg;
+                break;
+            case 'd':
+                seconds = atoi(optarg) > 0 ? atoi(optarg) : DEFAULT_SECONDS;
+                break;
+            case 'l':
+                late_ns = (uint64_t) atol(optarg) * 1000000ULL;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-b mosquitto] [-d seconds] [-l late ms] [rate ...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    char dir[] = "/tmp/bench_mqtt.XXXXXX";
+    char conf[sizeof(dir) + 16];
+    int port = free_port();
+    if (!mkdtemp(dir) || port < 0) {
+        perror("bench_mqtt");
+        return 2;
+    }
+    snprintf(conf, sizeof(conf), "%s/broker.conf", dir);
+    FILE *f = fopen(conf, "we");
+    if (!f) {
+        perror(conf);
+        return 2;
+    }
+    fprintf(f, "listener %d 127.0.0.1\nallow_anonymous true\npersistence false\n"
+               "log_dest stderr\nlog_type error\nlog_type warning\n", port);
+    fclose(f);
+    pid_t broker = broker_start(binary, conf, port);
+    unlink(conf);
+    rmdir(dir);
+    if (broker < 0) {
+        fprintf(stderr, "%s did not start on port %d\n", binary, port);
+        return 2;
+    }
+
+    // the callbacks log every value, at this rate the console would be measured
+    daemon_log_upto(LOG_WARNING);
+    mqcb_register();
+    for (size_t i = 0; i < TOPICS; i++) {
+        mosq_register_on_message_cb(topics[i], probe_cb);
+    }
+    mosq_set_broker("127.0.0.1", port);
+    mosq_init("bench_mqtt", "bench");
+
+    struct mosquitto *gen = mosquitto_new("bench_mqtt-generator", true, NULL);
+    int res = 2;
+    if (!gen || mosquitto_connect(gen, "127.0.0.1", port, 60) || mosquitto_loop_start(gen)) {
+        fprintf(stderr, "generator can't connect to port %d\n", port);
+        goto out;
+    }
+    // the client is up once a message gets through its subscriptions
+    for (int i = 0; i < 500 && !__atomic_load_n(&untagged, __ATOMIC_RELAXED); i++) {
+        publish(gen, 2, 0, false);
+        usleep(10000);
+    }
+    if (!__atomic_load_n(&untagged, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "mq client did not subscribe\n");
+        goto out;
+    }
+
+    res = 0;
+    uint64_t seq = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            double rate = atof(argv[i]);
+            if (rate > 0) {
+                res |= run_round(gen, broker, &seq, rate, seconds, late_ns);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(default_rates) / sizeof(default_rates[0]); i++) {
+            res |= run_round(gen, broker, &seq, default_rates[i], seconds, late_ns);
+        }
+    }
+
+out:
+    if (gen) {
+        mosquitto_disconnect(gen);
+        mosquitto_loop_stop(gen, false);
+        mosquitto_destroy(gen);
+    }
+    mosq_destroy();
+    kill(broker, SIGTERM);
+    waitpid(broker, NULL, 0);
+    return res;
+}
@@ -0,0 +1,243 @@
+/**
+* @file bench_pixops.c
+*
+* @brief Icon colouring with the old SDL_GetRGBA() loop against the pixel
+* kernels of pixops.c, on the icons in images/. Every implementation the CPU
+* supports is run and its output compared with the old loop, the RGB565
+* conversion is compared with SDL_ConvertSurfaceFormat().
+*
+*/
+#define _GNU_SOURCE
+
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "bench.h"
+#include "pixops.h"
+#include "dfork.h"
+
+#define MAX_IMAGES 64
+#define FRAME_W 800
+#define FRAME_H 480
+
+typedef struct {
+    SDL_Surface *src[MAX_IMAGES];
+    SDL_Surface *dst[MAX_IMAGES];
+    int count;
+    Uint32 color;
+    const pixops_t *ops;
+} icons_ctx_t;
+
+typedef struct {
+    uint32_t a[FRAME_W * FRAME_H];
+    uint32_t b[FRAME_W * FRAME_H];
+    uint32_t out[FRAME_W * FRAME_H];
+    uint16_t out16[FRAME_W * FRAME_H];
+    const pixops_t *ops;
+} frame_ctx_t;
+
+// colorizeSurface() before pixops.c
+static void colorize_reference(const SDL_Surface *surface, SDL_Surface *modifiedSurface, Uint32 color) {
+    int width = surface->w;
+    int height = surface->h;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            Uint32 pixel = ((Uint32 *) surface->pixels)[y * width + x];
+            Uint8 r, g, b, a;
+            SDL_GetRGBA(pixel, surface->format, &r, &g, &b, &a);
+            if (a != 0) {
+                pixel = color;
+            }
+            ((Uint32 *) modifiedSurface->pixels)[y * width + x] = pixel;
+        }
+    }
+}
+
+static void colorize_kernel(const pixops_t *ops, const SDL_Surface *surface, SDL_Surface *modifiedSurface,
+                            Uint32 color) {
+    for (int y = 0; y < surface->h; ++y) {
+        const Uint32 *src = (const Uint32 *) ((const Uint8 *) surface->pixels + y * surface->pitch);
+        Uint32 *dst = (Uint32 *) ((Uint8 *) modifiedSurface->pixels + y * modifiedSurface->pitch);
+        ops->colorize(dst, src, (size_t) surface->w, surface->format->Amask, color);
+    }
+}
+
+static void bench_icons_reference(void *ctx, uint64_t UNUSED(i)) {
+    icons_ctx_t *c = ctx;
+    for (int n = 0; n < c->count; n++) {
+        colorize_reference(c->src[n], c->dst[n], c->color);
+    }
+}
+
+static void bench_icons_kernel(void *ctx, uint64_t UNUSED(i)) {
+    icons_ctx_t *c = ctx;
+    for (int n = 0; n < c->count; n++) {
+        colorize_kernel(c->ops, c->src[n], c->dst[n], c->color);
+    }
+}
+
+static void bench_tint(void *ctx, uint64_t UNUSED(i)) {
+    frame_ctx_t *c = ctx;
+    c->ops->tint(c->out, c->a, FRAME_W * FRAME_H, 0xff80c0ff);
+}
+
+static void bench_lerp(void *ctx, uint64_t i) {
+    frame_ctx_t *c = ctx;
+    c->ops->lerp(c->out, c->a, c->b, FRAME_W * FRAME_H, (unsigned int) (i & 0xff));
+}
+
+static void bench_premultiply(void *ctx, uint64_t UNUSED(i)) {
+    frame_ctx_t *c = ctx;
+    c->ops->premultiply(c->out, c->a, FRAME_W * FRAME_H);
+}
+
+static void bench_rgb565(void *ctx, uint64_t UNUSED(i)) {
+    frame_ctx_t *c = ctx;
+    c->ops->to_rgb565(c->out16, c->a, FRAME_W * FRAME_H, 16, 8, 0);
+}
+
+static bool same_pixels(const SDL_Surface *a, const SDL_Surface *b) {
+    for (int y = 0; y < a->h; y++) {
+        if (memcmp((const Uint8 *) a->pixels + y * a->pitch, (const Uint8 *) b->pixels + y * b->pitch,
+                   (size_t) a->w * a->format->BytesPerPixel) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int load_icons(icons_ctx_t *icons, const char *pattern) {
+    glob_t files;
+    if (glob(pattern, 0, NULL, &files) != 0) {
+        fprintf(stderr, "no images match %s\n", pattern);
+        return -1;
+    }
+    for (size_t i = 0; i < files.gl_pathc && icons->count < MAX_IMAGES; i++) {
+        SDL_Surface *loaded = IMG_Load(files.gl_pathv[i]);
+        if (!loaded) {
+            fprintf(stderr, "IMG_Load: %s\n", IMG_GetError());
+            continue;
+        }
+        // the same conversion img_create() does
+        SDL_Surface *src = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(loaded);
+        if (!src) {
+            continue;
+        }
+        icons->src[icons->count] = src;
+        icons->dst[icons->count] = SDL_CreateRGBSurfaceWithFormat(0, src->w, src->h, 32, SDL_PIXELFORMAT_RGBA32);
+        icons->count++;
+    }
+    globfree(&files);
+    return icons->count ? 0 : -1;
+}
+
+// colour every icon with the reference loop and a kernel, compare
+static int check_icons(icons_ctx_t *icons, const pixops_t *ops) {
+    int res = 0;
+    for (int n = 0; n < icons->count; n++) {
+        SDL_Surface *expected = SDL_CreateRGBSurfaceWithFormat(0, icons->src[n]->w, icons->src[n]->h, 32,
+                                                               SDL_PIXELFORMAT_RGBA32);
+        colorize_reference(icons->src[n], expected, icons->color);
+        colorize_kernel(ops, icons->src[n], icons->dst[n], icons->color);
+        if (!same_pixels(expected, icons->dst[n])) {
+            fprintf(stderr, "%s colorize differs on image %d\n", ops->name, n);
+            res = 1;
+        }
+        SDL_FreeSurface(expected);
+    }
+    return res;
+}
+
+static int check_frame(frame_ctx_t *frame, const pixops_t *ops, SDL_Surface *golden565) {
+    static uint32_t expected[FRAME_W * FRAME_H];
+    const pixops_t *scalar = pixops_available(0);
+    const size_t n = FRAME_W * FRAME_H;
+    int res = 0;
+
+    ops->to_rgb565(frame->out16, frame->a, n, 16, 8, 0);
+    for (int y = 0; y < FRAME_H; y++) {
+        if (memcmp(frame->out16 + y * FRAME_W, (const Uint8 *) golden565->pixels + y * golden565->pitch,
+                   FRAME_W * sizeof(uint16_t)) != 0) {
+            fprintf(stderr, "%s to_rgb565 differs from SDL_ConvertSurfaceFormat\n", ops->name);
+            res = 1;
+            break;
+        }
+    }
+    scalar->tint(expected, frame->a, n, 0xff80c0ff);
+    ops->tint(frame->out, frame->a, n, 0xff80c0ff);
+    if (memcmp(expected, frame->out, sizeof(expected)) != 0) {
+        fprintf(stderr, "%s tint differs from scalar\n", ops->name);
+        res = 1;
+    }
+    scalar->lerp(expected, frame->a, frame->b, n, 77);
+    ops->lerp(frame->out, frame->a, frame->b, n, 77);
+    if (memcmp(expected, frame->out, sizeof(expected)) != 0) {
+        fprintf(stderr, "%s lerp differs from scalar\n", ops->name);
+        res = 1;
+    }
+    scalar->premultiply(expected, frame->a, n);
+    ops->premultiply(frame->out, frame->a, n);
+    if (memcmp(expected, frame->out, sizeof(expected)) != 0) {
+        fprintf(stderr, "%s premultiply differs from scalar\n", ops->name);
+        res = 1;
+    }
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    static icons_ctx_t icons;
+    static frame_ctx_t frame;
+    const char *pattern = argc > 1 ? argv[1] : "images/*.png";
+    char name[64];
+    int res = 0;
+
+    if (SDL_Init(0) != 0 || load_icons(&icons, pattern) != 0) {
+        return 1;
+    }
+    icons.color = SDL_MapRGBA(icons.src[0]->format, 0, 200, 0, 255);
+    printf("%d icons, default kernels: %s\n", icons.count, pixops.name);
+
+    // a frame of icon-like pixels: opaque, transparent and anti-aliased edges
+    srandom(1);
+    for (size_t i = 0; i < FRAME_W * FRAME_H; i++) {
+        frame.a[i] = (uint32_t) random() ^ ((uint32_t) random() << 16);
+        frame.b[i] = (uint32_t) random() ^ ((uint32_t) random() << 16);
+    }
+    SDL_Surface *argb = SDL_CreateRGBSurfaceWithFormatFrom(frame.a, FRAME_W, FRAME_H, 32, FRAME_W * 4,
+                                                           SDL_PIXELFORMAT_ARGB8888);
+    SDL_Surface *golden565 = SDL_ConvertSurfaceFormat(argb, SDL_PIXELFORMAT_RGB565, 0);
+
+    bench_run("colorize icons SDL_GetRGBA loop", 20000, bench_icons_reference, &icons);
+    for (size_t k = 0; (icons.ops = frame.ops = pixops_available(k)); k++) {
+        res |= check_icons(&icons, icons.ops);
+        res |= check_frame(&frame, frame.ops, golden565);
+
+        snprintf(name, sizeof(name), "colorize icons %s", icons.ops->name);
+        bench_run(name, 20000, bench_icons_kernel, &icons);
+        snprintf(name, sizeof(name), "tint %dx%d %s", FRAME_W, FRAME_H, frame.ops->name);
+        bench_run(name, 200, bench_tint, &frame);
+        snprintf(name, sizeof(name), "lerp %dx%d %s", FRAME_W, FRAME_H, frame.ops->name);
+        bench_run(name, 200, bench_lerp, &frame);
+        snprintf(name, sizeof(name), "premultiply %dx%d %s", FRAME_W, FRAME_H, frame.ops->name);
+        bench_run(name, 200, bench_premultiply, &frame);
+        snprintf(name, sizeof(name), "to_rgb565 %dx%d %s", FRAME_W, FRAME_H, frame.ops->name);
+        bench_run(name, 200, bench_rgb565, &frame);
+    }
+
+    SDL_FreeSurface(golden565);
+    SDL_FreeSurface(argb);
+    for (int n = 0; n < icons.count; n++) {
+        SDL_FreeSurface(icons.src[n]);
+        SDL_FreeSurface(icons.dst[n]);
+    }
+    SDL_Quit();
+    if (res) {
+        fprintf(stderr, "pixel kernels differ from the reference\n");
+    }
+    return res;
+}
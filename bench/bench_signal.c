@@ -0,0 +1,85 @@
+/**
+* @file bench_signal.c
+*
+* @brief Signals through dsignal: one at a time as SIGHUP and SIGUSR2 reach
+* the app, and in bursts of queued real time signals, sent and then taken
+* with daemon_signal_next() until none is left.
+*
+* The read() syscalls per signal come from syscr of /proc/self/io, the
+* sender of the last one is checked to be this process.
+*/
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "dsignal.h"
+#include "dfork.h"
+
+#define BURST 64
+
+static unsigned long long read_syscalls(void) {
+    unsigned long long syscr = 0;
+    char line[128];
+    FILE *f = fopen("/proc/self/io", "re");
+    while (f && fgets(line, sizeof(line), f)) {
+        sscanf(line, "syscr: %llu", &syscr);
+    }
+    if (f) {
+        fclose(f);
+    }
+    return syscr;
+}
+
+static void bench_single(void *UNUSED(ctx), uint64_t UNUSED(i)) {
+    struct pollfd pfd = {daemon_signal_fd(), POLLIN, 0};
+    kill(getpid(), SIGUSR2);
+    poll(&pfd, 1, 100);
+    while (daemon_signal_next() > 0) {
+    }
+}
+
+static void bench_burst(void *UNUSED(ctx), uint64_t UNUSED(i)) {
+    struct pollfd pfd = {daemon_signal_fd(), POLLIN, 0};
+    union sigval value = {0};
+    for (int n = 0; n < BURST; n++) {
+        sigqueue(getpid(), SIGRTMIN, value);
+    }
+    poll(&pfd, 1, 100);
+    while (daemon_signal_next() > 0) {
+    }
+}
+
+static void bench_reads(const char *name, bench_fn_t fn, int iters, int signals) {
+    char label[80];
+    unsigned long long syscr = read_syscalls();
+    bench_run(name, (uint64_t) iters, fn, NULL);
+    // bench_run() warms up with iters / 10 + 1 before the timed iters
+    double reads = (double) (read_syscalls() - syscr) / ((double) (iters + iters / 10 + 1) * signals);
+    printf("%-40s %12.2f read syscalls/signal\n", "", reads);
+    snprintf(label, sizeof(label), "%s read syscalls", name);
+    bench_metric(label, reads, "syscalls");
+}
+
+int main(void) {
+    if (daemon_signal_init(SIGUSR2, SIGRTMIN, 0) < 0) {
+        return 1;
+    }
+
+    bench_reads("signal kill+poll+next", bench_single, 100000, 1);
+    bench_reads("signal burst of 64 queued", bench_burst, 10000, BURST);
+
+    daemon_signal_info_t info;
+    kill(getpid(), SIGUSR2);
+    if (daemon_signal_next_info(&info) != SIGUSR2 || info.pid != getpid() || info.uid != getuid()) {
+        fprintf(stderr, "signal %d from pid %d uid %d, expected SIGUSR2 from %d\n", info.signo, (int) info.pid,
+                (int) info.uid, (int) getpid());
+        return 1;
+    }
+    printf("%-40s %12s pid %d uid %d\n", "signal sender", "", (int) info.pid, (int) info.uid);
+    daemon_signal_done();
+    return 0;
+}
@@ -0,0 +1,137 @@
+/**
+* @file bench_spawn.c
+*
+* @brief Starting a command the ways superclock did and does: system(),
+* daemon_exec() with fork(), daemon_spawn_run() and daemon_spawn() with
+* posix_spawn().
+*
+* Each runs /bin/true, then seq printing 200 lines for the output capture,
+* first as this small process and then with 64 MiB resident like the app
+* with its textures, where fork() copies the page tables. The read()
+* syscalls per command come from syscr of /proc/self/io.
+*/
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "dexec.h"
+#include "dlog.h"
+#include "dsignal.h"
+#include "dspawn.h"
+#include "dfork.h"
+
+#define RESIDENT (64 * 1024 * 1024)
+
+typedef struct {
+    const char *command;
+    char *const *args;
+} spawn_ctx_t;
+
+static unsigned long long read_syscalls(void) {
+    unsigned long long syscr = 0;
+    char line[128];
+    FILE *f = fopen("/proc/self/io", "re");
+    while (f && fgets(line, sizeof(line), f)) {
+        sscanf(line, "syscr: %llu", &syscr);
+    }
+    if (f) {
+        fclose(f);
+    }
+    return syscr;
+}
+
+static void bench_system(void *ctx, uint64_t UNUSED(i)) {
+    spawn_ctx_t *c = ctx;
+    if (system(c->command) < 0) {
+        perror("system");
+    }
+}
+
+static void bench_exec(void *ctx, uint64_t UNUSED(i)) {
+    spawn_ctx_t *c = ctx;
+    int ret;
+    if (c->args[1]) {
+        daemon_exec(NULL, &ret, c->args[0], c->args[0], c->args[1], c->args[2], (char *) NULL);
+    } else {
+        daemon_exec(NULL, &ret, c->args[0], c->args[0], (char *) NULL);
+    }
+}
+
+static void bench_spawn_run(void *ctx, uint64_t UNUSED(i)) {
+    spawn_ctx_t *c = ctx;
+    int ret;
+    daemon_spawn_run(NULL, &ret, c->args);
+}
+
+static void done(pid_t UNUSED(pid), int UNUSED(status), void *userdata) {
+    (*(int *) userdata)++;
+}
+
+// started and waited for in a poll loop, as the main loop of a daemon would
+static void bench_spawn_async(void *ctx, uint64_t UNUSED(i)) {
+    spawn_ctx_t *c = ctx;
+    int finished = 0;
+    if (daemon_spawnv(NULL, c->args, NULL, done, &finished) < 0) {
+        return;
+    }
+    while (!finished) {
+        struct pollfd pfd = {daemon_spawn_fd(), POLLIN, 0};
+        poll(&pfd, 1, 100);
+        daemon_spawn_dispatch();
+    }
+}
+
+static void bench_command(const char *name, const char *suffix, spawn_ctx_t *c, bench_fn_t fn, int iters) {
+    char label[80];
+    unsigned long long syscr = read_syscalls();
+    snprintf(label, sizeof(label), "%s %s%s", name, c->command, suffix);
+    bench_run(label, (uint64_t) iters, fn, c);
+    // bench_run() warms up with iters / 10 + 1 before the timed iters
+    double reads = (double) (read_syscalls() - syscr) / (double) (iters + iters / 10 + 1);
+    printf("%-40s %12.1f read syscalls/command\n", "", reads);
+    snprintf(label, sizeof(label), "%s %s%s read syscalls", name, c->command, suffix);
+    bench_metric(label, reads, "syscalls");
+}
+
+static void bench_commands(const char *suffix) {
+    char *const true_args[] = {(char *) "/bin/true", NULL};
+    char *const seq_args[] = {(char *) "/usr/bin/seq", (char *) "1", (char *) "200", NULL};
+    spawn_ctx_t commands[] = {{"/bin/true", true_args}, {"/usr/bin/seq 1 200", seq_args}};
+
+    for (size_t n = 0; n < sizeof(commands) / sizeof(commands[0]); n++) {
+        spawn_ctx_t *c = &commands[n];
+        if (n == 0) {
+            bench_command("system", suffix, c, bench_system, 200);
+        }
+        bench_command("daemon_exec", suffix, c, bench_exec, 200);
+        bench_command("daemon_spawn_run", suffix, c, bench_spawn_run, 200);
+        bench_command("daemon_spawn", suffix, c, bench_spawn_async, 200);
+    }
+}
+
+int main(void) {
+    // daemon_exec() wants the signal pipe, the output lines are not of interest
+    daemon_signal_init(SIGCHLD, 0);
+    unsigned int prio = daemon_log_upto(LOG_WARNING);
+
+    bench_commands("");
+    char *resident = malloc(RESIDENT);
+    if (resident) {
+        memset(resident, 1, RESIDENT);
+        bench_commands(", 64 MiB resident");
+        free(resident);
+    }
+
+    daemon_spawn_stats_t stats;
+    daemon_spawn_stats(&stats);
+    printf("%-40s %12lu spawned %6lu reads %8lu bytes %6lu lines\n", "daemon_spawn", (unsigned long) stats.spawned,
+           (unsigned long) stats.reads, (unsigned long) stats.bytes, (unsigned long) stats.lines);
+    daemon_log_upto(prio);
+    daemon_signal_done();
+    return 0;
+}
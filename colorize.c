@@ -0,0 +1,54 @@
+/**
+* @file colorize.c
+*
+* @brief Colouring of the icons by their alpha mask.
+*
+*/
+#include <SDL2/SDL.h>
+
+#include "colorize.h"
+#include "pixops.h"
+
+// RGB565 panels get the icon as a colour keyed RGB565 surface, half the bytes to compose.
+static SDL_Surface *colorize_rgb565(const SDL_Surface *surface, SDL_Color c) {
+    SDL_Surface *modifiedSurface = SDL_CreateRGBSurfaceWithFormat(0, surface->w, surface->h, 16,
+                                                                  SDL_PIXELFORMAT_RGB565);
+    if (!modifiedSurface) {
+        return NULL;
+    }
+    Uint16 color = (Uint16) SDL_MapRGB(modifiedSurface->format, c.r, c.g, c.b);
+    Uint16 key = color ^ 1;
+    for (int y = 0; y < surface->h; ++y) {
+        const Uint32 *src = (const Uint32 *) ((const Uint8 *) surface->pixels + y * surface->pitch);
+        Uint16 *dst = (Uint16 *) ((Uint8 *) modifiedSurface->pixels + y * modifiedSurface->pitch);
+        pixops.colorize_rgb565(dst, src, (size_t) surface->w, surface->format->Amask, color, key);
+    }
+    SDL_SetColorKey(modifiedSurface, SDL_TRUE, key);
+    return modifiedSurface;
+}
+
+SDL_Surface *colorize_surface(const SDL_Surface *surface, SDL_Color c, Uint32 format) {
+    if (!surface) {
+        return NULL;
+    } else if (format == SDL_PIXELFORMAT_RGB565) {
+        return colorize_rgb565(surface, c);
+    } else {
+        int width = surface->w;
+        int height = surface->h;
+
+        SDL_Surface *modifiedSurface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+        if (!modifiedSurface) {
+            return NULL;
+        }
+
+        Uint32 color = SDL_MapRGBA(surface->format, c.r, c.g, c.b, c.a);
+
+        for (int y = 0; y < height; ++y) {
+            const Uint32 *src = (const Uint32 *) ((const Uint8 *) surface->pixels + y * surface->pitch);
+            Uint32 *dst = (Uint32 *) ((Uint8 *) modifiedSurface->pixels + y * modifiedSurface->pitch);
+            pixops.colorize(dst, src, (size_t) width, surface->format->Amask, color);
+        }
+
+        return modifiedSurface;
+    }
+}
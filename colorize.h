@@ -0,0 +1,20 @@
+/**
+* @file colorize.h
+*
+* @brief Colouring of the icons by their alpha mask.
+*
+* The icons are white shapes on transparent pixels, a widget shows one in the
+* colour of its state. The source is a 32 bit surface with an alpha channel.
+*/
+#ifndef SUPER_CLOCK_COLORIZE_H
+#define SUPER_CLOCK_COLORIZE_H
+
+#include <SDL2/SDL.h>
+
+/** New surface with the pixels having any alpha in colour c, transparent ones copied unchanged.
+ * For SDL_PIXELFORMAT_RGB565 the result is a colour keyed RGB565 surface, RGBA32 otherwise.
+ * @return NULL if surface is NULL or the new surface can't be created
+ */
+SDL_Surface *colorize_surface(const SDL_Surface *surface, SDL_Color c, Uint32 format);
+
+#endif //SUPER_CLOCK_COLORIZE_H
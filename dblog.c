@@ -0,0 +1,742 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "dblog.h"
+#include "dlog.h"
+
+/* File layout: the header page, the string table and the ring. A record never
+ * crosses a 4 KiB block of the ring, the rest of a block too short for the
+ * next record is filled by a pad record, so a reader can start at any block.
+ * The stamp of a record, written last, is derived from its position: a record
+ * in flight or left over from the previous lap does not match and the reader
+ * skips to the next block. */
+
+#define BLOG_MAGIC "SCBLOG1\n"
+#define BLOG_VERSION 1
+#define BLOG_BLOCK 4096
+#define BLOG_HEADER 4096
+#define BLOG_STRINGS (64 * 1024)
+#define BLOG_MAX_FORMATS 1024
+#define BLOG_MAX_ARGS 16
+#define BLOG_MAX_STRING 128
+#define BLOG_MAX_RECORD 1024
+#define BLOG_PAD 0xffff
+// format 0 is "%s", the record of a message formatted on the calling thread
+#define BLOG_TEXT 0
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block;
+    uint64_t ring_size;
+    // bytes ever reserved in the ring, the position of the next record
+    uint64_t head;
+    uint32_t strings_size;
+    uint32_t strings_used;
+    uint32_t formats;
+    uint32_t reserved;
+} blog_header_t;
+
+typedef struct {
+    uint32_t stamp;
+    uint16_t len;
+    uint16_t format;
+    // CLOCK_REALTIME
+    uint64_t time_ns;
+    uint32_t tid;
+    uint8_t prio;
+    uint8_t reserved[3];
+} blog_record_t;
+
+typedef struct {
+    uint16_t id;
+    uint16_t len;
+} blog_string_t;
+
+typedef enum {
+    BLOG_INT,
+    BLOG_UINT,
+    BLOG_LONG,
+    BLOG_ULONG,
+    BLOG_LLONG,
+    BLOG_ULLONG,
+    BLOG_INTMAX,
+    BLOG_SIZE,
+    BLOG_PTRDIFF,
+    BLOG_DOUBLE,
+    BLOG_LDOUBLE,
+    BLOG_STR,
+    BLOG_PTR,
+    BLOG_ERRNO,
+} blog_arg_t;
+
+typedef struct {
+    const char *template;
+    uint16_t id;
+    // -1 if the arguments can't be stored
+    int8_t argc;
+    uint8_t types[BLOG_MAX_ARGS];
+} blog_format_t;
+
+static struct {
+    uint8_t *map;
+    size_t map_size;
+    blog_header_t *header;
+    // threads in blog_sink(), the mapping stays until they are out
+    int users;
+    blog_format_t formats[BLOG_MAX_FORMATS * 2];
+    int slots;
+    enum daemon_log_flags text_use;
+    bool switched;
+} blog = {0};
+
+static pthread_mutex_t blog_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+extern char __executable_start[];
+extern char __data_start[];
+
+static unsigned long blog_tid(void) {
+    static __thread unsigned long tid = 0;
+    if (!tid) {
+        tid = (unsigned long) syscall(SYS_gettid);
+    }
+    return tid;
+}
+
+static uint8_t *blog_ring(blog_header_t *h) {
+    return (uint8_t *) h + BLOG_HEADER + BLOG_STRINGS;
+}
+
+static uint32_t blog_stamp(uint64_t pos) {
+    return (uint32_t) (pos >> 3) + 1;
+}
+
+/* Argument types of the conversions of fmt in call order, '*' width and
+ * precision included. Returns -1 for what the sink does not store. */
+static int blog_parse(const char *fmt, uint8_t *types) {
+    int argc = 0;
+    for (const char *p = fmt; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        p++;
+        if (*p == '%') {
+            continue;
+        }
+        while (*p && strchr("-+ #0'I", *p)) {
+            p++;
+        }
+        for (int part = 0; part < 2; part++) {
+            if (*p == '*') {
+                if (argc == BLOG_MAX_ARGS) {
+                    return -1;
+                }
+                types[argc++] = BLOG_INT;
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    p++;
+                }
+            }
+            if (*p == '$') {
+                return -1;
+            }
+            if (part == 0 && *p == '.') {
+                p++;
+            } else {
+                break;
+            }
+        }
+        int longs = 0;
+        char size = 0;
+        for (; *p && strchr("hlqLjzZt", *p); p++) {
+            if (*p == 'l') {
+                longs++;
+            } else if (*p == 'q') {
+                longs = 2;
+            } else if (*p != 'h') {
+                size = *p;
+            }
+        }
+        blog_arg_t type;
+        switch (*p) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X': {
+                bool is_signed = *p == 'd' || *p == 'i';
+                if (size == 'j') {
+                    type = BLOG_INTMAX;
+                } else if (size == 'z' || size == 'Z') {
+                    type = BLOG_SIZE;
+                } else if (size == 't') {
+                    type = BLOG_PTRDIFF;
+                } else if (longs >= 2 || size == 'L') {
+                    type = is_signed ? BLOG_LLONG : BLOG_ULLONG;
+                } else if (longs == 1) {
+                    type = is_signed ? BLOG_LONG : BLOG_ULONG;
+                } else {
+                    type = is_signed ? BLOG_INT : BLOG_UINT;
+                }
+                break;
+            }
+            case 'c':
+                if (longs) {
+                    return -1;
+                }
+                type = BLOG_INT;
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                type = size == 'L' ? BLOG_LDOUBLE : BLOG_DOUBLE;
+                break;
+            case 's':
+                if (longs) {
+                    return -1;
+                }
+                type = BLOG_STR;
+                break;
+            case 'p':
+                type = BLOG_PTR;
+                break;
+            case 'm':
+                type = BLOG_ERRNO;
+                break;
+            default:
+                return -1;
+        }
+        if (argc == BLOG_MAX_ARGS) {
+            return -1;
+        }
+        types[argc++] = (uint8_t) type;
+    }
+    return argc;
+}
+
+static size_t blog_hash(const char *template) {
+    return (size_t) (((uintptr_t) template >> 3) * 0x9E3779B97F4A7C15ULL >> 32) % (BLOG_MAX_FORMATS * 2);
+}
+
+// Append the format to the string table, called with blog_mtx held
+static bool blog_string_add(blog_header_t *h, const char *template, uint16_t id) {
+    size_t len = strlen(template);
+    size_t size = (sizeof(blog_string_t) + len + 1 + 3) & ~(size_t) 3;
+    if (len > UINT16_MAX || h->strings_used + size > h->strings_size) {
+        return false;
+    }
+    uint8_t *p = (uint8_t *) h + BLOG_HEADER + h->strings_used;
+    blog_string_t s = {id, (uint16_t) len};
+    memcpy(p, &s, sizeof(s));
+    memcpy(p + sizeof(s), template, len + 1);
+    __atomic_store_n(&h->strings_used, h->strings_used + (uint32_t) size, __ATOMIC_RELEASE);
+    return true;
+}
+
+// The id of a format already in the table from an earlier run, -1 if there is none
+static int blog_string_find(blog_header_t *h, const char *template) {
+    const uint8_t *strings = (const uint8_t *) h + BLOG_HEADER;
+    size_t len = strlen(template);
+    for (uint32_t off = 0; off + sizeof(blog_string_t) <= h->strings_used;) {
+        blog_string_t s;
+        memcpy(&s, strings + off, sizeof(s));
+        if (s.len == len && s.id < h->formats && memcmp(strings + off + sizeof(s), template, len + 1) == 0) {
+            return s.id;
+        }
+        off += (uint32_t) ((sizeof(s) + s.len + 1 + 3) & ~(size_t) 3);
+    }
+    return -1;
+}
+
+static const blog_format_t *blog_format(blog_header_t *h, const char *template) {
+    size_t i = blog_hash(template);
+    const char *t;
+    while ((t = __atomic_load_n(&blog.formats[i].template, __ATOMIC_ACQUIRE)) != NULL) {
+        if (t == template) {
+            return &blog.formats[i];
+        }
+        i = (i + 1) % (BLOG_MAX_FORMATS * 2);
+    }
+
+    pthread_mutex_lock(&blog_mtx);
+    i = blog_hash(template);
+    while (blog.formats[i].template && blog.formats[i].template != template) {
+        i = (i + 1) % (BLOG_MAX_FORMATS * 2);
+    }
+    blog_format_t *f = &blog.formats[i];
+    if (!f->template) {
+        if (blog.slots == BLOG_MAX_FORMATS) {
+            pthread_mutex_unlock(&blog_mtx);
+            return NULL;
+        }
+        f->argc = (int8_t) blog_parse(template, f->types);
+        int id = f->argc >= 0 ? blog_string_find(h, template) : -1;
+        if (id >= 0) {
+            f->id = (uint16_t) id;
+        } else if (f->argc >= 0) {
+            f->id = (uint16_t) h->formats;
+            if (blog_string_add(h, template, f->id)) {
+                h->formats++;
+            } else {
+                f->argc = -1;
+            }
+        }
+        blog.slots++;
+        __atomic_store_n(&f->template, template, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&blog_mtx);
+    return f;
+}
+
+// The string cut to the room left, 0 if not even its length fits
+static size_t blog_put_string(uint8_t *p, size_t room, const char *s) {
+    if (room < 2) {
+        return 0;
+    }
+    if (!s) {
+        s = "(null)";
+    }
+    size_t len = strnlen(s, BLOG_MAX_STRING);
+    if (len + 2 > room) {
+        len = room - 2;
+    }
+    uint16_t len16 = (uint16_t) len;
+    memcpy(p, &len16, 2);
+    memcpy(p + 2, s, len);
+    return len + 2;
+}
+
+// Arguments as 8 byte values, strings as a 16 bit length and the bytes
+static size_t blog_put_args(uint8_t *p, size_t room, const blog_format_t *f, va_list arglist, int saved_errno) {
+    size_t n = 0;
+    for (int i = 0; i < f->argc; i++) {
+        int64_t v = 0;
+        double d;
+        // n never passes room, the record ends at the first argument that does not fit
+        if (f->types[i] == BLOG_STR) {
+            size_t len = blog_put_string(p + n, room - n, va_arg(arglist, const char *));
+            if (len == 0) {
+                return n;
+            }
+            n += len;
+            continue;
+        }
+        if (room - n < 8) {
+            return n;
+        }
+        switch (f->types[i]) {
+            case BLOG_INT:
+                v = va_arg(arglist, int);
+                break;
+            case BLOG_UINT:
+                v = (int64_t) va_arg(arglist, unsigned int);
+                break;
+            case BLOG_LONG:
+                v = va_arg(arglist, long);
+                break;
+            case BLOG_ULONG:
+                v = (int64_t) va_arg(arglist, unsigned long);
+                break;
+            case BLOG_LLONG:
+                v = va_arg(arglist, long long);
+                break;
+            case BLOG_ULLONG:
+                v = (int64_t) va_arg(arglist, unsigned long long);
+                break;
+            case BLOG_INTMAX:
+                v = (int64_t) va_arg(arglist, intmax_t);
+                break;
+            case BLOG_SIZE:
+                v = (int64_t) va_arg(arglist, size_t);
+                break;
+            case BLOG_PTRDIFF:
+                v = (int64_t) va_arg(arglist, ptrdiff_t);
+                break;
+            case BLOG_DOUBLE:
+                d = va_arg(arglist, double);
+                memcpy(&v, &d, 8);
+                break;
+            case BLOG_LDOUBLE:
+                d = (double) va_arg(arglist, long double);
+                memcpy(&v, &d, 8);
+                break;
+            case BLOG_PTR:
+                v = (int64_t) (uintptr_t) va_arg(arglist, void *);
+                break;
+            case BLOG_ERRNO:
+                v = saved_errno;
+                break;
+        }
+        memcpy(p + n, &v, 8);
+        n += 8;
+    }
+    return n;
+}
+
+// Reserve len bytes in the ring, a pad record fills the end of a block the record does not fit in
+static uint64_t blog_reserve(blog_header_t *h, size_t len) {
+    uint64_t head = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+    uint64_t pad, next;
+    do {
+        uint64_t off = head % BLOG_BLOCK;
+        pad = off + len > BLOG_BLOCK ? BLOG_BLOCK - off : 0;
+        next = head + pad + len;
+    } while (!__atomic_compare_exchange_n(&h->head, &head, next, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    if (pad) {
+        blog_record_t *r = (blog_record_t *) (blog_ring(h) + head % h->ring_size);
+        r->len = (uint16_t) pad;
+        r->format = BLOG_PAD;
+        __atomic_store_n(&r->stamp, blog_stamp(head), __ATOMIC_RELEASE);
+    }
+    return head + pad;
+}
+
+static void blog_sink(int prio, const char *template, va_list arglist) {
+    int saved_errno = errno;
+    uint8_t buf[BLOG_MAX_RECORD];
+    blog_record_t *r = (blog_record_t *) buf;
+    struct timespec ts;
+    size_t n;
+
+    // daemon_blog_close() clears the header first, then waits for the users to leave
+    __atomic_add_fetch(&blog.users, 1, __ATOMIC_SEQ_CST);
+    blog_header_t *h = __atomic_load_n(&blog.header, __ATOMIC_SEQ_CST);
+    if (!h) {
+        __atomic_sub_fetch(&blog.users, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    const blog_format_t *f = NULL;
+    if (template >= __executable_start && template < __data_start) {
+        f = blog_format(h, template);
+    }
+    if (f && f->argc >= 0) {
+        r->format = f->id;
+        n = blog_put_args(buf + sizeof(blog_record_t), sizeof(buf) - sizeof(blog_record_t), f, arglist,
+                          saved_errno);
+    } else {
+        // a format built at run time, stored as text
+        char text[BLOG_MAX_STRING * 2];
+        vsnprintf(text, sizeof(text), template, arglist);
+        r->format = BLOG_TEXT;
+        n = blog_put_string(buf + sizeof(blog_record_t), sizeof(buf) - sizeof(blog_record_t), text);
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    size_t len = (sizeof(blog_record_t) + n + 7) & ~(size_t) 7;
+    r->len = (uint16_t) len;
+    r->time_ns = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+    r->tid = (uint32_t) blog_tid();
+    r->prio = (uint8_t) prio;
+
+    uint64_t pos = blog_reserve(h, len);
+    uint8_t *dst = blog_ring(h) + pos % h->ring_size;
+    memcpy(dst + sizeof(uint32_t), buf + sizeof(uint32_t), len - sizeof(uint32_t));
+    __atomic_store_n((uint32_t *) dst, blog_stamp(pos), __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&blog.users, 1, __ATOMIC_SEQ_CST);
+    errno = saved_errno;
+}
+
+int daemon_blog_open(const char *path, size_t ring_size) {
+    ring_size = ring_size ? (ring_size + BLOG_BLOCK - 1) / BLOG_BLOCK * BLOG_BLOCK : DAEMON_BLOG_DEFAULT_SIZE;
+    size_t size = BLOG_HEADER + BLOG_STRINGS + ring_size;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    blog_header_t old = {0};
+    bool keep = pread(fd, &old, sizeof(old), 0) == sizeof(old) && memcmp(old.magic, BLOG_MAGIC, 8) == 0 &&
+                old.version == BLOG_VERSION && old.ring_size == ring_size;
+    if ((!keep && ftruncate(fd, 0) < 0) || ftruncate(fd, (off_t) size) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    daemon_blog_close();
+    pthread_mutex_lock(&blog_mtx);
+    blog_header_t *h = (blog_header_t *) map;
+    if (!keep) {
+        memcpy(h->magic, BLOG_MAGIC, 8);
+        h->version = BLOG_VERSION;
+        h->block = BLOG_BLOCK;
+        h->ring_size = ring_size;
+        h->strings_size = BLOG_STRINGS;
+    }
+    blog.map = map;
+    blog.map_size = size;
+    memset(blog.formats, 0, sizeof(blog.formats));
+    blog.slots = 0;
+    // the formats of an earlier run stay in the table, this run reuses those with the same text
+    if (!keep) {
+        static const char text[] = "%s";
+        blog_string_add(h, text, BLOG_TEXT);
+        h->formats = 1;
+    }
+    __atomic_store_n(&blog.header, h, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&blog_mtx);
+    daemon_log_set_binary(blog_sink);
+    return 0;
+}
+
+void daemon_blog_close(void) {
+    daemon_log_set_binary(NULL);
+    // a thread that got the sink before it was uninstalled may still be writing
+    __atomic_store_n(&blog.header, NULL, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&blog.users, __ATOMIC_SEQ_CST)) {
+        usleep(100);
+    }
+    pthread_mutex_lock(&blog_mtx);
+    if (blog.map) {
+        msync(blog.map, blog.map_size, MS_ASYNC);
+        munmap(blog.map, blog.map_size);
+    }
+    blog.map = NULL;
+    pthread_mutex_unlock(&blog_mtx);
+}
+
+bool daemon_blog_switch(void) {
+    enum daemon_log_flags text = DAEMON_LOG_TEXT;
+    if (!blog.switched) {
+        blog.text_use = daemon_log_use & text;
+        daemon_log_use = (daemon_log_use & ~text) | DAEMON_LOG_BINARY;
+    } else {
+        daemon_log_use = (daemon_log_use & ~DAEMON_LOG_BINARY) | blog.text_use;
+    }
+    blog.switched = !blog.switched;
+    return blog.switched;
+}
+
+// Print one conversion spec with the stored argument(s), p points past them on return
+static int blog_render_spec(char *out, size_t size, const char *spec, const uint8_t *types,
+                            const uint8_t **p, const uint8_t *end) {
+    int stars[2], nstars = 0;
+    int64_t v = 0;
+    double d;
+    char str[BLOG_MAX_STRING + 1];
+    int t = 0;
+
+    for (const char *s = spec; *s; s++) {
+        if (*s == '*') {
+            if (*p + 8 > end) {
+                return -1;
+            }
+            memcpy(&v, *p, 8);
+            *p += 8;
+            stars[nstars++] = (int) v;
+            t++;
+        }
+    }
+    blog_arg_t type = (blog_arg_t) types[t];
+    if (type == BLOG_STR) {
+        uint16_t len;
+        if (*p + 2 > end) {
+            return -1;
+        }
+        memcpy(&len, *p, 2);
+        if (*p + 2 + len > end || len > BLOG_MAX_STRING) {
+            return -1;
+        }
+        memcpy(str, *p + 2, len);
+        str[len] = 0;
+        *p += 2 + len;
+    } else {
+        if (*p + 8 > end) {
+            return -1;
+        }
+        memcpy(&v, *p, 8);
+        *p += 8;
+    }
+    memcpy(&d, &v, 8);
+
+#define BLOG_PRINT(value) \
+    (nstars == 2 ? snprintf(out, size, spec, stars[0], stars[1], value) : \
+     nstars == 1 ? snprintf(out, size, spec, stars[0], value) : snprintf(out, size, spec, value))
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    switch (type) {
+        case BLOG_INT:
+            return BLOG_PRINT((int) v);
+        case BLOG_UINT:
+            return BLOG_PRINT((unsigned int) v);
+        case BLOG_LONG:
+            return BLOG_PRINT((long) v);
+        case BLOG_ULONG:
+            return BLOG_PRINT((unsigned long) v);
+        case BLOG_LLONG:
+            return BLOG_PRINT((long long) v);
+        case BLOG_ULLONG:
+            return BLOG_PRINT((unsigned long long) v);
+        case BLOG_INTMAX:
+            return BLOG_PRINT((intmax_t) v);
+        case BLOG_SIZE:
+            return BLOG_PRINT((size_t) v);
+        case BLOG_PTRDIFF:
+            return BLOG_PRINT((ptrdiff_t) v);
+        case BLOG_DOUBLE:
+            return BLOG_PRINT(d);
+        case BLOG_LDOUBLE:
+            return BLOG_PRINT((long double) d);
+        case BLOG_STR:
+            return BLOG_PRINT(str);
+        case BLOG_PTR:
+            return BLOG_PRINT((void *) (uintptr_t) v);
+        case BLOG_ERRNO:
+            errno = (int) v;
+            return snprintf(out, size, spec, 0);
+    }
+#pragma GCC diagnostic pop
+#undef BLOG_PRINT
+    return -1;
+}
+
+// The text of a record, a damaged one renders as far as its arguments go
+static void blog_render(char *out, size_t size, const char *fmt, const uint8_t *args, const uint8_t *end) {
+    uint8_t types[BLOG_MAX_ARGS];
+    size_t n = 0;
+    int argi = 0;
+    int argc = blog_parse(fmt, types);
+    if (argc < 0) {
+        snprintf(out, size, "%s", fmt);
+        return;
+    }
+    for (const char *p = fmt; *p && n + 1 < size;) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+        // the spec runs to the conversion character
+        const char *start = p++;
+        while (*p && !strchr("diouxXcsSeEfFgGaApmn", *p)) {
+            p++;
+        }
+        char spec[64];
+        size_t spec_len = (size_t) (p - start) + 1;
+        if (!*p || spec_len >= sizeof(spec)) {
+            break;
+        }
+        memcpy(spec, start, spec_len);
+        spec[spec_len] = 0;
+        p++;
+        int stars = 0;
+        for (size_t i = 0; i < spec_len; i++) {
+            stars += spec[i] == '*';
+        }
+        if (argi + stars >= argc) {
+            break;
+        }
+        int len = blog_render_spec(out + n, size - n, spec, types + argi, &args, end);
+        if (len < 0) {
+            break;
+        }
+        argi += stars + 1;
+        n += (size_t) len < size - n ? (size_t) len : size - n - 1;
+    }
+    out[n] = 0;
+}
+
+long daemon_blog_dump(const char *path, FILE *out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < BLOG_HEADER + BLOG_STRINGS) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    blog_header_t h;
+    memcpy(&h, map, sizeof(h));
+    if (memcmp(h.magic, BLOG_MAGIC, 8) != 0 || h.version != BLOG_VERSION || h.block != BLOG_BLOCK ||
+        h.ring_size % BLOG_BLOCK || BLOG_HEADER + (uint64_t) h.strings_size + h.ring_size > (uint64_t) st.st_size ||
+        h.strings_used > h.strings_size) {
+        munmap(map, (size_t) st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    const char ** formats = calloc(h.formats ? h.formats : 1, sizeof(char *));
+    for (uint32_t off = 0; formats && off + sizeof(blog_string_t) <= h.strings_used;) {
+        blog_string_t s;
+        memcpy(&s, map + BLOG_HEADER + off, sizeof(s));
+        if (off + sizeof(s) + s.len + 1 > h.strings_used) {
+            break;
+        }
+        if (s.id < h.formats) {
+            formats[s.id] = (const char *) map + BLOG_HEADER + off + sizeof(s);
+        }
+        off += (uint32_t) ((sizeof(s) + s.len + 1 + 3) & ~(size_t) 3);
+    }
+
+    const uint8_t *ring = map + BLOG_HEADER + h.strings_size;
+    // the block of head is partly overwritten, the oldest whole block follows it
+    uint64_t pos = h.head > h.ring_size ? h.head / BLOG_BLOCK * BLOG_BLOCK + BLOG_BLOCK - h.ring_size : 0;
+    long count = 0;
+    char text[2048];
+    while (formats && pos < h.head) {
+        blog_record_t r = {0};
+        uint64_t next_block = (pos / BLOG_BLOCK + 1) * BLOG_BLOCK;
+        // a pad record at the end of a block may be shorter than a record header
+        memcpy(&r, ring + pos % h.ring_size, next_block - pos < sizeof(r) ? next_block - pos : sizeof(r));
+        if (r.stamp != blog_stamp(pos) || r.len < 8 || r.len % 8 || pos + r.len > next_block) {
+            pos = next_block;
+            continue;
+        }
+        if (r.format == BLOG_PAD || r.len < sizeof(r)) {
+            pos += r.len;
+            continue;
+        }
+        const uint8_t *args = ring + pos % h.ring_size + sizeof(r);
+        if (r.format < h.formats && formats[r.format]) {
+            blog_render(text, sizeof(text), formats[r.format], args, args + r.len - sizeof(r));
+        } else {
+            snprintf(text, sizeof(text), "<unknown format %u>", r.format);
+        }
+        time_t sec = (time_t) (r.time_ns / 1000000000ULL);
+        struct tm tm;
+        char time_buffer[32];
+        localtime_r(&sec, &tm);
+        strftime(time_buffer, sizeof(time_buffer), "%F %T", &tm);
+        fprintf(out, "%s.%06lu %s [%05u] %s\n", time_buffer, (unsigned long) (r.time_ns % 1000000000ULL / 1000),
+                daemon_prio_name(r.prio), r.tid, text);
+        count++;
+        pos += r.len;
+    }
+    free(formats);
+    munmap(map, (size_t) st.st_size);
+    return count;
+}
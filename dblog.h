@@ -0,0 +1,53 @@
+#ifndef foodaemonbloghfoo
+#define foodaemonbloghfoo
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file
+ *
+ * Binary log sink. With DAEMON_LOG_BINARY in daemon_log_use a daemon_log()
+ * call stores the id of its format string and the raw argument bytes into a
+ * ring in a memory mapped file instead of formatting the text. Each format
+ * string is written once to the string table of the file, the text is
+ * rendered later by daemon_blog_dump() or the blogdump tool.
+ *
+ * Format strings outside the read only data of the executable, or with
+ * conversions the sink does not store (%n, wide characters, positional
+ * arguments), are formatted on the calling thread and stored as text.
+ * The file survives a crash of the process, the next daemon_blog_open()
+ * of the same file keeps appending to it and reuses the formats stored by
+ * the earlier runs.
+ */
+
+/** Ring size used when daemon_blog_open() gets 0 */
+#define DAEMON_BLOG_DEFAULT_SIZE (1024 * 1024)
+
+/** Map the binary log file, created or resized as needed, and install the sink.
+ * @param ring_size bytes of records kept, rounded up to 4 KiB
+ * @return 0 on success, -1 with errno set otherwise */
+int daemon_blog_open(const char *path, size_t ring_size);
+
+/** Uninstall the sink and unmap the file */
+void daemon_blog_close(void);
+
+/** Switch between the text sinks and the binary one: the first call replaces
+ * the text sinks in daemon_log_use by DAEMON_LOG_BINARY, the next restores them.
+ * @return true if the binary sink is in use now */
+bool daemon_blog_switch(void);
+
+/** Render the records of a binary log file as text, oldest first
+ * @return number of records, -1 with errno set if the file is not a binary log */
+long daemon_blog_dump(const char *path, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
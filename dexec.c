@@ -23,16 +23,23 @@
 
 #define MAX_ARGS 100
 
+/* The signals blocked for the signalfd of dsignal would stay blocked
+ * across execv() */
+static void _unblock_signals(void) {
+    sigset_t ss;
+
+    sigemptyset(&ss);
+    sigprocmask(SIG_SETMASK, &ss, NULL);
+}
+
 int daemon_execv(const char * dir, int * ret, const char * prog, va_list ap) {
     pid_t pid;
     int p[2];
     unsigned n = 0;
-    static char buf[256];
+    char buf[256], chunk[4096];
     int sigfd, r;
     fd_set fds;
 
-    assert(daemon_signal_fd() >= 0);
-
     if (pipe(p) < 0) {
         daemon_log(LOG_ERR, "pipe() failed: %s", strerror(errno));
         return -1;
@@ -66,6 +73,8 @@ int daemon_execv(const char * dir, int * ret, const char * prog, va_list ap) {
 
         daemon_close_all(-1);
 
+        _unblock_signals();
+
         umask(0022); /* Set up a sane umask */
 
         if (dir && chdir(dir) < 0) {
@@ -91,8 +100,11 @@ int daemon_execv(const char * dir, int * ret, const char * prog, va_list ap) {
 
     FD_ZERO(&fds);
     FD_SET(p[0], &fds);
+    /* Without the signal pipe the child can't be killed by a signal to
+     * us, it runs to its end */
     sigfd = daemon_signal_fd();
-    FD_SET(sigfd, &fds);
+    if (sigfd >= 0)
+        FD_SET(sigfd, &fds);
 
     n = 0;
 
@@ -109,36 +121,47 @@ int daemon_execv(const char * dir, int * ret, const char * prog, va_list ap) {
         }
 
         if (FD_ISSET(p[0], &qfds)) {
-            char c;
+            ssize_t l, i;
+
+            /* A block per read(), split into lines here */
+            if ((l = read(p[0], chunk, sizeof(chunk))) < 0 && errno == EINTR)
+                continue;
 
-            if (read(p[0], &c, 1) != 1)
+            if (l <= 0)
                 break;
 
-            buf[n] = c;
+            for (i = 0; i < l; i++) {
+                char c = chunk[i];
 
-            if (c == '\n' || n >= sizeof(buf) - 2) {
-                if (c != '\n') n++;
-                buf[n] = 0;
+                buf[n] = c;
 
-                if (buf[0])
-                    daemon_log(LOG_INFO, "client: %s", buf);
+                if (c == '\n' || n >= sizeof(buf) - 2) {
+                    if (c != '\n') n++;
+                    buf[n] = 0;
 
-                n = 0;
-            } else
-                n++;
+                    if (buf[0])
+                        daemon_log(LOG_INFO, "client: %s", buf);
+
+                    n = 0;
+                } else
+                    n++;
+            }
         }
 
-        if (FD_ISSET(sigfd, &qfds)) {
+        if (sigfd >= 0 && FD_ISSET(sigfd, &qfds)) {
             int sig;
 
-            if ((sig = daemon_signal_next()) < 0) {
-                daemon_log(LOG_ERR, "daemon_signal_next(): %s", strerror(errno));
-                break;
+            /* Several signals come with one read() */
+            while ((sig = daemon_signal_next()) > 0) {
+                if (sig != SIGCHLD) {
+                    daemon_log(LOG_WARNING, "Killing child.");
+                    kill(pid, SIGTERM);
+                }
             }
 
-            if (sig != SIGCHLD) {
-                daemon_log(LOG_WARNING, "Killing child.");
-                kill(pid, SIGTERM);
+            if (sig < 0) {
+                daemon_log(LOG_ERR, "daemon_signal_next(): %s", strerror(errno));
+                break;
             }
         }
     }
@@ -196,6 +219,8 @@ pid_t daemon_execv1(const char * dir, const char * prog, va_list ap) {
         char * args[MAX_ARGS];
         int i;
 
+        _unblock_signals();
+
         umask(0022); /* Set up a sane umask */
 
         if (dir && chdir(dir) < 0) {
@@ -250,7 +275,6 @@ daemon_execva2(const char * dir, const char * prog,
     int i;
     for (i = 0; i < MAX_ARGS - 1; i++) {
         if (!(args[i] = va_arg(ap, char *))) {
-            syslog(LOG_INFO, "ARG[%d]=%s", i, args[i]);
             break;
         } else {
             syslog(LOG_INFO, "ARG[%d]=%s", i, args[i]);
@@ -309,6 +333,7 @@ daemon_execv2(const char * dir, const char * prog,
             daemon_log(LOG_ERR, "dup failed (%d) %s", errno, strerror(errno));
         }
 
+        _unblock_signals();
 
         umask(0022);
 
@@ -48,8 +48,9 @@ extern "C" {
  * specified directory and return the return value of the program in
  * the specified pointer. The calling process is blocked until the
  * child finishes and all child output (either STDOUT or STDIN) has
- * been written to syslog. Running this function requires that
- * daemon_signal() has been called with SIGCHLD as argument.
+ * been written to syslog. With daemon_signal() set up, with SIGCHLD
+ * among the signals, a signal other than SIGCHLD kills the child.
+ * daemon_spawn_run() of dspawn.h does the same without fork().
  *
  * @param dir Working directory for the process.
  * @param ret A pointer to an integer to write the return value of the program to.
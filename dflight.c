@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "dflight.h"
+#include "dlog.h"
+
+#define FLIGHT_BACKTRACE 64
+#define FLIGHT_LINE 192
+// a dump of a full ring and a deep backtrace fits in the preallocated space
+#define FLIGHT_FILE_SIZE (DAEMON_FLIGHT_RECORDS * FLIGHT_LINE + 64 * 1024)
+#define FLIGHT_ALTSTACK (64 * 1024)
+#define FLIGHT_EVENT 0xff
+
+/* A writer takes a slot with one fetch_add on head and publishes it by
+ * storing its sequence number last. The dump prints the slots of the last
+ * lap whose sequence matches, a slot being written is skipped. */
+typedef struct {
+    uint64_t seq;
+    // CLOCK_REALTIME
+    uint64_t time_ns;
+    uint32_t tid;
+    uint8_t prio;
+    uint8_t len;
+    char text[DAEMON_FLIGHT_TEXT];
+} flight_record_t;
+
+static struct {
+    flight_record_t *ring;
+    uint64_t head;
+    int fd;
+    // seconds east of UTC, localtime_r() is not async signal safe
+    long gmtoff;
+    int dumping;
+    bool open;
+    struct sigaction old[5];
+} flight = {.fd = -1};
+
+static const int flight_signals[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGUSR1};
+
+// the alternate stack of a thread is freed when it exits
+static pthread_key_t altstack_key;
+static pthread_once_t altstack_once = PTHREAD_ONCE_INIT;
+
+static void altstack_free(void *sp) {
+    stack_t ss = {.ss_sp = NULL, .ss_size = 0, .ss_flags = SS_DISABLE};
+    sigaltstack(&ss, NULL);
+    free(sp);
+}
+
+static void altstack_key_create(void) {
+    pthread_key_create(&altstack_key, altstack_free);
+}
+
+// a stack overflow leaves no room for the handler on the thread's own stack
+static void altstack_install(void) {
+    stack_t ss;
+    if (sigaltstack(NULL, &ss) == 0 && !(ss.ss_flags & SS_DISABLE)) {
+        return;
+    }
+    ss = (stack_t) {.ss_sp = malloc(FLIGHT_ALTSTACK), .ss_size = FLIGHT_ALTSTACK, .ss_flags = 0};
+    if (!ss.ss_sp) {
+        return;
+    }
+    if (sigaltstack(&ss, NULL) < 0) {
+        free(ss.ss_sp);
+        return;
+    }
+    pthread_once(&altstack_once, altstack_key_create);
+    pthread_setspecific(altstack_key, ss.ss_sp);
+}
+
+static uint32_t flight_tid(void) {
+    static __thread uint32_t tid = 0;
+    if (!tid) {
+        tid = (uint32_t) syscall(SYS_gettid);
+    }
+    return tid;
+}
+
+static void flight_put(int prio, const char *template, va_list arglist) {
+    flight_record_t *ring = __atomic_load_n(&flight.ring, __ATOMIC_ACQUIRE);
+    if (!ring) {
+        return;
+    }
+    int saved_errno = errno;
+    struct timespec ts;
+    uint64_t seq = __atomic_fetch_add(&flight.head, 1, __ATOMIC_RELAXED);
+    flight_record_t *r = &ring[seq % DAEMON_FLIGHT_RECORDS];
+
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r->time_ns = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+    r->tid = flight_tid();
+    r->prio = (uint8_t) prio;
+    int len = vsnprintf(r->text, sizeof(r->text), template, arglist);
+    r->len = (uint8_t) (len < 0 ? 0 : len < (int) sizeof(r->text) ? len : (int) sizeof(r->text) - 1);
+    __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELEASE);
+    errno = saved_errno;
+}
+
+void daemon_flight_event(const char *template, ...) {
+    va_list arglist;
+    va_start(arglist, template);
+    flight_put(FLIGHT_EVENT, template, arglist);
+    va_end(arglist);
+}
+
+/* Output of the dump, async signal safe: no stdio, no allocation */
+typedef struct {
+    char buf[FLIGHT_LINE];
+    size_t len;
+} flight_line_t;
+
+static void line_str(flight_line_t *l, const char *s, size_t n) {
+    if (n > sizeof(l->buf) - l->len) {
+        n = sizeof(l->buf) - l->len;
+    }
+    memcpy(l->buf + l->len, s, n);
+    l->len += n;
+}
+
+static void line_cstr(flight_line_t *l, const char *s) {
+    line_str(l, s, strlen(s));
+}
+
+static void line_uint(flight_line_t *l, uint64_t v, int width) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v && n < (int) sizeof(digits));
+    while (n < width && n < (int) sizeof(digits)) {
+        digits[sizeof(digits) - 1 - n++] = '0';
+    }
+    line_str(l, digits + sizeof(digits) - n, (size_t) n);
+}
+
+static bool line_write(int fd, flight_line_t *l) {
+    const char *p = l->buf;
+    size_t n = l->len;
+    l->len = 0;
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+        p += w;
+        n -= (size_t) w;
+    }
+    return true;
+}
+
+static const char *flight_signal_name(int sig) {
+    switch (sig) {
+        case SIGSEGV:
+            return "SIGSEGV";
+        case SIGBUS:
+            return "SIGBUS";
+        case SIGABRT:
+            return "SIGABRT";
+        case SIGFPE:
+            return "SIGFPE";
+        case SIGUSR1:
+            return "SIGUSR1";
+        default:
+            return "request";
+    }
+}
+
+bool daemon_flight_dump(int sig) {
+    int busy = 0;
+    if (!flight.open || !__atomic_compare_exchange_n(&flight.dumping, &busy, 1, false, __ATOMIC_ACQUIRE,
+                                                     __ATOMIC_RELAXED)) {
+        return false;
+    }
+    int saved_errno = errno;
+    int fd = flight.fd;
+    flight_line_t l = {.len = 0};
+
+    lseek(fd, 0, SEEK_SET);
+    line_cstr(&l, "flight recorder dump, ");
+    line_cstr(&l, flight_signal_name(sig));
+    line_cstr(&l, ", pid ");
+    line_uint(&l, (uint64_t) getpid(), 0);
+    line_cstr(&l, ", thread ");
+    line_uint(&l, flight_tid(), 0);
+    line_cstr(&l, "\n");
+    bool ok = line_write(fd, &l);
+
+    uint64_t head = __atomic_load_n(&flight.head, __ATOMIC_ACQUIRE);
+    uint64_t seq = head > DAEMON_FLIGHT_RECORDS ? head - DAEMON_FLIGHT_RECORDS : 0;
+    for (; ok && seq < head; seq++) {
+        const flight_record_t *r = &flight.ring[seq % DAEMON_FLIGHT_RECORDS];
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+            continue;
+        }
+        uint64_t local = (uint64_t) ((int64_t) (r->time_ns / 1000000000ULL) + flight.gmtoff);
+        line_uint(&l, local / 3600 % 24, 2);
+        line_cstr(&l, ":");
+        line_uint(&l, local / 60 % 60, 2);
+        line_cstr(&l, ":");
+        line_uint(&l, local % 60, 2);
+        line_cstr(&l, ".");
+        line_uint(&l, r->time_ns % 1000000000ULL / 1000, 6);
+        line_cstr(&l, " ");
+        line_cstr(&l, r->prio == FLIGHT_EVENT ? "[event]" : daemon_prio_name(r->prio));
+        line_cstr(&l, " [");
+        line_uint(&l, r->tid, 5);
+        line_cstr(&l, "] ");
+        line_str(&l, r->text, r->len < sizeof(r->text) ? r->len : sizeof(r->text));
+        line_cstr(&l, "\n");
+        ok = line_write(fd, &l);
+    }
+
+    void *frames[FLIGHT_BACKTRACE];
+    int depth = backtrace(frames, FLIGHT_BACKTRACE);
+    line_cstr(&l, "backtrace:\n");
+    if (ok && line_write(fd, &l)) {
+        backtrace_symbols_fd(frames, depth, fd);
+    }
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    if (end > 0 && ftruncate(fd, end) == 0) {
+        fdatasync(fd);
+    }
+    errno = saved_errno;
+    __atomic_store_n(&flight.dumping, 0, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void flight_handler(int sig) {
+    daemon_flight_dump(sig);
+    if (sig != SIGUSR1) {
+        // SA_RESETHAND restored the default action, the process dies of the signal and leaves its core
+        raise(sig);
+    }
+}
+
+int daemon_flight_open(const char *path) {
+    if (flight.open) {
+        errno = EBUSY;
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    // the disk may be full at crash time, the space is reserved up front
+    int res = posix_fallocate(fd, 0, FLIGHT_FILE_SIZE);
+    if (res && res != EOPNOTSUPP && res != EINVAL) {
+        close(fd);
+        errno = res;
+        return -1;
+    }
+    flight_record_t *ring = calloc(DAEMON_FLIGHT_RECORDS, sizeof(flight_record_t));
+    if (!ring) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    // backtrace() loads libgcc on first use, that must not happen in the handler
+    void *frames[FLIGHT_BACKTRACE];
+    backtrace(frames, FLIGHT_BACKTRACE);
+
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    flight.gmtoff = tm.tm_gmtoff;
+    flight.fd = fd;
+    flight.head = 0;
+    __atomic_store_n(&flight.ring, ring, __ATOMIC_RELEASE);
+    flight.open = true;
+    daemon_log_set_recorder(flight_put, LOG_UPTO(DAEMON_FLIGHT_UPTO));
+
+    altstack_install();
+    for (size_t i = 0; i < sizeof(flight_signals) / sizeof(flight_signals[0]); i++) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = flight_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_ONSTACK | (flight_signals[i] == SIGUSR1 ? SA_RESTART : SA_RESETHAND | SA_NODEFER);
+        if (sigaction(flight_signals[i], &sa, &flight.old[i]) < 0) {
+            daemon_log(LOG_WARNING, "flight recorder: sigaction(%s): %s", strsignal(flight_signals[i]),
+                       strerror(errno));
+        }
+    }
+    return 0;
+}
+
+void daemon_flight_thread(void) {
+    if (__atomic_load_n(&flight.open, __ATOMIC_ACQUIRE)) {
+        altstack_install();
+    }
+}
+
+void daemon_flight_close(void) {
+    if (!flight.open) {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(flight_signals) / sizeof(flight_signals[0]); i++) {
+        sigaction(flight_signals[i], &flight.old[i], NULL);
+    }
+    daemon_log_set_recorder(NULL, 0);
+    flight.open = false;
+    // a writer may still hold the ring, it stays allocated
+    __atomic_store_n(&flight.ring, NULL, __ATOMIC_RELEASE);
+    close(flight.fd);
+    flight.fd = -1;
+}
@@ -0,0 +1,63 @@
+#ifndef foodaemonflighthfoo
+#define foodaemonflighthfoo
+
+#include <stdbool.h>
+
+#include "dlog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file
+ *
+ * Crash flight recorder. Keeps the last DAEMON_FLIGHT_RECORDS daemon_log()
+ * calls up to DAEMON_FLIGHT_UPTO, those filtered out by daemon_log_upto()
+ * included, and the state change events of daemon_flight_event() in a lock-free ring
+ * in memory. On SIGSEGV, SIGBUS, SIGFPE or SIGABRT the ring and a backtrace() are
+ * written to the file given to daemon_flight_open(), then the signal is
+ * raised again with the default action. SIGUSR1 writes the same dump and
+ * the process goes on, for a watchdog that finds the process stuck.
+ *
+ * The handler runs on an alternate stack, so a stack overflow is dumped
+ * too. That stack is per thread: daemon_flight_open() sets it up for its
+ * caller, every thread started later calls daemon_flight_thread(). The
+ * threads of the log writer and the log rotation don't, a stack overflow
+ * there dies without a dump.
+ */
+
+/** Lowest priority recorded when daemon_log_upto() filters it out. Lower
+ * ones are recorded only when they are logged: a filtered out debug call
+ * stays a level check, nothing is formatted. */
+#define DAEMON_FLIGHT_UPTO LOG_INFO
+
+/** Records kept in the ring */
+#define DAEMON_FLIGHT_RECORDS 4096
+
+/** Characters of a record's text kept, longer lines are cut */
+#define DAEMON_FLIGHT_TEXT 104
+
+/** Open and preallocate the dump file, start recording and install the signal handlers
+ * @return 0 on success, -1 with errno set otherwise */
+int daemon_flight_open(const char *path);
+
+/** Give the calling thread an alternate stack for the dump handler, freed
+ * when the thread exits. Does nothing while the recorder is closed. */
+void daemon_flight_thread(void);
+
+/** Stop recording and restore the default signal actions */
+void daemon_flight_close(void);
+
+/** Record a state change, it goes to the ring only, not to the log */
+void daemon_flight_event(const char *template, ...) DAEMON_GCC_PRINTF_ATTR(1, 2);
+
+/** Write the ring and the backtrace of the calling thread to the dump file,
+ * async signal safe. sig is written to the header, 0 for a dump on request.
+ * @return false if the recorder is closed or a dump is in progress */
+bool daemon_flight_dump(int sig);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
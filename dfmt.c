@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "dfmt.h"
+
+typedef struct {
+    char *p;
+    char *end;
+} fmt_out_t;
+
+typedef struct {
+    bool left;
+    bool zero;
+    char sign;
+    int width;
+    int precision;
+} fmt_spec_t;
+
+static const double fmt_scales[] = {1.0, 10.0, 100.0, 1000.0, 10000.0};
+
+#define FMT_MAX_FIXED_PRECISION ((int) (sizeof(fmt_scales) / sizeof(fmt_scales[0])) - 1)
+
+static void fmt_put(fmt_out_t *out, const char *s, size_t len) {
+    size_t room = (size_t) (out->end - out->p);
+    if (len > room) {
+        len = room;
+    }
+    memcpy(out->p, s, len);
+    out->p += len;
+}
+
+static void fmt_fill(fmt_out_t *out, char c, int count) {
+    while (count-- > 0 && out->p < out->end) {
+        *out->p++ = c;
+    }
+}
+
+// Emit s honouring width, '-' and '0', zero padding goes after the sign.
+static void fmt_put_padded(fmt_out_t *out, const fmt_spec_t *spec, const char *s, size_t len, bool numeric) {
+    int pad = spec->width - (int) len;
+    if (spec->left) {
+        fmt_put(out, s, len);
+        fmt_fill(out, ' ', pad);
+    } else if (spec->zero && numeric) {
+        if (len && (*s == '-' || *s == '+' || *s == ' ')) {
+            fmt_put(out, s, 1);
+            s++;
+            len--;
+        }
+        fmt_fill(out, '0', pad);
+        fmt_put(out, s, len);
+    } else {
+        fmt_fill(out, ' ', pad);
+        fmt_put(out, s, len);
+    }
+}
+
+// Writes the digits backwards from end, returns the first character.
+static char *fmt_utoa(char *end, uint64_t value, unsigned int base, bool upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+    do {
+        *--p = digits[value % base];
+        value /= base;
+    } while (value);
+    return p;
+}
+
+static void fmt_integer(fmt_out_t *out, const fmt_spec_t *spec, uint64_t magnitude, bool negative,
+                        unsigned int base, bool upper) {
+    char tmp[32];
+    char *end = tmp + sizeof(tmp);
+    char *p = fmt_utoa(end, magnitude, base, upper);
+    if (negative) {
+        *--p = '-';
+    } else if (spec->sign) {
+        *--p = spec->sign;
+    }
+    fmt_put_padded(out, spec, p, (size_t) (end - p), true);
+}
+
+// Fixed point rendering of %.Nf, matches glibc except for exact ties after
+// scaling, which are left to snprintf.
+static size_t fmt_fixed(char *tmp, size_t size, double value, int precision, char sign) {
+    if (isfinite(value) && fabs(value) < 1e15 && precision <= FMT_MAX_FIXED_PRECISION) {
+        double scaled = fabs(value) * fmt_scales[precision];
+        double rounded = nearbyint(scaled);
+        if (precision == 0 || fabs(scaled - rounded) != 0.5) {
+            uint64_t n = (uint64_t) rounded;
+            char *end = tmp + size;
+            char *p = end;
+            for (int i = 0; i < precision; i++) {
+                *--p = (char) ('0' + n % 10);
+                n /= 10;
+            }
+            if (precision) {
+                *--p = '.';
+            }
+            p = fmt_utoa(p, n, 10, false);
+            if (signbit(value)) {
+                *--p = '-';
+            } else if (sign) {
+                *--p = sign;
+            }
+            size_t len = (size_t) (end - p);
+            memmove(tmp, p, len);
+            return len;
+        }
+    }
+    int len;
+    if (sign) {
+        char f[] = {'%', sign, '.', '*', 'f', 0};
+        len = snprintf(tmp, size, f, precision, value);
+    } else {
+        len = snprintf(tmp, size, "%.*f", precision, value);
+    }
+    if (len < 0) {
+        return 0;
+    }
+    return (size_t) len < size ? (size_t) len : size - 1;
+}
+
+static size_t fmt_fallback(char *buf, size_t size, const char *format, va_list ap) {
+    int len = vsnprintf(buf, size, format, ap);
+    if (len < 0) {
+        buf[0] = 0;
+        return 0;
+    }
+    return (size_t) len < size ? (size_t) len : size - 1;
+}
+
+size_t fmt_vformat(char *buf, size_t size, const char *format, va_list ap) {
+    if (!buf || !size) {
+        return 0;
+    }
+    va_list start;
+    va_copy(start, ap);
+
+    fmt_out_t out = {buf, buf + size - 1};
+    const char *f = format;
+
+    while (*f) {
+        if (*f != '%') {
+            const char *next = strchrnul(f, '%');
+            fmt_put(&out, f, (size_t) (next - f));
+            f = next;
+            continue;
+        }
+        f++;
+
+        fmt_spec_t spec = {false, false, 0, 0, -1};
+        for (;; f++) {
+            if (*f == '-') spec.left = true;
+            else if (*f == '0') spec.zero = true;
+            else if (*f == '+') spec.sign = '+';
+            else if (*f == ' ') { if (!spec.sign) spec.sign = ' '; }
+            else break;
+        }
+        if (*f == '*') {
+            spec.width = va_arg(ap, int);
+            if (spec.width < 0) {
+                spec.left = true;
+                spec.width = -spec.width;
+            }
+            f++;
+        } else {
+            while (*f >= '0' && *f <= '9') {
+                spec.width = spec.width * 10 + (*f++ - '0');
+            }
+        }
+        if (*f == '.') {
+            f++;
+            spec.precision = 0;
+            if (*f == '*') {
+                spec.precision = va_arg(ap, int);
+                f++;
+            } else {
+                while (*f >= '0' && *f <= '9') {
+                    spec.precision = spec.precision * 10 + (*f++ - '0');
+                }
+            }
+        }
+
+        int longs = 0;
+        bool size_t_arg = false;
+        if (*f == 'l') {
+            longs++;
+            f++;
+            if (*f == 'l') {
+                longs++;
+                f++;
+            }
+        } else if (*f == 'z') {
+            size_t_arg = true;
+            f++;
+        }
+
+        switch (*f) {
+            case '%':
+                fmt_put(&out, "%", 1);
+                break;
+            case 'c': {
+                char c = (char) va_arg(ap, int);
+                fmt_put_padded(&out, &spec, &c, 1, false);
+                break;
+            }
+            case 's': {
+                const char *s = va_arg(ap, const char *);
+                if (!s) {
+                    s = "(null)";
+                }
+                size_t len = spec.precision >= 0 ? strnlen(s, (size_t) spec.precision) : strlen(s);
+                fmt_put_padded(&out, &spec, s, len, false);
+                break;
+            }
+            case 'd':
+            case 'i': {
+                if (spec.precision >= 0) {
+                    goto fallback;
+                }
+                int64_t v;
+                if (size_t_arg) v = (int64_t) va_arg(ap, ssize_t);
+                else if (longs == 2) v = va_arg(ap, long long);
+                else if (longs == 1) v = va_arg(ap, long);
+                else v = va_arg(ap, int);
+                uint64_t magnitude = v < 0 ? (uint64_t) 0 - (uint64_t) v : (uint64_t) v;
+                fmt_integer(&out, &spec, magnitude, v < 0, 10, false);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                if (spec.precision >= 0) {
+                    goto fallback;
+                }
+                uint64_t v;
+                if (size_t_arg) v = va_arg(ap, size_t);
+                else if (longs == 2) v = va_arg(ap, unsigned long long);
+                else if (longs == 1) v = va_arg(ap, unsigned long);
+                else v = va_arg(ap, unsigned int);
+                spec.sign = 0;
+                fmt_integer(&out, &spec, v, false, *f == 'u' ? 10 : 16, *f == 'X');
+                break;
+            }
+            case 'f': {
+                char tmp[64];
+                double v = va_arg(ap, double);
+                size_t len = fmt_fixed(tmp, sizeof(tmp), v, spec.precision < 0 ? 6 : spec.precision, spec.sign);
+                fmt_put_padded(&out, &spec, tmp, len, isfinite(v));
+                break;
+            }
+            default:
+                goto fallback;
+        }
+        f++;
+    }
+    va_end(start);
+    *out.p = 0;
+    return (size_t) (out.p - buf);
+
+fallback: {
+        size_t len = fmt_fallback(buf, size, format, start);
+        va_end(start);
+        return len;
+    }
+}
+
+size_t fmt_format(char *buf, size_t size, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    size_t len = fmt_vformat(buf, size, format, ap);
+    va_end(ap);
+    return len;
+}
+
+bool fmt_text_vset(fmt_text_t *text, const char *format, va_list ap) {
+    char buf[FMT_TEXT_SIZE];
+    size_t len = fmt_vformat(buf, sizeof(buf), format, ap);
+    if (len == text->len && memcmp(buf, text->buf, len) == 0) {
+        return false;
+    }
+    memcpy(text->buf, buf, len + 1);
+    text->len = len;
+    return true;
+}
+
+bool fmt_text_set(fmt_text_t *text, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    bool changed = fmt_text_vset(text, format, ap);
+    va_end(ap);
+    return changed;
+}
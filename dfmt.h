@@ -0,0 +1,40 @@
+#ifndef foodfmth
+#define foodfmth
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dlog.h"
+
+/** \file
+ *
+ * printf style formatting into caller provided buffers without heap
+ * allocations. %d, %i, %u, %s, %c and %% with flags, width and the l/ll/z
+ * modifiers are handled in place, %.Nf with N <= 4 uses a fixed point
+ * fast path. Anything else falls back to vsnprintf() into the same buffer.
+ */
+
+#define FMT_TEXT_SIZE 64
+
+/** Fixed capacity text owned by a widget */
+typedef struct {
+    size_t len;
+    char buf[FMT_TEXT_SIZE];
+} fmt_text_t;
+
+/** Format into buf, the result is always terminated and truncated to size - 1
+ * @return The length of the formatted text
+ */
+size_t fmt_format(char *buf, size_t size, const char *format, ...) DAEMON_GCC_PRINTF_ATTR(3, 4);
+
+size_t fmt_vformat(char *buf, size_t size, const char *format, va_list ap);
+
+/** Format into text
+ * @return true if the text differs from the previous content
+ */
+bool fmt_text_set(fmt_text_t *text, const char *format, ...) DAEMON_GCC_PRINTF_ATTR(2, 3);
+
+bool fmt_text_vset(fmt_text_t *text, const char *format, va_list ap);
+
+#endif // foodfmth
@@ -5,11 +5,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/syscall.h>   /* For SYS_xxx definitions */
+#include <sys/uio.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include "dlog.h"
 
 enum daemon_log_flags daemon_log_use = DAEMON_LOG_AUTO | DAEMON_LOG_STDERR;
@@ -78,36 +82,432 @@ static unsigned long get_tid(void) {
     return (_tid);
 }
 
+static daemon_log_file_fn file_sink = NULL;
+
+void daemon_log_set_file(daemon_log_file_fn fn) {
+    __atomic_store_n(&file_sink, fn, __ATOMIC_RELEASE);
+}
+
+// openlog() once per ident instead of once per line
+static void syslog_open(void) {
+    static const char *opened = NULL;
+    const char *ident = daemon_log_ident ? daemon_log_ident : "UNKNOWN";
+    if (ident != opened) {
+        openlog(ident, 0, /*LOG_DAEMON*/ LOG_LOCAL1);
+        opened = ident;
+    }
+}
+
+// One syslog() line per line of the message, tabs and carriage returns as spaces
+static void syslog_lines(int prio, unsigned long tid, char *buffer) {
+    char *ps = buffer, *pb = buffer;
+    while (*pb) {
+        if (*pb == '\n') {
+            *pb = 0;
+            syslog(prio | LOG_DAEMON, "%s[%05ld]%s", daemon_prio_name(prio), tid, ps);
+            ps = pb + 1;
+        } else {
+            if ((*pb == '\r') || (*pb == '\t')) *pb = ' ';
+        }
+        pb++;
+    }
+    if (pb != ps) {
+        syslog(prio | LOG_DAEMON, "%s[%05ld]%s", daemon_prio_name(prio), tid, ps);
+    }
+}
+
+/* Asynchronous mode: the caller formats the message into a record of its own
+ * thread's ring, the writer thread adds the prefix and writes the records of
+ * all rings in batches. A ring has one producer, its thread, and one consumer,
+ * the writer, head and tail are the only shared state. Rings are never freed,
+ * the ring of an exited thread goes to the next new thread once drained. */
+
+#define DLOG_RING_SLOTS 256
+// the length the synchronous path formats, a longer message ends in "..."
+#define DLOG_RECORD_TEXT 512
+#define DLOG_BATCH 256
+#define DLOG_WRITER_NAP_MS 100
+
+typedef struct {
+    unsigned long seq;
+    struct timespec ts;
+    unsigned long tid;
+    int prio;
+    int len;
+    char text[DLOG_RECORD_TEXT];
+} dlog_record_t;
+
+typedef struct dlog_ring {
+    struct dlog_ring *next;
+    bool orphaned;
+    unsigned long dropped;
+    // written by the owner thread
+    unsigned long head __attribute__ ((aligned(64)));
+    // written by the writer thread
+    unsigned long tail __attribute__ ((aligned(64)));
+    dlog_record_t slots[DLOG_RING_SLOTS];
+} dlog_ring_t;
+
+typedef struct {
+    dlog_ring_t *ring;
+    dlog_record_t *record;
+} dlog_pending_t;
+
+static struct {
+    bool running;
+    bool stop;
+    // set by the writer before it sleeps, a producer clearing it posts wake
+    bool idle;
+    sem_t wake;
+    pthread_t thread;
+    pthread_key_t key;
+    dlog_ring_t *rings;
+    unsigned long seq;
+    unsigned long records;
+    unsigned long batches;
+    unsigned long writes;
+} async = {0};
+
+static __thread dlog_ring_t *own_ring = NULL;
+static pthread_once_t async_once = PTHREAD_ONCE_INIT;
+
+static void ring_release(void *ring) {
+    __atomic_store_n(&((dlog_ring_t *) ring)->orphaned, true, __ATOMIC_RELEASE);
+}
+
+static void async_key_create(void) {
+    pthread_key_create(&async.key, ring_release);
+}
+
+static dlog_ring_t *ring_get(void) {
+    if (own_ring) {
+        return own_ring;
+    }
+    dlog_ring_t *ring = __atomic_load_n(&async.rings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next) {
+        bool orphaned = true;
+        if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) &&
+            __atomic_compare_exchange_n(&ring->orphaned, &orphaned, false, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!ring) {
+        // not xmalloc(), the ring has to be cache line aligned
+        if (posix_memalign((void **) &ring, 64, sizeof(dlog_ring_t))) {
+            return NULL;
+        }
+        memset(ring, 0, sizeof(dlog_ring_t));
+        ring->next = __atomic_load_n(&async.rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&async.rings, &ring->next, ring, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_once(&async_once, async_key_create);
+    pthread_setspecific(async.key, ring);
+    own_ring = ring;
+    return ring;
+}
+
+static void async_wake(void) {
+    if (__atomic_load_n(&async.idle, __ATOMIC_RELAXED) && __atomic_exchange_n(&async.idle, false, __ATOMIC_ACQ_REL)) {
+        sem_post(&async.wake);
+    }
+}
+
+// The formatted message goes into a free slot of the thread's ring, a full ring drops it
+static bool async_log(int prio, const char *template, va_list arglist) {
+    dlog_ring_t *ring = ring_get();
+    if (!ring) {
+        return false;
+    }
+    unsigned long head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == DLOG_RING_SLOTS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        async_wake();
+        return true;
+    }
+    dlog_record_t *r = &ring->slots[head % DLOG_RING_SLOTS];
+    clock_gettime(CLOCK_REALTIME, &r->ts);
+    int len = vsnprintf(r->text, sizeof(r->text), template, arglist);
+    r->len = len < 0 ? 0 : len < (int) sizeof(r->text) ? len : (int) sizeof(r->text) - 1;
+    if (len >= (int) sizeof(r->text)) {
+        memcpy(r->text + r->len - 3, "...", 3);
+    }
+    r->prio = prio;
+    r->tid = get_tid();
+    r->seq = __atomic_fetch_add(&async.seq, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    async_wake();
+    return true;
+}
+
+static int pending_cmp(const void *a, const void *b) {
+    unsigned long x = ((const dlog_pending_t *) a)->record->seq, y = ((const dlog_pending_t *) b)->record->seq;
+    return x < y ? -1 : x > y;
+}
+
+static void write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count > IOV_MAX ? IOV_MAX : count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return;
+        }
+        __atomic_add_fetch(&async.writes, 1, __ATOMIC_RELAXED);
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+}
+
+// prefix, text and newline of each record, writev() advances the entries it wrote
+static int async_iov(struct iovec *iov, const dlog_pending_t *batch, int count, char (*prefixes)[64],
+                     const int *prefix_len) {
+    static char newline[] = "\n";
+    for (int i = 0; i < count; i++) {
+        iov[i * 3] = (struct iovec) {prefixes[i], (size_t) prefix_len[i]};
+        iov[i * 3 + 1] = (struct iovec) {batch[i].record->text, (size_t) batch[i].record->len};
+        iov[i * 3 + 2] = (struct iovec) {newline, 1};
+    }
+    return count * 3;
+}
+
+static void async_emit(dlog_pending_t *batch, int count) {
+    static time_t prefix_sec = 0;
+    static char time_buffer[21] = {};
+    static char prefixes[DLOG_BATCH][64];
+    static int prefix_len[DLOG_BATCH];
+    static struct iovec iov[DLOG_BATCH * 3];
+    enum daemon_log_flags use = daemon_log_use;
+
+    qsort(batch, (size_t) count, sizeof(dlog_pending_t), pending_cmp);
+    if (use & DAEMON_LOG_SYSLOG) {
+        syslog_open();
+        for (int i = 0; i < count; i++) {
+            // split on a copy, the text still goes to the other sinks
+            dlog_record_t *r = batch[i].record;
+            char buffer[256];
+            snprintf(buffer, sizeof(buffer), "%.*s", r->len, r->text);
+            syslog_lines(r->prio, r->tid, buffer);
+        }
+    }
+    daemon_log_file_fn file = (use & DAEMON_LOG_FILE) ? __atomic_load_n(&file_sink, __ATOMIC_ACQUIRE) : NULL;
+    // the console prefix with its colors, then the plain one for the file
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 0 ? !(use & (DAEMON_LOG_STDERR | DAEMON_LOG_STDOUT)) : !file) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            dlog_record_t *r = batch[i].record;
+            // localtime() once a second
+            if (r->ts.tv_sec != prefix_sec) {
+                struct tm now;
+                prefix_sec = r->ts.tv_sec;
+                localtime_r(&prefix_sec, &now);
+                strftime(time_buffer, 20, "%T", &now);
+            }
+            int len = snprintf(prefixes[i], sizeof(prefixes[i]), "%s.%04d %s%s%s [%05lu] ", time_buffer,
+                               (int) (r->ts.tv_nsec / 100000), pass ? "" : daemon_prio_color(r->prio),
+                               daemon_prio_name(r->prio), pass ? "" : color_end, r->tid);
+            prefix_len[i] = len < (int) sizeof(prefixes[i]) ? len : (int) sizeof(prefixes[i]) - 1;
+        }
+        if (pass == 1) {
+            file(iov, async_iov(iov, batch, count, prefixes, prefix_len));
+            continue;
+        }
+        if (use & DAEMON_LOG_STDERR) {
+            write_all(STDERR_FILENO, iov, async_iov(iov, batch, count, prefixes, prefix_len));
+        }
+        if (use & DAEMON_LOG_STDOUT) {
+            fflush(stdout);
+            write_all(STDOUT_FILENO, iov, async_iov(iov, batch, count, prefixes, prefix_len));
+        }
+    }
+    // the slots are free once written, a ring's records are contiguous from its tail
+    for (int i = 0; i < count; i++) {
+        __atomic_add_fetch(&batch[i].ring->tail, 1, __ATOMIC_RELEASE);
+    }
+    __atomic_add_fetch(&async.records, (unsigned long) count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&async.batches, 1, __ATOMIC_RELAXED);
+}
+
+static int async_collect(dlog_pending_t *batch) {
+    int count = 0;
+    for (dlog_ring_t *ring = __atomic_load_n(&async.rings, __ATOMIC_ACQUIRE); ring && count < DLOG_BATCH;
+         ring = ring->next) {
+        unsigned long tail = ring->tail;
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head && count < DLOG_BATCH; tail++) {
+            batch[count++] = (dlog_pending_t) {ring, &ring->slots[tail % DLOG_RING_SLOTS]};
+        }
+    }
+    return count;
+}
+
+static void *async_writer(void *arg) {
+    static dlog_pending_t batch[DLOG_BATCH];
+    (void) arg;
+    while (true) {
+        int count = async_collect(batch);
+        if (count) {
+            async_emit(batch, count);
+            continue;
+        }
+        if (__atomic_load_n(&async.stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        __atomic_store_n(&async.idle, true, __ATOMIC_RELEASE);
+        // a record written before idle was set would not wake us
+        if (async_collect(batch)) {
+            __atomic_store_n(&async.idle, false, __ATOMIC_RELEASE);
+            continue;
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += DLOG_WRITER_NAP_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        sem_timedwait(&async.wake, &until);
+        __atomic_store_n(&async.idle, false, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void async_exit(void) {
+    daemon_log_async_stop();
+}
+
+int daemon_log_async_start(void) {
+    static bool exit_registered = false;
+    if (async.running) {
+        return 0;
+    }
+    if (sem_init(&async.wake, 0, 0) < 0) {
+        return -1;
+    }
+    async.stop = false;
+    int res = pthread_create(&async.thread, NULL, async_writer, NULL);
+    if (res) {
+        sem_destroy(&async.wake);
+        errno = res;
+        return -1;
+    }
+    if (!exit_registered) {
+        atexit(async_exit);
+        exit_registered = true;
+    }
+    __atomic_store_n(&async.running, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void daemon_log_async_stop(void) {
+    if (!async.running) {
+        return;
+    }
+    __atomic_store_n(&async.running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&async.stop, true, __ATOMIC_RELEASE);
+    sem_post(&async.wake);
+    pthread_join(async.thread, NULL);
+    sem_destroy(&async.wake);
+}
+
+void daemon_log_flush(void) {
+    for (int i = 0; i < 1000 && async.running; i++) {
+        bool empty = true;
+        for (dlog_ring_t *ring = __atomic_load_n(&async.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+            empty &= __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        }
+        if (empty) {
+            break;
+        }
+        async_wake();
+        usleep(1000);
+    }
+}
+
+void daemon_log_async_stats(daemon_log_async_stats_t *stats) {
+    stats->records = __atomic_load_n(&async.records, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&async.batches, __ATOMIC_RELAXED);
+    stats->writes = __atomic_load_n(&async.writes, __ATOMIC_RELAXED);
+    stats->dropped = 0;
+    stats->rings = 0;
+    for (dlog_ring_t *ring = __atomic_load_n(&async.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        stats->dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        stats->rings++;
+    }
+}
+
+static daemon_log_binary_fn binary_sink = NULL;
+
+void daemon_log_set_binary(daemon_log_binary_fn fn) {
+    __atomic_store_n(&binary_sink, fn, __ATOMIC_RELEASE);
+}
+
+static daemon_log_binary_fn recorder = NULL;
+static unsigned int recorder_prio = 0;
+
+void daemon_log_set_recorder(daemon_log_binary_fn fn, unsigned int prio_mask) {
+    __atomic_store_n(&recorder_prio, prio_mask, __ATOMIC_RELAXED);
+    __atomic_store_n(&recorder, fn, __ATOMIC_RELEASE);
+}
+
+// a call is formatted only if the log or the recorder keeps its level
+static inline bool log_wanted(int prio) {
+    return (LOG_MASK(prio) & def_prio) ||
+           ((LOG_MASK(prio) & __atomic_load_n(&recorder_prio, __ATOMIC_RELAXED)) &&
+            __atomic_load_n(&recorder, __ATOMIC_RELAXED));
+}
+
 void daemon_logv(int prio, const char *template, va_list arglist) {
     int saved_errno;
 
+    daemon_log_binary_fn record = __atomic_load_n(&recorder, __ATOMIC_ACQUIRE);
+    if (record && (LOG_MASK(prio) & (def_prio | __atomic_load_n(&recorder_prio, __ATOMIC_RELAXED)))) {
+        va_list arglist0;
+        va_copy(arglist0, arglist);
+        record(prio, template, arglist0);
+        va_end(arglist0);
+    }
     if ((LOG_MASK(prio) & def_prio) == 0) return;
 
     saved_errno = errno;
+    if (daemon_log_use & DAEMON_LOG_BINARY) {
+        daemon_log_binary_fn fn = __atomic_load_n(&binary_sink, __ATOMIC_ACQUIRE);
+        if (fn) {
+            va_list arglist0;
+            va_copy(arglist0, arglist);
+            fn(prio, template, arglist0);
+            va_end(arglist0);
+        }
+        if (!(daemon_log_use & DAEMON_LOG_TEXT)) {
+            errno = saved_errno;
+            return;
+        }
+    }
+    if (__atomic_load_n(&async.running, __ATOMIC_ACQUIRE) && async_log(prio, template, arglist)) {
+        errno = saved_errno;
+        return;
+    }
     va_list arglist1, arglist2, arglist3;
     va_copy(arglist1, arglist);
     va_copy(arglist2, arglist);
     va_copy(arglist3, arglist);
     if (daemon_log_use & DAEMON_LOG_SYSLOG) {
         char buffer[256] = {};
-        openlog(daemon_log_ident ? daemon_log_ident : "UNKNOWN", 0, /*LOG_DAEMON*/ LOG_LOCAL1);
+        syslog_open();
         vsnprintf(buffer, sizeof(buffer), template, arglist1);
         buffer[sizeof(buffer) - 1] = 0;
-
-        char *ps = buffer, *pb = buffer;
-        while (*pb) {
-            if (*pb == '\n') {
-                *pb = 0;
-                syslog(prio | LOG_DAEMON, "%s[%05ld]%s", daemon_prio_name(prio), get_tid(), ps);
-                ps = pb + 1;
-            } else {
-                if ((*pb == '\r') || (*pb == '\t')) *pb = ' ';
-            }
-            pb++;
-        }
-        if (pb != ps) {
-            syslog(prio | LOG_DAEMON, "%s[%05ld]%s", daemon_prio_name(prio), get_tid(), ps);
-        }
+        syslog_lines(prio, get_tid(), buffer);
     }
     va_end(arglist1);
     if ((daemon_log_use & DAEMON_LOG_STDERR) || (daemon_log_use & DAEMON_LOG_STDOUT)) {
@@ -142,6 +542,24 @@ void daemon_logv(int prio, const char *template, va_list arglist) {
     }
     va_end(arglist2);
     va_end(arglist3);
+    daemon_log_file_fn file = (daemon_log_use & DAEMON_LOG_FILE) ? __atomic_load_n(&file_sink, __ATOMIC_ACQUIRE) : NULL;
+    if (file) {
+        char prefix[64], text[512];
+        struct timespec ts;
+        struct tm now;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        localtime_r(&ts.tv_sec, &now);
+        size_t prefix_len = strftime(prefix, sizeof(prefix), "%T", &now);
+        int len = snprintf(prefix + prefix_len, sizeof(prefix) - prefix_len, ".%04d %s [%05lu] ",
+                           (int) (ts.tv_nsec / 100000), daemon_prio_name(prio), get_tid());
+        prefix_len += len > 0 ? (size_t) len : 0;
+        errno = saved_errno;
+        len = vsnprintf(text, sizeof(text), template, arglist);
+        len = len < 0 ? 0 : len < (int) sizeof(text) ? len : (int) sizeof(text) - 1;
+        struct iovec iov[3] = {{prefix, prefix_len < sizeof(prefix) ? prefix_len : sizeof(prefix) - 1},
+                               {text, (size_t) len}, {(char *) "\n", 1}};
+        file(iov, 3);
+    }
 
     errno = saved_errno;
 }
@@ -149,7 +567,7 @@ void daemon_logv(int prio, const char *template, va_list arglist) {
 void daemon_log(int prio, const char *template, ...) {
     va_list arglist;
 
-    if ((LOG_MASK(prio) & def_prio) == 0) return;
+    if (!log_wanted(prio)) return;
 
     va_start(arglist, template);
     daemon_logv(prio, template, arglist);
@@ -170,93 +588,273 @@ unsigned int log_check_prio(unsigned int priority) {
 }
 
 
-static pthread_mutex_t _indent_mtx = PTHREAD_MUTEX_INITIALIZER;
-static __thread int _indent = 0;
+static daemon_log_site_t *log_sites = NULL;
 
-static int indent_get() {
-    int a;
-    pthread_mutex_lock(&_indent_mtx);
-    a = _indent;
-    pthread_mutex_unlock(&_indent_mtx);
-    return (a);
+static uint64_t site_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
 }
 
-void indent_set(int indent) {
-    pthread_mutex_lock(&_indent_mtx);
-    _indent = indent;
-    pthread_mutex_unlock(&_indent_mtx);
+static void site_report(daemon_log_site_t *site, uint64_t now) {
+    __atomic_store_n(&site->reported_ns, now, __ATOMIC_RELAXED);
+    uint32_t n = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    if (n) {
+        daemon_log(site->prio, "%s:%d: %u messages suppressed", site->file, site->line, n);
+    }
 }
 
-static bool _daemon_trace_on = true;
+bool daemon_log_site_allow(daemon_log_site_t *site) {
+    // the flight recorder may keep a level filtered out of the log
+    if ((LOG_MASK(site->prio) & def_prio) == 0) return log_wanted(site->prio);
 
-void daemon_enter(const char *func_name, const char *template, ...) {
-    static pthread_mutex_t tmp_mtx = PTHREAD_MUTEX_INITIALIZER;
+    uint64_t now = site_now_ns();
+    bool listed = false;
+    if (__atomic_compare_exchange_n(&site->listed, &listed, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&site->reported_ns, now, __ATOMIC_RELAXED);
+        site->next = __atomic_load_n(&log_sites, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&log_sites, &site->next, site, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    // sampled out lines are expected, they are not counted as suppressed
+    if (site->sample > 1 && __atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) % site->sample) return false;
+
+    // GCRA form of the token bucket: one CAS on the arrival time the bucket is full again
+    uint64_t tat = __atomic_load_n(&site->tat_ns, __ATOMIC_RELAXED);
+    bool allow;
+    do {
+        uint64_t next = (tat > now ? tat : now) + site->interval_ns;
+        allow = next - now <= site->burst_ns;
+        if (!allow) break;
+        if (__atomic_compare_exchange_n(&site->tat_ns, &tat, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } while (1);
+    if (!allow) __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+
+    uint64_t reported = __atomic_load_n(&site->reported_ns, __ATOMIC_RELAXED);
+    if (now - reported >= DAEMON_LOG_SUMMARY_S * 1000000000ULL &&
+        __atomic_load_n(&site->suppressed, __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&site->reported_ns, &reported, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        site_report(site, now);
+    }
+    return allow;
+}
 
-    indent_set(indent_get() + 1);
-    if (_daemon_trace_on) {
-        static __thread char tmp[256];
-        pthread_mutex_lock(&tmp_mtx);
-        int ll = snprintf(tmp, sizeof(tmp) - 1, "%*c>[%s] ", indent_get(), ' ', func_name);
-        tmp[sizeof(tmp) - 1] = 0;
-        int l = sizeof(tmp) - ll - 1;
-        strncat(tmp, template, l);
-        tmp[sizeof(tmp) - 1] = 0;
-        va_list arglist;
-        va_start(arglist, template);
-        daemon_logv(LOG_INFO, tmp, arglist);
-        va_end(arglist);
-        pthread_mutex_unlock(&tmp_mtx);
+void daemon_log_sites_report(void) {
+    uint64_t now = site_now_ns();
+    for (daemon_log_site_t *site = __atomic_load_n(&log_sites, __ATOMIC_ACQUIRE); site; site = site->next) {
+        site_report(site, now);
     }
 }
 
-void daemon_leave(const char *func_name, const char *template, ...) {
-    static pthread_mutex_t tmp_mtx = PTHREAD_MUTEX_INITIALIZER;
+/* Tracing: the DAEMON_TRACE_* macros record begin, end and instant events
+ * into a ring of the calling thread, the only writer of its ring. An export
+ * reads head before and after copying the events and drops those the owner
+ * may have overwritten meanwhile. The ring of an exited thread keeps its
+ * events for the next export and goes to a new thread once DAEMON_TRACE_RINGS
+ * rings exist. */
+
+#define DAEMON_TRACE_EVENTS 4096
+#define DAEMON_TRACE_RINGS 32
+#define DAEMON_TRACE_DETAIL 40
+
+typedef struct {
+    uint64_t ts_ns;
+    const char *name;
+    uint32_t tid;
+    char phase;
+    char detail[DAEMON_TRACE_DETAIL];
+} trace_event_t;
+
+typedef struct trace_ring {
+    struct trace_ring *next;
+    bool orphaned;
+    uint32_t tid;
+    char thread_name[16];
+    int depth;
+    uint64_t head;
+    trace_event_t events[DAEMON_TRACE_EVENTS];
+} trace_ring_t;
+
+bool daemon_trace_enabled = false;
+
+static struct {
+    trace_ring_t *rings;
+    int count;
+    pthread_key_t key;
+} trace = {0};
+
+static __thread trace_ring_t *own_trace = NULL;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static void trace_release(void *ring) {
+    __atomic_store_n(&((trace_ring_t *) ring)->orphaned, true, __ATOMIC_RELEASE);
+}
 
-    if (_daemon_trace_on) {
-        static __thread char tmp[256];
-        pthread_mutex_lock(&tmp_mtx);
-        int ll = snprintf(tmp, sizeof(tmp) - 1, "%*c<[%s] ", indent_get(), ' ', func_name);
-        tmp[sizeof(tmp) - 1] = 0;
-        int l = sizeof(tmp) - ll - 1;
-        strncat(tmp, template, l);
-        tmp[sizeof(tmp) - 1] = 0;
-        va_list arglist;
-        va_start(arglist, template);
-        daemon_logv(LOG_INFO, tmp, arglist);
-        va_end(arglist);
-        pthread_mutex_unlock(&tmp_mtx);
+static void trace_key_create(void) {
+    pthread_key_create(&trace.key, trace_release);
+}
+
+static trace_ring_t *trace_ring_get(void) {
+    if (own_trace) {
+        return own_trace;
     }
-    indent_set(indent_get() - 1);
+    trace_ring_t *ring = NULL;
+    if (__atomic_load_n(&trace.count, __ATOMIC_RELAXED) >= DAEMON_TRACE_RINGS) {
+        for (ring = __atomic_load_n(&trace.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+            bool orphaned = true;
+            if (__atomic_compare_exchange_n(&ring->orphaned, &orphaned, false, false, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(trace_ring_t));
+        if (!ring) {
+            return NULL;
+        }
+        ring->next = __atomic_load_n(&trace.rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace.rings, &ring->next, ring, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+        __atomic_add_fetch(&trace.count, 1, __ATOMIC_RELAXED);
+    }
+    ring->tid = (uint32_t) get_tid();
+    ring->depth = 0;
+    pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name));
+    pthread_once(&trace_once, trace_key_create);
+    pthread_setspecific(trace.key, ring);
+    own_trace = ring;
+    return ring;
+}
+
+static void trace_event(char phase, const char *func_name, const char *template, va_list arglist) {
+    trace_ring_t *ring = trace_ring_get();
+    if (!ring) {
+        return;
+    }
+    // an end without its begin, after daemon_trace_indent_reset_after_error(), would confuse the viewer
+    if (phase == 'E' && ring->depth == 0) {
+        return;
+    }
+    ring->depth += phase == 'B' ? 1 : phase == 'E' ? -1 : 0;
+    uint64_t head = ring->head;
+    trace_event_t *e = &ring->events[head % DAEMON_TRACE_EVENTS];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    e->ts_ns = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+    e->name = func_name;
+    e->tid = ring->tid;
+    e->phase = phase;
+    // most trace points pass "", only a detail costs a vsnprintf()
+    if (template[0]) {
+        vsnprintf(e->detail, sizeof(e->detail), template, arglist);
+    } else {
+        e->detail[0] = 0;
+    }
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void daemon_enter(const char *func_name, const char *template, ...) {
+    va_list arglist;
+    va_start(arglist, template);
+    trace_event('B', func_name, template, arglist);
+    va_end(arglist);
+}
+
+void daemon_leave(const char *func_name, const char *template, ...) {
+    va_list arglist;
+    va_start(arglist, template);
+    trace_event('E', func_name, template, arglist);
+    va_end(arglist);
+}
+
+void daemon_trace(const char *func_name, const char *template, ...) {
+    va_list arglist;
+    va_start(arglist, template);
+    trace_event('i', func_name, template, arglist);
+    va_end(arglist);
 }
 
 void daemon_trace_switch(bool on) {
-    _daemon_trace_on = on;
+    __atomic_store_n(&daemon_trace_enabled, on, __ATOMIC_RELAXED);
 }
 
 bool daemon_trace_switch_get() {
-    return (_daemon_trace_on);
+    return __atomic_load_n(&daemon_trace_enabled, __ATOMIC_RELAXED);
 }
 
 void daemon_trace_indent_reset_after_error() {
-    indent_set(0);
+    if (own_trace) {
+        own_trace->depth = 0;
+    }
 }
 
-void daemon_trace(const char *func_name, const char *template, ...) {
-    static pthread_mutex_t tmp_mtx = PTHREAD_MUTEX_INITIALIZER;
-    if (_daemon_trace_on) {
-        static __thread char tmp[256];
-        pthread_mutex_lock(&tmp_mtx);
-        int ll = snprintf(tmp, sizeof(tmp) - 1, "%*c*[%s] ", indent_get(), ' ', func_name);
-        tmp[sizeof(tmp) - 1] = 0;
-        int l = sizeof(tmp) - ll - 1;
-        strncat(tmp, template, l);
-        tmp[sizeof(tmp) - 1] = 0;
-        va_list arglist;
-        va_start(arglist, template);
-        daemon_logv(LOG_INFO, tmp, arglist);
-        va_end(arglist);
-        pthread_mutex_unlock(&tmp_mtx);
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+long daemon_trace_export(const char *path) {
+    FILE *f = fopen(path, "we");
+    if (!f) {
+        return -1;
+    }
+    trace_event_t *copy = malloc(sizeof(trace_event_t) * DAEMON_TRACE_EVENTS);
+    if (!copy) {
+        fclose(f);
+        errno = ENOMEM;
+        return -1;
+    }
+    long count = 0;
+    int pid = (int) getpid();
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (trace_ring_t *ring = __atomic_load_n(&trace.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > DAEMON_TRACE_EVENTS ? head - DAEMON_TRACE_EVENTS : 0;
+        for (uint64_t i = first; i < head; i++) {
+            copy[i - first] = ring->events[i % DAEMON_TRACE_EVENTS];
+        }
+        uint64_t after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t valid = after > DAEMON_TRACE_EVENTS ? after - DAEMON_TRACE_EVENTS : 0;
+        fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+                count ? ",\n" : "", pid, ring->tid);
+        json_string(f, ring->thread_name);
+        fprintf(f, "}}");
+        count++;
+        for (uint64_t i = first > valid ? first : valid; i < head; i++) {
+            const trace_event_t *e = &copy[i - first];
+            fprintf(f, ",\n{\"ph\":\"%c\",\"name\":", e->phase);
+            json_string(f, e->name);
+            fprintf(f, ",\"pid\":%d,\"tid\":%u,\"ts\":%" PRIu64 ".%03u", pid, e->tid, e->ts_ns / 1000,
+                    (unsigned) (e->ts_ns % 1000));
+            if (e->phase == 'i') {
+                fprintf(f, ",\"s\":\"t\"");
+            }
+            if (e->detail[0]) {
+                fprintf(f, ",\"args\":{\"detail\":");
+                json_string(f, e->detail);
+                fprintf(f, "}");
+            }
+            fprintf(f, "}");
+            count++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    free(copy);
+    if (fclose(f)) {
+        return -1;
     }
+    return count;
 }
 
 void hex_dump(const unsigned char *buf, int len) {
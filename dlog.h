@@ -25,6 +25,7 @@
 #include <syslog.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,11 +41,18 @@ enum daemon_log_flags {
     DAEMON_LOG_SYSLOG = 1,   /**< Log messages are written to syslog */
     DAEMON_LOG_STDERR = 2,   /**< Log messages are written to STDERR */
     DAEMON_LOG_STDOUT = 4,   /**< Log messages are written to STDOUT */
-    DAEMON_LOG_AUTO = 8      /**< If this is set a daemon_fork() will
+    DAEMON_LOG_AUTO = 8,     /**< If this is set a daemon_fork() will
                                   change this to DAEMON_LOG_SYSLOG in
                                   the daemon process. */
+    DAEMON_LOG_BINARY = 16,  /**< Log messages are passed unformatted to
+                                  the sink set by daemon_log_set_binary() */
+    DAEMON_LOG_FILE = 32     /**< Log lines are written by the sink set
+                                  by daemon_log_set_file() */
 };
 
+/** The sinks of formatted text */
+#define DAEMON_LOG_TEXT (DAEMON_LOG_SYSLOG | DAEMON_LOG_STDERR | DAEMON_LOG_STDOUT | DAEMON_LOG_FILE)
+
 /** This variable is used to specify the log target(s) to use. Defaults to DAEMON_LOG_STDERR|DAEMON_LOG_AUTO */
 extern enum daemon_log_flags daemon_log_use;
 
@@ -79,28 +87,83 @@ void daemon_logv(int prio, const char * template, va_list arglist);
  */
 char * daemon_ident_from_argv0(char * argv0);
 
+typedef struct {
+    unsigned long records;  /**< Records written by the writer thread */
+    unsigned long dropped;  /**< Records dropped because the ring of their thread was full */
+    unsigned long batches;  /**< Batches the writer took from the rings */
+    unsigned long writes;   /**< writev() calls */
+    unsigned long rings;    /**< Per thread rings allocated */
+} daemon_log_async_stats_t;
+
+/** Switch daemon_log() to the asynchronous mode: the caller formats the message into a ring of
+ * its own thread without locking or blocking, a writer thread adds the time prefix and writes
+ * the records to the sinks in batches. A message arriving at a full ring is dropped and counted,
+ * one longer than 511 bytes is cut and ends in "...".
+ * Start it after daemon_fork(), the records still queued are written at exit().
+ * @return 0 on success, -1 with errno set otherwise */
+int daemon_log_async_start(void);
+
+/** Write the queued records and return to formatting on the calling thread */
+void daemon_log_async_stop(void);
+
+/** Wait up to a second for the writer to empty the rings */
+void daemon_log_flush(void);
+
+void daemon_log_async_stats(daemon_log_async_stats_t *stats);
+
+/** Receives the unformatted daemon_log() calls when DAEMON_LOG_BINARY is in daemon_log_use */
+typedef void (*daemon_log_binary_fn)(int prio, const char *template, va_list arglist);
+
+/** Install the binary sink, NULL removes it */
+void daemon_log_set_binary(daemon_log_binary_fn fn);
+
+struct iovec;
+
+/** Receives whole log lines, prefix and newline included, when DAEMON_LOG_FILE is in daemon_log_use */
+typedef void (*daemon_log_file_fn)(const struct iovec *iov, int count);
+
+/** Install the file sink, NULL removes it */
+void daemon_log_set_file(daemon_log_file_fn fn);
+
+/** Install a function called with every daemon_log() call of a level the log keeps or that is in
+ * prio_mask, a LOG_MASK() set, before the daemon_log_upto() filter. Calls of the other levels are
+ * not formatted at all. NULL removes it */
+void daemon_log_set_recorder(daemon_log_binary_fn fn, unsigned int prio_mask);
+
 unsigned int daemon_log_upto(unsigned int);
 unsigned int  log_check_prio(unsigned int priority);
 const char * daemon_prio_name(unsigned int priority);
 unsigned int    daemon_get_prio(void);
 
+/** Set by daemon_trace_switch(), the DAEMON_TRACE_* macros do nothing else while it is false */
+extern bool daemon_trace_enabled;
+
 void daemon_trace_switch(bool on);
 bool daemon_trace_switch_get();
+/** Begin, end and instant events of func_name on the calling thread's timeline, template is an optional detail */
 void daemon_enter(const char * func_name, const char * template, ...) DAEMON_GCC_PRINTF_ATTR(2, 3);
 void daemon_leave(const char * func_name, const char * template, ...) DAEMON_GCC_PRINTF_ATTR(2, 3);
 void daemon_trace(const char * func_name, const char * template, ...) DAEMON_GCC_PRINTF_ATTR(2, 3);
 void daemon_trace_indent_reset_after_error();
+/** Write the recorded events as Chrome trace-event JSON, for chrome://tracing or ui.perfetto.dev
+ * @return number of events written, -1 with errno set on error */
+long daemon_trace_export(const char * path);
 void hex_dump(const unsigned char * buf, int len);
 
-#ifdef DEBUG
-#define DAEMON_TRACE_ENTER(...)    daemon_enter(__FUNCTION__,__VA_ARGS__)
-#define DAEMON_TRACE_LEAVE(...)    daemon_leave(__FUNCTION__,__VA_ARGS__)
-#define DAEMON_TRACE(...)    daemon_trace(__FUNCTION__,__VA_ARGS__)
-#else
-#define DAEMON_TRACE_ENTER(...)    ;
-#define DAEMON_TRACE_LEAVE(...)    ;
-#define DAEMON_TRACE(...)          ;
-#endif
+/* The detail format is optional: DAEMON_TRACE_ENTER() or DAEMON_TRACE_ENTER("%d", n) */
+#define DAEMON_TRACE_ON() __builtin_expect(__atomic_load_n(&daemon_trace_enabled, __ATOMIC_RELAXED), 0)
+#define DAEMON_TRACE_EVENT(fn, ...) \
+    do { \
+        if (DAEMON_TRACE_ON()) { \
+            _Pragma("GCC diagnostic push") \
+            _Pragma("GCC diagnostic ignored \"-Wformat-zero-length\"") \
+            fn(__FUNCTION__, "" __VA_ARGS__); \
+            _Pragma("GCC diagnostic pop") \
+        } \
+    } while (0)
+#define DAEMON_TRACE_ENTER(...)    DAEMON_TRACE_EVENT(daemon_enter, __VA_ARGS__)
+#define DAEMON_TRACE_LEAVE(...)    DAEMON_TRACE_EVENT(daemon_leave, __VA_ARGS__)
+#define DAEMON_TRACE(...)          DAEMON_TRACE_EVENT(daemon_trace, __VA_ARGS__)
 
 #ifdef  DEBUG
 #define DEBUG_FUNCTION_ENTER  daemon_log(LOG_DEBUG,"DEBUG FUNCTION ENTER %s",__FUNCTION__);
@@ -110,11 +173,74 @@ void hex_dump(const unsigned char * buf, int len);
 #define DEBUG_FUNCTION_LEAVE  ;
 #endif
 
-#define DLOG_ERR(format, ...) daemon_log(LOG_ERR, "[%s] "format, __FUNCTION__, ##__VA_ARGS__)
+/** State of a rate limited or sampled call site, one static instance per DLOG_* macro expansion */
+typedef struct daemon_log_site {
+    const char *file;
+    int line;
+    int prio;
+    /** Token bucket as the theoretical arrival time of the next message, CLOCK_MONOTONIC ns */
+    uint64_t tat_ns;
+    uint64_t interval_ns;
+    uint64_t burst_ns;
+    /** Log one message in sample, 0 or 1 logs all */
+    uint32_t sample;
+    uint32_t count;
+    /** Messages dropped since the last summary */
+    uint32_t suppressed;
+    uint64_t reported_ns;
+    bool listed;
+    struct daemon_log_site *next;
+} daemon_log_site_t;
+
+#define DAEMON_LOG_SITE_INIT(p, per_sec, burst, n) \
+    {__FILE__, __LINE__, (p), 0, 1000000000ULL / (per_sec), 1000000000ULL / (per_sec) * (burst), (n), 0, 0, 0, false, NULL}
+
+/** Takes a token from the bucket of the call site, false if the message is to be dropped.
+ * Logs a summary of the dropped messages at most every DAEMON_LOG_SUMMARY_S seconds. */
+bool daemon_log_site_allow(daemon_log_site_t *site);
+
+/** Log the summary of every call site with dropped messages, for sites gone quiet */
+void daemon_log_sites_report(void);
+
+/** Seconds between two "suppressed" summaries of a call site */
+#define DAEMON_LOG_SUMMARY_S 60
+
+/** Levels above DLOG_LEVEL are compiled out of the DLOG_* macros, e.g. -DDLOG_LEVEL=LOG_INFO */
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL LOG_DEBUG
+#endif
+
+/** Messages per second and burst of a DLOG_* call site */
+#ifndef DLOG_RATE
+#define DLOG_RATE 5
+#endif
+#ifndef DLOG_BURST
+#define DLOG_BURST 20
+#endif
 
-#define DLOG_INFO(format, ...) daemon_log(LOG_INFO, "[%s] "format, __FUNCTION__, ##__VA_ARGS__)
-#define DLOG_WARNING(format, ...) daemon_log(LOG_WARNING, "[%s] "format, __FUNCTION__, ##__VA_ARGS__)
-#define DLOG_DEBUG(format, ...) daemon_log(LOG_DEBUG, "[%s] "format, __FUNCTION__, ##__VA_ARGS__)
+/** Log through the token bucket of the call site: per_sec messages a second, burst at once */
+#define DLOG_LIMIT(prio, per_sec, burst, format, ...) \
+    DLOG_SITE(prio, per_sec, burst, 0, format, ##__VA_ARGS__)
+
+/** Log one in n messages of the call site, for lines hit on every MQTT message */
+#define DLOG_SAMPLE(prio, n, format, ...) \
+    DLOG_SITE(prio, DLOG_RATE, DLOG_BURST, n, format, ##__VA_ARGS__)
+
+#define DLOG_SITE(prio, per_sec, burst, n, format, ...) \
+    do { \
+        if ((prio) <= DLOG_LEVEL) { \
+            static daemon_log_site_t _dlog_site = DAEMON_LOG_SITE_INIT(prio, per_sec, burst, n); \
+            if (daemon_log_site_allow(&_dlog_site)) { \
+                daemon_log(prio, "[%s] "format, __FUNCTION__, ##__VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#define DLOG_ERR(format, ...) DLOG_LIMIT(LOG_ERR, DLOG_RATE, DLOG_BURST, format, ##__VA_ARGS__)
+
+#define DLOG_INFO(format, ...) DLOG_LIMIT(LOG_INFO, DLOG_RATE, DLOG_BURST, format, ##__VA_ARGS__)
+#define DLOG_WARNING(format, ...) DLOG_LIMIT(LOG_WARNING, DLOG_RATE, DLOG_BURST, format, ##__VA_ARGS__)
+#define DLOG_DEBUG(format, ...) DLOG_LIMIT(LOG_DEBUG, DLOG_RATE, DLOG_BURST, format, ##__VA_ARGS__)
 
 
 #ifdef __cplusplus
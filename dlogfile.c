@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "dlogfile.h"
+#include "dlog.h"
+#include "dmem.h"
+#include "dzip.h"
+#include "dfork.h"
+
+// rotation by age is checked this often
+#define LOGFILE_TICK_MS 1000
+#define LOGFILE_IOV 64
+
+/* A writer counts itself in the inflight slot of the current generation
+ * before it loads fd and out after its writev(). The rotation thread swaps
+ * fd, starts the next generation and closes the old fd once the slot of the
+ * old one has drained: later writers count in the other slot, a busy writer
+ * never keeps it from closing. */
+static struct {
+    char *path;
+    size_t max_size;
+    int max_age;
+    size_t budget;
+    int fd;
+    unsigned gen;
+    int inflight[2];
+    uint64_t size;
+    time_t opened;
+    bool pending;
+    bool stop;
+    bool running;
+    sem_t wake;
+    pthread_t thread;
+    daemon_log_file_stats_t stats;
+} lf = {.fd = -1};
+
+typedef struct {
+    char *name;
+    off_t size;
+    time_t mtime;
+} logfile_archive_t;
+
+static void write_iov(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return;
+        }
+        __atomic_add_fetch(&lf.stats.writes, 1, __ATOMIC_RELAXED);
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+}
+
+static void file_write(const struct iovec *iov, int count) {
+    struct iovec local[LOGFILE_IOV];
+    size_t bytes = 0;
+    int saved_errno = errno;
+
+    unsigned gen = __atomic_load_n(&lf.gen, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&lf.inflight[gen & 1], 1, __ATOMIC_SEQ_CST);
+    while (gen != __atomic_load_n(&lf.gen, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&lf.inflight[gen & 1], 1, __ATOMIC_SEQ_CST);
+        gen = __atomic_load_n(&lf.gen, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&lf.inflight[gen & 1], 1, __ATOMIC_SEQ_CST);
+    }
+    int fd = __atomic_load_n(&lf.fd, __ATOMIC_SEQ_CST);
+    // writev() changes the entries it wrote, the caller's are const
+    for (int done = 0; done < count && fd >= 0;) {
+        int n = count - done < LOGFILE_IOV ? count - done : LOGFILE_IOV;
+        memcpy(local, iov + done, (size_t) n * sizeof(struct iovec));
+        for (int i = 0; i < n; i++) {
+            bytes += local[i].iov_len;
+        }
+        write_iov(fd, local, n);
+        done += n;
+    }
+    __atomic_sub_fetch(&lf.inflight[gen & 1], 1, __ATOMIC_SEQ_CST);
+
+    __atomic_add_fetch(&lf.stats.bytes, bytes, __ATOMIC_RELAXED);
+    uint64_t size = __atomic_add_fetch(&lf.size, bytes, __ATOMIC_RELAXED);
+    if (lf.max_size && size >= lf.max_size && !__atomic_exchange_n(&lf.pending, true, __ATOMIC_ACQ_REL)) {
+        sem_post(&lf.wake);
+    }
+    errno = saved_errno;
+}
+
+static int archive_cmp(const void *a, const void *b) {
+    const logfile_archive_t *x = a, *y = b;
+    if (x->mtime != y->mtime) {
+        return x->mtime < y->mtime ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// The part after "<base>." of a name rotate_now() gives: YYYYmmdd-HHMMSS, -n for several
+// rotations a second, .zip once compressed
+static bool rotated_suffix(const char *s) {
+    for (int i = 0; i < 15; i++) {
+        if (i == 8 ? s[i] != '-' : !isdigit((unsigned char) s[i])) {
+            return false;
+        }
+    }
+    s += 15;
+    if (s[0] == '-' && isdigit((unsigned char) s[1])) {
+        for (s++; isdigit((unsigned char) *s); s++) {
+        }
+    }
+    return *s == 0 || strcmp(s, ".zip") == 0;
+}
+
+// Remove the oldest rotated files until they and the current file fit in the budget
+static void enforce_budget(void) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(lf.path, '/');
+    const char *base = slash ? slash + 1 : lf.path;
+    size_t base_len = strlen(base);
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int) (slash - lf.path) : 1, slash ? lf.path : ".");
+
+    DIR *d = opendir(dir[0] ? dir : "/");
+    if (!d) {
+        return;
+    }
+    logfile_archive_t *archives = NULL;
+    size_t count = 0;
+    uint64_t total = __atomic_load_n(&lf.size, __ATOMIC_RELAXED);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        struct stat st;
+        if (strncmp(e->d_name, base, base_len) != 0 || e->d_name[base_len] != '.' ||
+            !rotated_suffix(e->d_name + base_len + 1) || fstatat(dirfd(d), e->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (count % 16 == 0) {
+            archives = xrealloc(archives, (count + 16) * sizeof(logfile_archive_t));
+        }
+        archives[count++] = (logfile_archive_t) {xstrdup(e->d_name), st.st_size, st.st_mtime};
+        total += (uint64_t) st.st_size;
+    }
+    qsort(archives, count, sizeof(logfile_archive_t), archive_cmp);
+    for (size_t i = 0; i < count; i++) {
+        if (total > lf.budget && unlinkat(dirfd(d), archives[i].name, 0) == 0) {
+            total -= (uint64_t) archives[i].size;
+            __atomic_add_fetch(&lf.stats.removed, 1, __ATOMIC_RELAXED);
+        }
+        FREE(archives[i].name);
+    }
+    FREE(archives);
+    closedir(d);
+}
+
+// Swap in fd and wait until no writer holds the previous one
+static int swap_fd(int fd) {
+    int old = __atomic_exchange_n(&lf.fd, fd, __ATOMIC_SEQ_CST);
+    unsigned gen = __atomic_fetch_add(&lf.gen, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&lf.inflight[gen & 1], __ATOMIC_SEQ_CST)) {
+        usleep(100);
+    }
+    return old;
+}
+
+static void rotate_now(void) {
+    char rotated[PATH_MAX], zip[PATH_MAX + 4], stamp[32];
+    struct stat st;
+    time_t now = time(NULL);
+    struct tm tm;
+
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    // several rotations a second get a sequence number
+    snprintf(rotated, sizeof(rotated), "%s.%s", lf.path, stamp);
+    for (int n = 1;; n++) {
+        snprintf(zip, sizeof(zip), "%s.zip", rotated);
+        if (lstat(rotated, &st) < 0 && lstat(zip, &st) < 0) {
+            break;
+        }
+        snprintf(rotated, sizeof(rotated), "%s.%s-%d", lf.path, stamp, n);
+    }
+    if (rename(lf.path, rotated) < 0) {
+        daemon_log(LOG_ERR, "log file %s not rotated: %s", lf.path, strerror(errno));
+        return;
+    }
+    int fd = open(lf.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        // the lines keep going to the renamed file
+        daemon_log(LOG_ERR, "log file %s: %s", lf.path, strerror(errno));
+        return;
+    }
+    __atomic_store_n(&lf.size, 0, __ATOMIC_RELAXED);
+    lf.opened = now;
+    close(swap_fd(fd));
+
+    if (stat(rotated, &st) == 0) {
+        __atomic_add_fetch(&lf.stats.rotated_bytes, (uint64_t) st.st_size, __ATOMIC_RELAXED);
+    }
+    if (compress_zip(rotated, zip) == 0) {
+        if (stat(zip, &st) == 0) {
+            __atomic_add_fetch(&lf.stats.compressed_bytes, (uint64_t) st.st_size, __ATOMIC_RELAXED);
+        }
+        unlink(rotated);
+    }
+    if (lf.budget) {
+        enforce_budget();
+    }
+    __atomic_add_fetch(&lf.stats.rotations, 1, __ATOMIC_RELEASE);
+}
+
+static void *rotate_thread(void *UNUSED(arg)) {
+    pthread_setname_np(pthread_self(), "logrotate");
+    while (!__atomic_load_n(&lf.stop, __ATOMIC_ACQUIRE)) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += LOGFILE_TICK_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        sem_timedwait(&lf.wake, &until);
+        if (__atomic_load_n(&lf.stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        bool due = __atomic_exchange_n(&lf.pending, false, __ATOMIC_ACQ_REL);
+        if (lf.max_age && time(NULL) - lf.opened >= lf.max_age) {
+            due = true;
+        }
+        // an empty file is not worth an archive
+        if (due && __atomic_load_n(&lf.size, __ATOMIC_RELAXED)) {
+            rotate_now();
+        }
+    }
+    return NULL;
+}
+
+int daemon_log_file_open(const char *path, size_t max_size, int max_age, size_t budget) {
+    struct stat st;
+    if (lf.running) {
+        errno = EBUSY;
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (sem_init(&lf.wake, 0, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    lf.path = xstrdup(path);
+    lf.max_size = max_size;
+    lf.max_age = max_age;
+    lf.budget = budget;
+    lf.size = fstat(fd, &st) == 0 ? (uint64_t) st.st_size : 0;
+    lf.opened = time(NULL);
+    lf.pending = false;
+    lf.stop = false;
+    memset(&lf.stats, 0, sizeof(lf.stats));
+    __atomic_store_n(&lf.fd, fd, __ATOMIC_SEQ_CST);
+    int res = pthread_create(&lf.thread, NULL, rotate_thread, NULL);
+    if (res) {
+        close(fd);
+        lf.fd = -1;
+        sem_destroy(&lf.wake);
+        FREE(lf.path);
+        errno = res;
+        return -1;
+    }
+    lf.running = true;
+    daemon_log_set_file(file_write);
+    return 0;
+}
+
+void daemon_log_file_close(void) {
+    if (!lf.running) {
+        return;
+    }
+    daemon_log_set_file(NULL);
+    __atomic_store_n(&lf.stop, true, __ATOMIC_RELEASE);
+    sem_post(&lf.wake);
+    pthread_join(lf.thread, NULL);
+    close(swap_fd(-1));
+    sem_destroy(&lf.wake);
+    FREE(lf.path);
+    lf.running = false;
+}
+
+void daemon_log_file_rotate(void) {
+    if (lf.running && !__atomic_exchange_n(&lf.pending, true, __ATOMIC_ACQ_REL)) {
+        sem_post(&lf.wake);
+    }
+}
+
+void daemon_log_file_stats(daemon_log_file_stats_t *stats) {
+    stats->bytes = __atomic_load_n(&lf.stats.bytes, __ATOMIC_RELAXED);
+    stats->writes = __atomic_load_n(&lf.stats.writes, __ATOMIC_RELAXED);
+    stats->rotations = __atomic_load_n(&lf.stats.rotations, __ATOMIC_RELAXED);
+    stats->rotated_bytes = __atomic_load_n(&lf.stats.rotated_bytes, __ATOMIC_RELAXED);
+    stats->compressed_bytes = __atomic_load_n(&lf.stats.compressed_bytes, __ATOMIC_RELAXED);
+    stats->removed = __atomic_load_n(&lf.stats.removed, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,52 @@
+#ifndef foodaemonlogfilehfoo
+#define foodaemonlogfilehfoo
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file
+ *
+ * Log file sink. With DAEMON_LOG_FILE in daemon_log_use the log lines are
+ * appended to a file opened with O_APPEND, a writev() per line or per batch
+ * of the asynchronous writer. The file is rotated when it reaches max_size
+ * bytes or max_age seconds: a background thread renames it with the time of
+ * the rotation, opens a new one, deflates the old one into a zip archive and
+ * removes the oldest archives until the file and its archives fit in the
+ * disk budget. A writer only adds to the size and wakes that thread, the
+ * rotation never blocks it.
+ */
+
+typedef struct {
+    /** Bytes passed to write, prefixes and newlines included */
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t rotations;
+    /** Bytes of the rotated files and of their archives */
+    uint64_t rotated_bytes;
+    uint64_t compressed_bytes;
+    /** Archives removed to stay within the disk budget */
+    uint64_t removed;
+} daemon_log_file_stats_t;
+
+/** Open path for appending, start the rotation thread and install the sink.
+ * 0 for max_size or max_age disables that rotation, 0 for budget keeps every archive.
+ * @return 0 on success, -1 with errno set otherwise */
+int daemon_log_file_open(const char *path, size_t max_size, int max_age, size_t budget);
+
+/** Stop the rotation thread, uninstall the sink and close the file */
+void daemon_log_file_close(void);
+
+/** Rotate now, the rotation thread does the work */
+void daemon_log_file_rotate(void);
+
+void daemon_log_file_stats(daemon_log_file_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
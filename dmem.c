@@ -1,36 +1,411 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <execinfo.h>
 #include <strings.h>
 #include <string.h>
 #include <search.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "dmem.h"
 #include "dlog.h"
 
+// call sites, the first slot collects the allocations of the sites that don't fit
+#define DMEM_SITES 1024
+#define DMEM_STRIPES 64
+#define DMEM_STRIPE_SLOTS 256
+// the first chunk of an arena, the next ones double
+#define DMEM_ARENA_CHUNK 4096
+// malloc's alignment, enough for any type
+#define DMEM_ARENA_ALIGN 16
+
+typedef struct {
+    void *site;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;
+    uint64_t live;
+    uint64_t peak;
+} dmem_site_t;
+
+typedef struct {
+    uintptr_t ptr;
+    uint32_t site;
+    uint32_t size;
+} dmem_block_t;
+
+/* The live blocks by address, in open addressing tables under a lock per
+ * stripe of addresses. A block knows its call site, so a FREE anywhere
+ * takes the bytes off the site that allocated them. */
+typedef struct {
+    pthread_mutex_t lock;
+    dmem_block_t *blocks;
+    size_t mask;
+    size_t count;
+} dmem_stripe_t;
+
+static bool tracking = false;
+static struct timespec track_start;
+static dmem_site_t sites[DMEM_SITES];
+static dmem_stripe_t stripes[DMEM_STRIPES];
+static uint64_t total_live, total_peak;
+
+static inline uint64_t ptr_hash(uintptr_t p) {
+    return ((uint64_t) p >> 4) * 0x9e3779b97f4a7c15ULL;
+}
+
+static void peak_update(uint64_t *peak, uint64_t live) {
+    uint64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (live > seen && !__atomic_compare_exchange_n(peak, &seen, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static uint32_t site_index(void *site) {
+    uint32_t start = (uint32_t) (ptr_hash((uintptr_t) site) >> 54) % (DMEM_SITES - 1) + 1;
+    uint32_t i = start;
+    do {
+        void *seen = __atomic_load_n(&sites[i].site, __ATOMIC_ACQUIRE);
+        if (seen == site) {
+            return i;
+        }
+        if (!seen && (__atomic_compare_exchange_n(&sites[i].site, &seen, site, false, __ATOMIC_ACQ_REL,
+                                                  __ATOMIC_ACQUIRE) || seen == site)) {
+            return i;
+        }
+        i = i + 1 < DMEM_SITES ? i + 1 : 1;
+    } while (i != start);
+    return 0;
+}
+
+static void site_free(uint32_t site, uint32_t size) {
+    __atomic_add_fetch(&sites[site].frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&sites[site].live, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&total_live, size, __ATOMIC_RELAXED);
+}
+
+// the table of the stripe has grown to half full, the lock is held
+static void stripe_grow(dmem_stripe_t *s) {
+    size_t slots = s->blocks ? (s->mask + 1) * 2 : DMEM_STRIPE_SLOTS;
+    // plain calloc, the tracker doesn't track itself
+    dmem_block_t *blocks = calloc(slots, sizeof(dmem_block_t));
+    if (!blocks) {
+        return;
+    }
+    for (size_t i = 0; s->blocks && i <= s->mask; i++) {
+        if (s->blocks[i].ptr) {
+            size_t j = (ptr_hash(s->blocks[i].ptr) >> 6) & (slots - 1);
+            while (blocks[j].ptr) {
+                j = (j + 1) & (slots - 1);
+            }
+            blocks[j] = s->blocks[i];
+        }
+    }
+    free(s->blocks);
+    s->blocks = blocks;
+    s->mask = slots - 1;
+}
+
+static void track_alloc(void *ptr, size_t n, uint32_t site) {
+    uint64_t h = ptr_hash((uintptr_t) ptr);
+    dmem_stripe_t *s = &stripes[h % DMEM_STRIPES];
+    uint32_t size = n < UINT32_MAX ? (uint32_t) n : UINT32_MAX;
+
+    __atomic_add_fetch(&sites[site].allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sites[site].bytes, size, __ATOMIC_RELAXED);
+    peak_update(&sites[site].peak, __atomic_add_fetch(&sites[site].live, size, __ATOMIC_RELAXED));
+    peak_update(&total_peak, __atomic_add_fetch(&total_live, size, __ATOMIC_RELAXED));
+
+    pthread_mutex_lock(&s->lock);
+    if ((s->count + 1) * 2 > (s->blocks ? s->mask + 1 : 0)) {
+        stripe_grow(s);
+    }
+    if (s->blocks) {
+        size_t i = (h >> 6) & s->mask;
+        while (s->blocks[i].ptr && s->blocks[i].ptr != (uintptr_t) ptr) {
+            i = (i + 1) & s->mask;
+        }
+        if (s->blocks[i].ptr) {
+            // released by plain free() and handed out again
+            site_free(s->blocks[i].site, s->blocks[i].size);
+        } else {
+            s->count++;
+        }
+        s->blocks[i] = (dmem_block_t) {(uintptr_t) ptr, site, size};
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Forget ptr, false if it was allocated before tracking started or not by an x function
+static bool track_free(void *ptr, dmem_block_t *block) {
+    uint64_t h = ptr_hash((uintptr_t) ptr);
+    dmem_stripe_t *s = &stripes[h % DMEM_STRIPES];
+    bool found = false;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->blocks) {
+        size_t i = (h >> 6) & s->mask;
+        while (s->blocks[i].ptr && s->blocks[i].ptr != (uintptr_t) ptr) {
+            i = (i + 1) & s->mask;
+        }
+        if (s->blocks[i].ptr) {
+            found = true;
+            *block = s->blocks[i];
+            // shift the following entries back, the probe sequences stay unbroken without tombstones
+            for (size_t j = (i + 1) & s->mask; s->blocks[j].ptr; j = (j + 1) & s->mask) {
+                size_t home = (ptr_hash(s->blocks[j].ptr) >> 6) & s->mask;
+                if (((j - home) & s->mask) >= ((j - i) & s->mask)) {
+                    s->blocks[i] = s->blocks[j];
+                    i = j;
+                }
+            }
+            s->blocks[i].ptr = 0;
+            s->count--;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (found) {
+        site_free(block->site, block->size);
+    }
+    return found;
+}
+
+static void * alloc_at(size_t n, void *caller) {
+    if (!n) return(NULL);
+    // fresh pages from calloc are already zero, bzero() would touch them all
+    void * p = calloc (1, n);
+    if (p && __atomic_load_n(&tracking, __ATOMIC_RELAXED)) track_alloc(p, n, site_index(caller));
+    return p;
+}
+
 char * xstrdup(const char * s) {
     if (!s)
         return (char *) 0;
     size_t len = strlen (s) + 1;
-    char * result = (char *) xmalloc (len);
+    char * result = (char *) alloc_at (len, __builtin_return_address(0));
     if (result == (char *) 0)
         return (char *) 0;
     return (char *) memcpy (result, s, len);
 }
 
 void * xmalloc (size_t n) {
-    if (!n) return(NULL);
-    void * p = malloc (n);
-    if (p) bzero(p, n);
-    return p;
+    return alloc_at(n, __builtin_return_address(0));
 }
 
 void * xrealloc(void * ptr, size_t n) {
+    if (!__atomic_load_n(&tracking, __ATOMIC_RELAXED)) {
+        return realloc(ptr, n);
+    }
+    // forgotten before realloc(), another thread may get the address right after
+    dmem_block_t old;
+    bool known = ptr && track_free(ptr, &old);
     void * p = realloc (ptr, n);
+    if (p) {
+        track_alloc(p, n, site_index(__builtin_return_address(0)));
+    } else if (known && n) {
+        // ptr is still allocated
+        track_alloc(ptr, old.size, old.site);
+    }
     return(p);
 }
 
 void xfree(void * ptr) {
     if (ptr) {
+        dmem_block_t block;
+        if (__atomic_load_n(&tracking, __ATOMIC_RELAXED)) track_free(ptr, &block);
         free(ptr);
     }
 }
+
+void dmem_track_start(void) {
+    if (__atomic_load_n(&tracking, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    for (int i = 0; i < DMEM_STRIPES; i++) {
+        pthread_mutex_init(&stripes[i].lock, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &track_start);
+    __atomic_store_n(&tracking, true, __ATOMIC_RELEASE);
+}
+
+void dmem_stats(dmem_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < DMEM_SITES; i++) {
+        uint64_t allocs = __atomic_load_n(&sites[i].allocs, __ATOMIC_RELAXED);
+        stats->sites += allocs ? 1 : 0;
+        stats->allocs += allocs;
+        stats->frees += __atomic_load_n(&sites[i].frees, __ATOMIC_RELAXED);
+    }
+    stats->live = __atomic_load_n(&total_live, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+}
+
+static int cmp_live(const void *a, const void *b) {
+    const dmem_site_t *x = a, *y = b;
+    return x->live != y->live ? (x->live < y->live ? 1 : -1) : (x->allocs < y->allocs) - (x->allocs > y->allocs);
+}
+
+static int cmp_allocs(const void *a, const void *b) {
+    const dmem_site_t *x = a, *y = b;
+    return x->allocs != y->allocs ? (x->allocs < y->allocs ? 1 : -1) : (x->live < y->live) - (x->live > y->live);
+}
+
+static void report_sites(const char *title, bool live, dmem_site_t *copy, int count, int top, double seconds) {
+    void *addrs[DMEM_SITES];
+    int n = 0;
+    for (; n < count && n < top && (copy[n].live || !live); n++) {
+        addrs[n] = copy[n].site;
+    }
+    if (!n) {
+        return;
+    }
+    daemon_log(LOG_INFO, "mem: top %d by %s", n, title);
+    // the symbols need -rdynamic, otherwise addr2line -f -e the binary takes the offsets
+    char **names = backtrace_symbols(addrs, n);
+    for (int i = 0; i < n; i++) {
+        dmem_site_t *s = &copy[i];
+        daemon_log(LOG_INFO, "mem: %10lu live %10lu peak %7lu blocks %10lu allocs %9.1f/s %12lu bytes  %s",
+                   (unsigned long) s->live, (unsigned long) s->peak, (unsigned long) (s->allocs - s->frees),
+                   (unsigned long) s->allocs, (double) s->allocs / seconds, (unsigned long) s->bytes,
+                   !s->site ? "(other sites)" : names ? names[i] : "?");
+    }
+    free(names);
+}
+
+void dmem_report(int top) {
+    if (!__atomic_load_n(&tracking, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (double) (now.tv_sec - track_start.tv_sec) + (double) (now.tv_nsec - track_start.tv_nsec) / 1e9;
+    seconds = seconds > 0.0 ? seconds : 1.0;
+
+    dmem_site_t *copy = calloc(DMEM_SITES, sizeof(dmem_site_t));
+    if (!copy) {
+        return;
+    }
+    int count = 0;
+    for (int i = 0; i < DMEM_SITES; i++) {
+        dmem_site_t *s = &copy[count];
+        s->allocs = __atomic_load_n(&sites[i].allocs, __ATOMIC_RELAXED);
+        if (!s->allocs) {
+            continue;
+        }
+        s->site = __atomic_load_n(&sites[i].site, __ATOMIC_ACQUIRE);
+        s->frees = __atomic_load_n(&sites[i].frees, __ATOMIC_RELAXED);
+        s->bytes = __atomic_load_n(&sites[i].bytes, __ATOMIC_RELAXED);
+        s->live = __atomic_load_n(&sites[i].live, __ATOMIC_RELAXED);
+        s->peak = __atomic_load_n(&sites[i].peak, __ATOMIC_RELAXED);
+        // frees racing with the copy
+        s->frees = s->frees < s->allocs ? s->frees : s->allocs;
+        count++;
+    }
+
+    dmem_stats_t stats;
+    dmem_stats(&stats);
+    daemon_log(LOG_INFO, "mem: %lu bytes live in %lu blocks, peak %lu, %lu allocs %.1f/s over %.1f s at %lu sites",
+               (unsigned long) stats.live, (unsigned long) (stats.allocs - stats.frees), (unsigned long) stats.peak,
+               (unsigned long) stats.allocs, (double) stats.allocs / seconds, seconds, (unsigned long) stats.sites);
+    // still allocated: the working set while running, the leaks at exit
+    qsort(copy, (size_t) count, sizeof(dmem_site_t), cmp_live);
+    report_sites("live bytes", true, copy, count, top, seconds);
+    qsort(copy, (size_t) count, sizeof(dmem_site_t), cmp_allocs);
+    report_sites("allocations", false, copy, count, top, seconds);
+    free(copy);
+}
+
+struct dmem_arena_chunk {
+    dmem_arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    unsigned char data[] __attribute__ ((aligned (DMEM_ARENA_ALIGN)));
+};
+
+// a chunk for at least n more bytes, in front of the current one
+static bool arena_grow(dmem_arena_t *a, size_t n) {
+    size_t size = a->chunk ? a->chunk->size * 2 : DMEM_ARENA_CHUNK;
+    size = size < n ? n : size;
+    // plain malloc, a chunk is neither zeroed nor tracked
+    dmem_arena_chunk_t *chunk = malloc(sizeof(dmem_arena_chunk_t) + size);
+    if (!chunk) {
+        return false;
+    }
+    chunk->next = a->chunk;
+    chunk->size = size;
+    chunk->used = 0;
+    a->chunk = chunk;
+    a->grows++;
+    return true;
+}
+
+void * dmem_arena_alloc(dmem_arena_t * a, size_t n) {
+    n = (n + DMEM_ARENA_ALIGN - 1) & ~(DMEM_ARENA_ALIGN - 1);
+    if ((!a->chunk || a->chunk->size - a->chunk->used < n) && !arena_grow(a, n)) {
+        return NULL;
+    }
+    void *p = a->chunk->data + a->chunk->used;
+    a->chunk->used += n;
+    a->used += n;
+    return p;
+}
+
+char * dmem_arena_strdup(dmem_arena_t * a, const char * s) {
+    if (!s)
+        return NULL;
+    size_t len = strlen(s) + 1;
+    char *result = dmem_arena_alloc(a, len);
+    return result ? memcpy(result, s, len) : NULL;
+}
+
+char * dmem_arena_printf(dmem_arena_t * a, const char * format, ...) {
+    va_list ap, ap2;
+    va_start(ap, format);
+    va_copy(ap2, ap);
+    // formatted in place when the rest of the chunk is enough, the usual case
+    size_t room = a->chunk ? a->chunk->size - a->chunk->used : 0;
+    char *p = a->chunk ? (char *) a->chunk->data + a->chunk->used : NULL;
+    int len = vsnprintf(p, room, format, ap);
+    va_end(ap);
+    if (len >= 0 && (size_t) len >= room) {
+        p = dmem_arena_alloc(a, (size_t) len + 1);
+        if (p) {
+            vsnprintf(p, (size_t) len + 1, format, ap2);
+        }
+    } else if (len >= 0) {
+        p = dmem_arena_alloc(a, (size_t) len + 1);
+    } else {
+        p = NULL;
+    }
+    va_end(ap2);
+    return p;
+}
+
+void dmem_arena_reset(dmem_arena_t * a) {
+    a->high = a->used > a->high ? a->used : a->high;
+    a->used = 0;
+    if (a->chunk && a->chunk->next) {
+        size_t size = 0;
+        while (a->chunk) {
+            dmem_arena_chunk_t *next = a->chunk->next;
+            size += a->chunk->size;
+            free(a->chunk);
+            a->chunk = next;
+        }
+        arena_grow(a, size);
+    } else if (a->chunk) {
+        a->chunk->used = 0;
+    }
+}
+
+void dmem_arena_free(dmem_arena_t * a) {
+    while (a->chunk) {
+        dmem_arena_chunk_t *next = a->chunk->next;
+        free(a->chunk);
+        a->chunk = next;
+    }
+    a->used = 0;
+}
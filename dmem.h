@@ -1,11 +1,56 @@
 #ifndef foodmemh
 #define foodmemh
 #include <stdlib.h>
+#include <stdint.h>
 
 void * xmalloc (size_t);
 void * xrealloc(void *, size_t);
 void xfree(void * ptr);
 char * xstrdup(const char * s);
+
+/* Allocation tracking. Once started, the blocks of xmalloc, xstrdup and
+ * xrealloc are counted per call site (the return address) until xfree or
+ * FREE: live bytes, peak, allocations and bytes. Blocks from other
+ * allocators passed to FREE are ignored. A hash lookup and an uncontended
+ * lock per call, tracking stays on until exit. */
+typedef struct {
+    uint64_t live;
+    uint64_t peak;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t sites;
+} dmem_stats_t;
+
+void dmem_track_start(void);
+void dmem_stats(dmem_stats_t * stats);
+/** Log the totals and the top call sites by live bytes and by allocations */
+void dmem_report(int top);
+
+/* Arenas for transient data, owned by one thread. An allocation bumps a
+ * pointer in the current chunk, nothing is freed on its own and
+ * dmem_arena_reset() takes everything back at once. A reset merges the
+ * chunks into one of their total size, so an arena reset once per message
+ * or per frame settles on a single chunk and stops calling malloc. */
+typedef struct dmem_arena_chunk dmem_arena_chunk_t;
+
+typedef struct {
+    dmem_arena_chunk_t * chunk;
+    /** Bytes handed out since the last reset, the most of any turn and the chunks added */
+    size_t used;
+    size_t high;
+    uint64_t grows;
+} dmem_arena_t;
+
+#define DMEM_ARENA_INIT {NULL, 0, 0, 0}
+
+/** n bytes aligned for any type, not zeroed, NULL when out of memory */
+void * dmem_arena_alloc(dmem_arena_t * a, size_t n);
+char * dmem_arena_strdup(dmem_arena_t * a, const char * s);
+/** asprintf() into the arena */
+char * dmem_arena_printf(dmem_arena_t * a, const char * format, ...) __attribute__ ((format (printf, 2, 3)));
+void dmem_arena_reset(dmem_arena_t * a);
+/** Give the chunks back to malloc, the arena can be used again */
+void dmem_arena_free(dmem_arena_t * a);
 #ifndef FREE
 
 #define FREE(x) \
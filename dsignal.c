@@ -5,35 +5,99 @@
 #include <string.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
 
 #include "dnonblock.h"
 #include "dsignal.h"
 #include "dlog.h"
 
+/* Records taken by one read() */
+#define SIGNAL_BATCH 16
+
+/* With signalfd() the signals are blocked and read as records, no handler
+ * runs. Without it a handler writes a record per signal to the pipe. */
+static int _signal_fd = -1;
 static int _signal_pipe[2] = { -1, -1 };
+static sigset_t _signal_set;
+static unsigned _signal_dropped;
 
-static void _sigfunc(int s) {
-    if (write(_signal_pipe[1], &s, sizeof(s)) < 0) {
-//        daemon_log(LOG_ERR,"signal pipe write error %s",strerror(errno));//
-    }
+/* The records of the last read(), handed out one at a time */
+static daemon_signal_info_t _queue[SIGNAL_BATCH];
+static int _queue_head = 0, _queue_len = 0;
+static pthread_mutex_t _signal_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void _sigfunc(int s, siginfo_t * si, void * context) {
+    daemon_signal_info_t info = { s, si->si_code, si->si_pid, si->si_uid };
+    int saved_errno = errno;
+
+    (void) context;
+
+    /* Below PIPE_BUF the record is written whole or not at all */
+    if (write(_signal_pipe[1], &info, sizeof(info)) < 0)
+        __atomic_add_fetch(&_signal_dropped, 1, __ATOMIC_RELAXED);
+
+    errno = saved_errno;
 }
 
 static int _init(void) {
 
-    if (_signal_pipe[0] < 0 || _signal_pipe[1] < 0) {
-        if (pipe(_signal_pipe) < 0) {
-            daemon_log(LOG_ERR, "pipe(): %s", strerror(errno));
-            return -1;
-        }
+    if (_signal_fd >= 0 || (_signal_pipe[0] >= 0 && _signal_pipe[1] >= 0))
+        return 0;
+
+    sigemptyset(&_signal_set);
 
-        if (daemon_nonblock(_signal_pipe[0], 1) < 0 || daemon_nonblock(_signal_pipe[1], 1) < 0)
-            return -1;
+#ifdef __linux__
+    if ((_signal_fd = signalfd(-1, &_signal_set, SFD_NONBLOCK | SFD_CLOEXEC)) >= 0)
+        return 0;
+
+    daemon_log(LOG_WARNING, "signalfd(): %s, using a pipe", strerror(errno));
+#endif
+
+    if (pipe(_signal_pipe) < 0) {
+        daemon_log(LOG_ERR, "pipe(): %s", strerror(errno));
+        return -1;
     }
 
+    if (daemon_nonblock(_signal_pipe[0], 1) < 0 || daemon_nonblock(_signal_pipe[1], 1) < 0)
+        return -1;
+
     return 0;
 }
 
-int daemon_signal_install(int s) {
+#ifdef __linux__
+static int _install_signalfd(int s, const sigset_t * ss) {
+    struct sigaction sa;
+
+    /* An ignored signal is discarded before it could be queued */
+    if (sigaction(s, NULL, &sa) == 0 && sa.sa_handler == SIG_IGN) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = SIG_DFL;
+        sigemptyset(&sa.sa_mask);
+        sigaction(s, &sa, NULL);
+    }
+
+    /* The threads started from here on inherit the mask */
+    if ((errno = pthread_sigmask(SIG_BLOCK, ss, NULL)) != 0) {
+        daemon_log(LOG_ERR, "pthread_sigmask(): %s", strerror(errno));
+        return -1;
+    }
+
+    sigaddset(&_signal_set, s);
+
+    if (signalfd(_signal_fd, &_signal_set, SFD_NONBLOCK | SFD_CLOEXEC) < 0) {
+        daemon_log(LOG_ERR, "signalfd(%s, ...) failed: %s", strsignal(s), strerror(errno));
+        sigdelset(&_signal_set, s);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+static int _install(int s) {
     sigset_t ss;
     struct sigaction sa;
 
@@ -50,15 +114,20 @@ int daemon_signal_install(int s) {
         return -1;
     }
 
+#ifdef __linux__
+    if (_signal_fd >= 0)
+        return _install_signalfd(s, &ss);
+#endif
+
     if (sigprocmask(SIG_UNBLOCK, &ss, NULL) < 0) {
         daemon_log(LOG_ERR, "sigprocmask(): %s", strerror(errno));
         return -1;
     }
 
     memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = _sigfunc;
+    sa.sa_sigaction = _sigfunc;
     sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
 
     if (sigaction(s, &sa, NULL) < 0) {
         daemon_log(LOG_ERR, "sigaction(%s, ...) failed: %s", strsignal(s), strerror(errno));
@@ -68,20 +137,33 @@ int daemon_signal_install(int s) {
     return 0;
 }
 
+int daemon_signal_install(int s) {
+    int r;
+
+    pthread_mutex_lock(&_signal_mutex);
+    r = _install(s);
+    pthread_mutex_unlock(&_signal_mutex);
+
+    return r;
+}
+
 int daemon_signal_init(int s, ...) {
     int sig, r = 0;
 
     va_list ap;
     va_start(ap, s);
 
+    pthread_mutex_lock(&_signal_mutex);
+
     if (_init() < 0) {
+        pthread_mutex_unlock(&_signal_mutex);
         va_end(ap);
         return -1;
     }
 
     sig = s;
     while (sig > 0) {
-        if (daemon_signal_install(sig) < 0) {
+        if (_install(sig) < 0) {
             r = -1;
             break;
         }
@@ -89,42 +171,99 @@ int daemon_signal_init(int s, ...) {
         sig = va_arg(ap, int);
     }
 
+    pthread_mutex_unlock(&_signal_mutex);
+
     va_end(ap);
 
     return r;
 }
 
 void daemon_signal_done(void) {
+    pthread_mutex_lock(&_signal_mutex);
+
+    if (_signal_fd != -1)
+        close(_signal_fd);
+
     if (_signal_pipe[0] != -1)
         close(_signal_pipe[0]);
 
     if (_signal_pipe[1] != -1)
         close(_signal_pipe[1]);
 
-    _signal_pipe[0] = _signal_pipe[1] = -1;
+    _signal_fd = _signal_pipe[0] = _signal_pipe[1] = -1;
+    _queue_head = _queue_len = 0;
+
+    pthread_mutex_unlock(&_signal_mutex);
 }
 
-int daemon_signal_next(void) {
-    int s;
+/* Read the records waiting, as many as fit in the queue */
+static int _fill(void) {
+    unsigned dropped;
     ssize_t r;
 
-    if ((r = read(_signal_pipe[0], &s, sizeof(s))) == sizeof(s))
-        return s;
+    _queue_head = _queue_len = 0;
+
+    if ((dropped = __atomic_exchange_n(&_signal_dropped, 0, __ATOMIC_RELAXED)) > 0)
+        daemon_log(LOG_WARNING, "%u signals lost on a full signal pipe", dropped);
+
+#ifdef __linux__
+    if (_signal_fd >= 0) {
+        struct signalfd_siginfo si[SIGNAL_BATCH];
+        int i;
 
-    if (r < 0) {
+        if ((r = read(_signal_fd, si, sizeof(si))) < 0)
+            goto fail;
 
-        if (errno == EAGAIN)
-            return 0;
-        else {
-            daemon_log(LOG_ERR, "read(signal_pipe[0], ...): %s", strerror(errno));
-            return -1;
+        for (i = 0; i < (int) (r / (ssize_t) sizeof(si[0])); i++) {
+            _queue[i].signo = (int) si[i].ssi_signo;
+            _queue[i].code = si[i].ssi_code;
+            _queue[i].pid = (pid_t) si[i].ssi_pid;
+            _queue[i].uid = (uid_t) si[i].ssi_uid;
         }
+
+        return _queue_len = i;
     }
+#endif
+
+    if ((r = read(_signal_pipe[0], _queue, sizeof(_queue))) < 0)
+        goto fail;
 
-    daemon_log(LOG_ERR, "Short read() on signal pipe.");
+    if (r % (ssize_t) sizeof(_queue[0]) != 0) {
+        daemon_log(LOG_ERR, "Short read() on signal pipe.");
+        return -1;
+    }
+
+    return _queue_len = (int) (r / (ssize_t) sizeof(_queue[0]));
+
+fail:
+    if (errno == EAGAIN)
+        return 0;
+
+    daemon_log(LOG_ERR, "read(signal fd, ...): %s", strerror(errno));
     return -1;
 }
 
+int daemon_signal_next_info(daemon_signal_info_t * info) {
+    int r = 0;
+
+    pthread_mutex_lock(&_signal_mutex);
+
+    if (_queue_head < _queue_len || (r = _fill()) > 0) {
+        *info = _queue[_queue_head++];
+        r = info->signo;
+    }
+
+    pthread_mutex_unlock(&_signal_mutex);
+
+    return r;
+}
+
+int daemon_signal_next(void) {
+    daemon_signal_info_t info;
+
+    return daemon_signal_next_info(&info);
+}
+
 int daemon_signal_fd(void) {
-    return _signal_pipe[0];
+    return _signal_fd >= 0 ? _signal_fd : _signal_pipe[0];
 }
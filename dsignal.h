@@ -21,14 +21,16 @@
  * 02110-1301 USA
  */
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /** \file
  *
- * Contains the API for serializing signals to a pipe for
- * usage with select() or poll().
+ * Contains the API for serializing signals to a file descriptor for
+ * usage with select(), poll() or epoll.
  *
  * You should register all signals you
  * wish to handle with select() in your main loop with
@@ -36,8 +38,22 @@ extern "C" {
  * should sleep on the file descriptor returned by daemon_signal_fd()
  * and get the next signal recieved with daemon_signal_next(). You
  * should call daemon_signal_done() before exiting.
+ *
+ * On Linux the signals are blocked and read from a signalfd(), no
+ * handler runs. The mask is per thread: register the signals before
+ * starting any thread, a thread that has one unblocked takes it with
+ * its default action. Children should unblock them before exec().
+ * Elsewhere, or where signalfd() fails, a handler writes them to a pipe.
  */
 
+/** A signal and its sender */
+typedef struct {
+    int signo;  /**< The signal */
+    int code;   /**< si_code, SI_USER from kill(), SI_QUEUE from sigqueue() */
+    pid_t pid;  /**< The sending process, for SI_USER, SI_QUEUE and SIGCHLD */
+    uid_t uid;  /**< Its real user id */
+} daemon_signal_info_t;
+
 /** Installs signal handlers for the specified signals
  * @param s, ... The signals to install handlers for. The list should be terminated by 0
  * @return zero on success, nonzero on failure
@@ -50,7 +66,8 @@ int daemon_signal_init(int s, ...);
  */
 int daemon_signal_install(int s);
 
-/** Free resources of signal handling, should be called before daemon exit
+/** Free resources of signal handling, should be called before daemon exit.
+ * With signalfd() the signals stay blocked.
  */
 void daemon_signal_done(void);
 
@@ -61,6 +78,13 @@ void daemon_signal_done(void);
  */
 int daemon_signal_next(void);
 
+/** The same as daemon_signal_next() with the sender in info.
+ * Records are read several at a time, call it until it returns zero
+ * whenever the descriptor is ready.
+ * @return The signal, zero if none is queued, negative on failure.
+ */
+int daemon_signal_next_info(daemon_signal_info_t * info);
+
 /** Return the file descriptor the daemon should select() on for
  * reading. Whenever the descriptor is ready you should call
  * daemon_signal_next() to get the next signal queued.
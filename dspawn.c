@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "dspawn.h"
+#include "dlog.h"
+#include "dmem.h"
+#include "dnonblock.h"
+
+#define SPAWN_MAX_ARGS 100
+// reads of a child per dispatch, a chatty one doesn't hold up the others
+#define SPAWN_READS 16
+#define SPAWN_EVENTS 16
+
+// posix_spawn() closes the inherited descriptors with close_range() from glibc 2.34 on
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+#define SPAWN_POSIX 1
+#endif
+
+extern char **environ;
+
+typedef struct {
+    char buf[DAEMON_SPAWN_LINE];
+    size_t len;
+} spawn_lines_t;
+
+typedef struct spawn_child {
+    struct spawn_child *next;
+    pid_t pid;
+    // -1 once at end of file and once reaped
+    int out;
+    int pidfd;
+    bool exited;
+    int status;
+    spawn_lines_t lines;
+    daemon_spawn_line_fn line;
+    daemon_spawn_done_fn done;
+    void *userdata;
+} spawn_child_t;
+
+/* Recursive: a line callback may start another child. The done callbacks
+ * run after the lock is released. */
+static pthread_mutex_t spawn_mtx = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static spawn_child_t *children = NULL;
+static int children_count = 0;
+static int epfd = -1;
+static daemon_spawn_stats_t spawn_stats;
+
+// the signals superclock catches or ignores start with their default action in the child
+static void default_signals(sigset_t *set) {
+    sigemptyset(set);
+    sigaddset(set, SIGHUP);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTERM);
+    sigaddset(set, SIGPIPE);
+    sigaddset(set, SIGCHLD);
+    sigaddset(set, SIGUSR1);
+    sigaddset(set, SIGUSR2);
+}
+
+#ifndef SPAWN_POSIX
+// fork() child: only calls that are safe after fork() in a threaded process until execvp(), no
+// malloc() or opendir() whose locks another thread may have held at the fork. fd_max is taken
+// before the fork for the close() loop where close_range() is missing.
+static void child_exec(const char *dir, char *const args[], int out, int fd_max) {
+    sigset_t set;
+    int fd = open("/dev/null", O_RDONLY);
+    if (fd > 0) {
+        dup2(fd, 0);
+        close(fd);
+    }
+    dup2(out, 1);
+    dup2(out, 2);
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3U, ~0U, 0) < 0)
+#endif
+    {
+        for (int fd = 3; fd < fd_max; fd++) {
+            close(fd);
+        }
+    }
+    if (dir && chdir(dir) < 0 && chdir("/") < 0) {
+        _exit(127);
+    }
+    default_signals(&set);
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sigismember(&set, sig) == 1) {
+            signal(sig, SIG_DFL);
+        }
+    }
+    sigemptyset(&set);
+    sigprocmask(SIG_SETMASK, &set, NULL);
+    execvp(args[0], args);
+    _exit(127);
+}
+#endif
+
+// Start the child with its output on a pipe, *out gets the read end
+static pid_t spawn_start(const char *dir, char *const args[], int *out) {
+    int p[2];
+    pid_t pid;
+
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        return -1;
+    }
+#ifdef SPAWN_POSIX
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none, defaults;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, p[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, p[1], 2);
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+    if (dir) {
+        posix_spawn_file_actions_addchdir_np(&actions, dir);
+    }
+    sigemptyset(&none);
+    default_signals(&defaults);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    // vfork() semantics: no page tables copied, the parent waits for the exec only
+    int res = posix_spawnp(&pid, args[0], &actions, &attr, args, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (res) {
+        close(p[0]);
+        close(p[1]);
+        errno = res;
+        return -1;
+    }
+#else
+    long open_max = sysconf(_SC_OPEN_MAX);
+    int fd_max = open_max > 0 && open_max < 65536 ? (int) open_max : 65536;
+    if ((pid = fork()) < 0) {
+        int saved_errno = errno;
+        close(p[0]);
+        close(p[1]);
+        errno = saved_errno;
+        return -1;
+    } else if (pid == 0) {
+        child_exec(dir, args, p[1], fd_max);
+    }
+#endif
+    close(p[1]);
+    *out = p[0];
+    __atomic_add_fetch(&spawn_stats.spawned, 1, __ATOMIC_RELAXED);
+    return pid;
+}
+
+static void lines_flush(spawn_lines_t *l, pid_t pid, daemon_spawn_line_fn line, void *userdata) {
+    if (!l->len) {
+        return;
+    }
+    l->buf[l->len] = 0;
+    l->len = 0;
+    __atomic_add_fetch(&spawn_stats.lines, 1, __ATOMIC_RELAXED);
+    if (line) {
+        line(pid, l->buf, userdata);
+    } else {
+        daemon_log(LOG_INFO, "child %d: %s", (int) pid, l->buf);
+    }
+}
+
+// Split a block of output into lines, the last one is kept until its newline comes
+static void lines_feed(spawn_lines_t *l, const char *data, size_t n, pid_t pid, daemon_spawn_line_fn line,
+                       void *userdata) {
+    __atomic_add_fetch(&spawn_stats.reads, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&spawn_stats.bytes, n, __ATOMIC_RELAXED);
+    while (n > 0) {
+        const char *nl = memchr(data, '\n', n);
+        size_t segment = nl ? (size_t) (nl - data) : n;
+        size_t room = sizeof(l->buf) - 1 - l->len;
+        size_t take = segment < room ? segment : room;
+        memcpy(l->buf + l->len, data, take);
+        l->len += take;
+        data += take;
+        n -= take;
+        if (take < segment) {
+            lines_flush(l, pid, line, userdata);
+        } else if (nl) {
+            data++;
+            n--;
+            lines_flush(l, pid, line, userdata);
+        }
+    }
+}
+
+static void epoll_del(int *fd) {
+    if (epfd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, *fd, NULL);
+    }
+    close(*fd);
+    *fd = -1;
+}
+
+static void child_read(spawn_child_t *c) {
+    char buf[DAEMON_SPAWN_READ];
+    for (int i = 0; i < SPAWN_READS && c->out >= 0; i++) {
+        ssize_t n = read(c->out, buf, sizeof(buf));
+        if (n > 0) {
+            lines_feed(&c->lines, buf, (size_t) n, c->pid, c->line, c->userdata);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            break;
+        } else {
+            lines_flush(&c->lines, c->pid, c->line, c->userdata);
+            epoll_del(&c->out);
+        }
+    }
+}
+
+static void child_reap(spawn_child_t *c) {
+    int status;
+    pid_t r = waitpid(c->pid, &status, WNOHANG);
+    if (r == 0 || (r < 0 && errno == EINTR)) {
+        return;
+    }
+    // ECHILD: reaped by someone else, SIGCHLD ignored
+    c->exited = true;
+    c->status = r == c->pid ? status : -1;
+    if (c->pidfd >= 0) {
+        epoll_del(&c->pidfd);
+    }
+    __atomic_add_fetch(&spawn_stats.exited, 1, __ATOMIC_RELAXED);
+}
+
+static spawn_child_t *child_of_fd(int fd) {
+    for (spawn_child_t *c = children; c; c = c->next) {
+        if (c->out == fd || c->pidfd == fd) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void epoll_add(int fd) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    if (epfd < 0) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    if (epfd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        daemon_log(LOG_WARNING, "spawn: epoll_ctl(): %s", strerror(errno));
+    }
+}
+
+pid_t daemon_spawnv(const char * dir, char * const args[], daemon_spawn_line_fn line, daemon_spawn_done_fn done,
+                    void * userdata) {
+    int out;
+    pid_t pid = spawn_start(dir, args, &out);
+    if (pid < 0) {
+        daemon_log(LOG_ERR, "spawn %s: %s", args[0], strerror(errno));
+        return -1;
+    }
+    daemon_nonblock(out, 1);
+
+    spawn_child_t *c = xmalloc(sizeof(spawn_child_t));
+    c->pid = pid;
+    c->out = out;
+#ifdef SYS_pidfd_open
+    c->pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    c->pidfd = -1;
+#endif
+    c->line = line;
+    c->done = done;
+    c->userdata = userdata;
+
+    pthread_mutex_lock(&spawn_mtx);
+    epoll_add(c->out);
+    if (c->pidfd >= 0) {
+        epoll_add(c->pidfd);
+    }
+    c->next = children;
+    children = c;
+    __atomic_add_fetch(&children_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&spawn_mtx);
+    return pid;
+}
+
+pid_t daemon_spawn(const char * dir, daemon_spawn_line_fn line, daemon_spawn_done_fn done, void * userdata,
+                   const char * prog, ...) {
+    char *args[SPAWN_MAX_ARGS];
+    va_list ap;
+    int i;
+
+    args[0] = (char *) prog;
+    va_start(ap, prog);
+    for (i = 1; i < SPAWN_MAX_ARGS - 1; i++)
+        if (!(args[i] = va_arg(ap, char *)))
+            break;
+    va_end(ap);
+    args[i] = NULL;
+    return daemon_spawnv(dir, args, line, done, userdata);
+}
+
+int daemon_spawn_fd(void) {
+    pthread_mutex_lock(&spawn_mtx);
+    int fd = epfd;
+    pthread_mutex_unlock(&spawn_mtx);
+    return fd;
+}
+
+int daemon_spawn_dispatch(void) {
+    struct epoll_event events[SPAWN_EVENTS];
+    spawn_child_t *finished = NULL;
+
+    if (!__atomic_load_n(&children_count, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    pthread_mutex_lock(&spawn_mtx);
+    int n = epfd >= 0 ? epoll_wait(epfd, events, SPAWN_EVENTS, 0) : 0;
+    for (int i = 0; i < n; i++) {
+        spawn_child_t *c = child_of_fd(events[i].data.fd);
+        if (c && c->out == events[i].data.fd) {
+            child_read(c);
+        } else if (c) {
+            child_reap(c);
+        }
+    }
+    for (spawn_child_t **p = &children; *p;) {
+        spawn_child_t *c = *p;
+        // without epoll or a pidfd every turn
+        if (epfd < 0 && c->out >= 0) {
+            child_read(c);
+        }
+        if (c->pidfd < 0 && !c->exited) {
+            child_reap(c);
+        }
+        if (c->exited && c->out < 0) {
+            *p = c->next;
+            c->next = finished;
+            finished = c;
+            __atomic_sub_fetch(&children_count, 1, __ATOMIC_RELAXED);
+        } else {
+            p = &c->next;
+        }
+    }
+    int running = __atomic_load_n(&children_count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&spawn_mtx);
+
+    while (finished) {
+        spawn_child_t *c = finished;
+        finished = c->next;
+        if (c->done) {
+            c->done(c->pid, c->status, c->userdata);
+        }
+        FREE(c);
+    }
+    return running;
+}
+
+int daemon_spawn_run(const char * dir, int * ret, char * const args[]) {
+    spawn_lines_t lines = {.len = 0};
+    char buf[DAEMON_SPAWN_READ];
+    int out, status;
+
+    pid_t pid = spawn_start(dir, args, &out);
+    if (pid < 0) {
+        daemon_log(LOG_ERR, "spawn %s: %s", args[0], strerror(errno));
+        return -1;
+    }
+    for (;;) {
+        ssize_t n = read(out, buf, sizeof(buf));
+        if (n > 0) {
+            lines_feed(&lines, buf, (size_t) n, pid, NULL, NULL);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    lines_flush(&lines, pid, NULL, NULL);
+    close(out);
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            daemon_log(LOG_ERR, "waitpid(): %s", strerror(errno));
+            return -1;
+        }
+    }
+    __atomic_add_fetch(&spawn_stats.exited, 1, __ATOMIC_RELAXED);
+    if (!WIFEXITED(status))
+        return -1;
+    if (ret)
+        *ret = WEXITSTATUS(status);
+    return 0;
+}
+
+void daemon_spawn_stats(daemon_spawn_stats_t * stats) {
+    stats->spawned = __atomic_load_n(&spawn_stats.spawned, __ATOMIC_RELAXED);
+    stats->exited = __atomic_load_n(&spawn_stats.exited, __ATOMIC_RELAXED);
+    stats->reads = __atomic_load_n(&spawn_stats.reads, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&spawn_stats.bytes, __ATOMIC_RELAXED);
+    stats->lines = __atomic_load_n(&spawn_stats.lines, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,76 @@
+#ifndef foodaemonspawnhfoo
+#define foodaemonspawnhfoo
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dexec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file
+ *
+ * Sub processes started without blocking the caller. A child is started
+ * with posix_spawn() (fork() where the C library can't close the inherited
+ * descriptors) with STDIN on /dev/null and STDOUT and STDERR on a pipe,
+ * every descriptor above STDERR closed. Its output is read in blocks of
+ * DAEMON_SPAWN_READ bytes and handed on by line, its exit is noticed by a
+ * pidfd. daemon_spawn_fd() is readable whenever daemon_spawn_dispatch() has
+ * work to do, it goes into the caller's poll or epoll loop or the caller
+ * just calls daemon_spawn_dispatch() once per turn of its loop.
+ */
+
+/** Output is read this many bytes at a time */
+#define DAEMON_SPAWN_READ 4096
+
+/** Longer output lines are cut in pieces of this length */
+#define DAEMON_SPAWN_LINE 256
+
+/** A line of output of the child, without the newline. NULL logs the lines at LOG_INFO. */
+typedef void (*daemon_spawn_line_fn)(pid_t pid, const char * line, void * userdata);
+
+/** The child has exited and its output is read to the end, status as from waitpid() */
+typedef void (*daemon_spawn_done_fn)(pid_t pid, int status, void * userdata);
+
+typedef struct {
+    uint64_t spawned;
+    uint64_t exited;
+    uint64_t reads;
+    uint64_t bytes;
+    uint64_t lines;
+} daemon_spawn_stats_t;
+
+/** Start prog, searched in PATH unless it has a slash, with the argument
+ * vector args, args[0] included, in the working directory dir or the
+ * current one for NULL.
+ * @return the pid of the child, -1 with errno set on failure */
+pid_t daemon_spawnv(const char * dir, char * const args[], daemon_spawn_line_fn line, daemon_spawn_done_fn done,
+                    void * userdata);
+
+/** The same as daemon_spawnv with the arguments followed by a (char *) NULL, prog is args[0] */
+pid_t daemon_spawn(const char * dir, daemon_spawn_line_fn line, daemon_spawn_done_fn done, void * userdata,
+                   const char * prog, ...) DAEMON_GCC_SENTINEL;
+
+/** Readable while output or exits are waiting for daemon_spawn_dispatch(), -1 before the first spawn */
+int daemon_spawn_fd(void);
+
+/** Read the output and reap the children that have exited without
+ * blocking, calling their callbacks on this thread.
+ * @return the number of children still running */
+int daemon_spawn_dispatch(void);
+
+/** Run a child to its end, its output logged by line, on the calling
+ * thread only: for threads of their own that need the exit status. Needs
+ * no signal set up, other children are left to daemon_spawn_dispatch().
+ * @return 0 with the exit status in ret, -1 on failure or when it didn't exit normally */
+int daemon_spawn_run(const char * dir, int * ret, char * const args[]);
+
+void daemon_spawn_stats(daemon_spawn_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
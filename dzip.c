@@ -51,7 +51,7 @@ int extract_zip(const char * zip_archive_filename, const char * dst_folder) {
                 DLOG_INFO("extract %s ", zs.name);
                 char dst_file_name[255] = {};
                 snprintf(dst_file_name, sizeof(dst_file_name) - 1, "%s/%s", dst_folder, zs.name);
-                int fd = open(dst_file_name, O_RDWR | O_CREAT | O_TRUNC);
+                int fd = open(dst_file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
                 if (fd >= 0) {
                     while ( (r = zip_fread(file_in_zip, buffer, sizeof(buffer))) > 0) {
 
@@ -81,3 +81,34 @@ int extract_zip(const char * zip_archive_filename, const char * dst_folder) {
     else
         return(0);
 };
+
+int compress_zip(const char * src_filename, const char * zip_archive_filename) {
+    int err;
+    const char * name = strrchr(src_filename, '/');
+    name = name ? name + 1 : src_filename;
+
+    struct zip * zip_file = zip_open(zip_archive_filename, ZIP_CREATE | ZIP_TRUNCATE, &err);
+    if (!zip_file) {
+        DLOG_ERR("Error: can't create zip file %s", zip_archive_filename);
+        return -1;
+    }
+    zip_source_t * src = zip_source_file(zip_file, src_filename, 0, -1);
+    zip_int64_t index = src ? zip_file_add(zip_file, name, src, ZIP_FL_OVERWRITE) : -1;
+    if (index < 0) {
+        DLOG_ERR("Error: can't add %s to %s: %s", src_filename, zip_archive_filename, zip_strerror(zip_file));
+        if (src) {
+            zip_source_free(src);
+        }
+        zip_discard(zip_file);
+        return -1;
+    }
+    zip_set_file_compression(zip_file, (zip_uint64_t) index, ZIP_CM_DEFLATE, 9);
+    // the file is read and deflated here
+    if (zip_close(zip_file) < 0) {
+        DLOG_ERR("Error: can't write zip file %s: %s", zip_archive_filename, zip_strerror(zip_file));
+        zip_discard(zip_file);
+        unlink(zip_archive_filename);
+        return -1;
+    }
+    return 0;
+}
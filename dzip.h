@@ -1,4 +1,6 @@
 #ifndef DZIP_H_INCLUDED
 #define DZIP_H_INCLUDED
 int extract_zip(const char * zip_archive_filename, const char * dst_folder);
+/** Deflate src_filename into a new zip_archive_filename, src_filename is left in place */
+int compress_zip(const char * src_filename, const char * zip_archive_filename);
 #endif // DZIP_H_INCLUDED
@@ -0,0 +1,210 @@
+/**
+* @file fbdev.c
+*
+* @brief Output into a memory mapped Linux framebuffer.
+*
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+
+#include "fbdev.h"
+#include "dlog.h"
+
+static uint32_t channel_mask(const struct fb_bitfield *field) {
+    return field->length ? ((1u << field->length) - 1) << field->offset : 0;
+}
+
+// Geometry from the driver, asks for a second buffer in the virtual resolution.
+static int fbdev_query(fbdev_t *fb) {
+    struct fb_var_screeninfo var;
+    struct fb_fix_screeninfo fix;
+    if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &var) < 0) {
+        return -1;
+    }
+    if (var.yres_virtual < var.yres * 2) {
+        struct fb_var_screeninfo want = var;
+        want.yres_virtual = var.yres * 2;
+        if (ioctl(fb->fd, FBIOPUT_VSCREENINFO, &want) < 0 || ioctl(fb->fd, FBIOGET_VSCREENINFO, &var) < 0) {
+            daemon_log(LOG_INFO, "fbdev: no room for a second buffer");
+        }
+    }
+    if (ioctl(fb->fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+        return -1;
+    }
+    fb->width = (int) var.xres;
+    fb->height = (int) var.yres;
+    fb->bits_per_pixel = (int) var.bits_per_pixel;
+    fb->pitch = (int) fix.line_length;
+    fb->red_mask = channel_mask(&var.red);
+    fb->green_mask = channel_mask(&var.green);
+    fb->blue_mask = channel_mask(&var.blue);
+    fb->map_size = fix.smem_len;
+    fb->buffers = var.yres_virtual >= var.yres * 2 && fix.ypanstep &&
+                  fix.smem_len >= (size_t) fix.line_length * var.yres * 2 ? 2 : 1;
+    return 0;
+}
+
+// A regular file of the given geometry, RGB565 or XRGB8888.
+static int fbdev_file(fbdev_t *fb, int width, int height, int bits_per_pixel) {
+    if (width <= 0 || height <= 0 || (bits_per_pixel != 16 && bits_per_pixel != 32)) {
+        errno = EINVAL;
+        return -1;
+    }
+    fb->width = width;
+    fb->height = height;
+    fb->bits_per_pixel = bits_per_pixel;
+    fb->pitch = width * bits_per_pixel / 8;
+    if (bits_per_pixel == 16) {
+        fb->red_mask = 0xf800;
+        fb->green_mask = 0x07e0;
+        fb->blue_mask = 0x001f;
+    } else {
+        fb->red_mask = 0x00ff0000;
+        fb->green_mask = 0x0000ff00;
+        fb->blue_mask = 0x000000ff;
+    }
+    fb->map_size = (size_t) fb->pitch * (size_t) height;
+    fb->buffers = 1;
+
+    struct stat st;
+    if (fstat(fb->fd, &st) < 0) {
+        return -1;
+    }
+    if ((size_t) st.st_size < fb->map_size && ftruncate(fb->fd, (off_t) fb->map_size) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int fbdev_open(fbdev_t *fb, const char *path, int width, int height, int bits_per_pixel) {
+    memset(fb, 0, sizeof(fbdev_t));
+    fb->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fb->fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fb->fd, &st) < 0) {
+        goto fail;
+    }
+    fb->device = S_ISCHR(st.st_mode);
+    if (fb->device ? fbdev_query(fb) : fbdev_file(fb, width, height, bits_per_pixel)) {
+        goto fail;
+    }
+    fb->map = mmap(NULL, fb->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0);
+    if (fb->map == MAP_FAILED) {
+        fb->map = NULL;
+        goto fail;
+    }
+    // buffer 0 is on screen after the pan below
+    fb->back = fb->buffers - 1;
+    if (fb->device && fb->buffers == 2) {
+        struct fb_var_screeninfo var;
+        if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &var) == 0 && var.yoffset != 0) {
+            var.yoffset = 0;
+            ioctl(fb->fd, FBIOPAN_DISPLAY, &var);
+        }
+    }
+    daemon_log(LOG_INFO, "fbdev %s: %dx%d %d bpp pitch %d, %d buffer(s)", path, fb->width, fb->height,
+               fb->bits_per_pixel, fb->pitch, fb->buffers);
+    return 0;
+
+fail: {
+        int err = errno;
+        close(fb->fd);
+        fb->fd = -1;
+        errno = err;
+        return -1;
+    }
+}
+
+void fbdev_close(fbdev_t *fb) {
+    if (fb->map) {
+        munmap(fb->map, fb->map_size);
+        fb->map = NULL;
+    }
+    if (fb->fd >= 0) {
+        close(fb->fd);
+        fb->fd = -1;
+    }
+}
+
+static uint8_t *fbdev_buffer(const fbdev_t *fb, int index) {
+    return fb->map + (size_t) index * (size_t) fb->pitch * (size_t) fb->height;
+}
+
+uint8_t *fbdev_front_buffer(const fbdev_t *fb) {
+    return fbdev_buffer(fb, fb->buffers == 2 ? !fb->back : 0);
+}
+
+static bool fbdev_clip(const fbdev_t *fb, const fbdev_rect_t *in, fbdev_rect_t *out) {
+    int x0 = in->x < 0 ? 0 : in->x;
+    int y0 = in->y < 0 ? 0 : in->y;
+    int x1 = in->x + in->w > fb->width ? fb->width : in->x + in->w;
+    int y1 = in->y + in->h > fb->height ? fb->height : in->y + in->h;
+    if (x1 <= x0 || y1 <= y0) {
+        return false;
+    }
+    *out = (fbdev_rect_t) {x0, y0, x1 - x0, y1 - y0};
+    return true;
+}
+
+static int fbdev_flip(fbdev_t *fb) {
+    if (!fb->device || fb->buffers < 2) {
+        return 0;
+    }
+    struct fb_var_screeninfo var;
+    if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &var) < 0) {
+        return -1;
+    }
+    var.yoffset = (uint32_t) (fb->back * fb->height);
+    if (ioctl(fb->fd, FBIOPAN_DISPLAY, &var) < 0) {
+        daemon_log(LOG_ERR, "FBIOPAN_DISPLAY: %s", strerror(errno));
+        return -1;
+    }
+    // not every driver waits for the pan itself, errors only mean no vsync support
+    uint32_t screen = 0;
+    ioctl(fb->fd, FBIO_WAITFORVSYNC, &screen);
+    fb->back = !fb->back;
+    return 0;
+}
+
+int fbdev_present(fbdev_t *fb, const fbdev_rect_t *damage, int count, fbdev_compose_fn compose, void *ctx) {
+    fbdev_rect_t rects[FBDEV_MAX_DAMAGE * 2];
+    int n = 0;
+    bool full = count > FBDEV_MAX_DAMAGE || fb->previous_count > FBDEV_MAX_DAMAGE;
+
+    for (int i = 0; !full && i < count; i++) {
+        if (fbdev_clip(fb, &damage[i], &rects[n])) {
+            n++;
+        }
+    }
+    int current = n;
+    if (fb->buffers == 2) {
+        for (int i = 0; !full && i < fb->previous_count; i++) {
+            rects[n++] = fb->previous[i];
+        }
+    }
+    if (full) {
+        rects[0] = (fbdev_rect_t) {0, 0, fb->width, fb->height};
+        n = current = 1;
+    }
+
+    uint8_t *buffer = fbdev_buffer(fb, fb->back);
+    int bytes_per_pixel = fb->bits_per_pixel / 8;
+    for (int i = 0; i < n; i++) {
+        compose(ctx, &rects[i], buffer + rects[i].y * fb->pitch + rects[i].x * bytes_per_pixel, fb->pitch);
+    }
+
+    memcpy(fb->previous, rects, sizeof(fbdev_rect_t) * (size_t) current);
+    fb->previous_count = current;
+    fb->frames++;
+    return fbdev_flip(fb);
+}
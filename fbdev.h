@@ -0,0 +1,75 @@
+/**
+* @file fbdev.h
+*
+* @brief Output into a memory mapped Linux framebuffer.
+*
+* The frame is composed straight into the mapping, only the damaged rects are
+* redrawn. A device with room for two buffers in its virtual resolution is
+* double buffered, frames are drawn into the hidden buffer and shown with
+* FBIOPAN_DISPLAY. A regular file stands in for the device in tests, it is
+* sized to the geometry given to fbdev_open() and has a single buffer.
+*/
+#ifndef SUPER_CLOCK_FBDEV_H
+#define SUPER_CLOCK_FBDEV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FBDEV_MAX_DAMAGE 32
+
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} fbdev_rect_t;
+
+typedef struct {
+    int fd;
+    // a framebuffer device, the pan and vsync ioctls apply
+    bool device;
+    uint8_t *map;
+    size_t map_size;
+    int width;
+    int height;
+    int bits_per_pixel;
+    // bytes per line
+    int pitch;
+    uint32_t red_mask;
+    uint32_t green_mask;
+    uint32_t blue_mask;
+    int buffers;
+    // buffer drawn into, the other one is on screen
+    int back;
+    // rects of the previous frame, the back buffer still misses them
+    fbdev_rect_t previous[FBDEV_MAX_DAMAGE];
+    int previous_count;
+    unsigned long frames;
+} fbdev_t;
+
+/** Draw the rect into dst, which points at the rect's top left pixel */
+typedef void (*fbdev_compose_fn)(void *ctx, const fbdev_rect_t *rect, uint8_t *dst, int pitch);
+
+/** Map a framebuffer device or a regular file
+ *
+ * The geometry of a device comes from the driver, the arguments are used for
+ * regular files, which are grown to fit. Nothing is created, a missing path
+ * fails with ENOENT rather than leaving a file where a device was expected.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+int fbdev_open(fbdev_t *fb, const char *path, int width, int height, int bits_per_pixel);
+
+void fbdev_close(fbdev_t *fb);
+
+/** First pixel of the buffer on screen */
+uint8_t *fbdev_front_buffer(const fbdev_t *fb);
+
+/** Compose the damaged rects, together with the rects of the previous frame
+ * when double buffered, into the back buffer and show it. Rects are clipped
+ * to the screen, more than FBDEV_MAX_DAMAGE redraw the whole screen.
+ * @return 0 on success, -1 if the buffer could not be shown
+ */
+int fbdev_present(fbdev_t *fb, const fbdev_rect_t *damage, int count, fbdev_compose_fn compose, void *ctx);
+
+#endif //SUPER_CLOCK_FBDEV_H
@@ -0,0 +1,713 @@
+/**
+* @file history.c
+*
+* @brief Compressed on-disk history of the measured sensor values.
+*
+* File layout: block 0 holds the file header with the names of the series, the
+* following blocks hold samples of one series each. A block starts with two
+* copies of its header, the copy with the higher sequence number and a valid
+* CRC describes how many samples of the payload are committed. The first
+* sample of a block is stored raw so every block decodes on its own.
+*
+* Only the file header and the headers of the blocks being appended to are
+* rewritten, the payload bits below the committed count never change, and the
+* kernel writes the dirty pages back at its own pace or on history_sync().
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+
+#include "history.h"
+#include "dlog.h"
+#include "dmem.h"
+
+#define HISTORY_MAGIC "SCHIST1\n"
+#define HISTORY_VERSION 1
+#define HISTORY_BLOCK_MAGIC 0x4b4c4253u
+#define HISTORY_DAY 86400
+// 16 MiB of address space per day, a day of 10 s samples of every series takes about 1 MiB
+#define HISTORY_MAX_BLOCKS 4096
+// the file grows by 64 KiB at a time rather than by a block per append
+#define HISTORY_GROW_BLOCKS 16
+#define HISTORY_MAX_SERIES 16
+#define HISTORY_NAME_SIZE 32
+// '1111' + 32 bit delta-of-delta, '11' + 5 + 6 + 64 bit value
+#define HISTORY_SAMPLE_MAX_BITS (4 + 32 + 2 + 5 + 6 + 64)
+
+static const sensor_key_t history_keys[] = {
+        SENSOR_MAIN_POWER,
+        SENSOR_MAIN_VOLTAGE,
+        SENSOR_BATTERY_SOC,
+        SENSOR_BATTERY_CURRENT,
+        SENSOR_BATTERY_VOLTAGE,
+        SENSOR_BATTERY_TEMP,
+        SENSOR_BATTERY_CAPACITY,
+        SENSOR_INDOOR_TEMP,
+        SENSOR_OUTDOOR_TEMP,
+};
+
+#define HISTORY_SERIES_COUNT (sizeof(history_keys) / sizeof(history_keys[0]))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    // UTC midnight of the day
+    int64_t day;
+    uint32_t series_count;
+    // over the whole header with crc 0
+    uint32_t crc;
+    char names[HISTORY_MAX_SERIES][HISTORY_NAME_SIZE];
+} file_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t series;
+    uint16_t version;
+    uint32_t count;
+    uint32_t bits;
+    // over the fields above
+    uint32_t crc;
+} block_header_t;
+
+typedef struct {
+    block_header_t header[2];
+    uint8_t payload[HISTORY_BLOCK_SIZE - 2 * sizeof(block_header_t)];
+} block_t;
+
+#define HISTORY_PAYLOAD_BITS (sizeof(((block_t *) 0)->payload) * 8)
+
+// Encoder and decoder state, bits is the write or read position in the payload
+typedef struct {
+    uint32_t count;
+    uint32_t bits;
+    int64_t t;
+    int64_t delta;
+    uint64_t value;
+    int leading;
+    int trailing;
+} codec_t;
+
+typedef struct {
+    // blocks of the series in time order
+    int *blocks;
+    int count;
+    int capacity;
+    // state of the last block, only kept for the day being written
+    uint32_t seq;
+    codec_t codec;
+} series_t;
+
+typedef struct {
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    bool writable;
+    int64_t day;
+    // blocks in use including the file header
+    int used_blocks;
+    int file_blocks;
+    int series_count;
+    series_t series[HISTORY_MAX_SERIES];
+    int key_series[SENSOR_COUNT];
+} segment_t;
+
+static pthread_mutex_t history_mtx = PTHREAD_MUTEX_INITIALIZER;
+static char *history_dir = NULL;
+static segment_t history_current = {.fd = -1};
+// the past day scanned last, those files no longer change
+static segment_t history_cached = {.fd = -1};
+static unsigned long history_samples = 0;
+static unsigned long history_dropped = 0;
+
+static uint32_t history_crc(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t crc = 0xffffffffu;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static int64_t day_of(time_t t) {
+    int64_t s = (int64_t) t;
+    return s - ((s % HISTORY_DAY) + HISTORY_DAY) % HISTORY_DAY;
+}
+
+// Most significant bit first
+static void put_bits(uint8_t *buf, uint32_t *pos, uint64_t value, int n) {
+    while (n > 0) {
+        int room = 8 - (int) (*pos & 7);
+        int take = n < room ? n : room;
+        int shift = room - take;
+        unsigned int mask = ((1u << take) - 1) << shift;
+        unsigned int chunk = (unsigned int) (value >> (n - take)) << shift;
+        uint8_t *byte = &buf[*pos >> 3];
+        *byte = (uint8_t) ((*byte & ~mask) | (chunk & mask));
+        *pos += (uint32_t) take;
+        n -= take;
+    }
+}
+
+static uint64_t get_bits(const uint8_t *buf, uint32_t *pos, int n) {
+    uint64_t value = 0;
+    while (n > 0) {
+        int room = 8 - (int) (*pos & 7);
+        int take = n < room ? n : room;
+        value = (value << take) | ((buf[*pos >> 3] >> (room - take)) & ((1u << take) - 1));
+        *pos += (uint32_t) take;
+        n -= take;
+    }
+    return value;
+}
+
+static void encode(uint8_t *buf, codec_t *c, int64_t t, uint64_t value) {
+    if (c->count == 0) {
+        put_bits(buf, &c->bits, (uint64_t) t, 64);
+        put_bits(buf, &c->bits, value, 64);
+        c->delta = 0;
+        c->leading = -1;
+        c->trailing = 0;
+    } else {
+        int64_t delta = t - c->t;
+        int64_t dod = delta - c->delta;
+        if (dod == 0) {
+            put_bits(buf, &c->bits, 0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            put_bits(buf, &c->bits, 2, 2);
+            put_bits(buf, &c->bits, (uint64_t) (dod + 63), 7);
+        } else if (dod >= -255 && dod <= 256) {
+            put_bits(buf, &c->bits, 6, 3);
+            put_bits(buf, &c->bits, (uint64_t) (dod + 255), 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            put_bits(buf, &c->bits, 14, 4);
+            put_bits(buf, &c->bits, (uint64_t) (dod + 2047), 12);
+        } else {
+            // a block never spans more than a day, the delta fits
+            put_bits(buf, &c->bits, 15, 4);
+            put_bits(buf, &c->bits, (uint32_t) (int32_t) dod, 32);
+        }
+        c->delta = delta;
+
+        uint64_t x = value ^ c->value;
+        if (x == 0) {
+            put_bits(buf, &c->bits, 0, 1);
+        } else {
+            int leading = __builtin_clzll(x);
+            int trailing = __builtin_ctzll(x);
+            if (leading > 31) {
+                leading = 31;
+            }
+            if (c->leading >= 0 && leading >= c->leading && trailing >= c->trailing) {
+                // the meaningful bits fit the window of the previous value
+                put_bits(buf, &c->bits, 2, 2);
+                put_bits(buf, &c->bits, x >> c->trailing, 64 - c->leading - c->trailing);
+            } else {
+                int len = 64 - leading - trailing;
+                put_bits(buf, &c->bits, 3, 2);
+                put_bits(buf, &c->bits, (uint64_t) leading, 5);
+                put_bits(buf, &c->bits, (uint64_t) (len & 63), 6);
+                put_bits(buf, &c->bits, x >> trailing, len);
+                c->leading = leading;
+                c->trailing = trailing;
+            }
+        }
+    }
+    c->t = t;
+    c->value = value;
+    c->count++;
+}
+
+static void decode(const uint8_t *buf, codec_t *c) {
+    if (c->count == 0) {
+        c->t = (int64_t) get_bits(buf, &c->bits, 64);
+        c->value = get_bits(buf, &c->bits, 64);
+        c->delta = 0;
+        c->leading = -1;
+        c->trailing = 0;
+    } else {
+        int64_t dod;
+        if (!get_bits(buf, &c->bits, 1)) {
+            dod = 0;
+        } else if (!get_bits(buf, &c->bits, 1)) {
+            dod = (int64_t) get_bits(buf, &c->bits, 7) - 63;
+        } else if (!get_bits(buf, &c->bits, 1)) {
+            dod = (int64_t) get_bits(buf, &c->bits, 9) - 255;
+        } else if (!get_bits(buf, &c->bits, 1)) {
+            dod = (int64_t) get_bits(buf, &c->bits, 12) - 2047;
+        } else {
+            dod = (int32_t) (uint32_t) get_bits(buf, &c->bits, 32);
+        }
+        c->delta += dod;
+        c->t += c->delta;
+
+        if (get_bits(buf, &c->bits, 1)) {
+            if (!get_bits(buf, &c->bits, 1)) {
+                c->value ^= get_bits(buf, &c->bits, 64 - c->leading - c->trailing) << c->trailing;
+            } else {
+                int leading = (int) get_bits(buf, &c->bits, 5);
+                int len = (int) get_bits(buf, &c->bits, 6);
+                if (len == 0) {
+                    len = 64;
+                }
+                c->leading = leading;
+                c->trailing = 64 - leading - len;
+                c->value ^= get_bits(buf, &c->bits, len) << c->trailing;
+            }
+        }
+    }
+    c->count++;
+}
+
+static double value_of(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static block_t *block_at(const segment_t *s, int index) {
+    return (block_t *) (s->map + (size_t) index * HISTORY_BLOCK_SIZE);
+}
+
+static uint32_t block_crc(const block_header_t *h) {
+    return history_crc(h, offsetof(block_header_t, crc));
+}
+
+// The newer valid copy of the header, NULL for a free or torn block
+static const block_header_t *block_header(const block_t *b) {
+    const block_header_t *best = NULL;
+    for (int i = 0; i < 2; i++) {
+        const block_header_t *h = &b->header[i];
+        if (h->magic == HISTORY_BLOCK_MAGIC && h->crc == block_crc(h) && (!best || h->seq > best->seq)) {
+            best = h;
+        }
+    }
+    return best;
+}
+
+// Publish the samples encoded so far, the other copy stays valid until this one is complete
+static void block_commit(block_t *b, int series, uint32_t *seq, const codec_t *c) {
+    block_header_t h = {
+            .magic = HISTORY_BLOCK_MAGIC,
+            .seq = ++*seq,
+            .series = (uint16_t) series,
+            .version = HISTORY_VERSION,
+            .count = c->count,
+            .bits = c->bits,
+    };
+    h.crc = block_crc(&h);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&b->header[h.seq & 1], &h, sizeof(block_header_t));
+}
+
+static void series_add_block(series_t *s, int block) {
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 16;
+        s->blocks = xrealloc(s->blocks, sizeof(int) * (size_t) s->capacity);
+    }
+    s->blocks[s->count++] = block;
+}
+
+static void day_path(char *buf, size_t size, int64_t day) {
+    time_t t = (time_t) day;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(buf, size, "%s/%04d%02d%02d.hist", history_dir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+static uint32_t file_header_crc(const file_header_t *h) {
+    file_header_t copy = *h;
+    copy.crc = 0;
+    return history_crc(&copy, sizeof(file_header_t));
+}
+
+static int sync_dir(void) {
+    int fd = open(history_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int res = fsync(fd);
+    close(fd);
+    return res;
+}
+
+// A new day file, complete with its header before it appears under its name
+static int segment_create(int64_t day, const char *path) {
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    uint8_t block[HISTORY_BLOCK_SIZE];
+    file_header_t h;
+    memset(block, 0, sizeof(block));
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HISTORY_MAGIC, sizeof(h.magic));
+    h.version = HISTORY_VERSION;
+    h.block_size = HISTORY_BLOCK_SIZE;
+    h.day = day;
+    h.series_count = HISTORY_SERIES_COUNT;
+    for (size_t i = 0; i < HISTORY_SERIES_COUNT; i++) {
+        strncpy(h.names[i], sensor_name(history_keys[i]), HISTORY_NAME_SIZE - 1);
+    }
+    h.crc = file_header_crc(&h);
+    memcpy(block, &h, sizeof(h));
+
+    if (write(fd, block, sizeof(block)) != sizeof(block) || fsync(fd) < 0) {
+        int err = errno;
+        close(fd);
+        unlink(tmp);
+        errno = err ? err : EIO;
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) < 0) {
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    return sync_dir();
+}
+
+static void segment_close(segment_t *s) {
+    if (s->map) {
+        if (s->writable) {
+            msync(s->map, (size_t) s->used_blocks * HISTORY_BLOCK_SIZE, MS_SYNC);
+        }
+        munmap(s->map, s->map_size);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    for (int i = 0; i < HISTORY_MAX_SERIES; i++) {
+        FREE(s->series[i].blocks);
+    }
+    memset(s, 0, sizeof(segment_t));
+    s->fd = -1;
+}
+
+// Continue the last block of every series where the previous run stopped
+static void segment_restore(segment_t *s) {
+    for (int i = 0; i < s->series_count; i++) {
+        series_t *series = &s->series[i];
+        if (series->count == 0) {
+            continue;
+        }
+        const block_t *b = block_at(s, series->blocks[series->count - 1]);
+        const block_header_t *h = block_header(b);
+        codec_t c = {0};
+        while (c.count < h->count && c.bits < HISTORY_PAYLOAD_BITS) {
+            decode(b->payload, &c);
+        }
+        series->codec = c;
+        series->seq = h->seq;
+    }
+}
+
+static int segment_map(segment_t *s, const char *path, int64_t day, bool writable) {
+    memset(s, 0, sizeof(segment_t));
+    s->writable = writable;
+    s->day = day;
+    s->fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (s->fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(s->fd, &st) < 0) {
+        goto fail;
+    }
+    s->file_blocks = (int) (st.st_size / HISTORY_BLOCK_SIZE);
+    if (s->file_blocks < 1 || s->file_blocks > HISTORY_MAX_BLOCKS) {
+        errno = EINVAL;
+        goto fail;
+    }
+    // the writer maps the largest size once and grows the file below the mapping
+    s->map_size = (size_t) (writable ? HISTORY_MAX_BLOCKS : s->file_blocks) * HISTORY_BLOCK_SIZE;
+    s->map = mmap(NULL, s->map_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, s->fd, 0);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        goto fail;
+    }
+
+    const file_header_t *h = (const file_header_t *) s->map;
+    if (memcmp(h->magic, HISTORY_MAGIC, sizeof(h->magic)) != 0 || h->version != HISTORY_VERSION ||
+        h->block_size != HISTORY_BLOCK_SIZE || h->series_count > HISTORY_MAX_SERIES ||
+        h->crc != file_header_crc(h)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    s->series_count = (int) h->series_count;
+    for (int k = 0; k < SENSOR_COUNT; k++) {
+        s->key_series[k] = -1;
+        for (int i = 0; i < s->series_count; i++) {
+            if (strncmp(h->names[i], sensor_name((sensor_key_t) k), HISTORY_NAME_SIZE) == 0) {
+                s->key_series[k] = i;
+            }
+        }
+    }
+
+    // blocks are allocated in order, past the last used one the file is zeroed space
+    s->used_blocks = 1;
+    for (int i = 1; i < s->file_blocks; i++) {
+        const block_header_t *bh = block_header(block_at(s, i));
+        if (bh && bh->series < s->series_count && bh->bits <= HISTORY_PAYLOAD_BITS) {
+            series_add_block(&s->series[bh->series], i);
+            s->used_blocks = i + 1;
+        }
+    }
+    if (writable) {
+        segment_restore(s);
+    }
+    return 0;
+
+fail: {
+        int err = errno;
+        segment_close(s);
+        errno = err;
+        return -1;
+    }
+}
+
+// The day being written, a damaged file is set aside and started over
+static int segment_open_day(segment_t *s, int64_t day) {
+    char path[PATH_MAX];
+    day_path(path, sizeof(path), day);
+    if (access(path, F_OK) < 0 && segment_create(day, path) < 0) {
+        daemon_log(LOG_ERR, "history: can't create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (segment_map(s, path, day, true) == 0) {
+        return 0;
+    }
+    if (errno == EINVAL) {
+        char broken[PATH_MAX + 8];
+        snprintf(broken, sizeof(broken), "%s.broken", path);
+        daemon_log(LOG_WARNING, "history: %s is damaged, moved to %s", path, broken);
+        if (rename(path, broken) == 0 && segment_create(day, path) == 0 && segment_map(s, path, day, true) == 0) {
+            return 0;
+        }
+    }
+    daemon_log(LOG_ERR, "history: can't open %s: %s", path, strerror(errno));
+    return -1;
+}
+
+static block_t *segment_new_block(segment_t *s, int series) {
+    if (s->used_blocks >= HISTORY_MAX_BLOCKS) {
+        return NULL;
+    }
+    if (s->used_blocks >= s->file_blocks) {
+        int blocks = s->file_blocks + HISTORY_GROW_BLOCKS;
+        if (blocks > HISTORY_MAX_BLOCKS) {
+            blocks = HISTORY_MAX_BLOCKS;
+        }
+        if (ftruncate(s->fd, (off_t) blocks * HISTORY_BLOCK_SIZE) < 0) {
+            daemon_log(LOG_ERR, "history: can't grow the day file: %s", strerror(errno));
+            return NULL;
+        }
+        s->file_blocks = blocks;
+    }
+    int index = s->used_blocks++;
+    block_t *b = block_at(s, index);
+    // left over from a run that crashed before committing the block
+    memset(b, 0, sizeof(block_t));
+    series_t *ser = &s->series[series];
+    series_add_block(ser, index);
+    ser->seq = 0;
+    memset(&ser->codec, 0, sizeof(codec_t));
+    block_commit(b, series, &ser->seq, &ser->codec);
+    return b;
+}
+
+int history_open(const char *dir) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    pthread_mutex_lock(&history_mtx);
+    segment_close(&history_current);
+    segment_close(&history_cached);
+    FREE(history_dir);
+    history_dir = xstrdup(dir);
+    pthread_mutex_unlock(&history_mtx);
+    return 0;
+}
+
+void history_close(void) {
+    pthread_mutex_lock(&history_mtx);
+    segment_close(&history_current);
+    segment_close(&history_cached);
+    FREE(history_dir);
+    pthread_mutex_unlock(&history_mtx);
+}
+
+bool history_recorded(sensor_key_t key) {
+    for (size_t i = 0; i < HISTORY_SERIES_COUNT; i++) {
+        if (history_keys[i] == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void history_append_locked(sensor_key_t key, time_t t, double value) {
+    segment_t *s = &history_current;
+    int64_t day = day_of(t);
+    if (s->fd < 0 || day > s->day) {
+        segment_close(s);
+        if (segment_open_day(s, day) < 0) {
+            history_dropped++;
+            return;
+        }
+    } else if (day < s->day) {
+        history_dropped++;
+        return;
+    }
+    int id = s->key_series[key];
+    if (id < 0) {
+        history_dropped++;
+        return;
+    }
+
+    series_t *series = &s->series[id];
+    block_t *b = series->count ? block_at(s, series->blocks[series->count - 1]) : NULL;
+    int64_t ts = (int64_t) t;
+    if (b && series->codec.count && ts < series->codec.t) {
+        ts = series->codec.t;
+    }
+    if (!b || series->codec.bits + HISTORY_SAMPLE_MAX_BITS > HISTORY_PAYLOAD_BITS) {
+        b = segment_new_block(s, id);
+        if (!b) {
+            history_dropped++;
+            return;
+        }
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    encode(b->payload, &series->codec, ts, bits);
+    block_commit(b, id, &series->seq, &series->codec);
+    history_samples++;
+}
+
+void history_append(sensor_key_t key, time_t t, double value) {
+    if (!history_recorded(key)) {
+        return;
+    }
+    pthread_mutex_lock(&history_mtx);
+    if (history_dir) {
+        history_append_locked(key, t, value);
+    }
+    pthread_mutex_unlock(&history_mtx);
+}
+
+// First timestamp of a block, INT64_MAX for an empty one
+static int64_t block_first(const block_t *b) {
+    const block_header_t *h = block_header(b);
+    if (!h || h->count == 0) {
+        return INT64_MAX;
+    }
+    uint32_t pos = 0;
+    return (int64_t) get_bits(b->payload, &pos, 64);
+}
+
+static size_t segment_scan(const segment_t *s, sensor_key_t key, int64_t from, int64_t to, history_sample_fn fn,
+                           void *ctx) {
+    int id = s->key_series[key];
+    if (id < 0) {
+        return 0;
+    }
+    const series_t *series = &s->series[id];
+    size_t n = 0;
+    for (int i = 0; i < series->count; i++) {
+        // samples of a block are not later than the first sample of the next one
+        if (i + 1 < series->count && block_first(block_at(s, series->blocks[i + 1])) < from) {
+            continue;
+        }
+        const block_t *b = block_at(s, series->blocks[i]);
+        const block_header_t *h = block_header(b);
+        if (!h) {
+            continue;
+        }
+        codec_t c = {0};
+        while (c.count < h->count && c.bits < h->bits) {
+            decode(b->payload, &c);
+            if (c.t >= to) {
+                return n;
+            }
+            if (c.t >= from) {
+                fn(ctx, (time_t) c.t, value_of(c.value));
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+size_t history_scan(sensor_key_t key, time_t from, time_t to, history_sample_fn fn, void *ctx) {
+    size_t n = 0;
+    pthread_mutex_lock(&history_mtx);
+    for (int64_t day = day_of(from); history_dir && day < (int64_t) to; day += HISTORY_DAY) {
+        if (history_current.fd >= 0 && day == history_current.day) {
+            n += segment_scan(&history_current, key, from, to, fn, ctx);
+            continue;
+        }
+        if (history_cached.fd < 0 || history_cached.day != day) {
+            char path[PATH_MAX];
+            segment_close(&history_cached);
+            day_path(path, sizeof(path), day);
+            if (access(path, F_OK) < 0 || segment_map(&history_cached, path, day, false) < 0) {
+                continue;
+            }
+        }
+        n += segment_scan(&history_cached, key, from, to, fn, ctx);
+    }
+    pthread_mutex_unlock(&history_mtx);
+    return n;
+}
+
+void history_sync(void) {
+    pthread_mutex_lock(&history_mtx);
+    if (history_current.map) {
+        msync(history_current.map, (size_t) history_current.used_blocks * HISTORY_BLOCK_SIZE, MS_ASYNC);
+    }
+    pthread_mutex_unlock(&history_mtx);
+}
+
+void history_get_stats(history_stats_t *stats) {
+    pthread_mutex_lock(&history_mtx);
+    stats->samples = history_samples;
+    stats->dropped = history_dropped;
+    stats->blocks = 0;
+    stats->bits = 0;
+    const segment_t *s = &history_current;
+    if (s->map) {
+        stats->blocks = (unsigned long) (s->used_blocks - 1);
+        for (int i = 1; i < s->used_blocks; i++) {
+            const block_header_t *h = block_header(block_at(s, i));
+            stats->bits += h ? h->bits : 0;
+        }
+    }
+    pthread_mutex_unlock(&history_mtx);
+}
+
+void history_log_stats(void) {
+    history_stats_t stats;
+    history_get_stats(&stats);
+    daemon_log(LOG_INFO, "history: %lu samples, %lu dropped, %lu blocks in the open day, %llu bytes compressed",
+               stats.samples, stats.dropped, stats.blocks, (stats.bits + 7) / 8);
+}
@@ -0,0 +1,65 @@
+/**
+* @file history.h
+*
+* @brief Compressed on-disk history of the measured sensor values.
+*
+* One memory mapped file per UTC day holds fixed size blocks, each block
+* belongs to one series and is appended to until full. Timestamps are stored
+* as delta-of-delta and values as the XOR with the previous value (the
+* Gorilla encoding), a steady sensor costs a few bits per sample.
+*
+* Every block header is kept twice with a sequence number and a CRC, an
+* update overwrites the older copy, so a crash in the middle of a write
+* leaves the previous state readable. A day file is created under a temporary
+* name and renamed once its header is on disk.
+*/
+#ifndef SUPER_CLOCK_HISTORY_H
+#define SUPER_CLOCK_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "sensor.h"
+
+#define HISTORY_BLOCK_SIZE 4096
+
+typedef struct {
+    unsigned long samples;
+    // late samples of a previous day and samples of a full day file
+    unsigned long dropped;
+    unsigned long blocks;
+    // compressed size of the samples in the open day
+    unsigned long long bits;
+} history_stats_t;
+
+typedef void (*history_sample_fn)(void *ctx, time_t t, double value);
+
+/** Open the history kept in dir, created if missing
+ * @return 0 on success, -1 with errno set otherwise
+ */
+int history_open(const char *dir);
+
+/** Flush and unmap the open day */
+void history_close(void);
+
+/** Whether samples of the key are kept */
+bool history_recorded(sensor_key_t key);
+
+/** Append a sample, older than the last sample of the key are stored with the last timestamp */
+void history_append(sensor_key_t key, time_t t, double value);
+
+/** Call fn for the samples of key with from <= t < to in time order
+ * @return the number of samples passed to fn
+ */
+size_t history_scan(sensor_key_t key, time_t from, time_t to, history_sample_fn fn, void *ctx);
+
+/** Schedule the write back of the open day */
+void history_sync(void);
+
+void history_get_stats(history_stats_t *stats);
+
+void history_log_stats(void);
+
+#endif //SUPER_CLOCK_HISTORY_H
@@ -15,13 +15,14 @@
 #include <sys/sysinfo.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <json-c/json.h>
 #include <pthread.h>
 #include <string.h>
 #include <strings.h>
 
 #include "mq.h"
+#include "mqlog.h"
 #include "dlog.h"
+#include "dflight.h"
 #include "dmem.h"
 #include "dfork.h"
 
@@ -51,6 +52,8 @@ static t_client_info client_info;
 
 static struct mosquitto *mosq = NULL;
 static pthread_t mosq_th = 0;
+// text and buffers of the message or the publish in progress on this thread
+static __thread dmem_arena_t message_arena = DMEM_ARENA_INIT;
 
 uint64_t timeMillis(void) {
     struct timeval time;
@@ -106,15 +109,13 @@ static void publish_state(void) {
         int fd;
         char tmp_buf[20];
         memset(tmp_buf, ' ', sizeof(tmp_buf));
-        char *f_name = NULL;
-        asprintf(&f_name, FD_SYSTEM_TEMP_TMPL, thermal_zone);
-        if ((fd = open(f_name, O_RDONLY)) < 0) {
+        const char *f_name = dmem_arena_printf(&message_arena, FD_SYSTEM_TEMP_TMPL, thermal_zone);
+        if (!f_name || (fd = open(f_name, O_RDONLY)) < 0) {
             daemon_log(LOG_ERR, "%s : file open error!", __func__);
         } else {
             read(fd, buf, sizeof(tmp_buf));
             close(fd);
         }
-        FREE(f_name);
         int temp_C = atoi(buf) / 1000;
         const char *topic = create_topic(MQTT_STATE_TOPIC);
 
@@ -128,6 +129,7 @@ static void publish_state(void) {
             daemon_log(LOG_ERR, "Can't publish to Mosquitto server %s", mosquitto_strerror(res));
         }
     }
+    dmem_arena_reset(&message_arena);
 }
 
 void publish_sensors(void) {
@@ -148,20 +150,23 @@ void publish_sensors(void) {
     time(&timer);
     tm_info = localtime(&timer);
     strftime(tm_buffer, 26, "%Y-%m-%dT%H:%M:%S", tm_info);
-    json_object *j_root = json_object_new_object();
-    json_object_object_add(j_root, "Time", json_object_new_string(tm_buffer));
-
-    const char *str = json_object_to_json_string_ext(j_root, JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOZERO);
+    // the time needs no escaping, the object is printed instead of built with json-c
+    const char *str = dmem_arena_printf(&message_arena, "{\"Time\":\"%s\"}", tm_buffer);
+    if (!str) {
+        return;
+    }
     daemon_log(LOG_INFO, "%s %s", topic, str);
     if ((res = mosquitto_publish(mosq, NULL, topic, (int) strlen(str), str, 0, false)) != 0) {
         daemon_log(LOG_ERR, "Can't publish to Mosquitto server %s", mosquitto_strerror(res));
     }
-    json_object_put(j_root);
+    dmem_arena_reset(&message_arena);
 }
 
 static
 void *mosq_thread_loop(void *p) {
     t_client_info *info = (t_client_info *) p;
+    pthread_setname_np(pthread_self(), "mosquitto");
+    daemon_flight_thread();
     daemon_log(LOG_INFO, "%s", __FUNCTION__);
     while (!do_exit) {
         int res = mosquitto_loop(info->m, 1000, 1);
@@ -171,7 +176,7 @@ void *mosq_thread_loop(void *p) {
             case MOSQ_ERR_NO_CONN: {
                 int res = mosquitto_connect(mosq, mqtt_host, mqtt_port, mqtt_keepalive);
                 if (res) {
-                    daemon_log(LOG_ERR, "Can't connect to Mosquitto server %s", mosquitto_strerror(res));
+                    DLOG_ERR("Can't connect to Mosquitto server %s", mosquitto_strerror(res));
                     sleep(30);
                 }
                 break;
@@ -181,26 +186,27 @@ void *mosq_thread_loop(void *p) {
             case MOSQ_ERR_CONN_LOST:
             case MOSQ_ERR_PROTOCOL:
             case MOSQ_ERR_ERRNO:
-                daemon_log(LOG_ERR, "%s %s %s", __FUNCTION__, strerror(errno), mosquitto_strerror(res));
+                DLOG_ERR("%s %s", strerror(errno), mosquitto_strerror(res));
+                daemon_flight_event("mqtt connection lost: %s", mosquitto_strerror(res));
                 mosquitto_disconnect(mosq);
-                daemon_log(LOG_ERR, "%s disconnected", __FUNCTION__);
+                DLOG_ERR("disconnected");
                 sleep(10);
-                daemon_log(LOG_ERR, "%s Try to reconnect", __FUNCTION__);
+                DLOG_ERR("Try to reconnect");
                 int res = mosquitto_connect(mosq, mqtt_host, mqtt_port, mqtt_keepalive);
                 if (res) {
-                    daemon_log(LOG_ERR, "%s Can't connect to Mosquitto server %s", __FUNCTION__,
-                               mosquitto_strerror(res));
+                    DLOG_ERR("Can't connect to Mosquitto server %s", mosquitto_strerror(res));
                 } else {
-                    daemon_log(LOG_ERR, "%s Connected", __FUNCTION__);
+                    DLOG_ERR("Connected");
                 }
 
                 break;
             default:
-                daemon_log(LOG_ERR, "%s unknown error (%d) from mosquitto_loop", __FUNCTION__, res);
+                DLOG_ERR("unknown error (%d) from mosquitto_loop", res);
                 break;
         }
     }
     daemon_log(LOG_INFO, "%s finished", __FUNCTION__);
+    dmem_arena_free(&message_arena);
     pthread_exit(NULL);
 }
 
@@ -232,12 +238,13 @@ typedef struct _mosq_cb_info_t {
     mosq_cb_t cb;
 } t_mosq_cb_info;
 
-t_mosq_cb_info mosq_info[10] ={0};
+t_mosq_cb_info *mosq_info = NULL;
 size_t mosq_info_count = 0;
 
 static
 void on_connect(struct mosquitto *m, void *UNUSED(udata), int res) {
     daemon_log(LOG_INFO, "%s", __FUNCTION__);
+    daemon_flight_event("mqtt connect: %d", res);
     switch (res) {
         case 0:
             for (size_t i=0; i<mosq_info_count; i++) {
@@ -276,20 +283,34 @@ void on_message(struct mosquitto *UNUSED(m), void *UNUSED(udata),
 //               msg->topic, msg->payloadlen, msg->qos, msg->retain ? "R" : "!r",
 //               (char *) msg->payload);
 
+    mqlog_record(msg);
+    mosq_dispatch(msg);
+}
+
+void mosq_dispatch(const struct mosquitto_message *msg) {
     for (size_t i = 0; i < mosq_info_count; i++) {
         if (strcasecmp(mosq_info[i].topic, msg->topic) == 0) {
+            DAEMON_TRACE_ENTER("%s", msg->topic);
             mosq_info[i].cb(msg);
+            DAEMON_TRACE_LEAVE();
         }
     }
+    dmem_arena_reset(&message_arena);
 }
 
 void mosq_register_on_message_cb(const char * topic, mosq_cb_t cb) {
-    //
-    if (mosq_info_count < sizeof(mosq_info) / sizeof(mosq_info[0])) {
-        mosq_info[mosq_info_count].cb = cb;
-        mosq_info[mosq_info_count].topic = strdup(topic);
-        mosq_info_count++;
+    // grows by 16, registrations happen once at start up
+    if (mosq_info_count % 16 == 0) {
+        mosq_info = xrealloc(mosq_info, (mosq_info_count + 16) * sizeof(t_mosq_cb_info));
     }
+    mosq_info[mosq_info_count].cb = cb;
+    mosq_info[mosq_info_count].topic = xstrdup(topic);
+    mosq_info_count++;
+}
+
+void mosq_set_broker(const char *host, int port) {
+    mqtt_host = host;
+    mqtt_port = port;
 }
 
 void mosq_init(const char *prog_name, const char *host_name) {
@@ -12,10 +12,16 @@
 
 typedef void (*mosq_cb_t)(const struct mosquitto_message *msg);
 
+/** Connect to host:port instead of the house broker, call before mosq_init() */
+void mosq_set_broker(const char *host, int port);
+
 void mosq_init(const char *progname, const char *host_name);
 
 void mosq_destroy(void);
 
 void mosq_register_on_message_cb(const char *topic, mosq_cb_t cb);
 
+/** Run the callbacks registered for the message's topic, as a message from the broker does */
+void mosq_dispatch(const struct mosquitto_message *msg);
+
 #endif //SUPER_CLOCK_MQ_H
\ No newline at end of file
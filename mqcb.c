@@ -0,0 +1,164 @@
+/**
+* @file mqcb.c
+*
+* @brief Callbacks for the MQTT topics of the house sensors.
+*
+*/
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <json-c/json.h>
+
+#include "mqcb.h"
+#include "mq.h"
+#include "dlog.h"
+#include "sensor.h"
+#include "history.h"
+#include "rollup.h"
+
+// the battery and power meters publish every few seconds, one reading in 10 is logged
+#define MQCB_LOG_SAMPLE 10
+
+/* json-c takes no allocator, the object tree of a message comes from malloc.
+ * The tokener and its buffers are kept per thread instead of allocated by
+ * json_tokener_parse() for every message. */
+static json_object *mqcb_parse(const struct mosquitto_message *msg) {
+    static __thread json_tokener *tok = NULL;
+    if (!tok && !(tok = json_tokener_new())) {
+        return NULL;
+    }
+    json_tokener_reset(tok);
+    return json_tokener_parse_ex(tok, msg->payload, msg->payloadlen);
+}
+
+// Measured values also go to the on-disk history
+static void sensor_record(sensor_key_t key, double value) {
+    sensor_set(key, value);
+    time_t now = time(NULL);
+    history_append(key, now, value);
+    rollup_add(key, now, value);
+}
+
+void battery_cb(const struct mosquitto_message *msg) {
+    json_object *jobj = mqcb_parse(msg);
+    json_object *j_soc = NULL;
+    json_object_object_get_ex(jobj, "soc", &j_soc);
+    double soc = json_object_get_double(j_soc);
+    sensor_record(SENSOR_BATTERY_SOC, soc);
+    json_object *j_current = NULL;
+    json_object_object_get_ex(jobj, "current", &j_current);
+    double current = json_object_get_double(j_current);
+    sensor_record(SENSOR_BATTERY_CURRENT, current);
+    json_object *j_voltage = NULL;
+    json_object_object_get_ex(jobj, "voltage", &j_voltage);
+    double voltage = json_object_get_double(j_voltage);
+    sensor_record(SENSOR_BATTERY_VOLTAGE, voltage);
+    json_object *j_temp = NULL;
+    json_object_object_get_ex(jobj, "temp_tube", &j_temp);
+    double temp = json_object_get_double(j_temp);
+    sensor_record(SENSOR_BATTERY_TEMP, temp);
+    json_object *j_capacity = NULL;
+    json_object_object_get_ex(jobj, "capacity", &j_capacity);
+    double capacity = json_object_get_double(j_capacity);
+    sensor_record(SENSOR_BATTERY_CAPACITY, capacity);
+    DLOG_SAMPLE(LOG_INFO, MQCB_LOG_SAMPLE, "soc: %.0f%%, current: %.2fA, voltage: %.2fV, power:%.2fW temp: %.0fC "
+                                           "capacity: %.0f", soc, current, voltage, current * voltage, temp, capacity);
+    json_object_put(jobj);
+}
+
+//{"Time":"2023-11-06T13:36:55","SHT3X":{"Temperature":36.7,"Humidity":27.3},"PZEM004T":{"Total":8211.639,"Power":540,"Voltage":235,"Current":3.070},"TempUnit":"C"}
+
+void main_power_cb(const struct mosquitto_message *msg) {
+    json_object *jobj = mqcb_parse(msg);
+    json_object *j_pzem = NULL;
+    json_object_object_get_ex(jobj, "PZEM004T", &j_pzem);
+
+    json_object *j_power = NULL;
+    json_object_object_get_ex(j_pzem, "Power", &j_power);
+    double power = json_object_get_double(j_power);
+    sensor_record(SENSOR_MAIN_POWER, power);
+    json_object *j_voltage = NULL;
+    json_object_object_get_ex(j_pzem, "Voltage", &j_voltage);
+    double voltage = json_object_get_double(j_voltage);
+    sensor_record(SENSOR_MAIN_VOLTAGE, voltage);
+    DLOG_SAMPLE(LOG_INFO, MQCB_LOG_SAMPLE, "power: %.0fW, voltage: %.0fV", power, voltage);
+    json_object_put(jobj);
+}
+
+void main_power_lwt_cb(const struct mosquitto_message *msg) {
+    daemon_log(LOG_INFO, "main_power_lwt: %.*s", msg->payloadlen, (char *) msg->payload);
+    sensor_set_bool(SENSOR_MAIN_POWER_ONLINE, strcmp((char *) msg->payload, "Online") == 0);
+}
+
+void main_battery_lwt_cb(const struct mosquitto_message *msg) {
+    daemon_log(LOG_INFO, "main_battery_lwt: %.*s", msg->payloadlen, (char *) msg->payload);
+    sensor_set_bool(SENSOR_BATTERY_ONLINE, strcmp((char *) msg->payload, "Online") == 0);
+}
+
+
+//{"Time":"2023-11-08T14:55:49","IN":{"time": "2023-11-08 14:55:32","brand": "ODROID","model": "WB2","id": 0,"channel": 1,"battery": "OK","temperature_C": 25.47,"humidity": 53.48,"pressure": 984.9,"altitude": 329.2581,"uv_index": 0.01,"visible": 206,"ir": 30},"EX":{"time": "2023-11-08 14:55:36","brand": "OS","model": "Oregon-THGR122N","id": 249,"channel": 1,"battery_ok": 1,"temperature_C": 9.3,"humidity": 87}}
+void outdoor_cb(const struct mosquitto_message *msg) {
+    json_object *jobj = mqcb_parse(msg);
+    json_object *j_in = NULL;
+    json_object_object_get_ex(jobj, "EX", &j_in);
+    json_object *j_temperature = NULL;
+    json_object_object_get_ex(j_in, "temperature_C", &j_temperature);
+    double temperature = json_object_get_double(j_temperature);
+    sensor_record(SENSOR_OUTDOOR_TEMP, temperature);
+    daemon_log(LOG_INFO, "outdoor temperature: %.1fC", temperature);
+    json_object_put(jobj);
+}
+
+void outdoor_lwt_cb(const struct mosquitto_message *msg) {
+    daemon_log(LOG_INFO, "outdoor_lwt: %.*s", msg->payloadlen, (char *) msg->payload);
+    sensor_set_bool(SENSOR_OUTDOOR_ONLINE, strcasecmp((char *) msg->payload, "Online") == 0);
+}
+
+// {"battery":100,"humidity":51.52,"last_seen":"2023-11-08T12:53:56.724Z","linkquality":76,"pressure":984.7,"temperature":23.39,"voltage":3005}
+void thps_sf_hall_cb(const struct mosquitto_message *msg) {
+    json_object *jobj = mqcb_parse(msg);
+    json_object *j_temperature = NULL;
+    json_object_object_get_ex(jobj, "temperature", &j_temperature);
+    double temperature = json_object_get_double(j_temperature);
+    sensor_record(SENSOR_INDOOR_TEMP, temperature);
+    daemon_log(LOG_INFO, "indoor temperature: %.1fC", temperature);
+    json_object_put(jobj);
+}
+
+void thps_sf_hall_lwt_cb(const struct mosquitto_message *msg) {
+    sensor_set_bool(SENSOR_INDOOR_ONLINE, strcasecmp((char *) msg->payload, "Online") == 0);
+}
+
+void dos_entranse_lwt_cb(const struct mosquitto_message *msg) {
+    sensor_set_bool(SENSOR_DOOR_ONLINE, strcasecmp((char *) msg->payload, "Online") == 0);
+}
+
+void dos_entranse_cb(const struct mosquitto_message *msg) {
+    json_object *root = mqcb_parse(msg);
+    if (root) {
+        json_object *j_contact = NULL;
+        json_object_object_get_ex(root, "contact", &j_contact);
+        bool contact = json_object_get_boolean(j_contact);
+        if (!contact != sensor_get_bool(SENSOR_DOOR_OPEN)) {
+            daemon_log(LOG_INFO, "door open: %d", !contact);
+        }
+        sensor_set_bool(SENSOR_DOOR_OPEN, !contact);
+        json_object_put(root);
+    }
+}
+
+void mqcb_register(void) {
+    mosq_register_on_message_cb("tele/main_battery/SENSOR", battery_cb);
+    mosq_register_on_message_cb("tele/main-power/SENSOR", main_power_cb);
+    mosq_register_on_message_cb("tele/main-power/LWT", main_power_lwt_cb);
+    mosq_register_on_message_cb("tele/main_battery/LWT", main_battery_lwt_cb);
+    mosq_register_on_message_cb("tele/hass/SENSOR", outdoor_cb);
+    mosq_register_on_message_cb("tele/hass/LWT", outdoor_lwt_cb);
+    mosq_register_on_message_cb("zigbee2mqtt/thps_sf_hall", thps_sf_hall_cb);
+    mosq_register_on_message_cb("zigbee2mqtt/thps_sf_hall/availability", thps_sf_hall_lwt_cb);
+    mosq_register_on_message_cb("zigbee2mqtt/dos-entranse/availability", dos_entranse_lwt_cb);
+    mosq_register_on_message_cb("zigbee2mqtt/dos-entranse", dos_entranse_cb);
+}
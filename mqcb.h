@@ -0,0 +1,37 @@
+/**
+* @file mqcb.h
+*
+* @brief Callbacks for the MQTT topics of the house sensors.
+*
+* Each callback parses the payload of its topic into the sensor keys, the
+* measured values also go to the history and its rollups.
+*/
+#ifndef SUPER_CLOCK_MQCB_H
+#define SUPER_CLOCK_MQCB_H
+
+#include <mosquitto.h>
+
+void battery_cb(const struct mosquitto_message *msg);
+
+void main_power_cb(const struct mosquitto_message *msg);
+
+void main_power_lwt_cb(const struct mosquitto_message *msg);
+
+void main_battery_lwt_cb(const struct mosquitto_message *msg);
+
+void outdoor_cb(const struct mosquitto_message *msg);
+
+void outdoor_lwt_cb(const struct mosquitto_message *msg);
+
+void thps_sf_hall_cb(const struct mosquitto_message *msg);
+
+void thps_sf_hall_lwt_cb(const struct mosquitto_message *msg);
+
+void dos_entranse_lwt_cb(const struct mosquitto_message *msg);
+
+void dos_entranse_cb(const struct mosquitto_message *msg);
+
+/** Register the callbacks for the ten topics superclock subscribes to */
+void mqcb_register(void);
+
+#endif //SUPER_CLOCK_MQCB_H
@@ -0,0 +1,284 @@
+/**
+* @file mqlog.c
+*
+* @brief Recording of the received MQTT messages and their replay without a broker.
+*
+* Log layout: the 16 byte file header, then per message a 16 byte record
+* header, the topic (only for a topic seen the first time, its length in the
+* header) and the payload. All fields are little endian as written by the
+* host, logs are replayed on the machine type they were recorded on.
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "mqlog.h"
+#include "dlog.h"
+#include "dflight.h"
+#include "dmem.h"
+#include "dfork.h"
+
+#define MQLOG_MAGIC "SCMQLOG1"
+#define MQLOG_VERSION 1
+#define MQLOG_MAX_TOPICS 256
+// the record carries the topic string, its length is in topic_len
+#define MQLOG_NEW_TOPIC 0x01
+#define MQLOG_RETAIN 0x02
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} mqlog_file_header_t;
+
+typedef struct {
+    // CLOCK_REALTIME, microseconds
+    uint64_t time_us;
+    uint16_t topic;
+    uint8_t qos;
+    uint8_t flags;
+    uint16_t topic_len;
+    uint16_t reserved;
+    uint32_t payload_len;
+} mqlog_record_t;
+
+typedef struct {
+    FILE *file;
+    char *topics[MQLOG_MAX_TOPICS];
+    int topic_count;
+} mqlog_topics_t;
+
+static pthread_mutex_t record_mtx = PTHREAD_MUTEX_INITIALIZER;
+static mqlog_topics_t recorder = {0};
+
+static struct {
+    pthread_t thread;
+    bool running;
+    bool stop;
+    double speed;
+    mqlog_dispatch_fn dispatch;
+    mqlog_topics_t log;
+    mqlog_replay_stats_t stats;
+} replay = {0};
+
+static pthread_mutex_t replay_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void topics_free(mqlog_topics_t *t) {
+    for (int i = 0; i < t->topic_count; i++) {
+        FREE(t->topics[i]);
+    }
+    t->topic_count = 0;
+    if (t->file) {
+        fclose(t->file);
+        t->file = NULL;
+    }
+}
+
+int mqlog_record_open(const char *path) {
+    FILE *file = fopen(path, "we");
+    if (!file) {
+        return -1;
+    }
+    mqlog_file_header_t h = {.version = MQLOG_VERSION};
+    memcpy(h.magic, MQLOG_MAGIC, sizeof(h.magic));
+    if (fwrite(&h, sizeof(h), 1, file) != 1 || fflush(file)) {
+        int err = errno;
+        fclose(file);
+        errno = err;
+        return -1;
+    }
+    pthread_mutex_lock(&record_mtx);
+    topics_free(&recorder);
+    recorder.file = file;
+    pthread_mutex_unlock(&record_mtx);
+    daemon_log(LOG_INFO, "recording MQTT messages into %s", path);
+    return 0;
+}
+
+void mqlog_record_close(void) {
+    pthread_mutex_lock(&record_mtx);
+    topics_free(&recorder);
+    pthread_mutex_unlock(&record_mtx);
+}
+
+void mqlog_record(const struct mosquitto_message *msg) {
+    pthread_mutex_lock(&record_mtx);
+    if (!recorder.file || !msg->topic) {
+        pthread_mutex_unlock(&record_mtx);
+        return;
+    }
+    mqlog_record_t r = {
+            .time_us = clock_ns(CLOCK_REALTIME) / 1000,
+            .qos = (uint8_t) msg->qos,
+            .flags = msg->retain ? MQLOG_RETAIN : 0,
+            .payload_len = msg->payloadlen > 0 ? (uint32_t) msg->payloadlen : 0,
+    };
+    int topic = 0;
+    while (topic < recorder.topic_count && strcmp(recorder.topics[topic], msg->topic) != 0) {
+        topic++;
+    }
+    size_t topic_len = strlen(msg->topic);
+    if (topic == recorder.topic_count) {
+        if (topic == MQLOG_MAX_TOPICS || topic_len > UINT16_MAX) {
+            pthread_mutex_unlock(&record_mtx);
+            return;
+        }
+        recorder.topics[recorder.topic_count++] = xstrdup(msg->topic);
+        r.flags |= MQLOG_NEW_TOPIC;
+        r.topic_len = (uint16_t) topic_len;
+    }
+    r.topic = (uint16_t) topic;
+
+    // a message per flush, a crash loses at most the message being written
+    bool ok = fwrite(&r, sizeof(r), 1, recorder.file) == 1 &&
+              (!(r.flags & MQLOG_NEW_TOPIC) || fwrite(msg->topic, topic_len, 1, recorder.file) == 1) &&
+              (!r.payload_len || fwrite(msg->payload, r.payload_len, 1, recorder.file) == 1) &&
+              fflush(recorder.file) == 0;
+    if (!ok) {
+        daemon_log(LOG_ERR, "MQTT recording stopped: %s", strerror(errno));
+        topics_free(&recorder);
+    }
+    pthread_mutex_unlock(&record_mtx);
+}
+
+// Next message of the log into msg, the topic stays owned by the table, the NUL terminated payload is in arena
+static bool replay_read(mqlog_topics_t *log, mqlog_record_t *r, struct mosquitto_message *msg, dmem_arena_t *arena) {
+    if (fread(r, sizeof(mqlog_record_t), 1, log->file) != 1) {
+        return false;
+    }
+    if (r->flags & MQLOG_NEW_TOPIC) {
+        if (log->topic_count == MQLOG_MAX_TOPICS || r->topic != log->topic_count) {
+            return false;
+        }
+        char *topic = xmalloc((size_t) r->topic_len + 1);
+        if (fread(topic, 1, r->topic_len, log->file) != r->topic_len) {
+            FREE(topic);
+            return false;
+        }
+        topic[r->topic_len] = 0;
+        log->topics[log->topic_count++] = topic;
+    } else if (r->topic >= log->topic_count) {
+        return false;
+    }
+    char *payload = dmem_arena_alloc(arena, (size_t) r->payload_len + 1);
+    if (!payload || fread(payload, 1, r->payload_len, log->file) != r->payload_len) {
+        return false;
+    }
+    payload[r->payload_len] = 0;
+    memset(msg, 0, sizeof(struct mosquitto_message));
+    msg->topic = log->topics[r->topic];
+    msg->payload = payload;
+    msg->payloadlen = (int) r->payload_len;
+    msg->qos = r->qos;
+    msg->retain = (r->flags & MQLOG_RETAIN) != 0;
+    return true;
+}
+
+static void *replay_thread(void *UNUSED(arg)) {
+    mqlog_record_t r;
+    struct mosquitto_message msg;
+    dmem_arena_t arena = DMEM_ARENA_INIT;
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    uint64_t first_us = 0;
+    bool first = true;
+
+    daemon_flight_thread();
+    while (!__atomic_load_n(&replay.stop, __ATOMIC_RELAXED) && replay_read(&replay.log, &r, &msg, &arena)) {
+        if (first) {
+            first_us = r.time_us;
+            first = false;
+        }
+        if (replay.speed > 0) {
+            uint64_t due = start + (uint64_t) ((double) (r.time_us - first_us) * 1000.0 / replay.speed);
+            uint64_t now = clock_ns(CLOCK_MONOTONIC);
+            while (now < due && !__atomic_load_n(&replay.stop, __ATOMIC_RELAXED)) {
+                // short naps keep stop responsive on slow replays
+                uint64_t nap = due - now < 100000000ULL ? due - now : 100000000ULL;
+                struct timespec ts = {(time_t) (nap / 1000000000ULL), (long) (nap % 1000000000ULL)};
+                nanosleep(&ts, NULL);
+                now = clock_ns(CLOCK_MONOTONIC);
+            }
+        }
+        uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        replay.dispatch(&msg);
+        cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        dmem_arena_reset(&arena);
+
+        pthread_mutex_lock(&replay_mtx);
+        replay.stats.messages++;
+        replay.stats.callback_ns += cpu;
+        replay.stats.clock = (time_t) (r.time_us / 1000000);
+        replay.stats.wall_ns = clock_ns(CLOCK_MONOTONIC) - start;
+        pthread_mutex_unlock(&replay_mtx);
+    }
+    dmem_arena_free(&arena);
+    pthread_mutex_lock(&replay_mtx);
+    replay.stats.done = true;
+    replay.stats.wall_ns = clock_ns(CLOCK_MONOTONIC) - start;
+    pthread_mutex_unlock(&replay_mtx);
+    return NULL;
+}
+
+int mqlog_replay_start(const char *path, double speed, mqlog_dispatch_fn dispatch) {
+    if (replay.running) {
+        errno = EBUSY;
+        return -1;
+    }
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        return -1;
+    }
+    mqlog_file_header_t h;
+    if (fread(&h, sizeof(h), 1, file) != 1 || memcmp(h.magic, MQLOG_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != MQLOG_VERSION) {
+        fclose(file);
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&replay.stats, 0, sizeof(replay.stats));
+    replay.log.file = file;
+    replay.speed = speed;
+    replay.dispatch = dispatch;
+    replay.stop = false;
+    int res = pthread_create(&replay.thread, NULL, replay_thread, NULL);
+    if (res) {
+        topics_free(&replay.log);
+        errno = res;
+        return -1;
+    }
+    replay.running = true;
+    if (speed > 0) {
+        daemon_log(LOG_INFO, "replaying MQTT messages from %s at %gx", path, speed);
+    } else {
+        daemon_log(LOG_INFO, "replaying MQTT messages from %s at full speed", path);
+    }
+    return 0;
+}
+
+void mqlog_replay_stats(mqlog_replay_stats_t *stats) {
+    pthread_mutex_lock(&replay_mtx);
+    *stats = replay.stats;
+    pthread_mutex_unlock(&replay_mtx);
+}
+
+void mqlog_replay_stop(void) {
+    if (!replay.running) {
+        return;
+    }
+    __atomic_store_n(&replay.stop, true, __ATOMIC_RELAXED);
+    pthread_join(replay.thread, NULL);
+    topics_free(&replay.log);
+    replay.running = false;
+}
@@ -0,0 +1,57 @@
+/**
+* @file mqlog.h
+*
+* @brief Recording of the received MQTT messages and their replay without a broker.
+*
+* The recorder appends every message on_message() receives to a binary log:
+* receive time, topic, QoS, retain flag and payload. A topic is written out
+* the first time it appears and referred to by its index afterwards.
+*
+* The replay thread reads a log back and hands the messages to a dispatch
+* function, the one the broker connection uses, at the recorded pace, N times
+* faster or as fast as the callbacks go. It counts the messages and the CPU
+* time spent in dispatch.
+*/
+#ifndef SUPER_CLOCK_MQLOG_H
+#define SUPER_CLOCK_MQLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <mosquitto.h>
+
+typedef void (*mqlog_dispatch_fn)(const struct mosquitto_message *msg);
+
+typedef struct {
+    unsigned long messages;
+    // CPU time of the replay thread spent in dispatch
+    uint64_t callback_ns;
+    uint64_t wall_ns;
+    // receive time of the last message dispatched
+    time_t clock;
+    bool done;
+} mqlog_replay_stats_t;
+
+/** Start recording into path, an existing log is replaced
+ * @return 0 on success, -1 with errno set otherwise
+ */
+int mqlog_record_open(const char *path);
+
+/** Append the message, nothing happens unless recording */
+void mqlog_record(const struct mosquitto_message *msg);
+
+void mqlog_record_close(void);
+
+/** Replay the log on a thread
+ * @param speed 1 replays at the recorded pace, N N times faster, 0 without waiting
+ * @return 0 on success, -1 with errno set otherwise
+ */
+int mqlog_replay_start(const char *path, double speed, mqlog_dispatch_fn dispatch);
+
+void mqlog_replay_stats(mqlog_replay_stats_t *stats);
+
+/** Stop the replay and wait for the thread */
+void mqlog_replay_stop(void);
+
+#endif //SUPER_CLOCK_MQLOG_H
@@ -0,0 +1,499 @@
+/**
+* @file pixops.c
+*
+* @brief Pixel kernels for the software render path.
+*
+*/
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pixops.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXOPS_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXOPS_NEON
+#include <arm_neon.h>
+#endif
+
+// x * y / 255 rounded to nearest for x * y <= 255 * 255
+static inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t channel(uint32_t p, int shift) {
+    return (p >> shift) & 0xff;
+}
+
+static inline uint16_t rgb565(uint32_t p, int r_shift, int g_shift, int b_shift) {
+    return (uint16_t) ((channel(p, r_shift) >> 3) << 11 | (channel(p, g_shift) >> 2) << 5 | channel(p, b_shift) >> 3);
+}
+
+/*********************************************************************************************************************/
+static void colorize_scalar(uint32_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint32_t color) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (src[i] & amask) ? color : src[i];
+    }
+}
+
+static void colorize_rgb565_scalar(uint16_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint16_t color,
+                                   uint16_t key) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (src[i] & amask) ? color : key;
+    }
+}
+
+static void tint_scalar(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t p = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            p |= div255(channel(src[i], shift) * channel(color, shift)) << shift;
+        }
+        dst[i] = p;
+    }
+}
+
+static void lerp_scalar(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned int t) {
+    if (t > PIXOPS_LERP_ONE) {
+        t = PIXOPS_LERP_ONE;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint32_t p = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            p |= ((channel(a[i], shift) * (PIXOPS_LERP_ONE - t) + channel(b[i], shift) * t) >> 8) << shift;
+        }
+        dst[i] = p;
+    }
+}
+
+static void premultiply_scalar(uint32_t *dst, const uint32_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t alpha = src[i] >> 24;
+        uint32_t p = src[i] & 0xff000000;
+        for (int shift = 0; shift < 24; shift += 8) {
+            p |= div255(channel(src[i], shift) * alpha) << shift;
+        }
+        dst[i] = p;
+    }
+}
+
+static void to_rgb565_scalar(uint16_t *dst, const uint32_t *src, size_t n, int r_shift, int g_shift, int b_shift) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = rgb565(src[i], r_shift, g_shift, b_shift);
+    }
+}
+
+/*********************************************************************************************************************/
+#ifdef PIXOPS_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+static inline SSE2 __m128i div255_sse2(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static SSE2 void colorize_sse2(uint32_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint32_t color) {
+    const __m128i m = _mm_set1_epi32((int) amask);
+    const __m128i c = _mm_set1_epi32((int) color);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(p, m), zero);
+        _mm_storeu_si128((__m128i *) (dst + i),
+                         _mm_or_si128(_mm_and_si128(transparent, p), _mm_andnot_si128(transparent, c)));
+    }
+    colorize_scalar(dst + i, src + i, n - i, amask, color);
+}
+
+// the 16 bit values are sign extended to 32 bits so packs keeps them intact
+static SSE2 void colorize_rgb565_sse2(uint16_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint16_t color,
+                                      uint16_t key) {
+    const __m128i m = _mm_set1_epi32((int) amask);
+    const __m128i c = _mm_set1_epi32((int16_t) color);
+    const __m128i k = _mm_set1_epi32((int16_t) key);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *) (src + i)), m), zero);
+        __m128i hi = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *) (src + i + 4)), m), zero);
+        lo = _mm_or_si128(_mm_and_si128(lo, k), _mm_andnot_si128(lo, c));
+        hi = _mm_or_si128(_mm_and_si128(hi, k), _mm_andnot_si128(hi, c));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packs_epi32(lo, hi));
+    }
+    colorize_rgb565_scalar(dst + i, src + i, n - i, amask, color, key);
+}
+
+static SSE2 void tint_sse2(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32((int) color), zero);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), c));
+        __m128i hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), c));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(lo, hi));
+    }
+    tint_scalar(dst + i, src + i, n - i, color);
+}
+
+static SSE2 void lerp_sse2(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned int t) {
+    if (t > PIXOPS_LERP_ONE) {
+        t = PIXOPS_LERP_ONE;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wa = _mm_set1_epi16((short) (PIXOPS_LERP_ONE - t));
+    const __m128i wb = _mm_set1_epi16((short) t);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i pa = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i pb = _mm_loadu_si128((const __m128i *) (b + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), wb));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+    lerp_scalar(dst + i, a + i, b + i, n - i, t);
+}
+
+static inline SSE2 __m128i premultiply_half_sse2(__m128i p) {
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return div255_sse2(_mm_mullo_epi16(p, alpha));
+}
+
+static SSE2 void premultiply_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i amask = _mm_set1_epi32((int) 0xff000000);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i lo = premultiply_half_sse2(_mm_unpacklo_epi8(p, zero));
+        __m128i hi = premultiply_half_sse2(_mm_unpackhi_epi8(p, zero));
+        __m128i rgb = _mm_andnot_si128(amask, _mm_packus_epi16(lo, hi));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(rgb, _mm_and_si128(p, amask)));
+    }
+    premultiply_scalar(dst + i, src + i, n - i);
+}
+
+// 4 pixels to 4 RGB565 values in the low half of each 32 bit lane, sign extended for packs
+static inline SSE2 __m128i rgb565_sse2(__m128i p, __m128i rs, __m128i gs, __m128i bs) {
+    const __m128i byte = _mm_set1_epi32(0xff);
+    __m128i r = _mm_and_si128(_mm_srl_epi32(p, rs), byte);
+    __m128i g = _mm_and_si128(_mm_srl_epi32(p, gs), byte);
+    __m128i b = _mm_and_si128(_mm_srl_epi32(p, bs), byte);
+    __m128i v = _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 3), 11),
+                             _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(g, 2), 5), _mm_srli_epi32(b, 3)));
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+static SSE2 void to_rgb565_sse2(uint16_t *dst, const uint32_t *src, size_t n, int r_shift, int g_shift,
+                                int b_shift) {
+    const __m128i rs = _mm_cvtsi32_si128(r_shift);
+    const __m128i gs = _mm_cvtsi32_si128(g_shift);
+    const __m128i bs = _mm_cvtsi32_si128(b_shift);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + i)), rs, gs, bs);
+        __m128i hi = rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + i + 4)), rs, gs, bs);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packs_epi32(lo, hi));
+    }
+    to_rgb565_scalar(dst + i, src + i, n - i, r_shift, g_shift, b_shift);
+}
+
+/*********************************************************************************************************************/
+static inline AVX2 __m256i div255_avx2(__m256i x) {
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+static AVX2 void colorize_avx2(uint32_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint32_t color) {
+    const __m256i m = _mm256_set1_epi32((int) amask);
+    const __m256i c = _mm256_set1_epi32((int) color);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(p, m), zero);
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_blendv_epi8(c, p, transparent));
+    }
+    colorize_scalar(dst + i, src + i, n - i, amask, color);
+}
+
+static AVX2 void colorize_rgb565_avx2(uint16_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint16_t color,
+                                      uint16_t key) {
+    const __m256i m = _mm256_set1_epi32((int) amask);
+    const __m256i c = _mm256_set1_epi32((int16_t) color);
+    const __m256i k = _mm256_set1_epi32((int16_t) key);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i lo = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256((const __m256i *) (src + i)), m), zero);
+        __m256i hi = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256((const __m256i *) (src + i + 8)), m),
+                                        zero);
+        __m256i packed = _mm256_packs_epi32(_mm256_blendv_epi8(c, k, lo), _mm256_blendv_epi8(c, k, hi));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    colorize_rgb565_sse2(dst + i, src + i, n - i, amask, color, key);
+}
+
+// unpack and pack work within 128 bit lanes, so the pixel order survives the round trip
+static AVX2 void tint_avx2(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c = _mm256_unpacklo_epi8(_mm256_set1_epi32((int) color), zero);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(p, zero), c));
+        __m256i hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(p, zero), c));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    tint_scalar(dst + i, src + i, n - i, color);
+}
+
+static AVX2 void lerp_avx2(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned int t) {
+    if (t > PIXOPS_LERP_ONE) {
+        t = PIXOPS_LERP_ONE;
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i wa = _mm256_set1_epi16((short) (PIXOPS_LERP_ONE - t));
+    const __m256i wb = _mm256_set1_epi16((short) t);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i pa = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i pb = _mm256_loadu_si256((const __m256i *) (b + i));
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pa, zero), wa),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(pb, zero), wb));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pa, zero), wa),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(pb, zero), wb));
+        _mm256_storeu_si256((__m256i *) (dst + i),
+                            _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+    }
+    lerp_scalar(dst + i, a + i, b + i, n - i, t);
+}
+
+static inline AVX2 __m256i premultiply_half_avx2(__m256i p) {
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3)),
+                                           _MM_SHUFFLE(3, 3, 3, 3));
+    return div255_avx2(_mm256_mullo_epi16(p, alpha));
+}
+
+static AVX2 void premultiply_avx2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i amask = _mm256_set1_epi32((int) 0xff000000);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i lo = premultiply_half_avx2(_mm256_unpacklo_epi8(p, zero));
+        __m256i hi = premultiply_half_avx2(_mm256_unpackhi_epi8(p, zero));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_blendv_epi8(_mm256_packus_epi16(lo, hi), p, amask));
+    }
+    premultiply_scalar(dst + i, src + i, n - i);
+}
+
+static inline AVX2 __m256i rgb565_avx2(__m256i p, __m128i rs, __m128i gs, __m128i bs) {
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    __m256i r = _mm256_and_si256(_mm256_srl_epi32(p, rs), byte);
+    __m256i g = _mm256_and_si256(_mm256_srl_epi32(p, gs), byte);
+    __m256i b = _mm256_and_si256(_mm256_srl_epi32(p, bs), byte);
+    __m256i v = _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(r, 3), 11),
+                                _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(g, 2), 5),
+                                                _mm256_srli_epi32(b, 3)));
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+static AVX2 void to_rgb565_avx2(uint16_t *dst, const uint32_t *src, size_t n, int r_shift, int g_shift,
+                                int b_shift) {
+    const __m128i rs = _mm_cvtsi32_si128(r_shift);
+    const __m128i gs = _mm_cvtsi32_si128(g_shift);
+    const __m128i bs = _mm_cvtsi32_si128(b_shift);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i lo = rgb565_avx2(_mm256_loadu_si256((const __m256i *) (src + i)), rs, gs, bs);
+        __m256i hi = rgb565_avx2(_mm256_loadu_si256((const __m256i *) (src + i + 8)), rs, gs, bs);
+        // packs interleaves the 128 bit lanes of lo and hi, put them back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *) (dst + i), packed);
+    }
+    to_rgb565_sse2(dst + i, src + i, n - i, r_shift, g_shift, b_shift);
+}
+
+static bool supported_sse2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool supported_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif // PIXOPS_X86
+
+/*********************************************************************************************************************/
+#ifdef PIXOPS_NEON
+
+// (x + 128 + ((x + 128) >> 8)) >> 8 narrowed to 8 bits
+static inline uint8x8_t div255_neon(uint16x8_t x) {
+    return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+}
+
+static void colorize_neon(uint32_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint32_t color) {
+    const uint32x4_t m = vdupq_n_u32(amask);
+    const uint32x4_t c = vdupq_n_u32(color);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t p = vld1q_u32(src + i);
+        vst1q_u32(dst + i, vbslq_u32(vtstq_u32(p, m), c, p));
+    }
+    colorize_scalar(dst + i, src + i, n - i, amask, color);
+}
+
+static void colorize_rgb565_neon(uint16_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint16_t color,
+                                 uint16_t key) {
+    const uint32x4_t m = vdupq_n_u32(amask);
+    const uint32x4_t c = vdupq_n_u32(color);
+    const uint32x4_t k = vdupq_n_u32(key);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint32x4_t lo = vbslq_u32(vtstq_u32(vld1q_u32(src + i), m), c, k);
+        uint32x4_t hi = vbslq_u32(vtstq_u32(vld1q_u32(src + i + 4), m), c, k);
+        vst1q_u16(dst + i, vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+    }
+    colorize_rgb565_scalar(dst + i, src + i, n - i, amask, color, key);
+}
+
+static void tint_neon(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    const uint8x8_t c = vreinterpret_u8_u32(vdup_n_u32(color));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t p = vreinterpretq_u8_u32(vld1q_u32(src + i));
+        uint8x8_t lo = div255_neon(vmull_u8(vget_low_u8(p), c));
+        uint8x8_t hi = div255_neon(vmull_u8(vget_high_u8(p), c));
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vcombine_u8(lo, hi)));
+    }
+    tint_scalar(dst + i, src + i, n - i, color);
+}
+
+static void lerp_neon(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned int t) {
+    if (t > PIXOPS_LERP_ONE) {
+        t = PIXOPS_LERP_ONE;
+    }
+    const uint16_t wa = (uint16_t) (PIXOPS_LERP_ONE - t);
+    const uint16x8_t wb = vdupq_n_u16((uint16_t) t);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t pa = vreinterpretq_u8_u32(vld1q_u32(a + i));
+        uint8x16_t pb = vreinterpretq_u8_u32(vld1q_u32(b + i));
+        uint16x8_t lo = vmlaq_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(pa)), wa), vmovl_u8(vget_low_u8(pb)), wb);
+        uint16x8_t hi = vmlaq_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(pa)), wa), vmovl_u8(vget_high_u8(pb)), wb);
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8))));
+    }
+    lerp_scalar(dst + i, a + i, b + i, n - i, t);
+}
+
+static void premultiply_neon(uint32_t *dst, const uint32_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x4_t p = vld4_u8((const uint8_t *) (src + i));
+        for (int c = 0; c < 3; c++) {
+            p.val[c] = div255_neon(vmull_u8(p.val[c], p.val[3]));
+        }
+        vst4_u8((uint8_t *) (dst + i), p);
+    }
+    premultiply_scalar(dst + i, src + i, n - i);
+}
+
+static void to_rgb565_neon(uint16_t *dst, const uint32_t *src, size_t n, int r_shift, int g_shift, int b_shift) {
+    size_t i = 0;
+    if (!(r_shift & 7) && !(g_shift & 7) && !(b_shift & 7)) {
+        for (; i + 8 <= n; i += 8) {
+            uint8x8x4_t p = vld4_u8((const uint8_t *) (src + i));
+            uint16x8_t r = vshlq_n_u16(vmovl_u8(vshr_n_u8(p.val[r_shift / 8], 3)), 11);
+            uint16x8_t g = vshlq_n_u16(vmovl_u8(vshr_n_u8(p.val[g_shift / 8], 2)), 5);
+            uint16x8_t b = vmovl_u8(vshr_n_u8(p.val[b_shift / 8], 3));
+            vst1q_u16(dst + i, vorrq_u16(r, vorrq_u16(g, b)));
+        }
+    }
+    to_rgb565_scalar(dst + i, src + i, n - i, r_shift, g_shift, b_shift);
+}
+
+// built only when the compiler may use NEON anyway, so the CPU has it
+static bool supported_neon(void) {
+    return true;
+}
+
+#endif // PIXOPS_NEON
+
+/*********************************************************************************************************************/
+typedef struct {
+    pixops_t ops;
+    bool (*supported)(void);
+} pixops_impl_t;
+
+// slowest first, the last supported one is the default
+static const pixops_impl_t impls[] = {
+        {{"scalar", colorize_scalar, colorize_rgb565_scalar, tint_scalar, lerp_scalar, premultiply_scalar,
+          to_rgb565_scalar}, NULL},
+#ifdef PIXOPS_X86
+        {{"sse2", colorize_sse2, colorize_rgb565_sse2, tint_sse2, lerp_sse2, premultiply_sse2,
+          to_rgb565_sse2}, supported_sse2},
+        {{"avx2", colorize_avx2, colorize_rgb565_avx2, tint_avx2, lerp_avx2, premultiply_avx2,
+          to_rgb565_avx2}, supported_avx2},
+#endif
+#ifdef PIXOPS_NEON
+        {{"neon", colorize_neon, colorize_rgb565_neon, tint_neon, lerp_neon, premultiply_neon,
+          to_rgb565_neon}, supported_neon},
+#endif
+};
+
+#define IMPL_COUNT (sizeof(impls) / sizeof(impls[0]))
+
+pixops_t pixops = {"scalar", colorize_scalar, colorize_rgb565_scalar, tint_scalar, lerp_scalar, premultiply_scalar,
+                   to_rgb565_scalar};
+
+static bool impl_supported(const pixops_impl_t *impl) {
+    return !impl->supported || impl->supported();
+}
+
+const pixops_t *pixops_available(size_t index) {
+    for (size_t i = 0; i < IMPL_COUNT; i++) {
+        if (impl_supported(&impls[i]) && index-- == 0) {
+            return &impls[i].ops;
+        }
+    }
+    return NULL;
+}
+
+bool pixops_select(const char *name) {
+    for (size_t i = 0; i < IMPL_COUNT; i++) {
+        if (strcmp(impls[i].ops.name, name) == 0 && impl_supported(&impls[i])) {
+            pixops = impls[i].ops;
+            return true;
+        }
+    }
+    return false;
+}
+
+static
+void _pixops_module_init() __attribute__ ((constructor));
+
+static
+void _pixops_module_init() {
+    const char *forced = getenv("PIXOPS");
+    if (forced && pixops_select(forced)) {
+        return;
+    }
+    for (size_t i = IMPL_COUNT; i-- > 0;) {
+        if (impl_supported(&impls[i])) {
+            pixops = impls[i].ops;
+            return;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/**
+* @file pixops.h
+*
+* @brief Pixel kernels for the software render path.
+*
+* Every kernel works on rows of 32 bit pixels and has a scalar version plus
+* SSE2 / AVX2 versions on x86 and a NEON version on ARM builds with NEON
+* enabled. The fastest version the CPU supports is picked when the program
+* starts; PIXOPS=scalar|sse2|avx2|neon in the environment forces one. All
+* versions produce bit identical output.
+*
+* Per channel products are rounded exactly, x * y / 255 to the nearest
+* integer, so the result does not depend on the instruction set. Kernels that
+* need to know which byte holds alpha (premultiply) expect it in the top byte,
+* as in SDL_PIXELFORMAT_ARGB8888 and SDL_PIXELFORMAT_RGBA32 on little endian.
+*/
+#ifndef SUPER_CLOCK_PIXOPS_H
+#define SUPER_CLOCK_PIXOPS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Lerp weight of the second row, 0 gives the first row, PIXOPS_LERP_ONE the second */
+#define PIXOPS_LERP_ONE 256
+
+typedef struct {
+    const char *name;
+
+    /** dst = (src & amask) ? color : src, the alpha mask colouring of the icons */
+    void (*colorize)(uint32_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint32_t color);
+
+    /** dst = (src & amask) ? color : key, colorize into a colour keyed RGB565 surface */
+    void (*colorize_rgb565)(uint16_t *dst, const uint32_t *src, size_t n, uint32_t amask, uint16_t color,
+                            uint16_t key);
+
+    /** Multiply every channel by the matching channel of color / 255 */
+    void (*tint)(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color);
+
+    /** dst = (a * (PIXOPS_LERP_ONE - t) + b * t) / PIXOPS_LERP_ONE per channel, truncated */
+    void (*lerp)(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned int t);
+
+    /** Multiply the three colour channels by alpha / 255, alpha in the top byte */
+    void (*premultiply)(uint32_t *dst, const uint32_t *src, size_t n);
+
+    /** Truncating conversion to RGB565, the shifts locate the 8 bit channels in src */
+    void (*to_rgb565)(uint16_t *dst, const uint32_t *src, size_t n, int r_shift, int g_shift, int b_shift);
+} pixops_t;
+
+/** Kernels selected for this CPU */
+extern pixops_t pixops;
+
+/** Use the named implementation
+ * @return false if it is not built in or not supported by the CPU
+ */
+bool pixops_select(const char *name);
+
+/** Implementations supported by this CPU, index 0 is always the scalar one
+ * @return NULL past the last one
+ */
+const pixops_t *pixops_available(size_t index);
+
+#endif //SUPER_CLOCK_PIXOPS_H
@@ -0,0 +1,182 @@
+/**
+* @file raster.c
+*
+* @brief Pool of threads rasterising widget text into SDL surfaces.
+*
+*/
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "raster.h"
+#include "dlog.h"
+#include "dflight.h"
+#include "dfork.h"
+
+#define RASTER_MAX_FONTS 8
+
+typedef struct {
+    const char *file;
+    int size;
+    TTF_Font *font;
+    // fonts_clock at the last use, the least recent one is closed for a new font
+    unsigned long used;
+} raster_font_t;
+
+// fonts of the current thread
+static __thread raster_font_t fonts[RASTER_MAX_FONTS];
+static __thread int fonts_count = 0;
+static __thread unsigned long fonts_clock = 0;
+
+// FreeType only allows concurrent use of distinct faces, opening them is serialized
+static pthread_mutex_t open_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    pthread_t threads[RASTER_MAX_WORKERS];
+    int workers;
+    pthread_mutex_t mtx;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    raster_job_t *const *jobs;
+    int count;
+    int next;
+    int finished;
+    bool exit;
+} pool = {
+        .mtx = PTHREAD_MUTEX_INITIALIZER,
+        .start = PTHREAD_COND_INITIALIZER,
+        .done = PTHREAD_COND_INITIALIZER,
+};
+
+static TTF_Font *raster_font(const char *file, int size) {
+    int lru = 0;
+    for (int i = 0; i < fonts_count; i++) {
+        if (fonts[i].size == size && strcmp(fonts[i].file, file) == 0) {
+            fonts[i].used = ++fonts_clock;
+            return fonts[i].font;
+        }
+        if (fonts[i].used < fonts[lru].used) {
+            lru = i;
+        }
+    }
+    pthread_mutex_lock(&open_mtx);
+    TTF_Font *font = TTF_OpenFont(file, size);
+    if (font && fonts_count == RASTER_MAX_FONTS) {
+        TTF_CloseFont(fonts[lru].font);
+    }
+    pthread_mutex_unlock(&open_mtx);
+    if (!font) {
+        daemon_log(LOG_ERR, "TTF_OpenFont(%s, %d): %s", file, size, TTF_GetError());
+        return NULL;
+    }
+    int slot = fonts_count < RASTER_MAX_FONTS ? fonts_count++ : lru;
+    fonts[slot] = (raster_font_t) {file, size, font, ++fonts_clock};
+    return font;
+}
+
+static void raster_fonts_close(void) {
+    pthread_mutex_lock(&open_mtx);
+    while (fonts_count > 0) {
+        TTF_CloseFont(fonts[--fonts_count].font);
+    }
+    pthread_mutex_unlock(&open_mtx);
+}
+
+static void raster_render(raster_job_t *job) {
+    TTF_Font *font = raster_font(job->font_file, job->font_size);
+    job->surface = font ? TTF_RenderText_Solid(font, job->text, job->color) : NULL;
+}
+
+// Take jobs of the current batch until none is left, called with pool.mtx held.
+static void raster_take_jobs(void) {
+    while (pool.next < pool.count) {
+        raster_job_t *job = pool.jobs[pool.next++];
+        pthread_mutex_unlock(&pool.mtx);
+        DAEMON_TRACE_ENTER();
+        raster_render(job);
+        DAEMON_TRACE_LEAVE();
+        pthread_mutex_lock(&pool.mtx);
+        if (++pool.finished == pool.count) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+}
+
+static void *raster_worker(void *UNUSED(arg)) {
+    pthread_setname_np(pthread_self(), "raster");
+    daemon_flight_thread();
+    pthread_mutex_lock(&pool.mtx);
+    for (;;) {
+        while (!pool.exit && pool.next >= pool.count) {
+            pthread_cond_wait(&pool.start, &pool.mtx);
+        }
+        if (pool.exit) {
+            break;
+        }
+        raster_take_jobs();
+    }
+    pthread_mutex_unlock(&pool.mtx);
+    raster_fonts_close();
+    return NULL;
+}
+
+int raster_pool_init(int workers) {
+    if (workers > RASTER_MAX_WORKERS) {
+        workers = RASTER_MAX_WORKERS;
+    }
+    pool.exit = false;
+    for (pool.workers = 0; pool.workers < workers; pool.workers++) {
+        if (pthread_create(&pool.threads[pool.workers], NULL, raster_worker, NULL)) {
+            daemon_log(LOG_ERR, "raster worker %d not started", pool.workers);
+            break;
+        }
+    }
+    daemon_log(LOG_INFO, "raster pool: %d workers", pool.workers);
+    return pool.workers;
+}
+
+int raster_pool_workers(void) {
+    return pool.workers;
+}
+
+void raster_pool_run(raster_job_t *const jobs[], int count) {
+    if (count <= 0) {
+        return;
+    }
+    if (count == 1 || pool.workers == 0) {
+        for (int i = 0; i < count; i++) {
+            raster_render(jobs[i]);
+        }
+        return;
+    }
+    pthread_mutex_lock(&pool.mtx);
+    pool.jobs = jobs;
+    pool.count = count;
+    pool.next = 0;
+    pool.finished = 0;
+    pthread_cond_broadcast(&pool.start);
+
+    raster_take_jobs();
+    while (pool.finished < pool.count) {
+        pthread_cond_wait(&pool.done, &pool.mtx);
+    }
+    pool.jobs = NULL;
+    pool.count = 0;
+    pool.next = 0;
+    pthread_mutex_unlock(&pool.mtx);
+}
+
+void raster_pool_done(void) {
+    pthread_mutex_lock(&pool.mtx);
+    pool.exit = true;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.mtx);
+    for (int i = 0; i < pool.workers; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pool.workers = 0;
+    raster_fonts_close();
+}
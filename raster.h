@@ -0,0 +1,40 @@
+/**
+* @file raster.h
+*
+* @brief Pool of threads rasterising widget text into SDL surfaces.
+*
+* Only the font rendering runs on the workers, textures are still created
+* by the caller on the render thread. A TTF_Font must not be shared between
+* threads, so every thread taking jobs opens its own instance of each font.
+*/
+#ifndef SUPER_CLOCK_RASTER_H
+#define SUPER_CLOCK_RASTER_H
+
+#include <SDL2/SDL.h>
+
+#define RASTER_MAX_WORKERS 4
+
+typedef struct {
+    const char *font_file;
+    int font_size;
+    const char *text;
+    SDL_Color color;
+    // filled by raster_pool_run(), NULL if rendering failed
+    SDL_Surface *surface;
+} raster_job_t;
+
+/** Start the workers, call after TTF_Init(). With zero workers every job
+ * runs on the calling thread.
+ * @return number of started workers
+ */
+int raster_pool_init(int workers);
+
+int raster_pool_workers(void);
+
+/** Render all jobs and wait for them, the calling thread takes jobs too */
+void raster_pool_run(raster_job_t *const jobs[], int count);
+
+/** Stop the workers and close the fonts of the calling thread */
+void raster_pool_done(void);
+
+#endif //SUPER_CLOCK_RASTER_H
@@ -0,0 +1,386 @@
+/**
+* @file rollup.c
+*
+* @brief Per minute, hour and day aggregates of the recorded sensor values.
+*
+* A level of a day is the file YYYYMMDD.min, .hour or .day: a short header
+* followed by fixed size records in the order the buckets closed, the keys
+* interleaved. Closed buckets are buffered and appended with one write per
+* file when an hour closes, when the buffer fills up and on rollup_sync().
+* A torn record at the end of a file is cut off before the next append.
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+
+#include "rollup.h"
+#include "history.h"
+#include "dlog.h"
+#include "dmem.h"
+#include "dfork.h"
+
+#define ROLLUP_MAGIC "SCROLL1\n"
+#define ROLLUP_VERSION 1
+#define ROLLUP_DAY_SECONDS 86400
+// longer gaps between power samples are not integrated, the meter was offline
+#define ROLLUP_MAX_GAP 600
+#define ROLLUP_PENDING 256
+#define ROLLUP_READ_CHUNK 128
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t period;
+} rollup_file_header_t;
+
+typedef struct {
+    int64_t start;
+    uint32_t count;
+    double min;
+    double max;
+    double sum;
+    // Ws
+    double energy;
+} bucket_t;
+
+typedef struct {
+    bucket_t bucket[ROLLUP_LEVELS];
+    bool has_last;
+    int64_t last_t;
+    double last_value;
+    // buckets starting before are in the files already
+    int64_t persisted[ROLLUP_LEVELS];
+} series_state_t;
+
+static const int rollup_periods[ROLLUP_LEVELS] = {
+        [ROLLUP_MINUTE] = 60,
+        [ROLLUP_HOUR] = 3600,
+        [ROLLUP_DAY] = ROLLUP_DAY_SECONDS,
+};
+
+static const char *const rollup_suffixes[ROLLUP_LEVELS] = {
+        [ROLLUP_MINUTE] = "min",
+        [ROLLUP_HOUR] = "hour",
+        [ROLLUP_DAY] = "day",
+};
+
+static pthread_mutex_t rollup_mtx = PTHREAD_MUTEX_INITIALIZER;
+static char *rollup_dir = NULL;
+static series_state_t rollup_series[SENSOR_COUNT];
+static rollup_record_t rollup_pending[ROLLUP_PENDING];
+static int rollup_pending_count = 0;
+
+int rollup_period(rollup_level_t level) {
+    return rollup_periods[level];
+}
+
+static int64_t floor_to(int64_t t, int64_t period) {
+    return t - ((t % period) + period) % period;
+}
+
+static bool integrated(sensor_key_t key) {
+    return key == SENSOR_MAIN_POWER;
+}
+
+static void level_path(char *buf, size_t size, int64_t day, rollup_level_t level) {
+    time_t t = (time_t) day;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(buf, size, "%s/%04d%02d%02d.%s", rollup_dir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             rollup_suffixes[level]);
+}
+
+// Records of a file are appended whole, anything shorter at the end is a torn write
+static off_t records_end(off_t size) {
+    if (size < (off_t) sizeof(rollup_file_header_t)) {
+        return 0;
+    }
+    size -= (off_t) sizeof(rollup_file_header_t);
+    return (off_t) sizeof(rollup_file_header_t) + size - size % (off_t) sizeof(rollup_record_t);
+}
+
+static int file_append(int64_t day, rollup_level_t level, const rollup_record_t *records, size_t count) {
+    char path[PATH_MAX];
+    level_path(path, sizeof(path), day, level);
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        goto fail;
+    }
+    off_t end = records_end(st.st_size);
+    if (end != st.st_size && ftruncate(fd, end) < 0) {
+        goto fail;
+    }
+    if (end == 0) {
+        rollup_file_header_t h = {.version = ROLLUP_VERSION, .period = (uint32_t) rollup_periods[level]};
+        memcpy(h.magic, ROLLUP_MAGIC, sizeof(h.magic));
+        if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+            goto fail;
+        }
+        end = sizeof(h);
+    }
+    size_t bytes = sizeof(rollup_record_t) * count;
+    if (pwrite(fd, records, bytes, end) != (ssize_t) bytes) {
+        goto fail;
+    }
+    close(fd);
+    return 0;
+
+fail: {
+        int err = errno;
+        close(fd);
+        errno = err ? err : EIO;
+        return -1;
+    }
+}
+
+// Write the pending records, one append per run of records going to the same file
+static void pending_flush(void) {
+    for (int level = 0; level < ROLLUP_LEVELS; level++) {
+        rollup_record_t run[ROLLUP_PENDING];
+        size_t count = 0;
+        int64_t day = 0;
+        for (int i = 0; i <= rollup_pending_count; i++) {
+            const rollup_record_t *r = i < rollup_pending_count ? &rollup_pending[i] : NULL;
+            if (r && r->level != level) {
+                continue;
+            }
+            if (count && (!r || floor_to(r->start, ROLLUP_DAY_SECONDS) != day)) {
+                if (file_append(day, (rollup_level_t) level, run, count) < 0) {
+                    daemon_log(LOG_ERR, "rollup: can't write %zu %s records: %s", count, rollup_suffixes[level],
+                               strerror(errno));
+                }
+                count = 0;
+            }
+            if (r) {
+                day = floor_to(r->start, ROLLUP_DAY_SECONDS);
+                run[count++] = *r;
+            }
+        }
+    }
+    rollup_pending_count = 0;
+}
+
+static void bucket_reset(bucket_t *b, int64_t start) {
+    b->start = start;
+    b->count = 0;
+    b->min = INFINITY;
+    b->max = -INFINITY;
+    b->sum = 0;
+    b->energy = 0;
+}
+
+static void bucket_record(sensor_key_t key, rollup_level_t level, const bucket_t *b, rollup_record_t *r) {
+    memset(r, 0, sizeof(rollup_record_t));
+    r->start = b->start;
+    r->count = b->count;
+    r->key = (uint8_t) key;
+    r->level = (uint8_t) level;
+    r->min = b->count ? (float) b->min : NAN;
+    r->max = b->count ? (float) b->max : NAN;
+    r->mean = b->count ? (float) (b->sum / b->count) : NAN;
+    r->energy = (float) (b->energy / 3600.0);
+}
+
+static void bucket_close(sensor_key_t key, rollup_level_t level, const bucket_t *b) {
+    if (b->start < rollup_series[key].persisted[level] || (b->count == 0 && b->energy == 0)) {
+        return;
+    }
+    if (rollup_pending_count == ROLLUP_PENDING) {
+        pending_flush();
+    }
+    bucket_record(key, level, b, &rollup_pending[rollup_pending_count++]);
+    if (level == ROLLUP_HOUR) {
+        pending_flush();
+    }
+}
+
+static void rollup_add_locked(sensor_key_t key, int64_t t, double value) {
+    series_state_t *s = &rollup_series[key];
+    if (s->has_last && t < s->last_t) {
+        t = s->last_t;
+    }
+    bool integrate = integrated(key) && s->has_last && t - s->last_t <= ROLLUP_MAX_GAP;
+
+    for (int level = 0; level < ROLLUP_LEVELS; level++) {
+        bucket_t *b = &s->bucket[level];
+        int64_t period = rollup_periods[level];
+        int64_t start = floor_to(t, period);
+        if (!s->has_last) {
+            bucket_reset(b, start);
+        } else if (b->start != start) {
+            // the last value holds up to this sample, also through buckets without samples
+            int64_t from = s->last_t;
+            while (integrate && b->start + period < start) {
+                b->energy += s->last_value * (double) (b->start + period - from);
+                bucket_close(key, (rollup_level_t) level, b);
+                from = b->start + period;
+                bucket_reset(b, from);
+            }
+            if (integrate) {
+                b->energy += s->last_value * (double) (b->start + period - from);
+            }
+            bucket_close(key, (rollup_level_t) level, b);
+            bucket_reset(b, start);
+        }
+        if (integrate) {
+            b->energy += s->last_value * (double) (t - (s->last_t > b->start ? s->last_t : b->start));
+        }
+        b->count++;
+        b->sum += value;
+        if (value < b->min) {
+            b->min = value;
+        }
+        if (value > b->max) {
+            b->max = value;
+        }
+    }
+    s->has_last = true;
+    s->last_t = t;
+    s->last_value = value;
+}
+
+void rollup_add(sensor_key_t key, time_t t, double value) {
+    if (!history_recorded(key) || isnan(value)) {
+        return;
+    }
+    pthread_mutex_lock(&rollup_mtx);
+    if (rollup_dir) {
+        rollup_add_locked(key, (int64_t) t, value);
+    }
+    pthread_mutex_unlock(&rollup_mtx);
+}
+
+// Read the records of a file, returns the number of records passed to fn
+static size_t file_scan(int64_t day, rollup_level_t level, void (*fn)(void *, const rollup_record_t *), void *ctx) {
+    char path[PATH_MAX];
+    level_path(path, sizeof(path), day, level);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    rollup_file_header_t h;
+    size_t n = 0;
+    if (read(fd, &h, sizeof(h)) == sizeof(h) && memcmp(h.magic, ROLLUP_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == ROLLUP_VERSION && h.period == (uint32_t) rollup_periods[level]) {
+        rollup_record_t records[ROLLUP_READ_CHUNK];
+        ssize_t bytes;
+        while ((bytes = read(fd, records, sizeof(records))) >= (ssize_t) sizeof(rollup_record_t)) {
+            for (size_t i = 0; i < (size_t) bytes / sizeof(rollup_record_t); i++) {
+                fn(ctx, &records[i]);
+                n++;
+            }
+        }
+    }
+    close(fd);
+    return n;
+}
+
+static void mark_persisted(void *UNUSED(ctx), const rollup_record_t *r) {
+    if (r->key < SENSOR_COUNT && r->level < ROLLUP_LEVELS) {
+        int64_t *persisted = &rollup_series[r->key].persisted[r->level];
+        if (r->start + rollup_periods[r->level] > *persisted) {
+            *persisted = r->start + rollup_periods[r->level];
+        }
+    }
+}
+
+static void replay_sample(void *ctx, time_t t, double value) {
+    rollup_add_locked(*(sensor_key_t *) ctx, (int64_t) t, value);
+}
+
+int rollup_open(const char *dir, time_t now) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    pthread_mutex_lock(&rollup_mtx);
+    FREE(rollup_dir);
+    rollup_dir = xstrdup(dir);
+    memset(rollup_series, 0, sizeof(rollup_series));
+    rollup_pending_count = 0;
+
+    int64_t today = floor_to((int64_t) now, ROLLUP_DAY_SECONDS);
+    for (int64_t day = today - ROLLUP_DAY_SECONDS; day <= today; day += ROLLUP_DAY_SECONDS) {
+        for (int level = 0; level < ROLLUP_LEVELS; level++) {
+            file_scan(day, (rollup_level_t) level, mark_persisted, NULL);
+        }
+    }
+    // rebuild the open buckets and whatever did not make it to the files
+    for (int k = 0; k < SENSOR_COUNT; k++) {
+        sensor_key_t key = (sensor_key_t) k;
+        if (history_recorded(key)) {
+            history_scan(key, (time_t) (today - ROLLUP_DAY_SECONDS), now + 1, replay_sample, &key);
+        }
+    }
+    pending_flush();
+    pthread_mutex_unlock(&rollup_mtx);
+    return 0;
+}
+
+void rollup_close(void) {
+    pthread_mutex_lock(&rollup_mtx);
+    if (rollup_dir) {
+        pending_flush();
+    }
+    FREE(rollup_dir);
+    pthread_mutex_unlock(&rollup_mtx);
+}
+
+void rollup_sync(void) {
+    pthread_mutex_lock(&rollup_mtx);
+    if (rollup_dir && rollup_pending_count) {
+        pending_flush();
+    }
+    pthread_mutex_unlock(&rollup_mtx);
+}
+
+typedef struct {
+    sensor_key_t key;
+    int64_t from;
+    int64_t to;
+    rollup_record_fn fn;
+    void *ctx;
+    size_t n;
+} scan_ctx_t;
+
+static void scan_record(void *ctx, const rollup_record_t *r) {
+    scan_ctx_t *scan = ctx;
+    if (r->key == scan->key && r->start >= scan->from && r->start < scan->to) {
+        scan->fn(scan->ctx, r);
+        scan->n++;
+    }
+}
+
+size_t rollup_scan(sensor_key_t key, rollup_level_t level, time_t from, time_t to, rollup_record_fn fn, void *ctx) {
+    scan_ctx_t scan = {key, (int64_t) from, (int64_t) to, fn, ctx, 0};
+    pthread_mutex_lock(&rollup_mtx);
+    if (!rollup_dir) {
+        pthread_mutex_unlock(&rollup_mtx);
+        return 0;
+    }
+    pending_flush();
+    for (int64_t day = floor_to(scan.from, ROLLUP_DAY_SECONDS); day < scan.to; day += ROLLUP_DAY_SECONDS) {
+        file_scan(day, level, scan_record, &scan);
+    }
+    const series_state_t *s = &rollup_series[key];
+    if (s->has_last) {
+        rollup_record_t open;
+        bucket_record(key, level, &s->bucket[level], &open);
+        scan_record(&scan, &open);
+    }
+    pthread_mutex_unlock(&rollup_mtx);
+    return scan.n;
+}
@@ -0,0 +1,73 @@
+/**
+* @file rollup.h
+*
+* @brief Per minute, hour and day aggregates of the recorded sensor values.
+*
+* Every sample updates the open bucket of each level in O(1), a bucket is
+* written out once a sample of the next one arrives. The records of a level
+* go to one small file per UTC day next to the history files, a query over a
+* week of hours reads 168 records per key instead of the raw samples.
+*
+* The aggregates are derived from the history: on open the buckets of the
+* previous and current day missing from the files are rebuilt from the raw
+* samples, so records lost in a crash come back on the next start.
+*/
+#ifndef SUPER_CLOCK_ROLLUP_H
+#define SUPER_CLOCK_ROLLUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "sensor.h"
+
+typedef enum {
+    ROLLUP_MINUTE,
+    ROLLUP_HOUR,
+    ROLLUP_DAY,
+    ROLLUP_LEVELS
+} rollup_level_t;
+
+typedef struct {
+    // UTC start of the bucket
+    int64_t start;
+    // samples in the bucket, 0 for a bucket with only integrated energy
+    uint32_t count;
+    uint8_t key;
+    uint8_t level;
+    uint16_t reserved;
+    float min;
+    float max;
+    float mean;
+    // Wh, the power integrated over the bucket, 0 for other keys
+    float energy;
+} rollup_record_t;
+
+typedef void (*rollup_record_fn)(void *ctx, const rollup_record_t *record);
+
+/** Open the aggregates kept in dir, next to the history opened with history_open().
+ * Buckets of the day before now and of the current day missing from the files are rebuilt
+ * from the history.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+int rollup_open(const char *dir, time_t now);
+
+/** Write the closed buckets out */
+void rollup_close(void);
+
+/** Add a sample of a key kept by the history, older samples count with the last timestamp */
+void rollup_add(sensor_key_t key, time_t t, double value);
+
+/** Call fn for the buckets of key and level starting in [from, to) in time order, the
+ * open bucket included
+ * @return the number of records passed to fn
+ */
+size_t rollup_scan(sensor_key_t key, rollup_level_t level, time_t from, time_t to, rollup_record_fn fn, void *ctx);
+
+/** Length of a bucket of the level in seconds */
+int rollup_period(rollup_level_t level);
+
+/** Append the closed buckets to their files */
+void rollup_sync(void);
+
+#endif //SUPER_CLOCK_ROLLUP_H
@@ -0,0 +1,180 @@
+/**
+* @file sensor.c
+*
+* @brief Store of the values shown on the screen.
+*
+*/
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+
+#include "sensor.h"
+#include "dlog.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define THRESHOLDS(x) x, ARRAY_SIZE(x)
+#define EXACT -1
+
+typedef struct {
+    const char *name;
+    // decimal digits the widgets render, EXACT compares raw values
+    int precision;
+    // changes of the raw value within the band are not published
+    double hysteresis;
+    // colour / icon thresholds the widgets compare the value against
+    const double *thresholds;
+    size_t threshold_count;
+    // value seen by the widgets
+    double value;
+    // value last received
+    double raw;
+    unsigned long suppressed;
+} sensor_t;
+
+static const double power_thresholds[] = {1000.0, 4000.0};
+static const double soc_thresholds[] = {10.0, 20.0, 25.0, 40.0, 50.0, 55.0, 70.0, 85.0, 95.0};
+static const double current_thresholds[] = {-0.2, 0.0, 0.1, 0.2};
+static const double temp_thresholds[] = {40.0, 50.0};
+
+static sensor_t sensors[SENSOR_COUNT] = {
+        [SENSOR_MAIN_POWER_ONLINE] = {"main-power.Online", EXACT, 0, NULL, 0, 0, 0, 0},
+        [SENSOR_MAIN_POWER] = {"PZEM004T.Power", 0, 1.0, THRESHOLDS(power_thresholds), NAN, NAN, 0},
+        [SENSOR_MAIN_VOLTAGE] = {"PZEM004T.Voltage", 0, 0, NULL, 0, NAN, NAN, 0},
+        [SENSOR_BATTERY_ONLINE] = {"main_battery.Online", EXACT, 0, NULL, 0, 0, 0, 0},
+        [SENSOR_BATTERY_SOC] = {"main_battery.soc", 0, 0, THRESHOLDS(soc_thresholds), NAN, NAN, 0},
+        // current and voltage are multiplied into watts and hours, keep them finer than shown
+        [SENSOR_BATTERY_CURRENT] = {"main_battery.current", 3, 0, THRESHOLDS(current_thresholds), NAN, NAN, 0},
+        [SENSOR_BATTERY_VOLTAGE] = {"main_battery.voltage", 2, 0, NULL, 0, NAN, NAN, 0},
+        [SENSOR_BATTERY_TEMP] = {"main_battery.temp_tube", 0, 0, THRESHOLDS(temp_thresholds), NAN, NAN, 0},
+        [SENSOR_BATTERY_CAPACITY] = {"main_battery.capacity", 1, 0, NULL, 0, NAN, NAN, 0},
+        [SENSOR_INDOOR_ONLINE] = {"thps_sf_hall.Online", EXACT, 0, NULL, 0, 0, 0, 0},
+        [SENSOR_INDOOR_TEMP] = {"thps_sf_hall.temperature", 1, 0, NULL, 0, NAN, NAN, 0},
+        [SENSOR_OUTDOOR_ONLINE] = {"hass.Online", EXACT, 0, NULL, 0, 0, 0, 0},
+        [SENSOR_OUTDOOR_TEMP] = {"EX.temperature_C", 1, 0, NULL, 0, NAN, NAN, 0},
+        [SENSOR_DOOR_ONLINE] = {"dos-entranse.Online", EXACT, 0, NULL, 0, 0, 0, 0},
+        [SENSOR_DOOR_OPEN] = {"dos-entranse.open", EXACT, 0, NULL, 0, 0, 0, 0},
+        [SENSOR_POWER_OFF_PRESSED] = {"ui.power_off_pressed", EXACT, 0, NULL, 0, 0, 0, 0},
+        [SENSOR_CLOCK_MINUTE] = {"clock.minute", EXACT, 0, NULL, 0, NAN, NAN, 0},
+        [SENSOR_CLOCK_SECOND] = {"clock.second", EXACT, 0, NULL, 0, NAN, NAN, 0},
+};
+
+// every key starts changed so the first frame renders all widgets
+static sensor_mask_t changed = SENSOR_ALL;
+static unsigned long suppressed_total = 0;
+static pthread_mutex_t sensor_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static const double scales[] = {1.0, 10.0, 100.0, 1000.0, 10000.0};
+
+// Same rounding as printf("%.*f") uses for the rendered text.
+static double quantize(const sensor_t *sensor, double value) {
+    if (sensor->precision < 0 || (size_t) sensor->precision >= ARRAY_SIZE(scales)) {
+        return value;
+    }
+    return nearbyint(value * scales[sensor->precision]);
+}
+
+// Each threshold splits the range into below / equal / above, widgets use both < and >.
+static unsigned int bucket(const sensor_t *sensor, double value) {
+    unsigned int b = 0;
+    for (size_t i = 0; i < sensor->threshold_count; i++) {
+        b += (value > sensor->thresholds[i]) + (value >= sensor->thresholds[i]);
+    }
+    return b;
+}
+
+static bool visible_change(const sensor_t *sensor, double value) {
+    double old = sensor->value;
+    if (isnan(old) || isnan(value)) {
+        return isnan(old) != isnan(value);
+    }
+    if (bucket(sensor, old) != bucket(sensor, value)) {
+        return true;
+    }
+    if (quantize(sensor, old) == quantize(sensor, value)) {
+        return false;
+    }
+    return fabs(value - old) > sensor->hysteresis;
+}
+
+void sensor_set(sensor_key_t key, double value) {
+    if (key >= SENSOR_COUNT) {
+        return;
+    }
+    pthread_mutex_lock(&sensor_mtx);
+    sensor_t *sensor = &sensors[key];
+    sensor->raw = value;
+    if (visible_change(sensor, value)) {
+        sensor->value = value;
+        changed |= SENSOR_BIT(key);
+    } else if (sensor->value != value && !isnan(value)) {
+        sensor->suppressed++;
+        suppressed_total++;
+    }
+    pthread_mutex_unlock(&sensor_mtx);
+}
+
+void sensor_set_bool(sensor_key_t key, bool value) {
+    sensor_set(key, value ? 1.0 : 0.0);
+}
+
+double sensor_get(sensor_key_t key) {
+    if (key >= SENSOR_COUNT) {
+        return NAN;
+    }
+    pthread_mutex_lock(&sensor_mtx);
+    double value = sensors[key].value;
+    pthread_mutex_unlock(&sensor_mtx);
+    return value;
+}
+
+double sensor_get_raw(sensor_key_t key) {
+    if (key >= SENSOR_COUNT) {
+        return NAN;
+    }
+    pthread_mutex_lock(&sensor_mtx);
+    double value = sensors[key].raw;
+    pthread_mutex_unlock(&sensor_mtx);
+    return value;
+}
+
+bool sensor_get_bool(sensor_key_t key) {
+    double value = sensor_get(key);
+    return !isnan(value) && value != 0.0;
+}
+
+const char *sensor_name(sensor_key_t key) {
+    if (key >= SENSOR_COUNT) {
+        return "unknown";
+    }
+    return sensors[key].name;
+}
+
+unsigned long sensor_suppressed(sensor_key_t key) {
+    if (key >= SENSOR_COUNT) {
+        return suppressed_total;
+    }
+    return sensors[key].suppressed;
+}
+
+void sensor_log_stats(void) {
+    daemon_log(LOG_INFO, "sensor updates suppressed: %lu", suppressed_total);
+    for (int key = 0; key < SENSOR_COUNT; key++) {
+        if (sensors[key].suppressed) {
+            daemon_log(LOG_INFO, "  %s: %lu", sensors[key].name, sensors[key].suppressed);
+        }
+    }
+}
+
+sensor_mask_t sensor_take_changed(void) {
+    pthread_mutex_lock(&sensor_mtx);
+    sensor_mask_t mask = changed;
+    changed = 0;
+    pthread_mutex_unlock(&sensor_mtx);
+    return mask;
+}
+
+void sensor_tick(time_t now) {
+    sensor_set(SENSOR_CLOCK_MINUTE, (double) (now / 60));
+    sensor_set(SENSOR_CLOCK_SECOND, (double) now);
+}
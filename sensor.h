@@ -0,0 +1,74 @@
+/**
+* @file sensor.h
+*
+* @brief Store of the values shown on the screen.
+*
+* MQTT callbacks and UI handlers write values with sensor_set(), the render
+* loop picks up the keys changed since the previous frame with
+* sensor_take_changed() and refreshes only the widgets depending on them.
+*/
+#ifndef SUPER_CLOCK_SENSOR_H
+#define SUPER_CLOCK_SENSOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+    SENSOR_MAIN_POWER_ONLINE,
+    SENSOR_MAIN_POWER,
+    SENSOR_MAIN_VOLTAGE,
+    SENSOR_BATTERY_ONLINE,
+    SENSOR_BATTERY_SOC,
+    SENSOR_BATTERY_CURRENT,
+    SENSOR_BATTERY_VOLTAGE,
+    SENSOR_BATTERY_TEMP,
+    SENSOR_BATTERY_CAPACITY,
+    SENSOR_INDOOR_ONLINE,
+    SENSOR_INDOOR_TEMP,
+    SENSOR_OUTDOOR_ONLINE,
+    SENSOR_OUTDOOR_TEMP,
+    SENSOR_DOOR_ONLINE,
+    SENSOR_DOOR_OPEN,
+    SENSOR_POWER_OFF_PRESSED,
+    SENSOR_CLOCK_MINUTE,
+    SENSOR_CLOCK_SECOND,
+    SENSOR_COUNT
+} sensor_key_t;
+
+typedef uint32_t sensor_mask_t;
+
+#define SENSOR_BIT(key) ((sensor_mask_t) 1 << (key))
+#define SENSOR_ALL (SENSOR_BIT(SENSOR_COUNT) - 1)
+
+/** Store a new value. The key is marked changed only if the value differs
+ * once rounded to the precision the widgets render it with, moves out of the
+ * key's hysteresis band or crosses a colour threshold. Other updates are
+ * counted as suppressed.
+ */
+void sensor_set(sensor_key_t key, double value);
+
+void sensor_set_bool(sensor_key_t key, bool value);
+
+/** Value as last published to the widgets */
+double sensor_get(sensor_key_t key);
+
+/** Value as last received, including suppressed updates */
+double sensor_get_raw(sensor_key_t key);
+
+bool sensor_get_bool(sensor_key_t key);
+
+const char *sensor_name(sensor_key_t key);
+
+/** Number of suppressed updates of the key, SENSOR_COUNT gives the total */
+unsigned long sensor_suppressed(sensor_key_t key);
+
+void sensor_log_stats(void);
+
+/** Return the keys changed since the previous call and clear them */
+sensor_mask_t sensor_take_changed(void);
+
+/** Update the clock keys, call once per main loop iteration */
+void sensor_tick(time_t now);
+
+#endif //SUPER_CLOCK_SENSOR_H
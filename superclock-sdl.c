@@ -3,7 +3,10 @@
 
 //https://fonts.google.com/icons?selected=Material+Symbols+Outlined:power_off:FILL@0;wght@300;GRAD@0;opsz@40&icon.platform=web
 
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <time.h>
@@ -12,16 +15,43 @@
 #include <SDL2/SDL_image.h>
 #include <pthread.h>
 #include <errno.h>
-#include <json-c/json.h>
+#include <signal.h>
 #include "mq.h"
 #include "dlog.h"
 #include "dmem.h"
 #include "dfork.h"
+#include "sensor.h"
+#include "dfmt.h"
+#include "raster.h"
+#include "pixops.h"
+#include "colorize.h"
+#include "fbdev.h"
+#include "history.h"
+#include "rollup.h"
+#include "mqlog.h"
+#include "mqcb.h"
+#include "dblog.h"
+#include "dflight.h"
+#include "dlogfile.h"
+#include "dspawn.h"
+#include "dsignal.h"
 
 // Define directives for constants.
 #define MY_SDL_FLAGS (SDL_INIT_VIDEO|SDL_INIT_TIMER/*|SDL_INIT_AUDIO*/)
 #define TITLE "Super Clock - SDL"
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define FONT_FILE "/home/palich/bin/freesansbold.ttf"
+#define RASTER_MAX_PENDING 16
+#define TEXTURE_FORMAT_DEFAULT SDL_PIXELFORMAT_ARGB8888
+#define TEXTURE_MIN_BUCKET 32
+// the log file on the SD card: rotated at 1 MiB or daily, 16 MiB of it and its archives
+#define LOG_FILE_MAX_SIZE (1024 * 1024)
+#define LOG_FILE_MAX_AGE (24 * 3600)
+#define LOG_FILE_BUDGET (16 * 1024 * 1024)
+#define MEM_REPORT_TOP 10
+
+// buffers of the frame being made, reset once it is presented
+static dmem_arena_t frame_arena = DMEM_ARENA_INIT;
 
 SDL_Color rgba_green = {0, 255, 0, 255};
 SDL_Color rgba_red = {255, 0, 0, 255};
@@ -31,23 +61,6 @@ SDL_Color rgba_black = {0, 0, 0, 255};
 SDL_Color rgba_white = {255, 255, 255, 255};
 SDL_Color rgba_grey = {112, 112, 112, 255};
 
-struct main_power_t {
-    double power;
-    double voltage;
-    bool online;
-    bool changed;
-} main_power = {NAN, NAN, false, true};
-
-struct battery_t {
-    double soc;
-    double current;
-    double voltage;
-    double temp;
-    double capacity;
-    bool online;
-    bool changed;
-} battery = {NAN, NAN, NAN, NAN, NAN, false, true};
-
 struct superclock {
     SDL_Window *win;
     SDL_Renderer *rend;
@@ -55,6 +68,10 @@ struct superclock {
     int window_height;
     bool running;
     bool show_time;
+    // pixel format of the panel, widgets and layers are prepared in it
+    Uint32 pixel_format;
+    // framebuffer device or file to draw into instead of the SDL renderer
+    const char *fbdev_path;
     unsigned short exit_status;
 };
 
@@ -83,17 +100,60 @@ typedef void (*on_click_cb_t)(struct ITEM_T *item);
 typedef struct ITEM_T {
     const char *name;
     SDL_Point position;
+    // streaming texture, only the top left width x height part holds the content
     SDL_Texture *texture;
+    int texture_w;
+    int texture_h;
+    // the same in system memory, used instead of the texture by the fbdev backend
+    SDL_Surface *content;
+    int width;
+    int height;
+    // ring widgets (sparklines): the column shown at the left edge, the content wraps around
+    int scroll;
     void *custom_data;
+    // frees custom_data with the item, NULL when there is nothing to free
+    void (*destroy)(void *custom_data);
 
-    SDL_Texture *(*update)(SDL_Renderer *renderer, struct ITEM_T *);
+    SDL_Surface *(*update)(SDL_Renderer *renderer, struct ITEM_T *);
 
     bool texture_changed;
     align_t align;
     on_click_cb_t on_click;
+    sensor_mask_t depends;
+    bool dirty;
+    struct ITEM_T *dirty_next;
     struct ITEM_T *next;
 } item_t;
 
+typedef struct ITEM_DEP_T {
+    item_t *item;
+    struct ITEM_DEP_T *next;
+} item_dep_t;
+
+// widgets to refresh when a sensor key changes
+static item_dep_t *item_deps[SENSOR_COUNT] = {0};
+
+// debug counters of the widget update() calls
+static unsigned int frame_update_calls = 0;
+static unsigned long total_update_calls = 0;
+
+static struct {
+    unsigned long created;
+    unsigned long destroyed;
+    unsigned long uploads;
+} texture_stats = {0};
+
+// set by sdl_setup() from the -f option
+static Uint32 texture_format = TEXTURE_FORMAT_DEFAULT;
+
+// fbdev backend, NULL while the SDL renderer draws
+static fbdev_t fb;
+static fbdev_t *fb_out = NULL;
+
+// screen rects changed since the previous frame, more than FBDEV_MAX_DAMAGE redraw all
+static fbdev_rect_t fb_damage[FBDEV_MAX_DAMAGE];
+static int fb_damage_count = 0;
+
 // forward declaration of functions.
 
 unsigned short sdl_setup(struct superclock *sc);
@@ -106,64 +166,333 @@ int brightnessSet(int value);
 
 int brightnessGet(void);
 
+int align_h(int position, int textureSize, align_h_t align);
+
+int align_v(int position, int textureSize, align_v_t align);
+
+void background_copy(SDL_Renderer *renderer, const SDL_Rect *area, SDL_Surface *target);
+
+static void output_size(SDL_Renderer *renderer, int *width, int *height) {
+    if (fb_out) {
+        *width = fb_out->width;
+        *height = fb_out->height;
+    } else {
+        SDL_GetRendererOutputSize(renderer, width, height);
+    }
+}
+
+static void fb_damage_add(const SDL_Rect *rect) {
+    if (fb_damage_count < FBDEV_MAX_DAMAGE) {
+        fb_damage[fb_damage_count] = (fbdev_rect_t) {rect->x, rect->y, rect->w, rect->h};
+    }
+    if (fb_damage_count <= FBDEV_MAX_DAMAGE) {
+        fb_damage_count++;
+    }
+}
+
+// Formats without alpha (RGB565 panels) get opaque widget textures with the static layers baked in.
+static bool texture_opaque(void) {
+    return !SDL_ISPIXELFORMAT_ALPHA(texture_format);
+}
+
+// Where the widget lands on the screen with content of the given size.
+static SDL_Rect item_rect(const struct ITEM_T *item, int width, int height) {
+    SDL_Rect rect = {align_h(item->position.x, width, item->align.align_h),
+                     align_v(item->position.y, height, item->align.align_v),
+                     width,
+                     height};
+    return rect;
+}
+
+static int texture_bucket(int size) {
+    int bucket = TEXTURE_MIN_BUCKET;
+    while (bucket < size) {
+        bucket <<= 1;
+    }
+    return bucket;
+}
+
+void item_texture_destroy(item_t *item) {
+    if (item->texture) {
+        SDL_DestroyTexture(item->texture);
+        item->texture = NULL;
+        texture_stats.destroyed++;
+    }
+    if (item->content) {
+        SDL_FreeSurface(item->content);
+        item->content = NULL;
+        texture_stats.destroyed++;
+    }
+    item->texture_w = item->texture_h = 0;
+}
+
+// Draw the new content into target, which stands for the widget's rect on the screen.
+static void item_compose(SDL_Renderer *renderer, item_t *item, SDL_Surface *surface, SDL_Surface *target) {
+    if (texture_opaque()) {
+        // no alpha to blend with at render time, start from the static layers under the widget
+        SDL_Rect under = item_rect(item, surface->w, surface->h);
+        background_copy(renderer, &under, target);
+        SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_BLEND);
+    } else {
+        // colour keyed text leaves the background untouched, clear what the previous content left
+        SDL_FillRect(target, NULL, 0);
+        SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+    }
+    SDL_BlitSurface(surface, NULL, target, NULL);
+}
+
+// fbdev backend: keep the content in system memory and damage the old and the new rect.
+static bool item_store(item_t *item, SDL_Surface *surface) {
+    if (!item->content || surface->w > item->texture_w || surface->h > item->texture_h) {
+        item_texture_destroy(item);
+        int w = texture_bucket(surface->w);
+        int h = texture_bucket(surface->h);
+        item->content = SDL_CreateRGBSurfaceWithFormat(0, w, h, SDL_BITSPERPIXEL(texture_format), texture_format);
+        if (!item->content) {
+            daemon_log(LOG_ERR, "content surface(%s %dx%d): %s", item->name, w, h, SDL_GetError());
+            return false;
+        }
+        SDL_SetSurfaceBlendMode(item->content, SDL_BLENDMODE_NONE);
+        item->texture_w = w;
+        item->texture_h = h;
+        texture_stats.created++;
+    }
+    if (item->width && item->height) {
+        SDL_Rect old = item_rect(item, item->width, item->height);
+        fb_damage_add(&old);
+    }
+    SDL_Rect rect = item_rect(item, surface->w, surface->h);
+    fb_damage_add(&rect);
+    item_compose(NULL, item, surface, item->content);
+    item->width = surface->w;
+    item->height = surface->h;
+    item->scroll = 0;
+    texture_stats.uploads++;
+    return true;
+}
+
+// Copy the surface into the widget's streaming texture, a new texture is created only when the
+// surface outgrows the current one.
+bool item_upload(SDL_Renderer *renderer, item_t *item, SDL_Surface *surface) {
+    if (!surface) {
+        return false;
+    }
+    if (fb_out) {
+        return item_store(item, surface);
+    }
+    if (!item->texture || surface->w > item->texture_w || surface->h > item->texture_h) {
+        item_texture_destroy(item);
+        int w = texture_bucket(surface->w);
+        int h = texture_bucket(surface->h);
+        item->texture = SDL_CreateTexture(renderer, texture_format, SDL_TEXTUREACCESS_STREAMING, w, h);
+        if (!item->texture) {
+            daemon_log(LOG_ERR, "SDL_CreateTexture(%s %dx%d): %s", item->name, w, h, SDL_GetError());
+            return false;
+        }
+        SDL_SetTextureBlendMode(item->texture, texture_opaque() ? SDL_BLENDMODE_NONE : SDL_BLENDMODE_BLEND);
+        item->texture_w = w;
+        item->texture_h = h;
+        texture_stats.created++;
+    }
+
+    SDL_Rect rect = {0, 0, surface->w, surface->h};
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(item->texture, &rect, &pixels, &pitch)) {
+        daemon_log(LOG_ERR, "SDL_LockTexture(%s): %s", item->name, SDL_GetError());
+        return false;
+    }
+    SDL_Surface *target = SDL_CreateRGBSurfaceWithFormatFrom(pixels, surface->w, surface->h,
+                                                             SDL_BITSPERPIXEL(texture_format), pitch, texture_format);
+    if (target) {
+        item_compose(renderer, item, surface, target);
+        SDL_FreeSurface(target);
+    }
+    SDL_UnlockTexture(item->texture);
+    item->width = surface->w;
+    item->height = surface->h;
+    item->scroll = 0;
+    texture_stats.uploads++;
+    return true;
+}
+
+// Replace the oldest columns of a ring widget with the column surface, they show up at the right
+// edge. Only the new columns are uploaded, the rest of the content stays where it is.
+bool item_scroll(SDL_Renderer *UNUSED(renderer), item_t *item, SDL_Surface *column) {
+    if (!column || !item->width || column->h != item->height || item->scroll + column->w > item->width) {
+        return false;
+    }
+    SDL_Rect rect = {item->scroll, 0, column->w, column->h};
+    if (fb_out) {
+        if (!item->content) {
+            return false;
+        }
+        SDL_SetSurfaceBlendMode(column, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(column, NULL, item->content, &rect);
+        // everything moves one column on the screen, the widget's rect is all there is to redraw
+        SDL_Rect on_screen = item_rect(item, item->width, item->height);
+        fb_damage_add(&on_screen);
+    } else if (!item->texture || SDL_UpdateTexture(item->texture, &rect, column->pixels, column->pitch)) {
+        daemon_log(LOG_ERR, "item_scroll(%s): %s", item->name, SDL_GetError());
+        return false;
+    }
+    item->scroll = (item->scroll + column->w) % item->width;
+    item->texture_changed = true;
+    texture_stats.uploads++;
+    return true;
+}
+
+// The parts of the widget's content in screen order, the second one is empty unless scrolled.
+static int item_parts(const item_t *item, SDL_Rect src[2], SDL_Rect dst[2]) {
+    SDL_Rect rect = item_rect(item, item->width, item->height);
+    int left = item->width - item->scroll;
+    src[0] = (SDL_Rect) {item->scroll, 0, left, item->height};
+    dst[0] = (SDL_Rect) {rect.x, rect.y, left, item->height};
+    src[1] = (SDL_Rect) {0, 0, item->scroll, item->height};
+    dst[1] = (SDL_Rect) {rect.x + left, rect.y, item->scroll, item->height};
+    return item->scroll ? 2 : 1;
+}
+
+void item_texture_stats_log(void) {
+    daemon_log(LOG_INFO, "textures created: %lu destroyed: %lu uploads: %lu",
+               texture_stats.created, texture_stats.destroyed, texture_stats.uploads);
+}
+
 void item_add(item_t **head, item_t *item) {
     item->next = *head;
     *head = item;
+    for (int key = 0; key < SENSOR_COUNT; key++) {
+        if (item->depends & SENSOR_BIT(key)) {
+            item_dep_t *dep = calloc(1, sizeof(item_dep_t));
+            if (dep) {
+                dep->item = item;
+                dep->next = item_deps[key];
+                item_deps[key] = dep;
+            }
+        }
+    }
 }
 
 typedef struct {
     SDL_Color color;
-    char *text;
+    fmt_text_t text;
 } color_text_item_t;
 
 typedef struct {
     TTF_Font *font;
-    time_t last_time;
+    int font_size;
     color_text_item_t text;
+    raster_job_t job;
 } time_item_t;
 
-SDL_Texture *printf_SDL_Texture(SDL_Renderer *renderer, time_item_t *item, SDL_Color color, const char *format, ...) {
+typedef struct {
+    item_t *item;
+    raster_job_t *job;
+} raster_pending_t;
+
+// text widgets changed in this frame, rasterised together by raster_flush()
+static raster_pending_t raster_pending[RASTER_MAX_PENDING];
+static int raster_pending_count = 0;
+
+void *text_item_create(int font_size) {
+    time_item_t *item = calloc(1, sizeof(time_item_t));
+    if (item) {
+        item->font_size = font_size;
+        item->font = TTF_OpenFont(FONT_FILE, font_size);
+        if (!item->font) {
+            printf("TTF_OpenFont: %s\n", TTF_GetError());
+            FREE(item);
+        }
+    }
+    return item;
+}
+
+void text_item_destroy(void *custom_data) {
+    time_item_t *item = custom_data;
+    if (item) {
+        TTF_CloseFont(item->font);
+        FREE(item);
+    }
+}
+
+// Formats into the widget's inline buffer, nothing is allocated unless the text or colour changed.
+// With the raster pool running the text is queued and uploaded by raster_flush().
+SDL_Surface *printf_SDL_Surface(struct ITEM_T *_item, SDL_Color color, const char *format, ...) {
+    time_item_t *item = _item->custom_data;
     va_list args;
     va_start(args, format);
-    char *buf = NULL;
-    vasprintf(&buf, format, args);
+    bool changed = fmt_text_vset(&item->text.text, format, args);
     va_end(args);
-    if (buf) {
-        daemon_log(LOG_INFO, "buf: %s", buf);
-        bool changed = false;
-        if (memcmp(&color, &item->text.color, sizeof(SDL_Color))) {
-            item->text.color = color;
-            daemon_log(LOG_INFO, "color changed");
-            changed = true;
-        }
-        if (item->text.text) {
-            if (strcmp(item->text.text, buf)) {
-                daemon_log(LOG_INFO, "text changed %s %s", item->text.text, buf);
-                FREE(item->text.text);
-                item->text.text = buf;
-                changed = true;
-            } else {
-                FREE(buf);
-            }
-        } else {
-            daemon_log(LOG_INFO, "text changed %s", buf);
-            item->text.text = buf;
-            changed = true;
-        }
-        if (changed) {
-            SDL_Surface *surface = TTF_RenderText_Solid(item->font, item->text.text, item->text.color);
-            SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-            SDL_FreeSurface(surface);
-            return texture;
+    if (memcmp(&color, &item->text.color, sizeof(SDL_Color))) {
+        item->text.color = color;
+        changed = true;
+    }
+    // nothing shown yet: a new widget or its texture lost in a device reset
+    changed |= !_item->width;
+    if (changed) {
+        daemon_log(LOG_DEBUG, "text changed %s", item->text.text.buf);
+        if (raster_pool_workers() > 0 && raster_pending_count < RASTER_MAX_PENDING) {
+            item->job = (raster_job_t) {FONT_FILE, item->font_size, item->text.text.buf, item->text.color, NULL};
+            raster_pending[raster_pending_count++] = (raster_pending_t) {_item, &item->job};
+            return NULL;
         }
+        return TTF_RenderText_Solid(item->font, item->text.text.buf, item->text.color);
     }
     return NULL;
 }
 
+// Rasterise the queued texts on the pool, upload them on the render thread.
+bool raster_flush(SDL_Renderer *renderer) {
+    if (!raster_pending_count) {
+        return false;
+    }
+    raster_job_t *jobs[RASTER_MAX_PENDING];
+    for (int i = 0; i < raster_pending_count; i++) {
+        jobs[i] = raster_pending[i].job;
+    }
+    raster_pool_run(jobs, raster_pending_count);
+    for (int i = 0; i < raster_pending_count; i++) {
+        raster_job_t *job = raster_pending[i].job;
+        item_t *item = raster_pending[i].item;
+        if (job->surface) {
+            item_upload(renderer, item, job->surface);
+            SDL_FreeSurface(job->surface);
+            job->surface = NULL;
+        }
+    }
+    raster_pending_count = 0;
+    return true;
+}
+
+// The renderer lost every texture: recreate them with the whole content of each widget. Ring
+// widgets draw their full chart again, the scroll position went with the texture.
+void items_reset(SDL_Renderer *renderer, item_t *head) {
+    for (item_t *item = head; item; item = item->next) {
+        item_texture_destroy(item);
+        item->width = item->height = 0;
+        item->scroll = 0;
+        SDL_Surface *surface = item->update(renderer, item);
+        item_upload(renderer, item, surface);
+        SDL_FreeSurface(surface);
+        item->texture_changed = true;
+    }
+    raster_flush(renderer);
+}
+
 void item_free(item_t *head) {
+    for (int key = 0; key < SENSOR_COUNT; key++) {
+        while (item_deps[key]) {
+            item_dep_t *next = item_deps[key]->next;
+            FREE(item_deps[key]);
+            item_deps[key] = next;
+        }
+    }
     while (head) {
         item_t *next = head->next;
-        SDL_DestroyTexture(head->texture);
+        item_texture_destroy(head);
+        if (head->destroy) {
+            head->destroy(head->custom_data);
+        }
         FREE(head);
         head = next;
     }
@@ -171,15 +500,20 @@ void item_free(item_t *head) {
 
 item_t *
 item_new(const char *name, SDL_Renderer *renderer, SDL_Point position, align_t align, void *custom_data,
-         SDL_Texture *(*update)(SDL_Renderer *renderer, struct ITEM_T *)) {
+         void (*destroy)(void *custom_data), sensor_mask_t depends,
+         SDL_Surface *(*update)(SDL_Renderer *renderer, struct ITEM_T *)) {
     item_t *item = calloc(1, sizeof(item_t));
     if (item) {
         item->name = name;
         item->position = position;
         item->align = align;
         item->custom_data = custom_data;
+        item->destroy = destroy;
+        item->depends = depends;
         item->update = update;
-        item->texture = update(renderer, item);
+        SDL_Surface *surface = update(renderer, item);
+        item_upload(renderer, item, surface);
+        SDL_FreeSurface(surface);
         item->texture_changed = true;
     }
     return item;
@@ -195,197 +529,123 @@ SDL_Color lerp_color(const SDL_Color color1, const SDL_Color color2, float t) {
 }
 
 /*********************************************************************************************************************/
-struct weather_t {
-    double temperature_indoor;
-    double temperature_outdoor;
-    bool temperature_outdoor_online;
-    bool temperature_indoor_online;
-    bool temperature_indoor_changed;
-    bool temperature_outdoor_changed;
-} weather = {NAN, NAN, false, false, true, true};
-
-struct door_t {
-    bool online;
-    bool open;
-    bool changed;
-} door = {false, false, true};
-
 void *indoor_temp_create(void) {
-    time_item_t *item = calloc(1, sizeof(time_item_t));
-    if (item) {
-        item->font = TTF_OpenFont("/home/palich/bin/freesansbold.ttf", 50);
-        if (!item->font) {
-            printf("TTF_OpenFont: %s\n", TTF_GetError());
-            FREE(item);
-        }
-    }
-    return item;
+    return text_item_create(50);
 }
 
-SDL_Texture *indoor_temp_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *indoor_temp_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     time_item_t *item = _item->custom_data;
     if (!item || !item->font) {
         return NULL;
     }
-    if (weather.temperature_indoor_changed) {
-        weather.temperature_indoor_changed = false;
-        if (weather.temperature_indoor_online && !isnan(weather.temperature_indoor)) {
-            return printf_SDL_Texture(renderer, item, rgba_white, "%.1fC",
-                                      weather.temperature_indoor);
-        } else {
-            return printf_SDL_Texture(renderer, item, rgba_grey, "--.-C");
-        }
+    double temperature = sensor_get(SENSOR_INDOOR_TEMP);
+    if (sensor_get_bool(SENSOR_INDOOR_ONLINE) && !isnan(temperature)) {
+        return printf_SDL_Surface(_item, rgba_white, "%.1fC", temperature);
+    } else {
+        return printf_SDL_Surface(_item, rgba_grey, "--.-C");
     }
-    return NULL;
 }
 
 void *outdoor_temp_create(void) {
-    time_item_t *item = calloc(1, sizeof(time_item_t));
-    if (item) {
-        item->font = TTF_OpenFont("/home/palich/bin/freesansbold.ttf", 50);
-        if (!item->font) {
-            printf("TTF_OpenFont: %s\n", TTF_GetError());
-            FREE(item);
-        }
-    }
-    return item;
+    return text_item_create(50);
 }
 
-SDL_Texture *outdoor_temp_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *outdoor_temp_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     time_item_t *item = _item->custom_data;
     if (!item || !item->font) {
         return NULL;
     }
-
-    if (weather.temperature_outdoor_changed) {
-        weather.temperature_outdoor_changed = false;
-        if (weather.temperature_outdoor_online && !isnan(weather.temperature_outdoor)) {
-            return printf_SDL_Texture(renderer, item, rgba_white, "%.1fC",
-                                      weather.temperature_outdoor);
-        } else {
-            return printf_SDL_Texture(renderer, item, rgba_grey, "--.-C");
-        }
+    double temperature = sensor_get(SENSOR_OUTDOOR_TEMP);
+    if (sensor_get_bool(SENSOR_OUTDOOR_ONLINE) && !isnan(temperature)) {
+        return printf_SDL_Surface(_item, rgba_white, "%.1fC", temperature);
+    } else {
+        return printf_SDL_Surface(_item, rgba_grey, "--.-C");
     }
-    return NULL;
 }
 
 void *power_create() {
-    time_item_t *item = calloc(1, sizeof(time_item_t));
-    if (item) {
-        item->font = TTF_OpenFont("/home/palich/bin/freesansbold.ttf", 25);
-        if (!item->font) {
-            printf("TTF_OpenFont: %s\n", TTF_GetError());
-            FREE(item);
-        }
-    }
-    return item;
+    return text_item_create(25);
 }
 
-SDL_Texture *power_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *power_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     time_item_t *item = _item->custom_data;
     if (!item || !item->font) {
         return NULL;
     }
-    if (main_power.changed) {
-        main_power.changed = false;
-        if (main_power.online && !isnan(main_power.power)) {
-            SDL_Color color = rgba_green;
-            if (main_power.power > 1000.0) {
-                color = rgba_yellow;
-            } else if (main_power.power > 4000.0) {
-                color = rgba_red;
-            }
-            return printf_SDL_Texture(renderer, item, color, "%.0fW %.0fV",
-                                      main_power.power, main_power.voltage);
-        } else {
-            return printf_SDL_Texture(renderer, item, rgba_grey, "%.0fW %.0fV",
-                                      0.0, 0);
+    double power = sensor_get(SENSOR_MAIN_POWER);
+    if (sensor_get_bool(SENSOR_MAIN_POWER_ONLINE) && !isnan(power)) {
+        SDL_Color color = rgba_green;
+        if (power > 1000.0) {
+            color = rgba_yellow;
+        } else if (power > 4000.0) {
+            color = rgba_red;
         }
+        return printf_SDL_Surface(_item, color, "%.0fW %.0fV",
+                                  power, sensor_get(SENSOR_MAIN_VOLTAGE));
+    } else {
+        return printf_SDL_Surface(_item, rgba_grey, "%.0fW %.0fV",
+                                  0.0, 0.0);
     }
-    return NULL;
 }
 
 
 void *battery_create() {
-    time_item_t *item = calloc(1, sizeof(time_item_t));
-    if (item) {
-        item->font = TTF_OpenFont("/home/palich/bin/freesansbold.ttf", 25);
-        if (!item->font) {
-            printf("TTF_OpenFont: %s\n", TTF_GetError());
-            FREE(item);
-        }
-    }
-    return item;
+    return text_item_create(25);
 }
 
-SDL_Texture *battery_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *battery_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     time_item_t *item = _item->custom_data;
     if (!item || !item->font) {
         return NULL;
     }
-    if (battery.changed) {
-        battery.changed = false;
-        if (battery.online && !isnan(battery.soc)) {
-            SDL_Color color = rgba_green;
-            if (battery.soc < 20.0) {
-                color = rgba_red;
-            } else if (battery.soc < 50.0) {
-                color = rgba_yellow;
-            } else if (battery.temp > 50.0) {
-                color = rgba_red;
-            } else if (battery.temp > 40.0) {
-                color = rgba_yellow;
-            }
-            daemon_log(LOG_INFO, "battery: %.0f%% %.2fA %.0fC",
-                       battery.soc, battery.current, battery.temp
-            );
-            if (battery.current > 0.2) {
-                return printf_SDL_Texture(renderer, item, color, "%.0f%% %.0fW %.0fC %.0fh",
-                                          battery.soc, battery.current * battery.voltage, battery.temp,
-                                          (280 - battery.capacity) / battery.current);
-            } else if (battery.current < -0.2) {
-                return printf_SDL_Texture(renderer, item, color, "%.0f%% %.0fW %.0fC %.0fh",
-                                          battery.soc, battery.current * battery.voltage, battery.temp,
-                                          battery.capacity / (-battery.current));
-            }
-            return printf_SDL_Texture(renderer, item, color, "%.0f%% %.0fC",
-                                      battery.soc, battery.temp);
-        } else {
-            return printf_SDL_Texture(renderer, item, rgba_grey, "%.0f%% %.0fW %.0fC",
-                                      0.0, 0.0, 0.0);
+    double soc = sensor_get(SENSOR_BATTERY_SOC);
+    if (sensor_get_bool(SENSOR_BATTERY_ONLINE) && !isnan(soc)) {
+        double current = sensor_get(SENSOR_BATTERY_CURRENT);
+        double voltage = sensor_get(SENSOR_BATTERY_VOLTAGE);
+        double temp = sensor_get(SENSOR_BATTERY_TEMP);
+        double capacity = sensor_get(SENSOR_BATTERY_CAPACITY);
+        SDL_Color color = rgba_green;
+        if (soc < 20.0) {
+            color = rgba_red;
+        } else if (soc < 50.0) {
+            color = rgba_yellow;
+        } else if (temp > 50.0) {
+            color = rgba_red;
+        } else if (temp > 40.0) {
+            color = rgba_yellow;
+        }
+        daemon_log(LOG_INFO, "battery: %.0f%% %.2fA %.0fC", soc, current, temp);
+        if (current > 0.2) {
+            return printf_SDL_Surface(_item, color, "%.0f%% %.0fW %.0fC %.0fh",
+                                      soc, current * voltage, temp,
+                                      (280 - capacity) / current);
+        } else if (current < -0.2) {
+            return printf_SDL_Surface(_item, color, "%.0f%% %.0fW %.0fC %.0fh",
+                                      soc, current * voltage, temp,
+                                      capacity / (-current));
         }
+        return printf_SDL_Surface(_item, color, "%.0f%% %.0fC", soc, temp);
+    } else {
+        return printf_SDL_Surface(_item, rgba_grey, "%.0f%% %.0fW %.0fC",
+                                  0.0, 0.0, 0.0);
     }
-    return NULL;
 }
 
 void *time_create() {
-    time_item_t *item = calloc(1, sizeof(time_item_t));
-    if (item) {
-        item->font = TTF_OpenFont("/home/palich/bin/freesansbold.ttf", 55);
-        if (!item->font) {
-            printf("TTF_OpenFont: %s\n", TTF_GetError());
-            FREE(item);
-        }
-    }
-    return item;
+    return text_item_create(55);
 }
 
-SDL_Texture *time_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *time_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     time_item_t *item = _item->custom_data;
     if (!item || !item->font) {
         return NULL;
     }
-    time_t now;
-    time(&now);
-    time_t minutes = now / 60;
-    if (item->last_time != minutes) {
-        item->last_time = minutes;
-        struct tm *now_local = localtime(&now);
-        SDL_Color color = {255, 255, 255, 255};
-        return printf_SDL_Texture(renderer, item, color, "%02d:%02d", now_local->tm_hour,
-                                  now_local->tm_min);
-    }
-    return NULL;
+    double second = sensor_get(SENSOR_CLOCK_SECOND);
+    time_t now = isnan(second) ? time(NULL) : (time_t) second;
+    struct tm *now_local = localtime(&now);
+    SDL_Color color = {255, 255, 255, 255};
+    return printf_SDL_Surface(_item, color, "%02d:%02d", now_local->tm_hour,
+                              now_local->tm_min);
 }
 
 /*********************************************************************************************************************/
@@ -402,81 +662,84 @@ void *img_create(const char *file) {
         if (!item->surface) {
             printf("IMG_Load: %s\n", IMG_GetError());
             FREE(item);
+        } else if (item->surface->format->format != SDL_PIXELFORMAT_RGBA32) {
+            // colorizeSurface() works on 32 bit pixels with an alpha channel
+            SDL_Surface *converted = SDL_ConvertSurfaceFormat(item->surface, SDL_PIXELFORMAT_RGBA32, 0);
+            SDL_FreeSurface(item->surface);
+            item->surface = converted;
+            if (!item->surface) {
+                printf("SDL_ConvertSurfaceFormat: %s\n", SDL_GetError());
+                FREE(item);
+            }
         }
     }
     return item;
 }
 
-void img_destroy(img_item_t *item) {
+void img_destroy(void *custom_data) {
+    img_item_t *item = custom_data;
     if (item) {
         SDL_FreeSurface(item->surface);
         FREE(item);
     }
 }
 
-SDL_Texture *colorizeTexture(SDL_Renderer *renderer, const SDL_Surface *surface, SDL_Color c);
+SDL_Surface *colorizeSurface(const SDL_Surface *surface, SDL_Color c);
 
-SDL_Texture *img_main_power_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *img_main_power_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     img_item_t *item = _item->custom_data;
     if (!item || !item->surface) {
         return NULL;
     }
 
-    static int last_online = -1;
-    if (main_power.online != last_online) {
-        last_online = main_power.online;
-        if (main_power.online) {
-            return colorizeTexture(renderer, item->surface, rgba_green);
-        } else {
-            return colorizeTexture(renderer, item->surface, rgba_background);
-        }
+    if (sensor_get_bool(SENSOR_MAIN_POWER_ONLINE)) {
+        return colorizeSurface(item->surface, rgba_green);
+    } else {
+        return colorizeSurface(item->surface, rgba_background);
     }
-    return NULL;
 }
 
-SDL_Texture *img_main_power_update2(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *img_main_power_update2(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     img_item_t *item = _item->custom_data;
     if (!item || !item->surface) {
         return NULL;
     }
 
-    static int last_online = -1;
-    if (main_power.online != last_online) {
-        last_online = main_power.online;
-        if (!main_power.online) {
-            return colorizeTexture(renderer, item->surface, rgba_red);
-        } else {
-            return colorizeTexture(renderer, item->surface, rgba_background);
-        }
+    if (!sensor_get_bool(SENSOR_MAIN_POWER_ONLINE)) {
+        return colorizeSurface(item->surface, rgba_red);
+    } else {
+        return colorizeSurface(item->surface, rgba_background);
     }
-    return NULL;
 }
 
-static bool power_off_pressed = false;
-
 void on_click_power_off(item_t *UNUSED(item)) {
-    power_off_pressed = !power_off_pressed;
+    sensor_set_bool(SENSOR_POWER_OFF_PRESSED, !sensor_get_bool(SENSOR_POWER_OFF_PRESSED));
     daemon_log(LOG_INFO, "power_of_off_icon clicked");
 }
 
-SDL_Texture *img_main_power_button_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+static void shutdown_done(pid_t UNUSED(pid), int status, void *UNUSED(userdata)) {
+    daemon_log(LOG_INFO, "shutdown ret: %d", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+SDL_Surface *img_main_power_button_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     img_item_t *item = _item->custom_data;
     if (!item || !item->surface) {
         return NULL;
     }
-    static bool first_time = true;
-    if (first_time) {
-        first_time = false;
-        return colorizeTexture(renderer, item->surface, rgba_green);
-    }
     static bool power_off_pressed_prev = false;
     static float c = 0.0f;
+    // nothing shown yet: a new widget or its texture lost in a device reset
+    if (!_item->width) {
+        SDL_Color color = power_off_pressed_prev ? lerp_color(rgba_green, rgba_red, c) : rgba_green;
+        return colorizeSurface(item->surface, color);
+    }
+    bool power_off_pressed = sensor_get_bool(SENSOR_POWER_OFF_PRESSED);
 
     if (power_off_pressed != power_off_pressed_prev) {
         power_off_pressed_prev = power_off_pressed;
         if (!power_off_pressed) {
             c = 0.0f;
-            return colorizeTexture(renderer, item->surface, rgba_green);
+            return colorizeSurface(item->surface, rgba_green);
         } else {
             c = 0.1f;
         }
@@ -492,35 +755,32 @@ SDL_Texture *img_main_power_button_update(SDL_Renderer *renderer, struct ITEM_T
                     static bool first_time = true;
                     if (first_time) {
                         first_time = false;
-                        daemon_log(LOG_INFO, "shutdown ret: %d", system("sudo shutdown -P -h now"));
+                        daemon_spawn(NULL, NULL, shutdown_done, NULL, "sudo", "shutdown", "-P", "-h", "now",
+                                     (char *) NULL);
                     }
                     return NULL;
                 }
-                return colorizeTexture(renderer, item->surface, lerp_color(rgba_green, rgba_red, c));
+                return colorizeSurface(item->surface, lerp_color(rgba_green, rgba_red, c));
             }
         }
     }
     return NULL;
 }
 
-SDL_Texture *img_front_door_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *img_front_door_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     img_item_t *item = _item->custom_data;
     if (!item || !item->surface) {
         return NULL;
     }
-    if (door.changed) {
-        door.changed = false;
-        if (!door.online) {
-            return colorizeTexture(renderer, item->surface, rgba_grey);
+    if (!sensor_get_bool(SENSOR_DOOR_ONLINE)) {
+        return colorizeSurface(item->surface, rgba_grey);
+    } else {
+        if (sensor_get_bool(SENSOR_DOOR_OPEN)) {
+            return colorizeSurface(item->surface, rgba_red);
         } else {
-            if (door.open) {
-                return colorizeTexture(renderer, item->surface, rgba_red);
-            } else {
-                return colorizeTexture(renderer, item->surface, rgba_green);
-            }
+            return colorizeSurface(item->surface, rgba_green);
         }
     }
-    return NULL;
 }
 
 typedef enum battery_state_t {
@@ -551,81 +811,255 @@ const char *battery_state_picture[] = {
 };
 
 battery_state_t get_battery_state(void) {
-    if (isnan(battery.soc) || !battery.online) return BATTERY_STATE_UNKNOWN;
-    if (battery.current > 0.0) return BATTERY_STATE_CHARGING;
-    if (battery.current < 0.1) {
-        if (battery.soc < 10.0) return BATTERY_STATE_DISCHARGING_0;
-        if (battery.soc < 25.0) return BATTERY_STATE_DISCHARGING_1;
-        if (battery.soc < 40.0) return BATTERY_STATE_DISCHARGING_2;
-        if (battery.soc < 55.0) return BATTERY_STATE_DISCHARGING_3;
-        if (battery.soc < 70.0) return BATTERY_STATE_DISCHARGING_4;
-        if (battery.soc < 85.0) return BATTERY_STATE_DISCHARGING_5;
-        if (battery.soc < 95.0) return BATTERY_STATE_DISCHARGING_6;
+    double soc = sensor_get(SENSOR_BATTERY_SOC);
+    double current = sensor_get(SENSOR_BATTERY_CURRENT);
+    if (isnan(soc) || !sensor_get_bool(SENSOR_BATTERY_ONLINE)) return BATTERY_STATE_UNKNOWN;
+    if (current > 0.0) return BATTERY_STATE_CHARGING;
+    if (current < 0.1) {
+        if (soc < 10.0) return BATTERY_STATE_DISCHARGING_0;
+        if (soc < 25.0) return BATTERY_STATE_DISCHARGING_1;
+        if (soc < 40.0) return BATTERY_STATE_DISCHARGING_2;
+        if (soc < 55.0) return BATTERY_STATE_DISCHARGING_3;
+        if (soc < 70.0) return BATTERY_STATE_DISCHARGING_4;
+        if (soc < 85.0) return BATTERY_STATE_DISCHARGING_5;
+        if (soc < 95.0) return BATTERY_STATE_DISCHARGING_6;
     }
     return BATTERY_STATE_FULL;
 }
 
-SDL_Texture *img_main_battery_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+SDL_Surface *img_main_battery_update(SDL_Renderer *UNUSED(renderer), struct ITEM_T *_item) {
     img_item_t *item = _item->custom_data;
     if (!item || !item->surface) {
         return NULL;
     }
     static battery_state_t last_state = BATTERY_STATE_NONE;
     battery_state_t state = get_battery_state();
-    if (state != last_state) {
-        daemon_log(LOG_INFO, "battery state changed: %d", state);
+    if (state != last_state || !_item->width) {
+        if (state != last_state) {
+            daemon_log(LOG_INFO, "battery state changed: %d", state);
+        }
         last_state = state;
         img_destroy(item);
         _item->custom_data = img_create(battery_state_picture[state]);
         item = _item->custom_data;
-        if (isnan(battery.soc)) {
-            return colorizeTexture(renderer, item->surface, rgba_grey);
-        } else if (battery.soc < 20) {
-            return colorizeTexture(renderer, item->surface, rgba_red);
-        } else if (battery.soc < 50) {
-            return colorizeTexture(renderer, item->surface, rgba_yellow);
+        double soc = sensor_get(SENSOR_BATTERY_SOC);
+        if (isnan(soc)) {
+            return colorizeSurface(item->surface, rgba_grey);
+        } else if (soc < 20) {
+            return colorizeSurface(item->surface, rgba_red);
+        } else if (soc < 50) {
+            return colorizeSurface(item->surface, rgba_yellow);
         } else {
-            return colorizeTexture(renderer, item->surface, rgba_green);
+            return colorizeSurface(item->surface, rgba_green);
         }
     }
     return NULL;
 }
 
+/*********************************************************************************************************************/
+// Scrolling chart of a recorded sensor, one column per period filled from the history. Once drawn a
+// column only moves: each completed period uploads a single new column with item_scroll().
+typedef struct {
+    sensor_key_t key;
+    int width;
+    int height;
+    // seconds of history per column
+    int period;
+    // values mapped to the bottom and the top row
+    double min;
+    double max;
+    SDL_Color color;
+    // end of the newest column drawn
+    time_t drawn_until;
+    // row of the previous column's value, -1 after a column without samples
+    int last_y;
+    // the new column in the texture format
+    SDL_Surface *column;
+} sparkline_t;
+
+typedef struct {
+    time_t from;
+    int period;
+    int columns;
+    double *sum;
+    int *count;
+} sparkline_bins_t;
+
+static SDL_Color rgba_chart = {16, 52, 84, 255};
+
+void *sparkline_create(sensor_key_t key, int width, int height, int minutes, double min, double max,
+                       SDL_Color color) {
+    sparkline_t *item = calloc(1, sizeof(sparkline_t));
+    if (item) {
+        item->key = key;
+        item->width = width;
+        item->height = height;
+        item->period = minutes * 60 / width > 0 ? minutes * 60 / width : 1;
+        item->min = min;
+        item->max = max;
+        item->color = color;
+        item->last_y = -1;
+        item->column = SDL_CreateRGBSurfaceWithFormat(0, 1, height, SDL_BITSPERPIXEL(texture_format),
+                                                      texture_format);
+        if (!item->column) {
+            daemon_log(LOG_ERR, "sparkline column: %s", SDL_GetError());
+            FREE(item);
+        }
+    }
+    return item;
+}
+
+void sparkline_destroy(void *custom_data) {
+    sparkline_t *item = custom_data;
+    if (item) {
+        SDL_FreeSurface(item->column);
+        FREE(item);
+    }
+}
+
+static void sparkline_bin(void *ctx, time_t t, double value) {
+    sparkline_bins_t *bins = ctx;
+    int column = (int) ((t - bins->from) / bins->period);
+    if (column >= 0 && column < bins->columns && !isnan(value)) {
+        bins->sum[column] += value;
+        bins->count[column]++;
+    }
+}
+
+// Mean of the samples of the key in [from, from + period * columns) per column, NAN for no samples.
+static void sparkline_means(const sparkline_t *item, time_t from, int columns, double *means) {
+    sparkline_bins_t bins = {from, item->period, columns, means,
+                             dmem_arena_alloc(&frame_arena, (size_t) columns * sizeof(int))};
+    if (!bins.count) {
+        for (int x = 0; x < columns; x++) {
+            means[x] = NAN;
+        }
+        return;
+    }
+    memset(means, 0, sizeof(double) * (size_t) columns);
+    memset(bins.count, 0, sizeof(int) * (size_t) columns);
+    history_scan(item->key, from, from + (time_t) item->period * columns, sparkline_bin, &bins);
+    for (int x = 0; x < columns; x++) {
+        means[x] = bins.count[x] ? means[x] / bins.count[x] : NAN;
+    }
+}
+
+// Column x of dst: the chart background and a vertical stroke joining the previous value.
+static void sparkline_column(sparkline_t *item, SDL_Surface *dst, int x, double value) {
+    SDL_Rect rect = {x, 0, 1, item->height};
+    SDL_FillRect(dst, &rect, SDL_MapRGB(dst->format, rgba_chart.r, rgba_chart.g, rgba_chart.b));
+    if (isnan(value)) {
+        item->last_y = -1;
+        return;
+    }
+    double scaled = (value - item->min) / (item->max - item->min);
+    scaled = scaled < 0.0 ? 0.0 : scaled > 1.0 ? 1.0 : scaled;
+    int y = item->height - 1 - (int) lround(scaled * (item->height - 1));
+    int from = item->last_y < 0 ? y : item->last_y;
+    rect.y = from < y ? from : y;
+    rect.h = abs(from - y) + 1;
+    SDL_FillRect(dst, &rect, SDL_MapRGB(dst->format, item->color.r, item->color.g, item->color.b));
+    item->last_y = y;
+}
+
+// The whole chart, when the widget is created or fell behind by more than its width.
+static SDL_Surface *sparkline_full(sparkline_t *item, time_t now) {
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, item->width, item->height,
+                                                          SDL_BITSPERPIXEL(texture_format), texture_format);
+    double *means = dmem_arena_alloc(&frame_arena, (size_t) item->width * sizeof(double));
+    if (!surface || !means) {
+        SDL_FreeSurface(surface);
+        return NULL;
+    }
+    item->drawn_until = now - now % item->period;
+    sparkline_means(item, item->drawn_until - (time_t) item->period * item->width, item->width, means);
+    item->last_y = -1;
+    for (int x = 0; x < item->width; x++) {
+        sparkline_column(item, surface, x, means[x]);
+    }
+    return surface;
+}
+
+SDL_Surface *sparkline_update(SDL_Renderer *renderer, struct ITEM_T *_item) {
+    sparkline_t *item = _item->custom_data;
+    if (!item) {
+        return NULL;
+    }
+    double second = sensor_get(SENSOR_CLOCK_SECOND);
+    time_t now = isnan(second) ? time(NULL) : (time_t) second;
+    if (!_item->width || now - item->drawn_until >= (time_t) item->period * item->width) {
+        return sparkline_full(item, now);
+    }
+    // a second of slack for samples stamped just before the tick
+    while (item->drawn_until + item->period < now) {
+        double mean;
+        sparkline_means(item, item->drawn_until, 1, &mean);
+        sparkline_column(item, item->column, 0, mean);
+        item_scroll(renderer, _item, item->column);
+        item->drawn_until += item->period;
+    }
+    return NULL;
+}
+
+/*********************************************************************************************************************/
 item_t *root = NULL;
 
 void init_textures(SDL_Renderer *renderer) {
     int screenWidth, screenHeight;
-    SDL_GetRendererOutputSize(renderer, &screenWidth, &screenHeight);
+    output_size(renderer, &screenWidth, &screenHeight);
     printf("screenWidth: %d, screenHeight: %d\n", screenWidth, screenHeight);
 
     {
         SDL_Point pos = {screenWidth / 2, screenHeight / 2};
         align_t align = {ALIGN_H_CENTER, ALIGN_V_CENTER};
-        item_add(&root, item_new("time, ", renderer, pos, align, time_create(), time_update));
+        item_add(&root, item_new("time, ", renderer, pos, align, time_create(), text_item_destroy,
+                                  SENSOR_BIT(SENSOR_CLOCK_MINUTE), time_update));
     }
 
     {
         SDL_Point pos = {screenWidth / 2, screenHeight / 3};
         align_t align = {ALIGN_H_CENTER, ALIGN_V_CENTER};
-        item_add(&root, item_new("battery", renderer, pos, align, battery_create(), battery_update));
+        item_add(&root, item_new("battery", renderer, pos, align, battery_create(), text_item_destroy,
+                                  SENSOR_BIT(SENSOR_BATTERY_ONLINE) | SENSOR_BIT(SENSOR_BATTERY_SOC) |
+                                  SENSOR_BIT(SENSOR_BATTERY_CURRENT) | SENSOR_BIT(SENSOR_BATTERY_VOLTAGE) |
+                                  SENSOR_BIT(SENSOR_BATTERY_TEMP) | SENSOR_BIT(SENSOR_BATTERY_CAPACITY),
+                                  battery_update));
     }
 
     {
         SDL_Point pos = {screenWidth / 2, screenHeight * 3 / 4};
         align_t align = {ALIGN_H_CENTER, ALIGN_V_CENTER};
-        item_add(&root, item_new("power", renderer, pos, align, power_create(), power_update));
+        item_add(&root, item_new("power", renderer, pos, align, power_create(), text_item_destroy,
+                                  SENSOR_BIT(SENSOR_MAIN_POWER_ONLINE) | SENSOR_BIT(SENSOR_MAIN_POWER) |
+                                  SENSOR_BIT(SENSOR_MAIN_VOLTAGE), power_update));
     }
 
     {
         SDL_Point pos = {screenWidth / 3 - 90, screenHeight * 3 / 4 - 50};
         align_t align = {ALIGN_H_CENTER, ALIGN_V_CENTER};
-        item_add(&root, item_new("indoor temp", renderer, pos, align, indoor_temp_create(), indoor_temp_update));
+        item_add(&root, item_new("indoor temp", renderer, pos, align, indoor_temp_create(), text_item_destroy,
+                                  SENSOR_BIT(SENSOR_INDOOR_ONLINE) | SENSOR_BIT(SENSOR_INDOOR_TEMP),
+                                  indoor_temp_update));
     }
 
     {
         SDL_Point pos = {screenWidth * 2 / 3 + 90, screenHeight * 3 / 4 - 50};
         align_t align = {ALIGN_H_CENTER, ALIGN_V_CENTER};
-        item_add(&root, item_new("outdoor temp", renderer, pos, align, outdoor_temp_create(), outdoor_temp_update));
+        item_add(&root, item_new("outdoor temp", renderer, pos, align, outdoor_temp_create(), text_item_destroy,
+                                  SENSOR_BIT(SENSOR_OUTDOOR_ONLINE) | SENSOR_BIT(SENSOR_OUTDOOR_TEMP),
+                                  outdoor_temp_update));
+    }
+
+    {
+        SDL_Point pos = {screenWidth / 4, screenHeight - 70};
+        align_t align = {ALIGN_H_CENTER, ALIGN_TOP};
+        item_add(&root, item_new("power chart", renderer, pos, align,
+                                  sparkline_create(SENSOR_MAIN_POWER, 240, 48, 60, 0.0, 3000.0, rgba_green),
+                                  sparkline_destroy, SENSOR_BIT(SENSOR_CLOCK_SECOND), sparkline_update));
+        pos.x = screenWidth * 3 / 4;
+        item_add(&root, item_new("battery current chart", renderer, pos, align,
+                                  sparkline_create(SENSOR_BATTERY_CURRENT, 240, 48, 60, -20.0, 20.0, rgba_yellow),
+                                  sparkline_destroy, SENSOR_BIT(SENSOR_CLOCK_SECOND), sparkline_update));
     }
 
     {
@@ -633,31 +1067,31 @@ void init_textures(SDL_Renderer *renderer) {
 
         align_t align = {ALIGN_LEFT, ALIGN_TOP};
         item_t *icon = item_new("power_green_icon", renderer, pos, align,
-                                img_create("/home/palich/bin/outline_power_black_24dp.png"),
-                                img_main_power_update);
+                                img_create("/home/palich/bin/outline_power_black_24dp.png"), img_destroy,
+                                SENSOR_BIT(SENSOR_MAIN_POWER_ONLINE), img_main_power_update);
 
         item_add(&root, icon);
 
-        int textureWidth, textureHeight;
-        SDL_QueryTexture(icon->texture, NULL, NULL, &textureWidth, &textureHeight);
+        int textureWidth = icon->width;
 
         pos.x = +20 + textureWidth;
         pos.y = 20;
 
         icon = item_new("power red icon", renderer, pos, align,
-                        img_create("/home/palich/bin/outline_power_off_black_24dp.png"),
-                        img_main_power_update2);
+                        img_create("/home/palich/bin/outline_power_off_black_24dp.png"), img_destroy,
+                        SENSOR_BIT(SENSOR_MAIN_POWER_ONLINE), img_main_power_update2);
 
         item_add(&root, icon);
 
-        SDL_QueryTexture(icon->texture, NULL, NULL, &textureWidth, &textureHeight);
+        textureWidth = icon->width;
 
         pos.x += 20 + textureWidth;
         pos.y = 20;
 
         icon = item_new("battery icon", renderer, pos, align,
-                        img_create("/home/palich/bin/outline_battery_charging_full_black_24dp.png"),
-                        img_main_battery_update);
+                        img_create("/home/palich/bin/outline_battery_charging_full_black_24dp.png"), img_destroy,
+                        SENSOR_BIT(SENSOR_BATTERY_ONLINE) | SENSOR_BIT(SENSOR_BATTERY_SOC) |
+                        SENSOR_BIT(SENSOR_BATTERY_CURRENT), img_main_battery_update);
 
         item_add(&root, icon);
 
@@ -668,74 +1102,235 @@ void init_textures(SDL_Renderer *renderer) {
 
         align_t align = {ALIGN_LEFT, ALIGN_TOP};
         item_t *icon = item_new("power_of_off_icon", renderer, pos, align,
-                                img_create("/home/palich/bin/outline_power_settings_new_black_24dp.png"),
+                                img_create("/home/palich/bin/outline_power_settings_new_black_24dp.png"), img_destroy,
+                                SENSOR_BIT(SENSOR_POWER_OFF_PRESSED) | SENSOR_BIT(SENSOR_CLOCK_SECOND),
                                 img_main_power_button_update);
         if (icon) {
             icon->on_click = on_click_power_off;
         }
         item_add(&root, icon);
 
-        int textureWidth, textureHeight;
-        SDL_QueryTexture(icon->texture, NULL, NULL, &textureWidth, &textureHeight);
+        int textureWidth = icon->width;
 
         pos = (SDL_Point) {screenWidth - 70 - textureWidth - 20, 20};
 
         align = (align_t) {ALIGN_LEFT, ALIGN_TOP};
         icon = item_new("door_icon", renderer, pos, align,
-                        img_create("/home/palich/bin/outline_door_front_black_24dp.png"),
-                        img_front_door_update);
+                        img_create("/home/palich/bin/outline_door_front_black_24dp.png"), img_destroy,
+                        SENSOR_BIT(SENSOR_DOOR_ONLINE) | SENSOR_BIT(SENSOR_DOOR_OPEN), img_front_door_update);
         item_add(&root, icon);
 
     }
+
+    // the text of all widgets was queued by item_new(), rasterised here in one batch on the pool
+    raster_flush(renderer);
 }
 
-SDL_Texture *colorizeTexture(SDL_Renderer *renderer, const SDL_Surface *surface, SDL_Color c) {
-    if (!surface) {
-        return NULL;
-    } else {
-        int width = surface->w;
-        int height = surface->h;
+// Pixels with any alpha take the colour, transparent ones are copied unchanged.
+SDL_Surface *colorizeSurface(const SDL_Surface *surface, SDL_Color c) {
+    return colorize_surface(surface, c, texture_format);
+}
 
-        SDL_Surface *modifiedSurface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+// Refresh only the widgets depending on the sensor keys changed since the previous frame.
+bool make_textures(SDL_Renderer *renderer) {
+    DAEMON_TRACE_ENTER();
+    bool changed = false;
+    item_t *dirty = NULL;
+
+    sensor_mask_t keys = sensor_take_changed();
+    while (keys) {
+        int key = __builtin_ctz(keys);
+        keys &= keys - 1;
+        for (item_dep_t *dep = item_deps[key]; dep; dep = dep->next) {
+            if (!dep->item->dirty) {
+                dep->item->dirty = true;
+                dep->item->dirty_next = dirty;
+                dirty = dep->item;
+            }
+        }
+    }
 
-        Uint32 color = SDL_MapRGBA(surface->format, c.r, c.g, c.b, c.a);
+    frame_update_calls = 0;
+    while (dirty) {
+        item_t *item = dirty;
+        dirty = item->dirty_next;
+        item->dirty = false;
+        item->dirty_next = NULL;
 
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                Uint32 pixel = ((Uint32 *) surface->pixels)[y * width + x];
-                Uint8 r, g, b, a;
-                SDL_GetRGBA(pixel, surface->format, &r, &g, &b, &a);
-                if (a != 0) {
-                    pixel = color;
-                }
-                ((Uint32 *) modifiedSurface->pixels)[y * width + x] = pixel;
-            }
+        SDL_Surface *surface = item->update(renderer, item);
+        frame_update_calls++;
+        if (surface) {
+            item_upload(renderer, item, surface);
+            SDL_FreeSurface(surface);
+            changed = true;
+        }
+        // set by item_scroll() for widgets updating their content in place
+        if (item->texture_changed) {
+            item->texture_changed = false;
+            changed = true;
         }
+    }
+    if (raster_flush(renderer)) {
+        changed = true;
+    }
+    if (frame_update_calls) {
+        total_update_calls += frame_update_calls;
+        daemon_log(LOG_DEBUG, "update calls per frame: %u total: %lu", frame_update_calls, total_update_calls);
+    }
 
-        SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, modifiedSurface);
-        SDL_FreeSurface(modifiedSurface);
-        return texture;
+    DAEMON_TRACE_LEAVE("%s", changed ? "changed" : "");
+    return changed;
+}
+
+/*********************************************************************************************************************/
+// Static layers composed once into a target texture, frames only copy it.
+static struct {
+    SDL_Texture *texture;
+    // the same layers in system memory, opaque widget textures are composed over them
+    SDL_Surface *surface;
+    int width;
+    int height;
+    bool valid;
+} background = {NULL, NULL, 0, 0, false};
+
+static SDL_Color rgba_background_inner = {28, 81, 128, 255};
+
+// Filled rects inset from the window edges, painted in order.
+static const struct {
+    int inset;
+    const SDL_Color *color;
+} background_layers[] = {
+        {0, &rgba_background},
+        {4, &rgba_background_inner},
+};
+
+static void background_paint(SDL_Renderer *renderer, int width, int height) {
+    for (size_t i = 0; i < ARRAY_SIZE(background_layers); i++) {
+        const SDL_Color *c = background_layers[i].color;
+        int inset = background_layers[i].inset;
+        SDL_Rect rect = {inset, inset, width - inset * 2, height - inset * 2};
+        SDL_SetRenderDrawColor(renderer, c->r, c->g, c->b, c->a);
+        SDL_RenderFillRect(renderer, &rect);
     }
 }
 
-bool make_textures(SDL_Renderer *renderer, item_t *head) {
-    bool changed = false;
+static void background_paint_surface(SDL_Surface *surface) {
+    for (size_t i = 0; i < ARRAY_SIZE(background_layers); i++) {
+        const SDL_Color *c = background_layers[i].color;
+        int inset = background_layers[i].inset;
+        SDL_Rect rect = {inset, inset, surface->w - inset * 2, surface->h - inset * 2};
+        SDL_FillRect(surface, &rect, SDL_MapRGBA(surface->format, c->r, c->g, c->b, c->a));
+    }
+}
 
-    while (head) {
-        SDL_Texture *new_texture = head->update(renderer, head);
-        if (new_texture) {
-            SDL_DestroyTexture(head->texture);
-            head->texture = new_texture;
-            changed = true;
+// Rebuild the static layers on the next frame, call on theme change.
+void background_invalidate(void) {
+    background.valid = false;
+    SDL_FreeSurface(background.surface);
+    background.surface = NULL;
+}
+
+void background_free(void) {
+    if (background.texture) {
+        SDL_DestroyTexture(background.texture);
+        background.texture = NULL;
+    }
+    SDL_FreeSurface(background.surface);
+    background.surface = NULL;
+    background.valid = false;
+}
+
+// Copy the area of the static layers into target, in the panel format.
+void background_copy(SDL_Renderer *renderer, const SDL_Rect *area, SDL_Surface *target) {
+    int width, height;
+    output_size(renderer, &width, &height);
+    if (background.surface && (background.surface->w != width || background.surface->h != height)) {
+        SDL_FreeSurface(background.surface);
+        background.surface = NULL;
+    }
+    if (!background.surface) {
+        background.surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, SDL_BITSPERPIXEL(texture_format),
+                                                            texture_format);
+        if (!background.surface) {
+            daemon_log(LOG_ERR, "background surface %dx%d: %s", width, height, SDL_GetError());
+            SDL_FillRect(target, NULL, 0);
+            return;
         }
-        head = head->next;
+        background_paint_surface(background.surface);
+        SDL_SetSurfaceBlendMode(background.surface, SDL_BLENDMODE_NONE);
     }
+    SDL_Rect src = *area;
+    SDL_BlitSurface(background.surface, &src, target, NULL);
+}
 
-    return changed;
+static bool background_build(SDL_Renderer *renderer, int width, int height) {
+    if (!SDL_RenderTargetSupported(renderer)) {
+        return false;
+    }
+    if (!background.texture || background.width != width || background.height != height) {
+        background_free();
+        background.texture = SDL_CreateTexture(renderer, texture_format, SDL_TEXTUREACCESS_TARGET, width, height);
+        if (!background.texture) {
+            daemon_log(LOG_ERR, "background texture %dx%d: %s", width, height, SDL_GetError());
+            return false;
+        }
+        background.width = width;
+        background.height = height;
+        texture_stats.created++;
+    }
+    SDL_Texture *target = SDL_GetRenderTarget(renderer);
+    if (SDL_SetRenderTarget(renderer, background.texture)) {
+        daemon_log(LOG_ERR, "background render target: %s", SDL_GetError());
+        return false;
+    }
+    background_paint(renderer, width, height);
+    SDL_SetRenderTarget(renderer, target);
+    background.valid = true;
+    daemon_log(LOG_INFO, "background rebuilt %dx%d", width, height);
+    return true;
+}
+
+// Copy the static layers, only the area part of them if area is not NULL.
+void background_draw(SDL_Renderer *renderer, int width, int height, const SDL_Rect *area) {
+    if (!background.valid || background.width != width || background.height != height) {
+        if (!background_build(renderer, width, height)) {
+            background_paint(renderer, width, height);
+            return;
+        }
+    }
+    SDL_RenderCopy(renderer, background.texture, area, area);
+}
+
+// fbdev backend: no window, the screen geometry and pixel format come from the framebuffer.
+static unsigned short fbdev_setup(struct superclock *sc) {
+    if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS))
+        return 1;
+
+    if (TTF_Init())
+        return 2;
+
+    int bits_per_pixel = SDL_BITSPERPIXEL(sc->pixel_format) > 16 ? 32 : 16;
+    if (fbdev_open(&fb, sc->fbdev_path, sc->window_width, sc->window_height, bits_per_pixel))
+        return 11;
+
+    texture_format = SDL_MasksToPixelFormatEnum(fb.bits_per_pixel, fb.red_mask, fb.green_mask, fb.blue_mask, 0);
+    if (texture_format == SDL_PIXELFORMAT_UNKNOWN) {
+        daemon_log(LOG_ERR, "fbdev: no pixel format for %d bpp", fb.bits_per_pixel);
+        fbdev_close(&fb);
+        return 11;
+    }
+    fb_out = &fb;
+    sc->window_width = fb.width;
+    sc->window_height = fb.height;
+    daemon_log(LOG_INFO, "panel pixel format: %s", SDL_GetPixelFormatName(texture_format));
+    return 0;
 }
 
 // Initialize SDL, create window and renderer.
 unsigned short sdl_setup(struct superclock *sc) {
+    if (sc->fbdev_path)
+        return fbdev_setup(sc);
+
     // Initialize SDL.
     if (SDL_Init(MY_SDL_FLAGS))
         return 1;
@@ -755,6 +1350,21 @@ unsigned short sdl_setup(struct superclock *sc) {
     if (!sc->rend)
         return 4;
 
+    // Textures in a format the renderer lacks are converted by SDL on every upload.
+    texture_format = sc->pixel_format;
+    SDL_RendererInfo info;
+    if (!SDL_GetRendererInfo(sc->rend, &info)) {
+        bool native = false;
+        for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+            native |= info.texture_formats[i] == texture_format;
+        }
+        if (!native) {
+            daemon_log(LOG_WARNING, "renderer %s has no native %s textures", info.name,
+                       SDL_GetPixelFormatName(texture_format));
+        }
+    }
+    daemon_log(LOG_INFO, "panel pixel format: %s", SDL_GetPixelFormatName(texture_format));
+
     int numDisplays = SDL_GetNumVideoDisplays();
     for (int displayIndex = 0; displayIndex < numDisplays; ++displayIndex) {
         SDL_DisplayMode mode;
@@ -813,10 +1423,17 @@ void memory_release_exit(struct superclock *sc) {
         case 10:
             fprintf(stderr, "Error an array was not the expected length:\n");
             break;
+        case 11:
+            fprintf(stderr, "Error opening the framebuffer: %s\n", strerror(errno));
+            break;
         default:
             break;
     }
 
+    if (fb_out) {
+        fbdev_close(fb_out);
+        fb_out = NULL;
+    }
     SDL_DestroyRenderer(sc->rend);
     sc->rend = NULL;
     SDL_DestroyWindow(sc->win);
@@ -827,16 +1444,34 @@ void memory_release_exit(struct superclock *sc) {
 
 static bool brightness_available = false;
 
+// gpio of wiringPi with the arguments up to NULL, its output logged, the exit status or -1
+static int gpio(const char *arg, ...) DAEMON_GCC_SENTINEL;
+
+static int gpio(const char *arg, ...) {
+    char *args[8] = {(char *) "gpio", (char *) arg};
+    va_list ap;
+    va_start(ap, arg);
+    for (size_t i = 2; i < ARRAY_SIZE(args) - 1 && args[i - 1]; i++) {
+        args[i] = va_arg(ap, char *);
+    }
+    va_end(ap);
+    int ret = 0;
+    return daemon_spawn_run(NULL, &ret, args) < 0 ? -1 : ret;
+}
+
 int brightnessInit(void) {
-    const char *cmd[] = {"gpio -g mode 18 pwm", "gpio pwmc 100"};
-    for (size_t i = 0; i < ARRAY_SIZE(cmd); i++) {
-        int res = system(cmd[i]);
-        if (res != 0) {
-            printf("[%s:%d] %s Error: %d \n", __FUNCTION__, __LINE__, cmd[i], WEXITSTATUS(res));
-            return res;
-        }
-        sleep(1);
+    int res = gpio("-g", "mode", "18", "pwm", (char *) NULL);
+    if (res != 0) {
+        printf("[%s:%d] gpio -g mode 18 pwm Error: %d \n", __FUNCTION__, __LINE__, res);
+        return res;
+    }
+    sleep(1);
+    res = gpio("pwmc", "100", (char *) NULL);
+    if (res != 0) {
+        printf("[%s:%d] gpio pwmc 100 Error: %d \n", __FUNCTION__, __LINE__, res);
+        return res;
     }
+    sleep(1);
     brightness_available = true;
     brightnessSet(0);
     return 0;
@@ -853,11 +1488,11 @@ int brightnessSet(int value) {
         value = 0;
     }
     if (brightnessGet() != value) {
-        char cmd[64];
-        snprintf(cmd, sizeof(cmd), "gpio -g pwm 18 %d", value);
-        int res = system(cmd);
+        char level[16];
+        snprintf(level, sizeof(level), "%d", value);
+        int res = gpio("-g", "pwm", "18", level, (char *) NULL);
         if (res != 0) {
-            printf("[%s:%d] Error: %d \n", __FUNCTION__, __LINE__, WEXITSTATUS(res));
+            printf("[%s:%d] Error: %d \n", __FUNCTION__, __LINE__, res);
             return res;
         }
         brightness = value;
@@ -870,6 +1505,9 @@ pthread_t brightness_thread = 0;
 void *brightness_thread_func(void *arg) {
     const int steps = 10;
     int value = (long) arg;
+    pthread_setname_np(pthread_self(), "brightness");
+    daemon_flight_thread();
+    DAEMON_TRACE_ENTER("%d", value);
     double step = (value - brightnessGet()) / (double) steps;
     int start = brightnessGet();
     for (int i = 0; i < steps; i++) {
@@ -877,6 +1515,7 @@ void *brightness_thread_func(void *arg) {
         usleep(10000);
     }
     brightnessSet(value);
+    DAEMON_TRACE_LEAVE();
     pthread_exit(NULL);
 }
 
@@ -902,9 +1541,9 @@ int brightnessDeinit(void) {
     if (!brightness_available) {
         return -1;
     }
-    int res = system("gpio -g mode 18 out");
+    int res = gpio("-g", "mode", "18", "out", (char *) NULL);
     if (res != 0) {
-        printf("[%s:%d] Error: %d \n", __FUNCTION__, __LINE__, WEXITSTATUS(res));
+        printf("[%s:%d] Error: %d \n", __FUNCTION__, __LINE__, res);
         return res;
     }
     return 0;
@@ -934,173 +1573,272 @@ int align_v(int position, int textureSize, align_v_t align) {
     return position;
 }
 
-void battery_cb(const struct mosquitto_message *msg) {
-    json_object *jobj = json_tokener_parse(msg->payload);
-    json_object *j_soc = NULL;
-    json_object_object_get_ex(jobj, "soc", &j_soc);
-    double soc = json_object_get_double(j_soc);
-    if (soc != battery.soc) {
-        battery.changed = true;
-        battery.soc = soc;
-    }
-    json_object *j_current = NULL;
-    json_object_object_get_ex(jobj, "current", &j_current);
-    double current = json_object_get_double(j_current);
-    if (current != battery.current) {
-        battery.changed = true;
-        battery.current = current;
-    }
-    json_object *j_voltage = NULL;
-    json_object_object_get_ex(jobj, "voltage", &j_voltage);
-    double voltage = json_object_get_double(j_voltage);
-    if (voltage != battery.voltage) {
-        battery.changed = true;
-        battery.voltage = voltage;
+item_t *detect_where_mouse_pressed(int x, int y) {
+    for (item_t *item = root; item; item = item->next) {
+        SDL_Rect rect = item_rect(item, item->width, item->height);
+        if (SDL_PointInRect(&(SDL_Point) {x, y}, &rect)) {
+            return item;
+        }
     }
-    json_object *j_temp = NULL;
-    json_object_object_get_ex(jobj, "temp_tube", &j_temp);
-    double temp = json_object_get_double(j_temp);
-    if (temp != battery.temp) {
-        battery.changed = true;
-        battery.temp = temp;
-    }
-    json_object *j_capacity = NULL;
-    json_object_object_get_ex(jobj, "capacity", &j_capacity);
-    double capacity = json_object_get_double(j_capacity);
-    if (capacity != battery.capacity) {
-        battery.changed = true;
-        battery.capacity = capacity;
-    }
-    daemon_log(LOG_INFO, "soc: %.0f%%, current: %.2fA, voltage: %.2fV, power:%.2fW temp: %.0fC capacity: %.0f", soc,
-               current, voltage,
-               current * voltage, temp, capacity);
-    json_object_put(jobj);
-}
-
-//{"Time":"2023-11-06T13:36:55","SHT3X":{"Temperature":36.7,"Humidity":27.3},"PZEM004T":{"Total":8211.639,"Power":540,"Voltage":235,"Current":3.070},"TempUnit":"C"}
-
-void main_power_cb(const struct mosquitto_message *msg) {
-    json_object *jobj = json_tokener_parse(msg->payload);
-    json_object *j_pzem = NULL;
-    json_object_object_get_ex(jobj, "PZEM004T", &j_pzem);
-
-    json_object *j_power = NULL;
-    json_object_object_get_ex(j_pzem, "Power", &j_power);
-    double power = json_object_get_double(j_power);
-    if (power != main_power.power) {
-        main_power.changed = true;
-        main_power.power = power;
-    }
-    json_object *j_voltage = NULL;
-    json_object_object_get_ex(j_pzem, "Voltage", &j_voltage);
-    double voltage = json_object_get_double(j_voltage);
-    if (main_power.voltage != voltage) {
-        main_power.changed = true;
-        main_power.voltage = voltage;
-    }
-    daemon_log(LOG_INFO, "power: %.0fW, voltage: %.0fV", main_power.power, main_power.voltage);
-    json_object_put(jobj);
-}
-
-void main_power_lwt_cb(const struct mosquitto_message *msg) {
-    daemon_log(LOG_INFO, "main_power_lwt: %.*s", msg->payloadlen, (char *) msg->payload);
-    main_power.online = strcmp((char *) msg->payload, "Online") == 0;
-}
-
-void main_battery_lwt_cb(const struct mosquitto_message *msg) {
-    daemon_log(LOG_INFO, "main_battery_lwt: %.*s", msg->payloadlen, (char *) msg->payload);
-    battery.online = strcmp((char *) msg->payload, "Online") == 0;
-}
-
-
-//{"Time":"2023-11-08T14:55:49","IN":{"time": "2023-11-08 14:55:32","brand": "ODROID","model": "WB2","id": 0,"channel": 1,"battery": "OK","temperature_C": 25.47,"humidity": 53.48,"pressure": 984.9,"altitude": 329.2581,"uv_index": 0.01,"visible": 206,"ir": 30},"EX":{"time": "2023-11-08 14:55:36","brand": "OS","model": "Oregon-THGR122N","id": 249,"channel": 1,"battery_ok": 1,"temperature_C": 9.3,"humidity": 87}}
-void outdoor_cb(const struct mosquitto_message *msg) {
-    json_object *jobj = json_tokener_parse(msg->payload);
-    json_object *j_in = NULL;
-    json_object_object_get_ex(jobj, "EX", &j_in);
-    json_object *j_temperature = NULL;
-    json_object_object_get_ex(j_in, "temperature_C", &j_temperature);
-    double temperature = json_object_get_double(j_temperature);
-    if (temperature != weather.temperature_outdoor) {
-        weather.temperature_outdoor_changed = true;
-        weather.temperature_outdoor = temperature;
-    }
-    daemon_log(LOG_INFO, "outdoor temperature: %.1fC", weather.temperature_outdoor);
-    json_object_put(jobj);
-}
-
-void outdoor_lwt_cb(const struct mosquitto_message *msg) {
-    daemon_log(LOG_INFO, "outdoor_lwt: %.*s", msg->payloadlen, (char *) msg->payload);
-    weather.temperature_outdoor_online = strcasecmp((char *) msg->payload, "Online") == 0;
-}
-
-// {"battery":100,"humidity":51.52,"last_seen":"2023-11-08T12:53:56.724Z","linkquality":76,"pressure":984.7,"temperature":23.39,"voltage":3005}
-void thps_sf_hall_cb(const struct mosquitto_message *msg) {
-    json_object *jobj = json_tokener_parse(msg->payload);
-    json_object *j_temperature = NULL;
-    json_object_object_get_ex(jobj, "temperature", &j_temperature);
-    double temperature = json_object_get_double(j_temperature);
-    if (temperature != weather.temperature_indoor) {
-        weather.temperature_indoor_changed = true;
-        weather.temperature_indoor = temperature;
-    }
-    daemon_log(LOG_INFO, "indoor temperature: %.1fC", weather.temperature_indoor);
-    json_object_put(jobj);
-}
-
-void thps_sf_hall_lwt_cb(const struct mosquitto_message *msg) {
-    weather.temperature_indoor_online = strcasecmp((char *) msg->payload, "Online") == 0;
-}
-
-void dos_entranse_lwt_cb(const struct mosquitto_message *msg) {
-    door.online = strcasecmp((char *) msg->payload, "Online") == 0;
-    door.changed = true;
+    return NULL;
 }
 
-void dos_entranse_cb(const struct mosquitto_message *msg) {
-    json_object *root = json_tokener_parse(msg->payload);
-    if (root) {
-        json_object *j_contact = NULL;
-        json_object_object_get_ex(root, "contact", &j_contact);
-        bool contact = json_object_get_boolean(j_contact);
-        if (!contact != door.open) {
-            door.open = !contact;
-            daemon_log(LOG_INFO, "door open: %d", door.open);
-            door.changed = true;
+// Draw the static layers and every widget, the caller presents.
+void render_frame(SDL_Renderer *renderer, int width, int height) {
+    background_draw(renderer, width, height, NULL);
+    for (item_t *item = root; item; item = item->next) {
+        SDL_Rect src[2], rect[2];
+        for (int i = 0, parts = item_parts(item, src, rect); i < parts; i++) {
+            SDL_RenderCopy(renderer, item->texture, &src[i], &rect[i]);
         }
-        json_object_put(root);
     }
 }
 
-item_t *detect_where_mouse_pressed(int x, int y) {
+// Draw the rect of the screen from the static layers and the widget contents.
+static void fb_compose(void *UNUSED(ctx), const fbdev_rect_t *rect, uint8_t *dst, int pitch) {
+    SDL_Surface *target = SDL_CreateRGBSurfaceWithFormatFrom(dst, rect->w, rect->h, SDL_BITSPERPIXEL(texture_format),
+                                                             pitch, texture_format);
+    if (!target) {
+        return;
+    }
+    SDL_Rect area = {rect->x, rect->y, rect->w, rect->h};
+    background_copy(NULL, &area, target);
     for (item_t *item = root; item; item = item->next) {
-        int textureWidth, textureHeight;
+        SDL_Rect src[2], on_screen[2];
+        for (int i = 0, parts = item_parts(item, src, on_screen); item->content && i < parts; i++) {
+            SDL_Rect part;
+            if (SDL_IntersectRect(&area, &on_screen[i], &part)) {
+                SDL_Rect from = {src[i].x + part.x - on_screen[i].x, part.y - on_screen[i].y, part.w, part.h};
+                SDL_Rect to = {part.x - area.x, part.y - area.y, part.w, part.h};
+                SDL_BlitSurface(item->content, &from, target, &to);
+            }
+        }
+    }
+    SDL_FreeSurface(target);
+}
+
+// Show the frame. The fbdev backend redraws only the rects damaged since the previous frame.
+void present_frame(SDL_Renderer *renderer, int width, int height, bool full) {
+    DAEMON_TRACE_ENTER("%s", full ? "full" : "");
+    if (fb_out) {
+        if (full) {
+            fb_damage_count = FBDEV_MAX_DAMAGE + 1;
+        }
+        fbdev_present(fb_out, fb_damage, fb_damage_count, fb_compose, NULL);
+        fb_damage_count = 0;
+    } else {
+        render_frame(renderer, width, height);
+        SDL_RenderPresent(renderer);
+    }
+    DAEMON_TRACE_LEAVE();
+}
 
-        SDL_QueryTexture(item->texture, NULL, NULL, &textureWidth, &textureHeight);
+// Fixed clock of the golden frame, the sensors stay unset.
+#define GOLDEN_TIME 1700000000
+
+// The frame as shown: read back from the renderer or wrapped around the framebuffer.
+static SDL_Surface *golden_frame(SDL_Renderer *renderer, int width, int height) {
+    if (fb_out) {
+        present_frame(renderer, width, height, true);
+        return SDL_CreateRGBSurfaceWithFormatFrom(fbdev_front_buffer(fb_out), width, height,
+                                                  SDL_BITSPERPIXEL(texture_format), fb_out->pitch, texture_format);
+    }
+    SDL_Surface *frame = SDL_CreateRGBSurfaceWithFormat(0, width, height, SDL_BITSPERPIXEL(texture_format),
+                                                        texture_format);
+    if (frame) {
+        render_frame(renderer, width, height);
+        if (SDL_RenderReadPixels(renderer, NULL, texture_format, frame->pixels, frame->pitch)) {
+            SDL_FreeSurface(frame);
+            return NULL;
+        }
+    }
+    return frame;
+}
 
-        SDL_Rect rect = {align_h(item->position.x, textureWidth, item->align.align_h),
-                         align_v(item->position.y, textureHeight, item->align.align_v),
-                         textureWidth,
-                         textureHeight};
-        if (SDL_PointInRect(&(SDL_Point) {x, y}, &rect)) {
-            return item;
+// Render the first frame and compare it pixel for pixel with the golden image, converted to the panel
+// format. A missing golden image is written from the frame, create it with the 32 bit format.
+int golden_check(SDL_Renderer *renderer, const char *file, int width, int height) {
+    SDL_Surface *frame = golden_frame(renderer, width, height);
+    if (!frame) {
+        daemon_log(LOG_ERR, "golden frame: %s", SDL_GetError());
+        return 1;
+    }
+
+    int res = 0;
+    SDL_Surface *golden = SDL_LoadBMP(file);
+    if (!golden) {
+        res = SDL_SaveBMP(frame, file) ? 1 : 0;
+        daemon_log(res ? LOG_ERR : LOG_INFO, "golden %s written in %s", file, SDL_GetPixelFormatName(texture_format));
+        SDL_FreeSurface(frame);
+        return res;
+    }
+    SDL_Surface *expected = SDL_ConvertSurfaceFormat(golden, texture_format, 0);
+    SDL_FreeSurface(golden);
+    if (!expected || expected->w != width || expected->h != height) {
+        daemon_log(LOG_ERR, "golden %s does not match the %dx%d frame", file, width, height);
+        SDL_FreeSurface(expected);
+        SDL_FreeSurface(frame);
+        return 1;
+    }
+
+    // alpha of the read back frame depends on the window, compare the colours
+    unsigned long differ = 0;
+    int bpp = frame->format->BytesPerPixel;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            Uint32 a = 0, b = 0;
+            memcpy(&a, (Uint8 *) frame->pixels + y * frame->pitch + x * bpp, (size_t) bpp);
+            memcpy(&b, (Uint8 *) expected->pixels + y * expected->pitch + x * bpp, (size_t) bpp);
+            Uint8 ar, ag, ab, br, bg, bb;
+            SDL_GetRGB(a, frame->format, &ar, &ag, &ab);
+            SDL_GetRGB(b, expected->format, &br, &bg, &bb);
+            if (ar != br || ag != bg || ab != bb) {
+                if (!differ) {
+                    daemon_log(LOG_ERR, "golden mismatch at %d,%d: %02x%02x%02x expected %02x%02x%02x",
+                               x, y, ar, ag, ab, br, bg, bb);
+                }
+                differ++;
+            }
         }
     }
-    return NULL;
+    daemon_log(differ ? LOG_ERR : LOG_INFO, "golden %s %s: %lu pixels differ", file,
+               SDL_GetPixelFormatName(texture_format), differ);
+    SDL_FreeSurface(expected);
+    SDL_FreeSurface(frame);
+    return differ ? 1 : 0;
+}
+
+static Uint32 parse_pixel_format(const char *name) {
+    if (strcasecmp(name, "rgb565") == 0) {
+        return SDL_PIXELFORMAT_RGB565;
+    } else if (strcasecmp(name, "argb8888") == 0) {
+        return SDL_PIXELFORMAT_ARGB8888;
+    }
+    return SDL_PIXELFORMAT_UNKNOWN;
 }
 
 #define HOSTNAME_SIZE 256
 #define CDIR "./"
 
-int main(int UNUSED(argc), char *const *argv) {
+int main(int argc, char *const *argv) {
     SDL_Event event;
     SDL_TimerID timer;
 
     const char *progname = NULL;
     char *pathname = NULL;
+    const char *golden = NULL;
+    const char *fbdev_path = NULL;
+    const char *record_log = NULL;
+    const char *replay_log = NULL;
+    double replay_speed = 1.0;
+    bool async_log = false;
+    const char *binary_log = NULL;
+    const char *flight_dump = NULL;
+    const char *trace_path = NULL;
+    const char *log_file = NULL;
+    bool mem_track = false;
+    bool signals = false;
+    Uint32 pixel_format = TEXTURE_FORMAT_DEFAULT;
 
     tzset();
 
+    int opt;
+    while ((opt = getopt(argc, argv, "ab:c:d:f:g:l:mr:p:s:t:")) != -1) {
+        switch (opt) {
+            case 'a':
+                async_log = true;
+                break;
+            case 'b':
+                binary_log = optarg;
+                break;
+            case 'c':
+                flight_dump = optarg;
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'l':
+                log_file = optarg;
+                break;
+            case 'm':
+                mem_track = true;
+                break;
+            case 'f':
+                pixel_format = parse_pixel_format(optarg);
+                if (pixel_format == SDL_PIXELFORMAT_UNKNOWN) {
+                    fprintf(stderr, "unknown pixel format %s, use rgb565 or argb8888\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                fbdev_path = optarg;
+                break;
+            case 'g':
+                golden = optarg;
+                break;
+            case 'r':
+                record_log = optarg;
+                break;
+            case 'p':
+                replay_log = optarg;
+                break;
+            case 's':
+                replay_speed = strcmp(optarg, "max") == 0 ? 0.0 : strtod(optarg, NULL);
+                if (replay_speed < 0.0) {
+                    fprintf(stderr, "replay speed %s, use a factor or max\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-a] [-b log.blog] [-c crash.txt] [-d /dev/fb0] [-f rgb565|argb8888] [-g golden.bmp] [-l log.txt] [-m]\n"
+                                "       [-r record.mqlog] [-p replay.mqlog [-s 1|N|max]] [-t trace.json]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // SIGHUP writes the trace and the memory report, SIGUSR2 switches the binary log: both are
+    // blocked for the signal fd before the log threads start, which would otherwise take them
+    if (mem_track || trace_path) {
+        signals = daemon_signal_install(SIGHUP) == 0 || signals;
+    }
+    if (binary_log) {
+        signals = daemon_signal_install(SIGUSR2) == 0 || signals;
+    }
+    // the last log records of all levels go to the dump file on a crash or on SIGUSR1
+    if (flight_dump && daemon_flight_open(flight_dump) < 0) {
+        daemon_log(LOG_ERR, "flight recorder %s: %s", flight_dump, strerror(errno));
+    }
+    // live bytes and allocations per call site, logged on SIGHUP and at exit with the leaks
+    if (mem_track) {
+        dmem_track_start();
+    }
+    // log lines are also appended to a file, rotated and deflated in the background
+    if (log_file) {
+        if (daemon_log_file_open(log_file, LOG_FILE_MAX_SIZE, LOG_FILE_MAX_AGE, LOG_FILE_BUDGET) < 0) {
+            daemon_log(LOG_ERR, "log file %s: %s", log_file, strerror(errno));
+            log_file = NULL;
+        } else {
+            daemon_log_use |= DAEMON_LOG_FILE;
+        }
+    }
+    // log lines are formatted on the calling thread and written by the log writer thread
+    if (async_log && daemon_log_async_start() < 0) {
+        daemon_log(LOG_ERR, "async log: %s", strerror(errno));
+    }
+    // log calls store the format id and the arguments, SIGUSR2 switches back and forth to text
+    if (binary_log) {
+        if (daemon_blog_open(binary_log, DAEMON_BLOG_DEFAULT_SIZE) < 0) {
+            daemon_log(LOG_ERR, "binary log %s: %s", binary_log, strerror(errno));
+            binary_log = NULL;
+        } else {
+            daemon_blog_switch();
+        }
+    }
+    // timeline of the render, mosquitto, raster and brightness threads, written on SIGHUP and at exit
+    if (trace_path) {
+        daemon_trace_switch(true);
+    }
+
     if ((progname = strrchr(argv[0], '/')) == NULL)
         progname = argv[0];
     else
@@ -1121,6 +1859,11 @@ int main(int UNUSED(argc), char *const *argv) {
 
     pathname = get_current_dir_name();
 
+    // replayed messages would land in the history at the wrong time
+    if (!replay_log && (history_open("history") < 0 || rollup_open("history", time(NULL)) < 0)) {
+        daemon_log(LOG_ERR, "history: %s", strerror(errno));
+    }
+
     char *hostname = calloc(1, HOSTNAME_SIZE);
     gethostname(hostname, HOSTNAME_SIZE - 1);
 
@@ -1134,6 +1877,8 @@ int main(int UNUSED(argc), char *const *argv) {
             .window_height = 480,
             .running = true,
             .show_time = false,
+            .pixel_format = pixel_format,
+            .fbdev_path = fbdev_path,
     };
 
 
@@ -1145,26 +1890,65 @@ int main(int UNUSED(argc), char *const *argv) {
     srandom(time(NULL));
 
 
+    raster_pool_init(SDL_GetCPUCount() - 1);
+    daemon_log(LOG_INFO, "pixel kernels: %s", pixops.name);
+    if (golden) {
+        sensor_tick(GOLDEN_TIME);
+        init_textures(sc.rend);
+        sensor_take_changed();
+        sc.exit_status = (unsigned short) golden_check(sc.rend, golden, sc.window_width, sc.window_height);
+        raster_pool_done();
+        background_free();
+        memory_release_exit(&sc);
+    }
     init_textures(sc.rend);
     SDL_ShowCursor(SDL_DISABLE);
     brightnessInit();
 
-    mosq_register_on_message_cb("tele/main_battery/SENSOR", battery_cb);
-    mosq_register_on_message_cb("tele/main-power/SENSOR", main_power_cb);
-    mosq_register_on_message_cb("tele/main-power/LWT", main_power_lwt_cb);
-    mosq_register_on_message_cb("tele/main_battery/LWT", main_battery_lwt_cb);
-    mosq_register_on_message_cb("tele/hass/SENSOR", outdoor_cb);
-    mosq_register_on_message_cb("tele/hass/LWT", outdoor_lwt_cb);
-    mosq_register_on_message_cb("zigbee2mqtt/thps_sf_hall", thps_sf_hall_cb);
-    mosq_register_on_message_cb("zigbee2mqtt/thps_sf_hall/availability", thps_sf_hall_lwt_cb);
-    mosq_register_on_message_cb("zigbee2mqtt/dos-entranse/availability", dos_entranse_lwt_cb);
-    mosq_register_on_message_cb("zigbee2mqtt/dos-entranse", dos_entranse_cb);
+    mqcb_register();
 
-    mosq_init("superclock-sdl", hostname);
+    // a replay drives the callbacks from the log, no broker connection
+    useconds_t loop_us = 1000000;
+    if (replay_log) {
+        if (mqlog_replay_start(replay_log, replay_speed, mosq_dispatch) < 0) {
+            daemon_log(LOG_ERR, "replay %s: %s", replay_log, strerror(errno));
+            sc.running = false;
+        }
+        loop_us = replay_speed > 1.0 ? (useconds_t) (1000000 / replay_speed) : replay_speed > 0.0 ? 1000000 : 1000;
+        if (loop_us < 1000) {
+            loop_us = 1000;
+        }
+    } else {
+        if (record_log && mqlog_record_open(record_log) < 0) {
+            daemon_log(LOG_ERR, "record %s: %s", record_log, strerror(errno));
+        }
+        mosq_init("superclock-sdl", hostname);
+    }
 
     time_t last_active = time(NULL);
+    time_t sites_reported = time(NULL);
     bool first = true;
+    unsigned long frames = 0;
+    mqlog_replay_stats_t replay_stats = {0};
     while (sc.running) {
+        // records are read several at a time, all those waiting are handled in this turn
+        daemon_signal_info_t sig_info;
+        int sig;
+        while (signals && (sig = daemon_signal_next_info(&sig_info)) > 0) {
+            daemon_log(LOG_INFO, "%s from pid %d uid %d", strsignal(sig), (int) sig_info.pid, (int) sig_info.uid);
+            if (sig == SIGUSR2 && binary_log) {
+                bool binary = daemon_blog_switch();
+                daemon_log(LOG_INFO, "logging %s", binary ? "binary" : "text");
+            } else if (sig == SIGHUP) {
+                if (trace_path) {
+                    daemon_log(LOG_INFO, "trace: %ld events written to %s", daemon_trace_export(trace_path),
+                               trace_path);
+                }
+                if (mem_track) {
+                    dmem_report(MEM_REPORT_TOP);
+                }
+            }
+        }
         // Check key events, key pressed or released.
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
@@ -1172,6 +1956,19 @@ int main(int UNUSED(argc), char *const *argv) {
                     // handling of close button
                     sc.running = false;
                     break;
+                case SDL_RENDER_TARGETS_RESET:
+                    // content of target textures is lost
+                    daemon_flight_event("render reset %u", event.type);
+                    background_invalidate();
+                    first = true;
+                    break;
+                case SDL_RENDER_DEVICE_RESET:
+                    // all textures are lost, the widgets' streaming ones too
+                    daemon_flight_event("render reset %u", event.type);
+                    background_free();
+                    items_reset(sc.rend, root);
+                    first = true;
+                    break;
                 case SDL_USEREVENT:
                     if (event.user.code == 1) {
                         sc.show_time = false;
@@ -1216,48 +2013,89 @@ int main(int UNUSED(argc), char *const *argv) {
             }
         }
 
-        if (first || make_textures(sc.rend, root)) {
-            first = false;
+        time_t now = time(NULL);
+        if (replay_log) {
+            // the clock follows the recorded receive times
+            mqlog_replay_stats(&replay_stats);
+            now = replay_stats.clock ? replay_stats.clock : now;
+            sc.running = sc.running && !replay_stats.done;
+        }
+        sensor_tick(now);
+        // output and exit of the commands started without waiting
+        daemon_spawn_dispatch();
+        // summaries of the rate limited log lines that went quiet
+        if (time(NULL) - sites_reported >= DAEMON_LOG_SUMMARY_S) {
+            daemon_log_sites_report();
+            sites_reported = time(NULL);
+        }
+        if (first || make_textures(sc.rend)) {
             last_active = time(NULL);
             brightnessSetTo(0);
-            SDL_RenderClear(sc.rend);
-
-            SDL_SetRenderDrawColor(sc.rend, rgba_background.r, rgba_background.g, rgba_background.b, rgba_background.a);
-            SDL_Rect rect = {0, 0, sc.window_width, sc.window_height};
-            SDL_RenderDrawRect(sc.rend, &rect);
-            SDL_RenderFillRect(sc.rend, &rect);
-
-            SDL_SetRenderDrawColor(sc.rend, 28, 81, 128, 255);
-            int offset = 4;
-            SDL_Rect rect1 = {0 + offset, 0 + offset, sc.window_width - offset * 2, sc.window_height - offset * 2};
-            SDL_RenderDrawRect(sc.rend, &rect1);
-            SDL_RenderFillRect(sc.rend, &rect1);
-
-            // Draw the images to the renderer.
-
-            for (item_t *item = root; item; item = item->next) {
-                int textureWidth, textureHeight;
-
-                SDL_QueryTexture(item->texture, NULL, NULL, &textureWidth, &textureHeight);
-
-                SDL_Rect rect = {align_h(item->position.x, textureWidth, item->align.align_h),
-                                 align_v(item->position.y, textureHeight, item->align.align_v),
-                                 textureWidth,
-                                 textureHeight};
-
-                SDL_RenderCopy(sc.rend, item->texture, NULL, &rect);
-            }
-
-            SDL_RenderPresent(sc.rend);
+            present_frame(sc.rend, sc.window_width, sc.window_height, first);
+            first = false;
+            frames++;
         } else {
             if (time(NULL) - last_active > 5) {
                 brightnessSetTo(600);
             }
         }
-        sleep(1);
-    }
+        dmem_arena_reset(&frame_arena);
+        usleep(loop_us);
+    }
+    if (replay_log) {
+        mqlog_replay_stop();
+        mqlog_replay_stats(&replay_stats);
+        double seconds = (double) replay_stats.wall_ns / 1e9;
+        daemon_log(LOG_INFO, "replay: %lu messages in %.2f s, %.0f messages/s, callbacks %.1f us/message CPU, "
+                             "%lu frames rendered", replay_stats.messages, seconds,
+                   seconds > 0 ? (double) replay_stats.messages / seconds : 0.0,
+                   replay_stats.messages ? (double) replay_stats.callback_ns / 1e3 / (double) replay_stats.messages
+                                         : 0.0, frames);
+    }
+    mqlog_record_close();
+    if (async_log) {
+        daemon_log_async_stats_t log_stats;
+        daemon_log_async_stats(&log_stats);
+        daemon_log(LOG_INFO, "async log: %lu records in %lu batches, %lu writes, %lu dropped, %lu rings",
+                   log_stats.records, log_stats.batches, log_stats.writes, log_stats.dropped, log_stats.rings);
+    }
+    daemon_log_sites_report();
+    sensor_log_stats();
+    history_log_stats();
+    if (trace_path) {
+        daemon_trace_switch(false);
+        daemon_log(LOG_INFO, "trace: %ld events written to %s", daemon_trace_export(trace_path), trace_path);
+    }
+    if (signals) {
+        daemon_signal_done();
+    }
+    if (binary_log) {
+        daemon_blog_close();
+    }
+    daemon_flight_close();
+    dmem_arena_free(&frame_arena);
+    if (log_file) {
+        daemon_log_file_stats_t file_stats;
+        daemon_log_file_stats(&file_stats);
+        daemon_log(LOG_INFO, "log file: %lu bytes in %lu writes, %lu rotations, %lu archives removed",
+                   (unsigned long) file_stats.bytes, (unsigned long) file_stats.writes,
+                   (unsigned long) file_stats.rotations, (unsigned long) file_stats.removed);
+        daemon_log_use &= ~DAEMON_LOG_FILE;
+        daemon_log_file_close();
+    }
+    rollup_close();
+    history_close();
+    item_texture_stats_log();
+    raster_pool_done();
+    background_free();
     brightnessDeinit();
     SDL_ShowCursor(SDL_ENABLE);
+    // memory_release_exit() ends in exit(), the blocks still live after the widgets are freed are the leaks
+    item_free(root);
+    root = NULL;
+    if (mem_track) {
+        dmem_report(MEM_REPORT_TOP);
+    }
     memory_release_exit(&sc);
     mosq_destroy();
 }
\ No newline at end of file
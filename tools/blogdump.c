@@ -0,0 +1,24 @@
+/**
+* @file blogdump.c
+*
+* @brief Prints the records of a binary log written with superclock-sdl -b, oldest first.
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dblog.h"
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s file.blog\n", argv[0]);
+        return 2;
+    }
+    if (daemon_blog_dump(argv[1], stdout) < 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    return 0;
+}